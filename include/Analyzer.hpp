@@ -0,0 +1,156 @@
+/* Analyzer.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef ANALYZER_HPP_
+#define ANALYZER_HPP_
+
+#pragma once
+
+#include "BatchWriter.hpp"
+#include "Danger.hpp"
+#include "FileMetaBroker.hpp"
+#include "ReplaySource.hpp"
+#include "distance.pb.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * Analyzer re-scores recorded detections offline, the way DistanceFilter
+ * would have, so thresholds can be tried without running DeepStream on the
+ * video again. It needs neither GStreamer nor DeepStream at runtime (see
+ * distance-analyze).
+ *
+ * Inputs are FileMetaBroker proto (.coded) or packed (.packed) files, or
+ * MOT style text files (anything else, see MotReplaySource). Each is
+ * written to its own output, in one of FileMetaBroker's formats, by the
+ * same writers FileMetaBroker uses.
+ *
+ * Files are analyzed in parallel, and a file's frames are scored in
+ * parallel chunks (of up to chunk_size batches) when there are more threads
+ * than files. Output is the same whatever the number of threads.
+ */
+class Analyzer {
+public:
+  Analyzer();
+  virtual ~Analyzer() = default;
+  /**
+   * See DistanceFilter::filter_height_diff (default: 0.25).
+   */
+  float filter_height_diff;
+  /**
+   * danger_val at which a person is_danger (default: 1.0).
+   */
+  float danger_threshold;
+  /**
+   * Output format (default: proto). events is not supported, and sqlite
+   * includes people.
+   */
+  FileMetaBroker::Format format;
+  /**
+   * Threads to use (default: 0, one per core).
+   */
+  unsigned num_threads;
+  /**
+   * Batches read (and written) at a time per file (default: 1024).
+   */
+  size_t chunk_size;
+  /**
+   * Frame rate of MOT inputs, for timestamps (default: 30).
+   */
+  double fps;
+  /**
+   * Leave out MOT boxes with a lower conf (default: none).
+   */
+  float min_confidence;
+
+  /**
+   * Score the people in `frame` in place: danger_val, is_danger and
+   * sum_danger. `boxes` is scratch space.
+   */
+  void score(distanceproto::Frame* frame, std::vector<Box>* boxes) const;
+  /**
+   * Analyze `input` into `output` using `threads` threads. MOT inputs get
+   * `source_id`.
+   *
+   * Returns true on success, false on failure.
+   */
+  bool analyze_file(const std::string& input, const std::string& output,
+                    uint32_t source_id = 0, unsigned threads = 1);
+  /**
+   * Analyze every input into `output_dir` (see output_filename), the i-th
+   * input (if MOT) as source i. Names of inputs which failed are added to
+   * `failed`, if not null. If any outputs clash (see find_clashes), nothing
+   * is analyzed and the clashing inputs fail.
+   *
+   * Returns true if every input succeeded.
+   */
+  bool run(const std::vector<std::string>& inputs,
+           const std::string& output_dir,
+           std::vector<std::string>* failed = nullptr);
+  /**
+   * Where run() writes `input`: its name without the extension, in
+   * output_dir, with the format's extension.
+   */
+  std::string output_filename(const std::string& input,
+                              const std::string& output_dir) const;
+  /**
+   * The inputs whose output would also be another input's output, or would
+   * be another input (eg. SEQ/det/det.txt for more than one SEQ, since only
+   * the name is kept), in order.
+   */
+  std::vector<std::string> find_clashes(const std::vector<std::string>& inputs,
+                                        const std::string& output_dir) const;
+  /**
+   * Frames analyzed so far.
+   */
+  uint64_t frames() const { return frames_.load(); }
+
+protected:
+  /**
+   * The source for `input`, or nullptr if it can't be read.
+   */
+  std::unique_ptr<ReplaySource> open_source(const std::string& input,
+                                            uint32_t source_id) const;
+  /**
+   * A writer for `format`, or nullptr if not supported.
+   */
+  std::unique_ptr<BatchWriter> make_writer() const;
+  /**
+   * Score every frame in batches[0, count) using `threads` threads.
+   */
+  void score_batches(distanceproto::Batch* batches, size_t count,
+                     unsigned threads) const;
+
+  std::atomic<uint64_t> frames_;
+};
+
+} // namespace ds
+
+#endif  // ANALYZER_HPP_
@@ -8,12 +8,20 @@
 #include "gstnvdsmeta.h"
 #include "nvbufsurface.h"
 
+#include "ObjectSnapshot.hpp"
+#include "StaticFilter.hpp"
+
 namespace ds {
 
 /**
  * Base class for all filters
+ *
+ * This is a thin virtual adapter over StaticFilter, for filters which need
+ * to be used through a base class pointer. Filters which don't can derive
+ * from StaticFilter directly and avoid the virtual calls (and, if they only
+ * need metadata, the buffer map).
  */
-class BaseFilter {
+class BaseFilter : public StaticFilter<BaseFilter> {
  public:
   virtual ~BaseFilter() = default;
   /**
@@ -40,6 +48,18 @@ class BaseFilter {
   virtual bool on_object(NvDsFrameMeta* f_meta,
                          NvDsObjectMeta* o_meta,
                          NvBufSurfaceParams* frame);
+
+ protected:
+  /**
+   * Build a flat view of every object in batch_meta, as an alternative to
+   * on_frame and on_object. Storage is reused across calls, and the result
+   * is valid until the next call. The caller should hold the meta lock.
+   *
+   * @param class_id only include objects of this class (-1 for all).
+   */
+  const ObjectSnapshot& snapshot(NvDsBatchMeta* batch_meta, int class_id = -1);
+
+  ObjectSnapshot snapshot_;
 };
 
 } // namespace ds
@@ -0,0 +1,96 @@
+/* BatchSerializer.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef BATCH_SERIALIZER_HPP_
+#define BATCH_SERIALIZER_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * BatchSerializer is a hand written encoder for distanceproto::Batch that
+ * produces the same bytes as the generated code, but knows the
+ * Batch/Frame/Person/BBox layout, so it skips the generic machinery.
+ *
+ * Usage mirrors ByteSizeLong() / SerializeWithCachedSizesToArray():
+ *
+ *   size_t size = serializer.byte_size(batch);
+ *   // ... get `size` bytes somewhere ...
+ *   serializer.write(batch, target);
+ *
+ * byte_size() caches nested message sizes in the serializer (not the Batch),
+ * so the Batch may be const, and write() must be called with the same,
+ * unchanged, Batch. A serializer is not thread safe, so use one per thread.
+ *
+ * Field numbers and types come from the generated code, and the schema is
+ * checked against the descriptors once. If it isn't the one this was written
+ * for (eg. new fields), the generated serializer is used instead.
+ *
+ * Unknown fields are dropped. A Batch parsed from data written with a newer
+ * schema keeps the fields it doesn't know about, and the generated
+ * serializer writes them back out, but this doesn't (checking every message
+ * for them would cost most of what's saved). Use SerializeToString() for
+ * anything that has to round trip such data, eg. when relaying parsed
+ * payloads rather than ones built from NvDs meta.
+ */
+class BatchSerializer {
+public:
+  /**
+   * True if the generated Batch matches the schema this was written for, so
+   * the fast path is used.
+   */
+  static bool is_compatible();
+  /**
+   * Compute the serialized size of `batch` (and cache nested sizes).
+   */
+  size_t byte_size(const distanceproto::Batch& batch);
+  /**
+   * Write `batch`, as measured by the last byte_size() call, to `target`,
+   * which must have room for that many bytes.
+   *
+   * Returns the end of the written bytes.
+   */
+  uint8_t* write(const distanceproto::Batch& batch, uint8_t* target);
+  /**
+   * Serialize `batch` into `out` (replacing the contents).
+   *
+   * Returns true on success, false on failure.
+   */
+  bool serialize(const distanceproto::Batch& batch, std::string* out);
+
+protected:
+  // nested message sizes, in the order write() needs them
+  std::vector<uint32_t> sizes_;
+};
+
+} // namespace ds
+
+#endif  // BATCH_SERIALIZER_HPP_
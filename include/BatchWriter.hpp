@@ -0,0 +1,238 @@
+/* BatchWriter.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef BATCH_WRITER_HPP_
+#define BATCH_WRITER_HPP_
+
+#pragma once
+
+#include "BatchSerializer.hpp"
+#include "DirectOutputStream.hpp"
+#include "PackedBatch.hpp"
+#include "distance.pb.h"
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#ifdef DS_SQLITE
+struct sqlite3;
+struct sqlite3_stmt;
+#endif
+
+namespace ds {
+
+/**
+ * BatchWriter writes Batches to a file in one of FileMetaBroker's formats.
+ * It's what FileMetaBroker's worker threads write with, and it doesn't need
+ * GStreamer, so the same files can be written offline (see Analyzer).
+ *
+ * Not thread safe. One writer per file.
+ */
+class BatchWriter {
+public:
+  virtual ~BatchWriter() = default;
+  /**
+   * Open (create or truncate) `filename` and write any header.
+   *
+   * Returns true on success, false on failure (see error()).
+   */
+  virtual bool open(const std::string& filename) = 0;
+  /**
+   * Write a Batch.
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool write(const distanceproto::Batch& batch) = 0;
+  /**
+   * Push anything buffered to the file.
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool flush() = 0;
+  /**
+   * Finish and close the file. Called on destruction, if not before.
+   *
+   * Returns true on success, false on failure (see error()).
+   */
+  virtual bool close() = 0;
+  /**
+   * If an I/O error has occurred, this is the errno from that error (if
+   * there was one). Otherwise, it is zero.
+   */
+  int error() const { return errno_; }
+
+protected:
+  int errno_ = 0;
+};
+
+/**
+ * CodedBatchWriter writes the proto (.coded) format, or the packed format,
+ * through a DirectOutputStream.
+ */
+class CodedBatchWriter : public BatchWriter {
+public:
+  /**
+   * @param packed write PackedBatch records instead of Batches.
+   */
+  explicit CodedBatchWriter(bool packed = false);
+  virtual ~CodedBatchWriter();
+  /**
+   * See FileMetaBroker::direct_io, prealloc_size and writeback_size. Set
+   * before open().
+   */
+  bool direct_io;
+  size_t prealloc_size;
+  size_t writeback_size;
+
+  virtual bool open(const std::string& filename);
+  virtual bool write(const distanceproto::Batch& batch);
+  /**
+   * Write a PackedBatch record as is. Only for packed writers.
+   *
+   * Returns true on success, false on failure (or if not packed).
+   */
+  bool write(const PackedBatch& batch);
+  virtual bool flush();
+  virtual bool close();
+  /**
+   * True if the file was opened with O_DIRECT (direct_io was asked for and
+   * the filesystem supports it).
+   */
+  bool is_direct() const { return direct_; }
+
+protected:
+  /**
+   * Where to write the next `size` bytes of record (in the stream's buffer
+   * if they fit, otherwise scratch_).
+   */
+  uint8_t* reserve(size_t size);
+  /**
+   * Finish the record started by reserve().
+   *
+   * Returns false on a write error.
+   */
+  bool finish(size_t size);
+
+  bool packed_;
+  bool direct_;
+  int fd_;
+  // aligned, optionally preallocated and paced, output stream
+  std::unique_ptr<DirectOutputStream> raw_;
+  std::unique_ptr<google::protobuf::io::CodedOutputStream> coded_;
+  BatchSerializer serializer_;
+  PackedBatch packed_batch_;
+  // for records too big for the stream's buffer
+  std::string scratch_;
+  // whether the record being written went straight to the stream
+  bool in_place_;
+};
+
+/**
+ * CsvBatchWriter writes the csv format, a line per frame.
+ */
+class CsvBatchWriter : public BatchWriter {
+public:
+  /**
+   * @param append add to the end of an existing file, instead of
+   *  truncating it. The header is only written to an empty file.
+   */
+  explicit CsvBatchWriter(bool append = false);
+  virtual ~CsvBatchWriter();
+
+  virtual bool open(const std::string& filename);
+  virtual bool write(const distanceproto::Batch& batch);
+  virtual bool flush();
+  virtual bool close();
+
+protected:
+  bool append_;
+  std::ofstream out_;
+};
+
+#ifdef DS_SQLITE
+/**
+ * SqliteBatchWriter writes frames, and optionally people, to an SQLite
+ * database in WAL mode, so they can be queried by source and time:
+ *
+ *   frames (id, source_id, timestamp, frame_num, pts, dts, people,
+ *           violating, sum_danger)
+ *   people (frame_id, uid, bbox_left, bbox_top, bbox_width, bbox_height,
+ *           danger_val, is_danger)
+ *
+ * timestamp is ns since the epoch, taken the same way as the csv format's
+ * (dts, or pts, or now), and frames are indexed on (source_id, timestamp).
+ * An existing database is added to.
+ *
+ * Rows are inserted with prepared statements in a transaction which is
+ * begun by the first write() and committed by flush(), so the caller picks
+ * the batches per transaction.
+ *
+ * Only built when SQLite is found (meson configure -Dsqlite=..., which
+ * defines DS_SQLITE).
+ */
+class SqliteBatchWriter : public BatchWriter {
+public:
+  /**
+   * @param people also insert a row per person.
+   */
+  explicit SqliteBatchWriter(bool people = false);
+  virtual ~SqliteBatchWriter();
+
+  virtual bool open(const std::string& filename);
+  virtual bool write(const distanceproto::Batch& batch);
+  /**
+   * Commit the transaction (if any).
+   */
+  virtual bool flush();
+  virtual bool close();
+  /**
+   * SQLite's message for the last error.
+   */
+  const std::string& message() const { return message_; }
+
+protected:
+  /**
+   * Run `sql`. Returns true on success, false on failure (see message()).
+   */
+  bool exec(const char* sql);
+  /**
+   * Record the last error. Returns false.
+   */
+  bool fail();
+
+  bool people_;
+  bool in_transaction_;
+  sqlite3* db_;
+  sqlite3_stmt* insert_frame_;
+  sqlite3_stmt* insert_person_;
+  std::string message_;
+};
+#endif  // DS_SQLITE
+
+} // namespace ds
+
+#endif  // BATCH_WRITER_HPP_
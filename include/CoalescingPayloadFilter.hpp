@@ -0,0 +1,176 @@
+#ifndef COALESCING_PAYLOAD_FILTER_HPP_
+#define COALESCING_PAYLOAD_FILTER_HPP_
+
+#pragma once
+
+#include "BatchSerializer.hpp"
+#include "PackedBatch.hpp"
+#include "ProtoPayloadFilter.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ds {
+
+/**
+ * CoalescingPayloadFilter accumulates serialized Batches and attaches them
+ * as one NVDS_PAYLOAD_META every max_batches batches or max_delay_ms
+ * milliseconds, whichever comes first. Payloads at least compress_threshold
+ * bytes long are optionally compressed.
+ *
+ * Payload format ('C' is never the first byte of a serialized Batch):
+ * 
+ * 'C' | uint8 flags | varint count | varint raw size | body
+ * 
+ * where the low bits of flags are the Compression and the COLUMNAR bit is
+ * set with the columnar encoding, and the body, after decompression, is
+ * `count` times (varint size | Batch), or (varint size | PackedBatch) with
+ * COLUMNAR. With the columnar encoding, attached PackedBatches are written
+ * as they are.
+ *
+ * Each Subscription gets payloads of its own filtered Batches, tagged with
+ * its id, like ProtoPayloadFilter.
+ *
+ * The deadline is checked when a batch arrives. Metadata can only be
+ * attached to a buffer, so on a stream that may stall, call on_timeout()
+ * periodically to get overdue payloads on a buffer of their own, and call
+ * on_eos() at EOS for the rest.
+ */
+class CoalescingPayloadFilter : public ProtoPayloadFilter {
+public:
+  /**
+   * First byte of a coalesced payload.
+   */
+  static const uint8_t MAGIC = 'C';
+  /**
+   * Body compression (using protobuf's zlib streams).
+   */
+  enum Compression { none = 0, gzip = 1, zlib = 2 };
+  /**
+   * Flag (with the Compression) in the second byte of a columnar payload.
+   */
+  static const uint8_t COLUMNAR = 0x80;
+
+  /**
+   * @param max_batches batches per payload.
+   * @param max_delay_ms max age of the oldest batch in a payload (0 for no
+   *  limit).
+   * @param compression how to compress large payloads.
+   * @param compress_threshold only compress bodies at least this big.
+   * @param compression_level zlib level (-1 for zlib's default).
+   */
+  CoalescingPayloadFilter(uint32_t max_batches = 10,
+                          uint32_t max_delay_ms = 100,
+                          Compression compression = none,
+                          size_t compress_threshold = 4096,
+                          int compression_level = -1);
+  virtual ~CoalescingPayloadFilter() = default;
+  /**
+   * This implementation adds the Batch (and filtered copies for each
+   * Subscription) to the pending payloads and attaches those which are full
+   * or old enough.
+   */
+  virtual bool on_batch_meta(
+    NvDsBatchMeta* batch_meta, distanceproto::Batch* batch);
+  /**
+   * Like on_batch_meta, but with the columnar encoding the PackedBatch is
+   * added as is (it's only materialized for Subscriptions).
+   */
+  virtual bool on_packed_meta(NvDsBatchMeta* batch_meta, PackedBatch* batch);
+  /**
+   * Attach any pending batches to batch_meta now.
+   *
+   * Returns true on success (or if nothing is pending), false on failure.
+   */
+  virtual bool flush(NvDsBatchMeta* batch_meta);
+  /**
+   * Everything pending, on a buffer of its own (see ProtoPayloadFilter).
+   */
+  virtual GstBuffer* on_eos();
+  /**
+   * Pending payloads older than max_delay, on a buffer of their own (like
+   * on_eos), or nullptr if none are. Safe to call from another thread (eg.
+   * a g_timeout_add callback every max_delay / 2).
+   */
+  virtual GstBuffer* on_timeout();
+  /**
+   * Returns true if `data` looks like a coalesced payload.
+   */
+  static bool is_coalesced(const uint8_t* data, size_t size);
+  /**
+   * Unpack a coalesced payload (of either encoding), appending the Batches
+   * to `batches`.
+   *
+   * Returns true on success, false on malformed input.
+   */
+  static bool unpack(const uint8_t* data, size_t size,
+                     std::vector<distanceproto::Batch>* batches);
+
+protected:
+  /**
+   * Batches waiting to be packed for one subscription.
+   */
+  struct Pending {
+    uint32_t count;
+    std::chrono::steady_clock::time_point first;
+    // (varint size | Batch) * count, capacity reused
+    std::string raw;
+  };
+  /**
+   * Add `packed`, or `batch` if that's nullptr, to the pending payloads
+   * (with filtered copies for each Subscription) and attach those which are
+   * due.
+   */
+  virtual bool coalesce(NvDsBatchMeta* batch_meta,
+                        distanceproto::Batch* batch, PackedBatch* packed);
+  /**
+   * Count a record of `size` bytes in `pending`, append its varint size to
+   * the raw body and return where the record goes.
+   */
+  uint8_t* add_record(size_t size, Pending* pending,
+                      std::chrono::steady_clock::time_point now);
+  /**
+   * Append (varint size | Batch) to `pending` (in the encoding).
+   */
+  virtual void append(const distanceproto::Batch& batch, Pending* pending,
+                      std::chrono::steady_clock::time_point now);
+  /**
+   * Append (varint size | PackedBatch) to `pending`.
+   */
+  virtual void append_packed(const PackedBatch& batch, Pending* pending,
+                             std::chrono::steady_clock::time_point now);
+  /**
+   * Pack (and reset) every pending payload which is full (or all of them
+   * with `all`), or older than max_delay at `now`, onto `payloads`.
+   * pending_lock_ must be held.
+   *
+   * Returns false if any could not be packed.
+   */
+  virtual bool pack_due(bool all, std::chrono::steady_clock::time_point now,
+                        std::vector<Payload*>* payloads);
+  /**
+   * Build a Payload tagged with `subscription` from `pending` and reset it.
+   */
+  virtual Payload* pack(uint32_t subscription, Pending* pending);
+
+  uint32_t max_batches_;
+  std::chrono::milliseconds max_delay_;
+  Compression compression_;
+  size_t compress_threshold_;
+  int compression_level_;
+  // guards the pending payloads (on_timeout may come from another thread)
+  std::mutex pending_lock_;
+  // pending batches by subscription id (0 for the unfiltered ones)
+  std::unordered_map<uint32_t, Pending> pending_;
+  // reused for the compressed bodies
+  std::string compressed_;
+  BatchSerializer serializer_;
+  PackedBatch packed_;
+};
+
+} // namespace ds
+
+#endif  // COALESCING_PAYLOAD_FILTER_HPP_
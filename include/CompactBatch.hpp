@@ -0,0 +1,161 @@
+/* CompactBatch.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef COMPACT_BATCH_HPP_
+#define COMPACT_BATCH_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ds {
+
+/**
+ * Frame level record of a CompactBatch.
+ */
+struct CompactFrame {
+  int32_t frame_num;
+  uint32_t source_id;
+  uint64_t pts;
+  uint64_t dts;
+  float sum_danger;
+  // index of the first of this frame's people in the people array
+  uint32_t first_person;
+  uint32_t num_people;
+  uint32_t reserved;
+};
+
+/**
+ * Person level record of a CompactBatch.
+ */
+struct CompactPerson {
+  float left;
+  float top;
+  float width;
+  float height;
+  float danger_val;
+  uint32_t is_danger;
+  // Person.uid (see DistanceFilter)
+  int32_t uid;
+};
+
+/**
+ * CompactBatch is the flat, plain old data, alternative to a
+ * distanceproto::Batch that DistanceFilter can attach (see
+ * DistanceFilter::compact_meta). The header, fixed size frame records and
+ * packed person array live in one malloc()ed block, so building one is one
+ * allocation and copying one is one memcpy.
+ *
+ * The equivalent distanceproto::Batch is only built if somebody asks for it
+ * (see materialize), and then only once.
+ */
+class CompactBatch {
+public:
+  /**
+   * Allocate a CompactBatch able to hold `frame_capacity` frames and
+   * `person_capacity` people in total. Free it with destroy().
+   *
+   * @param max_frames the max_frames of the batch (batch size).
+   */
+  static CompactBatch* create(uint32_t max_frames,
+                              uint32_t frame_capacity,
+                              uint32_t person_capacity);
+  /**
+   * Free a CompactBatch (and its materialized Batch, if any).
+   */
+  static void destroy(CompactBatch* batch);
+  /**
+   * A copy of the whole block (but not the materialized Batch). Free it with
+   * destroy().
+   */
+  CompactBatch* copy() const;
+  /**
+   * Append a (zeroed) frame, or return nullptr if full.
+   */
+  CompactFrame* add_frame();
+  /**
+   * Append a (zeroed) person to the last frame, or return nullptr if full
+   * or there is no frame.
+   */
+  CompactPerson* add_person();
+
+  uint32_t max_frames() const { return max_frames_; }
+  uint32_t frames_size() const { return num_frames_; }
+  uint32_t people_size() const { return num_people_; }
+  const CompactFrame& frame(uint32_t i) const { return frames()[i]; }
+  /**
+   * The people of frame `f` (frame(f).num_people of them).
+   */
+  const CompactPerson* people(const CompactFrame& f) const {
+    return people() + f.first_person;
+  }
+  /**
+   * Size of the block in bytes.
+   */
+  size_t byte_size() const { return byte_size(frame_capacity_, person_capacity_); }
+  /**
+   * Fill in `out` (which is cleared first) with the equivalent Batch.
+   */
+  void to_proto(distanceproto::Batch* out) const;
+  /**
+   * The equivalent Batch, built on the first call and cached. Like the rest
+   * of the metadata, this is guarded by the meta lock.
+   */
+  distanceproto::Batch* materialize();
+
+private:
+  CompactBatch(uint32_t max_frames,
+               uint32_t frame_capacity,
+               uint32_t person_capacity);
+  ~CompactBatch() = default;
+
+  static size_t byte_size(uint32_t frame_capacity, uint32_t person_capacity);
+
+  CompactFrame* frames() {
+    return (CompactFrame*)(this + 1);
+  }
+  const CompactFrame* frames() const {
+    return (const CompactFrame*)(this + 1);
+  }
+  CompactPerson* people() {
+    return (CompactPerson*)(frames() + frame_capacity_);
+  }
+  const CompactPerson* people() const {
+    return (const CompactPerson*)(frames() + frame_capacity_);
+  }
+
+  uint32_t max_frames_;
+  uint32_t frame_capacity_;
+  uint32_t person_capacity_;
+  uint32_t num_frames_;
+  uint32_t num_people_;
+  // lazily built by materialize()
+  distanceproto::Batch* proto_;
+};
+
+} // namespace ds
+
+#endif  // COMPACT_BATCH_HPP_
@@ -0,0 +1,65 @@
+/* Danger.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef DANGER_HPP_
+#define DANGER_HPP_
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace ds {
+
+class GroupFinder;
+
+/**
+ * A person's bounding box (pixels), as in NvOSD_RectParams or a
+ * distanceproto::BBox.
+ */
+struct Box {
+  float left;
+  float top;
+  float width;
+  float height;
+};
+
+/**
+ * Calculate how dangerous boxes[i] is based on proximity to the other
+ * boxes: the sum, over everybody closer (feet to feet) than boxes[i]'s
+ * height, of how much closer, as a fraction of that height. Pairs whose
+ * heights differ by more than filter_height_diff (see
+ * DistanceFilter::filter_height_diff) are ignored.
+ *
+ * If finder is not null, boxes[i] is grouped with everybody that adds to
+ * its danger.
+ *
+ * This is DistanceFilter's scoring, without any DeepStream metadata, so it
+ * can be run offline (see Analyzer).
+ */
+float how_dangerous(const std::vector<Box>& boxes, size_t i,
+                    float filter_height_diff, GroupFinder* finder = nullptr);
+
+} // namespace ds
+
+#endif  // DANGER_HPP_
@@ -0,0 +1,126 @@
+/* DeltaCodec.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef DELTA_CODEC_HPP_
+#define DELTA_CODEC_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace ds {
+
+/**
+ * DeltaEncoder turns a stream of distanceproto::Batch into keyframes and
+ * deltas.
+ *
+ * A keyframe carries a full, exact, Batch. A delta carries, per frame, only
+ * the frame aggregates that changed and the people that changed since the
+ * last message for the same source_id. People are matched by Person.uid,
+ * so people leaving or changing order only costs a few bytes. People with a
+ * uid of 0 are matched by their index in the frame. Boxes in deltas are
+ * quantized to a grid, so a decoded box is within one grid cell of the
+ * original.
+ *
+ * Both kinds of message start with a byte which is not a valid first byte
+ * of a serialized Batch, so consumers can tell them apart from plain
+ * payloads.
+ *
+ * Keyframe: 'K' | varint seq | fixed32 grid | varint size | Batch
+ * Delta:    'D' | varint seq | varint max_frames | varint frames | frame...
+ */
+class DeltaEncoder {
+public:
+  /**
+   * First byte of a keyframe message.
+   */
+  static const uint8_t KEYFRAME = 'K';
+  /**
+   * First byte of a delta message.
+   */
+  static const uint8_t DELTA = 'D';
+
+  /**
+   * @param keyframe_interval send a keyframe every this many messages.
+   * @param grid box quantization step in pixels.
+   * @param danger_step smallest danger_val or sum_danger change to send.
+   */
+  DeltaEncoder(uint32_t keyframe_interval = 30,
+               float grid = 4.0f,
+               float danger_step = 0.01f);
+  virtual ~DeltaEncoder() = default;
+  /**
+   * Encode the next Batch in the stream into `out` (cleared first).
+   *
+   * Returns true on success, false on failure.
+   */
+  bool encode(const distanceproto::Batch& batch, std::string* out);
+  /**
+   * Make the next message a keyframe (eg. when a new consumer connects).
+   */
+  void force_keyframe() { since_keyframe_ = keyframe_interval_; }
+
+protected:
+  uint32_t keyframe_interval_;
+  float grid_;
+  float danger_step_;
+  uint64_t seq_;
+  uint32_t since_keyframe_;
+  // what the decoder will have for each source (not the exact input)
+  std::unordered_map<uint32_t, distanceproto::Frame> refs_;
+};
+
+/**
+ * DeltaDecoder rebuilds full Batches from DeltaEncoder output.
+ */
+class DeltaDecoder {
+public:
+  DeltaDecoder();
+  virtual ~DeltaDecoder() = default;
+  /**
+   * Decode the next message in the stream into `batch` (cleared first).
+   *
+   * Returns false if the message is malformed or if a delta can't be
+   * applied (no keyframe yet or a message was lost). Decoding resumes with
+   * the next keyframe.
+   */
+  bool decode(const uint8_t* data, size_t size, distanceproto::Batch* batch);
+  /**
+   * Returns true if `data` looks like a DeltaEncoder message.
+   */
+  static bool is_delta_message(const uint8_t* data, size_t size);
+
+protected:
+  bool synced_;
+  float grid_;
+  uint64_t seq_;
+  std::unordered_map<uint32_t, distanceproto::Frame> refs_;
+};
+
+} // namespace ds
+
+#endif  // DELTA_CODEC_HPP_
@@ -0,0 +1,65 @@
+#ifndef DELTA_PAYLOAD_FILTER_HPP_
+#define DELTA_PAYLOAD_FILTER_HPP_
+
+#pragma once
+
+#include "DeltaCodec.hpp"
+#include "ProtoPayloadFilter.hpp"
+
+#include <string>
+#include <unordered_map>
+
+namespace ds {
+
+/**
+ * DeltaPayloadFilter attaches DeltaEncoder keyframes and deltas instead of
+ * full serialized Batches. Use a DeltaDecoder on the receiving end.
+ *
+ * Messages depend on the one before, so they are always encoded in order,
+ * on the streaming thread. Each Subscription gets its own stream.
+ */
+class DeltaPayloadFilter : public ProtoPayloadFilter {
+public:
+  /**
+   * @param keyframe_interval send a full Batch every this many payloads.
+   * @param grid box quantization step in pixels for deltas.
+   * @param danger_step smallest danger change sent in deltas.
+   */
+  DeltaPayloadFilter(uint32_t keyframe_interval = 30,
+                     float grid = 4.0f,
+                     float danger_step = 0.01f);
+  virtual ~DeltaPayloadFilter() = default;
+  /**
+   * Make the next payload a keyframe.
+   */
+  void force_keyframe();
+
+protected:
+  /**
+   * This implementation delta encodes the Batch (against the previous one
+   * for the same subscription).
+   */
+  virtual Payload* serialize(distanceproto::Batch* batch,
+                             uint32_t subscription);
+  /**
+   * Delta encodes the materialized Batch (whatever the encoding).
+   */
+  virtual Payload* serialize_packed(PackedBatch* batch,
+                                    uint32_t subscription) {
+    return this->serialize(batch->materialize(), subscription);
+  }
+
+  uint32_t keyframe_interval_;
+  float grid_;
+  float danger_step_;
+  // encoder for the unfiltered stream
+  DeltaEncoder encoder_;
+  // encoders for each subscription's stream, created on first use
+  std::unordered_map<uint32_t, DeltaEncoder> subscription_encoders_;
+  // reused encoding buffer
+  std::string scratch_;
+};
+
+} // namespace ds
+
+#endif  // DELTA_PAYLOAD_FILTER_HPP_
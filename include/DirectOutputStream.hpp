@@ -0,0 +1,133 @@
+/* DirectOutputStream.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef DIRECT_OUTPUT_STREAM_HPP_
+#define DIRECT_OUTPUT_STREAM_HPP_
+
+#pragma once
+
+#include <google/protobuf/io/zero_copy_stream.h>
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace ds {
+
+/**
+ * DirectOutputStream is a ZeroCopyOutputStream that writes a file descriptor
+ * through a single aligned buffer, so it may be used with a fd opened with
+ * O_DIRECT. It can optionally fallocate() the file ahead of the write offset
+ * in large extents and pace page cache writeback with sync_file_range().
+ *
+ * The fd is not owned (or closed) by the stream. Close() must be called
+ * before the fd is closed, since it writes out the last (padded) block and
+ * truncates the file back to the number of bytes actually written.
+ */
+class DirectOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+public:
+  /**
+   * Alignment of the buffer, file offsets and write sizes (O_DIRECT).
+   */
+  static const size_t ALIGNMENT = 4096;
+  /**
+   * Default size of the aligned write buffer (1 MiB).
+   */
+  static const size_t DEFAULT_BUFFER_SIZE = 1 << 20;
+
+  /**
+   * @param fd an open, writable, file descriptor positioned at 0.
+   * @param direct the fd was opened with O_DIRECT, so every write must be
+   *  a multiple of ALIGNMENT.
+   * @param prealloc_size fallocate() the file in extents of this many bytes
+   *  ahead of the write offset (0 to disable).
+   * @param writeback_size start writeback every this many bytes and wait on
+   *  the previous window, so dirty pages never pile up (0 to disable,
+   *  ignored when direct).
+   * @param buffer_size size of the write buffer (rounded up to ALIGNMENT).
+   */
+  DirectOutputStream(int fd,
+                     bool direct = false,
+                     size_t prealloc_size = 0,
+                     size_t writeback_size = 0,
+                     size_t buffer_size = DEFAULT_BUFFER_SIZE);
+  /**
+   * Calls Close() if it has not already been called.
+   */
+  virtual ~DirectOutputStream();
+
+  // ZeroCopyOutputStream implementation
+  virtual bool Next(void** data, int* size);
+  virtual void BackUp(int count);
+  virtual int64_t ByteCount() const;
+
+  /**
+   * Write any buffered data and truncate the file to ByteCount(), or, after
+   * a failed write, to the data written before it.
+   *
+   * Returns true on success, false on failure.
+   */
+  bool Close();
+  /**
+   * If an I/O error has occurred, this is the errno from that error.
+   * Otherwise, it is zero.
+   */
+  int GetErrno() const { return errno_; }
+
+protected:
+  /**
+   * Write the first `size` bytes of the buffer at the current file offset.
+   */
+  bool write_buffer(size_t size);
+  /**
+   * Make sure the file is allocated up to `end`.
+   */
+  void reserve(off_t end);
+  /**
+   * Kick off writeback of new data and wait on the previous window.
+   */
+  void pace();
+
+  int fd_;
+  bool direct_;
+  size_t prealloc_size_;
+  size_t writeback_size_;
+  size_t buffer_size_;
+  uint8_t* buffer_;
+  // bytes of the buffer handed out by Next() (less any BackUp())
+  size_t buffer_used_;
+  // bytes written to the fd (always a multiple of ALIGNMENT until Close())
+  off_t offset_;
+  // end of the region fallocate()d so far
+  off_t allocated_;
+  // start of the writeback window which has been started but not waited on
+  off_t wb_started_;
+  // end of the writeback window which has been started
+  off_t wb_end_;
+  bool closed_;
+  int errno_;
+};
+
+} // namespace ds
+
+#endif  // DIRECT_OUTPUT_STREAM_HPP_
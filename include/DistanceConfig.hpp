@@ -0,0 +1,141 @@
+/* DistanceConfig.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef DISTANCE_CONFIG_HPP_
+#define DISTANCE_CONFIG_HPP_
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace ds {
+
+/**
+ * An osd color, each channel from 0.0 to 1.0.
+ */
+struct Rgba {
+  float red;
+  float green;
+  float blue;
+  float alpha;
+};
+
+/**
+ * DistanceFilter parameters which may differ by source.
+ */
+struct SourceConfig {
+  SourceConfig();
+  /**
+   * Whether to set osd metadata for drawing (default: false).
+   */
+  bool do_drawing;
+  /**
+   * The height % difference between two bounding boxes after which a pair
+   * detection is ignored (default: 0.25, see how_dangerous).
+   */
+  float filter_height_diff;
+  /**
+   * A person is_danger at or above this danger_val (default: 1.0). The
+   * adaptive FrameScheduler follows it, but ViolationTracker::enter_danger
+   * and exit_danger don't, so set those to match.
+   */
+  float danger_threshold;
+  /**
+   * The danger_val at which a box is drawn ramp_high (default: 1.0).
+   */
+  float ramp_danger;
+  /**
+   * Box color at no danger (default: 0.2, 0.2, 0.2, 0.2).
+   */
+  Rgba ramp_low;
+  /**
+   * Box color at ramp_danger and above (default: 0.8, 0.2, 0.2, 0.8).
+   */
+  Rgba ramp_high;
+  /**
+   * The box color for `danger`, linear from ramp_low to ramp_high.
+   */
+  Rgba color(float danger) const;
+};
+
+/**
+ * DistanceConfig is a complete set of DistanceFilter parameters. The filter
+ * only ever reads an immutable one, so a new one may be swapped in while
+ * buffers are flowing (see DistanceFilter::set_config).
+ */
+struct DistanceConfig {
+  DistanceConfig();
+  /**
+   * The class id to turn red (default: 0).
+   */
+  int class_id;
+  /**
+   * Parameters for any source not in `sources`.
+   */
+  SourceConfig defaults;
+  /**
+   * Parameters by source_id.
+   */
+  std::unordered_map<uint32_t, SourceConfig> sources;
+  /**
+   * The parameters for source_id.
+   */
+  const SourceConfig& source(uint32_t source_id) const {
+    if (sources.empty()) {
+      return defaults;
+    }
+    auto it = sources.find(source_id);
+    return it == sources.end() ? defaults : it->second;
+  }
+
+  /**
+   * Load a config from a text file into `config` (reset to defaults first).
+   * Lines are `key value`. Keys before the first `source` line are the
+   * defaults. Keys after one apply to that source, which starts out with
+   * the defaults. # starts a comment.
+   *
+   *   class_id 0
+   *   do_drawing true
+   *   filter_height_diff 0.25
+   *   danger_threshold 1.0
+   *   ramp_danger 2.0
+   *   ramp_low 0.2,0.2,0.2,0.2
+   *   ramp_high 0.8,0.2,0.2,0.8
+   *   source 3
+   *   filter_height_diff 0.4
+   *
+   * Returns true on success, false on failure (with a warning saying
+   * where).
+   */
+  static bool load(const std::string& filename, DistanceConfig* config);
+  /**
+   * load() from a string (eg. a config property).
+   */
+  static bool parse(const std::string& text, DistanceConfig* config);
+};
+
+} // namespace ds
+
+#endif  // DISTANCE_CONFIG_HPP_
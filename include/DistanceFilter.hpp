@@ -36,39 +36,140 @@
 #pragma once
 
 #include "BaseFilter.hpp"
+#include "Danger.hpp"
+#include "DistanceConfig.hpp"
+#include "FrameScheduler.hpp"
+#include "Groups.hpp"
+#include "Rcu.hpp"
+#include "RoiMask.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /**
  *  distanceproto batch nvds user metadata type
  */
 #define DF_USER_BATCH_META (nvds_get_user_meta_type((gchar*)"NVIDIA.NVINFER.USER_META"))
+/**
+ *  CompactBatch batch nvds user metadata type (see DistanceFilter::compact_meta)
+ */
+#define DF_USER_COMPACT_BATCH_META (nvds_get_user_meta_type((gchar*)"LIBDISTANCE.COMPACT_BATCH_META"))
+/**
+ *  PackedBatch batch nvds user metadata type (see DistanceFilter::packed_meta)
+ */
+#define DF_USER_PACKED_BATCH_META (nvds_get_user_meta_type((gchar*)"LIBDISTANCE.PACKED_BATCH_META"))
+/**
+ *  BatchGroups batch nvds user metadata type (see DistanceFilter::find_groups)
+ */
+#define DF_USER_GROUPS_META (nvds_get_user_meta_type((gchar*)"LIBDISTANCE.GROUPS_META"))
 
 namespace ds {
 
 /**
  * DistanceFilter modifies osd metadata to make closer objects red.
+ *
+ * Each Person's uid is the tracker's object_id, truncated to the low 32 bits
+ * of the 64 bit id, or 0 if the object isn't tracked (so an id of 0, or of a
+ * multiple of 2^32, looks untracked too).
  */
 class DistanceFilter : public BaseFilter {
  public:
   DistanceFilter();
   virtual ~DistanceFilter() = default;
   /**
-   * The class id to turn red (default: 0).
+   * A copy of the current parameters (class_id, do_drawing,
+   * filter_height_diff, ...), to modify and set_config().
+   */
+  DistanceConfig config() const { return config_.copy(); }
+  /**
+   * Replace the parameters. Safe to call from any thread while buffers are
+   * flowing. The next buffer uses the new ones, and the buffer in progress
+   * finishes with the old ones.
+   */
+  void set_config(const DistanceConfig& config);
+  /**
+   * set_config() from a file (see DistanceConfig::load), eg. on SIGHUP.
+   *
+   * Returns true on success, false on failure (parameters unchanged).
+   */
+  bool load_config(const std::string& filename);
+  /**
+   * Attach a CompactBatch as DF_USER_COMPACT_BATCH_META instead of a
+   * distanceproto::Batch as DF_USER_BATCH_META (default: false). It is one
+   * allocation to build and one memcpy to copy. ProtoPayloadFilter (and so
+   * FileMetaBroker) only convert it to a Batch when they see it.
    */
-  int class_id;
+  bool compact_meta;
   /**
-   * Whether to set osd metadata for drawing (default: true).
+   * Attach a PackedBatch (columnar people) as DF_USER_PACKED_BATCH_META
+   * instead (default: false). Takes precedence over compact_meta. Like a
+   * CompactBatch, ProtoPayloadFilter only converts it to a Batch when it
+   * sees it.
    */
-  bool do_drawing;
+  bool packed_meta;
   /**
-   * The height % difference between two bounding boxes after which a pair detection is ignored. (default: 0.25)
-   * 
-   * ignore = (abs(current->rect_params.height - other->rect_params.height) > current->rect_params.height * filter_height_diff)
+   * Only compute danger as often as each source's scene needs it, reusing
+   * each person's last result in between (default: false). Needs a tracker
+   * upstream, since people are matched by object_id. Every frame still gets
+   * complete metadata.
    */
-  float filter_height_diff;
+  bool adaptive;
+  /**
+   * How often to compute danger when adaptive (see FrameScheduler). Set
+   * before the first buffer.
+   */
+  FrameScheduler scheduler;
+  /**
+   * Also attach a BatchGroups as DF_USER_GROUPS_META, with the groups of
+   * people connected by violating pairs in each frame (default: false).
+   * Groups are found while pairs are scored, so it doesn't take another
+   * pass. When adaptive, skipped frames get their source's last groups.
+   * ProtoPayloadFilter attaches them as a Payload of their own (see
+   * ProtoPayloadFilter::on_groups_meta).
+   */
+  bool find_groups;
+  /**
+   * The smallest group find_groups reports (default: 2, any pair).
+   */
+  uint32_t min_group_size;
+  /**
+   * Only consider people whose feet are inside `roi` on source_id. Anybody
+   * else is left out of danger scoring and metadata altogether, as if they
+   * weren't detected. Sources without a mask include everything.
+   *
+   * Not thread safe with on_buffer (set masks before the first buffer).
+   */
+  void set_roi(uint32_t source_id, const RoiMask& roi);
+  /**
+   * Remove source_id's mask.
+   */
+  void clear_roi(uint32_t source_id);
+  /**
+   * Replace every mask with the ones in `filename` (see RoiMask::load).
+   * Same rules as set_roi.
+   *
+   * Returns true on success, false on failure (masks unchanged).
+   */
+  bool load_roi(const std::string& filename);
   /**
    * This implementation does drawing and analytics on NvDs Metadata.
    */
   virtual GstFlowReturn on_buffer(GstBuffer* buf);
+
+ protected:
+  // parameters, read once per buffer by on_buffer
+  Rcu<DistanceConfig> config_;
+  // region of interest by source_id
+  RoiMasks roi_;
+  // people of class_id, inside the roi, in the frame being processed
+  std::vector<NvDsObjectMeta*> people_;
+  // and their boxes, for scoring
+  std::vector<Box> boxes_;
+  // groups of people_ (find_groups)
+  GroupFinder finder_;
+  // groups as of each source's last computed frame (find_groups, adaptive)
+  std::unordered_map<uint32_t, std::vector<Group>> last_groups_;
 };
 
 } // namespace ds
@@ -5,10 +5,13 @@
 
 #include "ProtoPayloadFilter.hpp"
 #include "Queue.hpp"
+#include "ViolationTracker.hpp"
 
 #include <memory>
+#include <string>
 #include <thread>
 #include <fstream>
+#include <vector>
 
 namespace ds {
 
@@ -22,17 +25,75 @@ public:
    * Magic number to prefix a binary protobuf file with (32 bit uint).
    */
   static const uint32_t PROTO_MAGIC_NUMBER = 0x5640FD6E;
+  /**
+   * Magic number to prefix a packed file with (32 bit uint).
+   */
+  static const uint32_t PACKED_MAGIC_NUMBER = 0x5640FD6F;
+  /**
+   * Magic number to prefix a violation event file with (32 bit uint).
+   */
+  static const uint32_t EVENTS_MAGIC_NUMBER = 0x5640FD70;
   /**
    * The available formats to write metadata in.
    * 
    * proto: raw protobuf in a CodedOutputStream prefixed by PROTO_MAGIC_NUMBER
    * csv: csv text format as expected by smart_distancing's frontend.
+   * packed: PackedBatch records, each prefixed by its varint size, after
+   *  PACKED_MAGIC_NUMBER (written like proto, so direct_io and friends
+   *  apply).
+   * events: ViolationTracker messages, each prefixed by its varint size,
+   *  after EVENTS_MAGIC_NUMBER. A message is only written when something
+   *  happened.
+   * sqlite: an SQLite database in WAL mode, with a row per frame (and
+   *  optionally per person) indexed on (source_id, timestamp), see
+   *  SqliteBatchWriter. Everything queued is inserted in one transaction.
+   *  An existing database is appended to. Only there when the library was
+   *  built with SQLite (DS_SQLITE).
    */
-  enum Format { proto, csv };
+  enum Format {
+    proto, csv, packed, events,
+#ifdef DS_SQLITE
+    sqlite,
+#endif
+  };
 
   FileMetaBroker(std::string basename, Format format = proto);
   virtual ~FileMetaBroker() = default;
 
+  /**
+   * Open proto output with O_DIRECT and write it through an aligned buffer,
+   * bypassing the page cache (default: false). Falls back to buffered writes
+   * if the filesystem does not support O_DIRECT. Set before start().
+   */
+  bool direct_io;
+  /**
+   * fallocate() proto output ahead of the write offset in extents of this
+   * many bytes, so file growth doesn't stall on block allocation. The file is
+   * truncated to the written size on stop(). (default: 0, disabled)
+   */
+  size_t prealloc_size;
+  /**
+   * When not using direct_io, start writeback of proto output every this
+   * many bytes with sync_file_range() and wait on the window before it, so
+   * dirty pages never build up into a writeback storm. (default: 0, disabled)
+   */
+  size_t writeback_size;
+  /**
+   * Also insert a row per person with the sqlite format (default: false).
+   * Set before start().
+   */
+  bool db_people;
+  /**
+   * Most batches per transaction with the sqlite format, when a backlog
+   * builds up (default: 1024). Set before start().
+   */
+  size_t db_max_batches;
+  /**
+   * Thresholds, timeouts and limits for the events format. Set before the
+   * first buffer.
+   */
+  ViolationTracker tracker;
+
   /**
    * Called by on_buffer when payload metadata is found in batch_meta's user
    * meta list.
@@ -44,12 +105,23 @@ public:
    */
   virtual bool on_batch_meta(
     NvDsBatchMeta* batch_meta, distanceproto::Batch* batch);
+  /**
+   * With the packed format, queues a copy of the PackedBatch to be written
+   * as is. Otherwise calls on_batch_meta with the materialized Batch.
+   */
+  virtual bool on_packed_meta(NvDsBatchMeta* batch_meta, PackedBatch* batch);
+  /**
+   * Groups aren't written by any format, so this does nothing.
+   */
+  virtual bool on_groups_meta(NvDsBatchMeta*, BatchGroups*) { return true; }
   /**
    * Opens the file and starts the worker thread.
    */
   virtual void start();
   /**
    * tells the worker thread to flush any data in the queue and shut down.
+   * With the events format, violations still going on are ended first, so
+   * call this after the last buffer.
    * 
    * @param block blocks until queue flushed and file closed.
    */
@@ -61,14 +133,25 @@ public:
 
 protected:
   /**
-   * worker thread for writing distanceproto::Batch to a protobuf
-   * CodedOutputStream
+   * worker thread for writing distanceproto::Batch (or, with the packed
+   * format, PackedBatch) to a protobuf CodedOutputStream
    */
   virtual void proto_worker_func();
   /**
    * worker thread for writing distanceproto::Batch to file in a format
    */
   virtual void csv_worker_func();
+  /**
+   * worker thread for writing encoded violation events
+   */
+  virtual void events_worker_func();
+#ifdef DS_SQLITE
+  /**
+   * worker thread for inserting distanceproto::Batch into an SQLite
+   * database, a transaction per drain of the queue
+   */
+  virtual void sqlite_worker_func();
+#endif
 
   // my husband complained about this->everywhere so now there are underscores
   // everywhere and to me this is more confusing. explicit "this" is like "self"
@@ -77,6 +160,11 @@ protected:
   Format format_;
   std::thread worker_;
   ds::Queue<std::unique_ptr<distanceproto::Batch>> queue_;
+  // records for the packed format
+  ds::Queue<std::unique_ptr<PackedBatch>> packed_queue_;
+  // encoded violation events (events format)
+  ds::Queue<std::unique_ptr<std::string>> events_queue_;
+  std::vector<ViolationEvent> events_;
 };
 
 } // namespace ds
@@ -0,0 +1,188 @@
+/* FrameScheduler.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef FRAME_SCHEDULER_HPP_
+#define FRAME_SCHEDULER_HPP_
+
+#pragma once
+
+#include "gstnvdsmeta.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ds {
+
+/**
+ * FrameScheduler decides, per source, which frames need their danger
+ * computed, and remembers the results for the frames in between.
+ *
+ * A source's frame is computed when the scene changed since the last
+ * computed frame (somebody new, somebody gone, or somebody moved more than
+ * motion_threshold), or when the last result is getting stale (interval
+ * frames or max_staleness ns old). The interval starts at min_interval and
+ * doubles, up to max_interval (or violation_interval while somebody is in
+ * violation), every time a scheduled computation finds the scene still
+ * quiet. Any change puts it back to min_interval.
+ *
+ * People are matched across frames by tracker object_id, so untracked
+ * objects mean every frame is computed.
+ *
+ * Usage, for each frame:
+ *
+ *   if (scheduler.begin_frame(frame_meta, people)) {
+ *     // for each person: danger = compute(); scheduler.set_danger(obj, danger);
+ *   } else {
+ *     // for each person: danger = scheduler.get_danger(obj);
+ *   }
+ *   scheduler.end_frame();
+ */
+class FrameScheduler {
+public:
+  FrameScheduler();
+  virtual ~FrameScheduler() = default;
+  /**
+   * Frames between computations when there's something going on
+   * (default: 1, every frame).
+   */
+  uint32_t min_interval;
+  /**
+   * Most frames between computations of a quiet scene (default: 8).
+   */
+  uint32_t max_interval;
+  /**
+   * Most frames between computations while somebody is in violation
+   * (default: 2).
+   */
+  uint32_t violation_interval;
+  /**
+   * Most time (ns, by frame pts) between computations, whatever the
+   * interval (default: 250ms, 0 for no limit).
+   */
+  uint64_t max_staleness;
+  /**
+   * How far somebody may move (the bottom center of their box, as a
+   * fraction of its height) before the scene counts as changed
+   * (default: 0.05).
+   */
+  float motion_threshold;
+  /**
+   * danger_val at which somebody is in violation (default: 1.0).
+   * DistanceFilter sets it to the SourceConfig::danger_threshold of each
+   * frame's source.
+   */
+  float violation_danger;
+
+  /**
+   * Start a frame with `people`, the objects whose danger is wanted, in
+   * object meta order. Returns true if its danger should be computed (and
+   * recorded with set_danger), false if it should be taken from get_danger.
+   */
+  bool begin_frame(NvDsFrameMeta* frame_meta,
+                   const std::vector<NvDsObjectMeta*>& people);
+  /**
+   * Record the danger computed for a person (computed frames only).
+   */
+  void set_danger(const NvDsObjectMeta* obj_meta, float danger);
+  /**
+   * The last danger computed for a person (skipped frames only), or 0 if
+   * there is none.
+   */
+  float get_danger(const NvDsObjectMeta* obj_meta);
+  /**
+   * Finish the frame started with begin_frame.
+   */
+  void end_frame();
+  /**
+   * Forget every source.
+   */
+  void clear();
+  /**
+   * Frames computed so far.
+   */
+  uint64_t computed() const { return computed_; }
+  /**
+   * Frames skipped so far.
+   */
+  uint64_t skipped() const { return skipped_; }
+
+protected:
+  // a person as of the last computed frame
+  struct Person {
+    uint64_t object_id;
+    float x;
+    float y;
+    float height;
+    float danger;
+  };
+
+  // in object meta order, which trackers mostly keep from frame to frame
+  typedef std::vector<Person> People;
+
+  /**
+   * Find a person by object_id, trying `hint` first. Returns nullptr if
+   * they're not there.
+   */
+  static const Person* find(const People& people, uint64_t object_id,
+                            size_t hint);
+
+  struct Source {
+    // people as of the last computed frame
+    People people;
+    // pts of the last computed frame
+    uint64_t pts = 0;
+    // frames between computations
+    uint32_t interval = 1;
+    // frames skipped since the last computation
+    uint32_t since = 0;
+    // there has been a computation
+    bool valid = false;
+  };
+
+  /**
+   * Returns true if `people` are not the ones in `source`, or have moved
+   * too much.
+   */
+  bool changed(const Source& source,
+               const std::vector<NvDsObjectMeta*>& people) const;
+
+  std::unordered_map<uint32_t, Source> sources_;
+  // state of the current frame
+  Source* current_;
+  uint64_t pts_;
+  bool computing_;
+  bool changed_;
+  bool violation_;
+  // where the last get_danger found somebody
+  size_t cursor_;
+  // people of the frame being computed (swapped into its Source)
+  People next_;
+  uint64_t computed_;
+  uint64_t skipped_;
+};
+
+} // namespace ds
+
+#endif  // FRAME_SCHEDULER_HPP_
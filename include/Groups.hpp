@@ -0,0 +1,163 @@
+/* Groups.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GROUPS_HPP_
+#define GROUPS_HPP_
+
+#pragma once
+
+#include "Danger.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * A group of people connected by violating pairs (close enough to add to
+ * each other's danger), directly or through others in the group.
+ */
+struct Group {
+  uint32_t size;
+  // the axis aligned bounding box of everybody's boxes (not a hull)
+  Box bbox;
+};
+
+/**
+ * The groups in one frame.
+ */
+struct FrameGroups {
+  int32_t frame_num;
+  uint32_t source_id;
+  uint64_t pts;
+  std::vector<Group> groups;
+};
+
+/**
+ * Batch level group metadata, one FrameGroups per frame, in the same order
+ * as the distanceproto::Batch frames (see DistanceFilter::find_groups).
+ *
+ * distanceproto has no place for groups, so they encode to a message of
+ * their own (see encode), which starts with a byte that can't begin a
+ * serialized Batch or any other message of ours:
+ *
+ * 'G' | varint count | frame...
+ * frame: varint frame_num | varint source_id | varint pts | varint count
+ *  | group...
+ * group: varint size | fixed32 left | fixed32 top | fixed32 width
+ *  | fixed32 height
+ */
+struct BatchGroups {
+  /**
+   * First byte of an encoded message.
+   */
+  static const uint8_t MAGIC = 'G';
+
+  std::vector<FrameGroups> frames;
+
+  /**
+   * Encode `groups` as a message into `out` (cleared first).
+   */
+  static void encode(const BatchGroups& groups, std::string* out);
+  /**
+   * Decode a message from encode into `groups` (cleared first).
+   *
+   * Returns true on success, false if the message is malformed.
+   */
+  static bool decode(const uint8_t* data, size_t size, BatchGroups* groups);
+  /**
+   * Returns true if `data` looks like an encoded message.
+   */
+  static bool is_groups_message(const uint8_t* data, size_t size);
+};
+
+/**
+ * GroupFinder finds connected components of people with union-find, so
+ * they can be grouped while the pairs are evaluated anyway, in near linear
+ * time in the number of pairs.
+ *
+ * Usage, for each frame:
+ *
+ *   finder.reset(people.size());
+ *   // for each violating pair: finder.unite(i, j);
+ *   finder.collect(boxes, min_size, &groups);
+ */
+class GroupFinder {
+public:
+  /**
+   * Start over with `n` people, each in a group of their own.
+   */
+  void reset(size_t n);
+  /**
+   * Put people `a` and `b` (and everybody grouped with them) in one group.
+   */
+  void unite(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+      return;
+    }
+    // union by size
+    if (size_[a] < size_[b]) {
+      uint32_t t = a;
+      a = b;
+      b = t;
+    }
+    parent_[b] = a;
+    size_[a] += size_[b];
+  }
+  /**
+   * The representative of the group person `a` is in.
+   */
+  uint32_t find(uint32_t a) {
+    // path halving
+    while (parent_[a] != a) {
+      parent_[a] = parent_[parent_[a]];
+      a = parent_[a];
+    }
+    return a;
+  }
+  /**
+   * The number of people in the group person `a` is in.
+   */
+  uint32_t size(uint32_t a) { return size_[find(a)]; }
+  /**
+   * Append the groups of at least `min_size` to `groups`, in order of their
+   * first member, with the bounding box of their members' boxes. `boxes`
+   * are the people reset() was called for.
+   */
+  void collect(const std::vector<Box>& boxes, uint32_t min_size,
+               std::vector<Group>* groups);
+
+protected:
+  std::vector<uint32_t> parent_;
+  std::vector<uint32_t> size_;
+  // index in groups of each representative's group, during collect
+  std::vector<int32_t> index_;
+};
+
+} // namespace ds
+
+#endif  // GROUPS_HPP_
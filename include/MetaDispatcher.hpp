@@ -0,0 +1,81 @@
+/* MetaDispatcher.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef META_DISPATCHER_HPP_
+#define META_DISPATCHER_HPP_
+
+#pragma once
+
+#include "BaseFilter.hpp"
+#include "UserMetaHandler.hpp"
+
+#include <vector>
+
+namespace ds {
+
+/**
+ * MetaDispatcher feeds any number of UserMetaHandlers (eg. ProtoPayloadFilter
+ * and PayloadBrokers) from one buffer callback. It takes the meta lock once
+ * and makes a single pass over the batch user meta list, routing each meta
+ * to every handler registered for its type, in the order they were added.
+ *
+ * Meta attached by a handler during the pass (eg. a Payload attached by
+ * ProtoPayloadFilter), appended or prepended, is routed as well, as is
+ * anything attached in turn by its handlers. Producers should be added
+ * before their consumers so it all happens in list order where possible.
+ */
+class MetaDispatcher : public BaseFilter {
+public:
+  virtual ~MetaDispatcher() = default;
+  /**
+   * Register a handler (not owned). Its meta types are resolved here, once.
+   * Not thread safe with on_buffer, so add everything before streaming.
+   */
+  virtual void add(UserMetaHandler* handler);
+  /**
+   * Dispatch the batch user meta on buf to the registered handlers.
+   */
+  virtual GstFlowReturn on_buffer(GstBuffer* buf);
+
+protected:
+  /**
+   * Route one user meta to every handler registered for its type.
+   */
+  bool dispatch(NvDsBatchMeta* batch_meta, NvDsUserMeta* user_meta);
+  /**
+   * Dispatch the list from `begin` up to (not including) `end`.
+   *
+   * Returns the last element dispatched (nullptr if none).
+   */
+  GList* dispatch_list(NvDsBatchMeta* batch_meta, GList* begin, GList* end);
+
+  struct Route {
+    NvDsMetaType meta_type;
+    UserMetaHandler* handler;
+  };
+  std::vector<Route> routes_;
+};
+
+} // namespace ds
+
+#endif  // META_DISPATCHER_HPP_
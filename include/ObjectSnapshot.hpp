@@ -0,0 +1,91 @@
+/* ObjectSnapshot.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef OBJECT_SNAPSHOT_HPP_
+#define OBJECT_SNAPSHOT_HPP_
+
+#pragma once
+
+#include "gstnvdsmeta.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ds {
+
+/**
+ * ObjectSnapshot is a flat, structure of arrays, view of every object in a
+ * batch, so a filter can run plain (vectorizable, or parallel) loops over
+ * columns instead of walking the frame and object GLists.
+ *
+ * Object i is in frame frame_index[i]. The objects of frame f are
+ * [frame_begin[f], frame_begin[f + 1]). objects[i] and frames[f] point back
+ * at the metadata for write back, and are only valid while the buffer is.
+ *
+ * Storage is reused by build(), so steady state doesn't allocate. The
+ * columns are public for easy looping, but only build() and clear() should
+ * change their sizes.
+ */
+class ObjectSnapshot {
+public:
+  /**
+   * Rebuild from batch_meta. The caller should hold the meta lock.
+   *
+   * @param batch_meta the batch to snapshot.
+   * @param class_id only include objects of this class (-1 for all).
+   */
+  void build(NvDsBatchMeta* batch_meta, int class_id = -1);
+  /**
+   * Empty the snapshot (keeping the storage).
+   */
+  void clear();
+  /**
+   * The number of objects.
+   */
+  size_t size() const { return objects.size(); }
+  /**
+   * The number of frames.
+   */
+  size_t num_frames() const { return frames.size(); }
+
+  // per object columns
+  std::vector<uint32_t> frame_index;
+  std::vector<uint32_t> source_id;
+  std::vector<int32_t> class_id;
+  std::vector<uint64_t> object_id;
+  std::vector<float> left;
+  std::vector<float> top;
+  std::vector<float> width;
+  std::vector<float> height;
+  std::vector<float> confidence;
+  std::vector<NvDsObjectMeta*> objects;
+
+  // per frame columns (frame_begin has num_frames() + 1 entries)
+  std::vector<NvDsFrameMeta*> frames;
+  std::vector<uint32_t> frame_begin;
+};
+
+} // namespace ds
+
+#endif  // OBJECT_SNAPSHOT_HPP_
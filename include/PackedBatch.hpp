@@ -0,0 +1,206 @@
+/* PackedBatch.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef PACKED_BATCH_HPP_
+#define PACKED_BATCH_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * Frame level record of a PackedBatch.
+ */
+struct PackedFrame {
+  int32_t frame_num;
+  uint32_t source_id;
+  uint64_t pts;
+  uint64_t dts;
+  float sum_danger;
+  // index of the first of this frame's people in the person columns
+  uint32_t first_person;
+  uint32_t num_people;
+};
+
+/**
+ * PackedBatch is a columnar alternative to distanceproto::Batch. Instead of
+ * a Person (and BBox) submessage per person, each frame has packed arrays
+ * of uid/left/top/width/height/danger_val and a bitset for is_danger, so there
+ * are no per person tags, lengths or heap objects, and it parses in a few
+ * memcpys.
+ *
+ * On the wire it's protobuf, equivalent to:
+ *
+ *   message PackedFrame {
+ *     int32 frame_num = 1;
+ *     float sum_danger = 3;
+ *     uint64 pts = 4;
+ *     uint64 dts = 5;
+ *     uint32 source_id = 6;
+ *     repeated float left = 7;
+ *     repeated float top = 8;
+ *     repeated float width = 9;
+ *     repeated float height = 10;
+ *     repeated float danger_val = 11;
+ *     // bit i % 8 of byte i / 8 is person i's is_danger
+ *     bytes is_danger = 12;
+ *     // left out if every uid in the frame is 0 (eg. no tracker)
+ *     repeated int32 uid = 13;
+ *   }
+ *   message PackedBatch {
+ *     uint32 max_frames = 1;
+ *     repeated PackedFrame frames = 2;
+ *   }
+ *
+ * Frame field numbers match distanceproto::Frame. This is hand encoded
+ * (distanceproto lives in its own project), so it can move into the .proto
+ * later without changing a byte.
+ *
+ * In memory, the person columns are shared by the whole batch and frames
+ * index into them, the same as CompactBatch, so building one is a handful
+ * of allocations, however many frames there are.
+ */
+class PackedBatch {
+public:
+  PackedBatch();
+  /**
+   * Copies everything but the materialized Batch.
+   */
+  PackedBatch(const PackedBatch& other);
+  PackedBatch& operator=(const PackedBatch& other);
+  ~PackedBatch();
+
+  uint32_t max_frames() const { return max_frames_; }
+  void set_max_frames(uint32_t max_frames) { max_frames_ = max_frames; }
+  size_t frames_size() const { return frames_.size(); }
+  size_t people_size() const { return left_.size(); }
+  const PackedFrame& frame(size_t i) const { return frames_[i]; }
+  /**
+   * Per person columns of frame `f` (f.num_people of each).
+   */
+  const int32_t* uid(const PackedFrame& f) const {
+    return uid_.data() + f.first_person;
+  }
+  const float* left(const PackedFrame& f) const {
+    return left_.data() + f.first_person;
+  }
+  const float* top(const PackedFrame& f) const {
+    return top_.data() + f.first_person;
+  }
+  const float* width(const PackedFrame& f) const {
+    return width_.data() + f.first_person;
+  }
+  const float* height(const PackedFrame& f) const {
+    return height_.data() + f.first_person;
+  }
+  const float* danger_val(const PackedFrame& f) const {
+    return danger_val_.data() + f.first_person;
+  }
+  bool is_danger(const PackedFrame& f, uint32_t i) const {
+    return is_danger_[f.first_person + i] != 0;
+  }
+  /**
+   * Clear everything, keeping allocated storage.
+   */
+  void clear();
+  /**
+   * Reserve room for `num_frames` frames and `num_people` people in total.
+   */
+  void reserve(size_t num_frames, size_t num_people);
+  /**
+   * Append a (zeroed) frame.
+   */
+  PackedFrame* add_frame();
+  /**
+   * Append a person to the last frame (which must exist).
+   */
+  void add_person(float left, float top, float width, float height,
+                  float danger_val, bool is_danger, int32_t uid = 0);
+  /**
+   * Replace the contents with the equivalent of `batch`. People without a
+   * bbox get a zero one.
+   */
+  void from_proto(const distanceproto::Batch& batch);
+  /**
+   * Fill in `out` (which is cleared first) with the equivalent Batch.
+   */
+  void to_proto(distanceproto::Batch* out) const;
+  /**
+   * The equivalent Batch, built on the first call and cached. As metadata,
+   * this is guarded by the meta lock.
+   */
+  distanceproto::Batch* materialize();
+  /**
+   * The serialized size in bytes.
+   */
+  size_t byte_size() const;
+  /**
+   * Serialize to `target`, which must have byte_size() bytes of room.
+   *
+   * Returns the end of the written bytes.
+   */
+  uint8_t* write(uint8_t* target) const;
+  /**
+   * Serialize into `out` (replacing the contents).
+   */
+  void serialize(std::string* out) const;
+  /**
+   * Replace the contents with the PackedBatch serialized in `data`.
+   *
+   * Returns true on success, false if the data is malformed (in which case
+   * the contents are unspecified).
+   */
+  bool parse(const uint8_t* data, size_t size);
+
+protected:
+  /**
+   * Serialized size of frame `f`, without its tag and length.
+   */
+  size_t frame_size(const PackedFrame& f) const;
+
+  uint32_t max_frames_;
+  std::vector<PackedFrame> frames_;
+  // person columns
+  std::vector<int32_t> uid_;
+  std::vector<float> left_;
+  std::vector<float> top_;
+  std::vector<float> width_;
+  std::vector<float> height_;
+  std::vector<float> danger_val_;
+  // one byte per person in memory (bits on the wire)
+  std::vector<uint8_t> is_danger_;
+  // lazily built by materialize()
+  std::unique_ptr<distanceproto::Batch> proto_;
+};
+
+} // namespace ds
+
+#endif  // PACKED_BATCH_HPP_
@@ -0,0 +1,233 @@
+/* Payload.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef PAYLOAD_HPP_
+#define PAYLOAD_HPP_
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+class Payload;
+class PayloadPool;
+
+/**
+ * PayloadProducer fills in a pending Payload when somebody first needs its
+ * bytes (see PayloadPool::acquire_pending).
+ */
+class PayloadProducer {
+public:
+  virtual ~PayloadProducer() = default;
+  /**
+   * Fill in the payload using reserve(), mutable_data() and set_size().
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool produce(Payload* payload) = 0;
+};
+
+/**
+ * Payload is a reference counted, immutable once published, byte buffer.
+ *
+ * It is what ProtoPayloadFilter attaches as NVDS_PAYLOAD_META, so copying
+ * the metadata only takes another reference. When the last reference is
+ * released, the buffer goes back to the PayloadPool it came from.
+ *
+ * A Payload may be pending, in which case the bytes are produced by the
+ * first call to resolve() (or anything that reads the bytes). If nobody
+ * ever reads them, they are never produced.
+ */
+class Payload {
+public:
+  /**
+   * Take another reference. Returns this.
+   */
+  Payload* ref() {
+    refcount_.fetch_add(1, std::memory_order_relaxed);
+    return this;
+  }
+  /**
+   * Release a reference. The Payload must not be used by the caller after.
+   */
+  void unref();
+  /**
+   * The number of references currently held.
+   */
+  int use_count() const {
+    return refcount_.load(std::memory_order_relaxed);
+  }
+  /**
+   * Produce the bytes if the Payload is pending. If another thread is
+   * already producing them, this blocks until it is done.
+   *
+   * Returns true if the bytes are valid, false if production failed.
+   */
+  bool resolve() const {
+    if (ready_.load(std::memory_order_acquire)) {
+      return !failed_;
+    }
+    return resolve_slow();
+  }
+  /**
+   * True if the bytes have been produced (or never needed producing).
+   */
+  bool is_ready() const { return ready_.load(std::memory_order_acquire); }
+  /**
+   * The serialized bytes (resolves first, may block).
+   */
+  const uint8_t* data() const { resolve(); return data_; }
+  /**
+   * The number of serialized bytes (resolves first, may block).
+   */
+  size_t size() const { resolve(); return size_; }
+  /**
+   * Copy the bytes into a std::string (resolves first, may block).
+   */
+  std::string str() const {
+    return std::string((const char*)data(), size());
+  }
+  /**
+   * Writable bytes. Only for whoever acquired the Payload, before it is
+   * shared with anybody else, or for a PayloadProducer.
+   */
+  uint8_t* mutable_data() { return data_; }
+  /**
+   * Set the number of valid bytes (must be <= capacity()). Same rules as
+   * mutable_data().
+   */
+  void set_size(size_t size) { size_ = size; }
+  /**
+   * Make sure the buffer can hold `size` bytes and set the size. Existing
+   * contents are not preserved if the buffer grows (it's swapped for one
+   * from the pool). Same rules as mutable_data().
+   */
+  void reserve(size_t size);
+  /**
+   * The allocated size of the buffer.
+   */
+  size_t capacity() const { return capacity_; }
+  /**
+   * The Subscription (see ProtoPayloadFilter::subscribe) the Payload was
+   * filtered for, or 0 for the full, unfiltered, Batch.
+   */
+  uint32_t subscription() const { return subscription_; }
+  /**
+   * Set the Subscription id. Same rules as mutable_data().
+   */
+  void set_subscription(uint32_t id) { subscription_ = id; }
+
+private:
+  friend class PayloadPool;
+
+  Payload(PayloadPool* pool, size_t capacity);
+  ~Payload();
+
+  bool resolve_slow() const;
+
+  std::atomic<int> refcount_;
+  PayloadPool* pool_;
+  uint8_t* data_;
+  size_t size_;
+  size_t capacity_;
+  uint32_t subscription_;
+  // pending state
+  mutable std::atomic<bool> ready_;
+  mutable bool failed_;
+  mutable std::mutex resolve_lock_;
+  mutable std::unique_ptr<PayloadProducer> producer_;
+};
+
+/**
+ * PayloadPool hands out Payload buffers from power of two size classes and
+ * recycles them when released, so steady state serialization never hits
+ * the allocator.
+ */
+class PayloadPool {
+public:
+  /**
+   * Smallest size class (bytes).
+   */
+  static const size_t MIN_CLASS_SIZE = 1 << 10;
+  /**
+   * Largest size class (bytes). Anything bigger is allocated and freed.
+   */
+  static const size_t MAX_CLASS_SIZE = 1 << 22;
+  /**
+   * Default number of free buffers to keep per size class.
+   */
+  static const size_t DEFAULT_MAX_FREE = 32;
+
+  explicit PayloadPool(size_t max_free = DEFAULT_MAX_FREE);
+  /**
+   * Note: outstanding Payloads must be released before the pool is
+   * destroyed. Use get_default() when that can't be guaranteed.
+   */
+  virtual ~PayloadPool();
+  /**
+   * Get a Payload with at least `size` bytes of capacity, a size of `size`
+   * and one reference.
+   */
+  Payload* acquire(size_t size);
+  /**
+   * Get a pending Payload with one reference. The bytes are filled in by
+   * `producer` when first needed (see Payload::resolve).
+   */
+  Payload* acquire_pending(std::unique_ptr<PayloadProducer> producer);
+  /**
+   * The process wide pool. It is never destroyed, so Payloads attached to
+   * metadata may safely outlive whatever element created them.
+   */
+  static PayloadPool* get_default();
+
+private:
+  friend class Payload;
+
+  /**
+   * Called by Payload::unref() when the last reference goes away.
+   */
+  void recycle(Payload* payload);
+  /**
+   * Index of the smallest class that fits `size`, or -1 if too big.
+   */
+  static int size_class(size_t size);
+  /**
+   * Capacity to allocate for `size` bytes (the size class size, if any).
+   */
+  static size_t class_capacity(size_t size);
+
+  size_t max_free_;
+  std::mutex lock_;
+  std::vector<std::vector<Payload*>> free_;
+};
+
+} // namespace ds
+
+#endif  // PAYLOAD_HPP_
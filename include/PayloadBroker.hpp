@@ -4,14 +4,15 @@
 #pragma once
 
 #include "BaseFilter.hpp"
-#include <string>
+#include "Payload.hpp"
+#include "UserMetaHandler.hpp"
 
 namespace ds {
 
 /**
  * PayloadBroker is a base class for payload brokers.
  */
-class PayloadBroker : public BaseFilter {
+class PayloadBroker : public BaseFilter, public UserMetaHandler {
 public:
   virtual ~PayloadBroker() = default;
   /**
@@ -24,11 +25,43 @@ public:
    */
   virtual GstFlowReturn on_buffer(GstBuffer* buf);
   /**
-   * Called by on_buffer when a serialized payload is found on the buffer.
+   * NVDS_PAYLOAD_META
+   */
+  virtual std::vector<NvDsMetaType> user_meta_types() {
+    return {NVDS_PAYLOAD_META};
+  }
+  /**
+   * Calls on_batch_payload with the Payload in user_meta, if it's for our
+   * subscription (for MetaDispatcher).
+   */
+  virtual bool on_user_meta(NvDsBatchMeta* batch_meta,
+                            NvDsUserMeta* user_meta);
+  /**
+   * Called by on_buffer when a serialized payload for our subscription is
+   * found on the buffer.
+   * 
+   * The payload is only borrowed for the duration of the call. Take a
+   * reference with payload->ref() to keep it around (no copy needed).
+   * 
+   * The payload may still be pending (see ProtoPayloadFilter::Serialization).
+   * Reading the bytes resolves it, so implementations that don't need them
+   * should avoid data(), size() and str().
    * 
    * Returns true on success, false on failure.
    */
-  virtual bool on_batch_payload(std::string* payload) = 0;
+  virtual bool on_batch_payload(Payload* payload) = 0;
+  /**
+   * Only receive payloads for this subscription id, as returned by
+   * ProtoPayloadFilter::subscribe. Default 0 (unfiltered payloads).
+   */
+  virtual void set_subscription(uint32_t id) { subscription_ = id; }
+  /**
+   * get the subscription id
+   */
+  virtual uint32_t get_subscription() { return subscription_; }
+
+protected:
+  std::atomic<uint32_t> subscription_{0};
 };
 
 } // namespace ds
@@ -4,33 +4,237 @@
 #pragma once
 
 #include "BaseFilter.hpp"
+#include "Groups.hpp"
+#include "PackedBatch.hpp"
+#include "Payload.hpp"
+#include "Queue.hpp"
+#include "Subscription.hpp"
+#include "UserMetaHandler.hpp"
 #include "distance.pb.h"
 
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 namespace ds {
 
 /**
  * ProtoPayloadFilter serializes distanceproto metadata.
  */
-class ProtoPayloadFilter : public BaseFilter {
+class ProtoPayloadFilter : public BaseFilter, public UserMetaHandler {
 public:
-  ProtoPayloadFilter();
-  virtual ~ProtoPayloadFilter() = default;
   /**
-   * This implementation extracts metadata of type DF_USER_BATCH_META
-   * from the user metadata list on batch_meta and calls on_batch with each.
+   * When, and on which thread, a Batch is serialized.
+   *
+   * sync: in on_batch_meta, on the streaming thread.
+   * async: a copy of the Batch is attached as a pending Payload and
+   *  serialized by a worker thread. A reader that gets there first
+   *  serializes it itself.
+   * lazy: a copy of the Batch is attached as a pending Payload and only
+   *  serialized when something first reads the bytes (if ever).
+   *
+   * A Batch in metadata is shared with everything downstream, so async and
+   * lazy snapshot it into a PackedBatch (flat columns, so much cheaper than
+   * copying the Batch, or serializing it), which the producer expands back
+   * into a Batch if needed. Filtered Batches are handed over instead, and a
+   * PackedBatch (see DistanceFilter::packed_meta) is copied as is, which is
+   * a handful of memcpys. Like BatchSerializer, snapshots drop unknown
+   * fields.
+   */
+  enum Serialization { sync, async, lazy };
+  /**
+   * How a Batch is laid out in the Payload bytes.
+   *
+   * nested: a distanceproto::Batch, with a Person submessage per person.
+   * columnar: a PackedBatch, with packed arrays per frame (see
+   *  PackedBatch for the schema). Consumers must be expecting it.
+   */
+  enum Encoding { nested, columnar };
+  /**
+   * Returned by subscribe when a filter doesn't take Subscriptions. No
+   * Payload is ever tagged with it.
+   */
+  static const uint32_t NO_SUBSCRIPTION = 0xFFFFFFFE;
+  /**
+   * The subscription id group Payloads (see on_groups_meta) are tagged
+   * with.
+   */
+  static const uint32_t GROUPS_SUBSCRIPTION = 0xFFFFFFFD;
+
+  ProtoPayloadFilter(Serialization serialization = sync);
+  /**
+   * Finishes any queued async serialization and joins the worker.
+   */
+  virtual ~ProtoPayloadFilter();
+  /**
+   * The encoding of attached Payloads (default: nested). Set before the
+   * first buffer. DeltaPayloadFilter has its own encoding and ignores this.
+   */
+  Encoding encoding;
+  /**
+   * This implementation extracts metadata of type DF_USER_BATCH_META (or
+   * DF_USER_COMPACT_BATCH_META or DF_USER_PACKED_BATCH_META) from the user
+   * metadata list on batch_meta and calls on_batch with each, and
+   * on_groups_meta with any DF_USER_GROUPS_META.
    */
   virtual GstFlowReturn on_buffer(GstBuffer* buf);
+  /**
+   * DF_USER_BATCH_META, DF_USER_COMPACT_BATCH_META,
+   * DF_USER_PACKED_BATCH_META and DF_USER_GROUPS_META (resolved once, at
+   * construction).
+   */
+  virtual std::vector<NvDsMetaType> user_meta_types() {
+    return {batch_meta_type_, compact_meta_type_, packed_meta_type_,
+            groups_meta_type_};
+  }
+  /**
+   * Calls on_batch_meta with the Batch in user_meta, materializing it first
+   * if it's a CompactBatch, on_packed_meta if it's a PackedBatch, or
+   * on_groups_meta if it's a BatchGroups (for MetaDispatcher).
+   */
+  virtual bool on_user_meta(NvDsBatchMeta* batch_meta,
+                            NvDsUserMeta* user_meta);
   /**
    * Called by on_buffer when payload metadata is found in batch_meta's user
    * meta list.
    * 
-   * The default implementation serializes the Batch to string and attaches
-   * the result as NvDsPayload type metadata (for message broker elements).
+   * The default implementation serializes the Batch to a pooled Payload and
+   * attaches it as NVDS_PAYLOAD_META type metadata (for payload brokers).
+   * It does the same with a filtered copy of the Batch for each Subscription
+   * that matches anything.
    * 
    * Returns true on success, false on failure.
    */
   virtual bool on_batch_meta(
     NvDsBatchMeta* batch_meta, distanceproto::Batch* batch);
+  /**
+   * Called by on_user_meta with DF_USER_PACKED_BATCH_META.
+   *
+   * With the columnar encoding, or async or lazy serialization, the
+   * unfiltered Payload comes straight from the PackedBatch (see
+   * serialize_packed), and the Batch is only materialized if there are
+   * Subscriptions to filter it for. Otherwise this calls on_batch_meta with
+   * the materialized Batch. Subclasses overriding on_batch_meta should
+   * override this too (or it bypasses them with the columnar encoding).
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool on_packed_meta(NvDsBatchMeta* batch_meta, PackedBatch* batch);
+  /**
+   * Called by on_user_meta with DF_USER_GROUPS_META (see
+   * DistanceFilter::find_groups).
+   *
+   * The default implementation encodes the groups (see BatchGroups::encode)
+   * to a pooled Payload tagged with GROUPS_SUBSCRIPTION and attaches it, so
+   * a PayloadBroker gets them with set_subscription(GROUPS_SUBSCRIPTION).
+   * Subscriptions don't apply to groups.
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool on_groups_meta(NvDsBatchMeta* batch_meta, BatchGroups* groups);
+  /**
+   * Add a Subscription. Each Batch is filtered once for it, and matching
+   * parts are attached as a separate Payload tagged with the returned id
+   * (see PayloadBroker::set_subscription). Subscribing again with an equal
+   * Subscription returns the same id.
+   *
+   * Returns the subscription id, 0 (the unfiltered Payload) if the
+   * Subscription keeps everything, or NO_SUBSCRIPTION if this filter
+   * doesn't take Subscriptions.
+   */
+  virtual uint32_t subscribe(const Subscription& subscription);
+  /**
+   * Release a Subscription returned by subscribe. Once every subscribe call
+   * for it is matched, it is no longer evaluated.
+   */
+  virtual void unsubscribe(uint32_t id);
+  /**
+   * Whether to attach the full, unfiltered, Payload (subscription 0). Turn
+   * this off if every consumer subscribes to something. Default true.
+   */
+  virtual void set_unfiltered(bool unfiltered);
+  /**
+   * Call at EOS (and before destroying the filter) for anything still
+   * pending. Metadata needs a buffer, so it comes on a new one, with an
+   * empty NvDsBatchMeta carrying only NVDS_PAYLOAD_META, for the element to
+   * push downstream ahead of the EOS event.
+   *
+   * Returns the buffer, or nullptr if nothing is pending (always, here).
+   */
+  virtual GstBuffer* on_eos() { return nullptr; }
+
+protected:
+  /**
+   * A new buffer with an empty NvDsBatchMeta with `payloads` attached (see
+   * on_eos). Takes over the references (even on failure).
+   *
+   * Returns the buffer, or nullptr if there are no payloads.
+   */
+  virtual GstBuffer* make_payload_buffer(const std::vector<Payload*>& payloads);
+  /**
+   * Attach a Payload to batch_meta as NVDS_PAYLOAD_META. Takes over the
+   * caller's reference (even on failure).
+   *
+   * Returns true on success, false on failure.
+   */
+  virtual bool attach_payload(NvDsBatchMeta* batch_meta, Payload* payload);
+  /**
+   * Serialize a Batch into a Payload from pool_ (or make a pending Payload
+   * which will, depending on serialization_), tagged with `subscription`.
+   *
+   * Returns a Payload with one reference on success, nullptr on failure.
+   */
+  virtual Payload* serialize(distanceproto::Batch* batch,
+                             uint32_t subscription);
+  /**
+   * Like serialize, for filtered_, which is taken over (and left empty)
+   * rather than copied if serialization is deferred.
+   */
+  Payload* serialize_filtered(uint32_t subscription);
+  /**
+   * Like serialize, but for a PackedBatch, which is written as is with the
+   * columnar encoding (or, with the nested encoding, copied and expanded
+   * into a Batch by the producer).
+   */
+  virtual Payload* serialize_packed(PackedBatch* batch,
+                                    uint32_t subscription);
+  /**
+   * A pending Payload from `producer` (taken over), tagged with
+   * `subscription` and queued for the worker if async.
+   */
+  Payload* serialize_pending(PayloadProducer* producer,
+                             uint32_t subscription);
+  /**
+   * worker thread for async serialization
+   */
+  virtual void serialize_worker_func();
+
+  PayloadPool* pool_;
+  // DF_USER_BATCH_META is a string lookup, so only do it once
+  NvDsMetaType batch_meta_type_;
+  NvDsMetaType compact_meta_type_;
+  NvDsMetaType packed_meta_type_;
+  NvDsMetaType groups_meta_type_;
+  Serialization serialization_;
+  std::thread serialize_worker_;
+  ds::Queue<Payload*> serialize_queue_;
+
+  struct SubscriptionEntry {
+    uint32_t id;
+    Subscription subscription;
+    // number of subscribe calls not matched by unsubscribe
+    size_t count;
+  };
+  // guards the subscription state
+  std::mutex subscriptions_lock_;
+  std::vector<SubscriptionEntry> subscriptions_;
+  uint32_t next_subscription_;
+  bool unfiltered_;
+  // reused for filtered copies of each Batch
+  distanceproto::Batch filtered_;
+  // reused for encoded groups
+  std::string groups_scratch_;
 };
 
 } // namespace ds
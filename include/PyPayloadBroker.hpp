@@ -5,9 +5,9 @@
 
 #include "PayloadBroker.hpp"
 
-#include <thread>
+#include <condition_variable>
 #include <mutex>
-#include <queue>
+#include <vector>
 
 namespace ds {
 
@@ -15,28 +15,77 @@ namespace ds {
  * PyPayloadBroker is a class designed to be used from other languages.
  * (not necessarily Python, but i'm feeling too lazy to rename at the moment)
  * 
- * It stores NVDS_PAYLOAD_META in a string and returns a null terminated char*
- * copy with get_payload()
+ * It keeps the last N NVDS_PAYLOAD_META in a ring, tagged with sequence
+ * numbers starting at 1, so a reader can block for the next payload and
+ * catch up on any it missed. The ring only holds references, so nothing is
+ * copied unless get_payload() is used.
  */
 class PyPayloadBroker : public PayloadBroker {
-private:
-  std::string data;
-  std::mutex data_lock;
 public:
-  PyPayloadBroker() = default;
-  virtual ~PyPayloadBroker() = default;
+  /**
+   * Default number of payloads kept.
+   */
+  static const size_t DEFAULT_SLOTS = 16;
+  /**
+   * A borrowed payload and its sequence number.
+   */
+  struct Entry {
+    guint64 seq;
+    Payload* payload;
+  };
+
+  explicit PyPayloadBroker(size_t slots = DEFAULT_SLOTS);
+  virtual ~PyPayloadBroker();
   /**
    * Called by on_buffer when a NVDS_PAYLOAD_META is found on the buffer.
    * 
    * Returns true on success, false on failure.
    */
-  virtual bool on_batch_payload(std::string* payload);
+  virtual bool on_batch_payload(Payload* payload);
   /**
-   * get a gchararray with the latest serialized batch.
+   * get a gchararray with a copy of the latest serialized batch.
    */
   virtual gchararray get_payload();
+  /**
+   * Sequence number of the latest payload (0 if there are none yet).
+   */
+  virtual guint64 latest_seq();
+  /**
+   * Block until there is a payload newer than last_seq, or timeout_ms passes
+   * (negative to wait forever).
+   *
+   * Returns the latest sequence number (last_seq on timeout).
+   */
+  virtual guint64 wait_for_next(guint64 last_seq, gint64 timeout_ms = -1);
+  /**
+   * Borrow every payload newer than seq which is still in the ring, oldest
+   * first. Each Entry's payload must be given back with release().
+   *
+   * Returns the number of payloads newer than seq which were already
+   * overwritten (missed).
+   */
+  virtual guint64 get_since(guint64 seq, std::vector<Entry>* entries);
+  /**
+   * Borrow the payload with sequence number seq (0 for the latest), without
+   * copying. The bytes (payload->data(), payload->size()) stay valid until
+   * the payload is given back with release().
+   *
+   * Returns nullptr if that payload isn't in the ring.
+   */
+  virtual Payload* borrow(guint64 seq = 0);
+  /**
+   * Give back a payload from borrow() or get_since().
+   */
+  static void release(Payload* payload);
+
+private:
+  std::vector<Entry> ring_;
+  // sequence number of the latest payload
+  guint64 seq_;
+  std::mutex lock_;
+  std::condition_variable cv_;
 };
 
 } // namespace ds
 
-#endif  // PY_PAYLOAD_BROKER_HPP_
\ No newline at end of file
+#endif  // PY_PAYLOAD_BROKER_HPP_
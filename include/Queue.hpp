@@ -29,6 +29,7 @@
 #include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <vector>
 
 namespace ds {
 
@@ -41,7 +42,7 @@ protected:
   std::deque<T> d;
   std::mutex mutex;
   std::condition_variable cv;
-  bool flushing;
+  bool flushing = false;
 public:
   /**
    * Checks if the Queue is empty.
@@ -80,12 +81,26 @@ public:
     this->d.pop_front();
     return ret;
   }
+  /**
+   * Move up to `max` items (0 for no limit) into `things`, without waiting
+   * for more. Returns the number of items moved.
+   */
+  size_t drain(std::vector<T>* things, size_t max = 0) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    size_t count = max && max < this->d.size() ? max : this->d.size();
+    for (size_t i = 0; i < count; i++) {
+      things->push_back(std::move(this->d.front()));
+      this->d.pop_front();
+    }
+    return count;
+  }
   /**
    * Stop waiting for a get()
    */
   void flush() {
+    std::unique_lock<std::mutex> lock(this->mutex);
     this->flushing = true;
-    this->cv.notify_one();
+    this->cv.notify_all();
   }
 };
 
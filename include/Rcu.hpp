@@ -0,0 +1,128 @@
+/* Rcu.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef RCU_HPP_
+#define RCU_HPP_
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ds {
+
+/**
+ * Rcu holds an immutable T which one reader thread (eg. a streaming thread)
+ * may read without locking while any number of writers replace it.
+ *
+ * The reader's acquire() is a couple of loads when nothing has changed.
+ * Writers publish() a whole new T and the old one is freed once the reader
+ * has moved on from it (a single hazard pointer), so a reader never sees a
+ * T change under it and never waits for a writer.
+ */
+template <typename T>
+class Rcu {
+public:
+  explicit Rcu(std::unique_ptr<T> initial) :
+    current_(initial.release()),
+    hazard_(nullptr)
+    {}
+  Rcu(const Rcu&) = delete;
+  Rcu& operator=(const Rcu&) = delete;
+  /**
+   * Note: the reader must be done with whatever it acquired.
+   */
+  ~Rcu() {
+    delete current_.load();
+    for (T* old : retired_) {
+      delete old;
+    }
+  }
+  /**
+   * Get the current T. Reader thread only. It stays valid until the next
+   * acquire() (or release()), however many times it's replaced meanwhile.
+   */
+  const T* acquire() {
+    T* ptr = current_.load(std::memory_order_acquire);
+    // already protected since the last acquire()
+    if (ptr == hazard_.load(std::memory_order_relaxed)) {
+      return ptr;
+    }
+    for (;;) {
+      hazard_.store(ptr);
+      // make sure it wasn't retired before the hazard was visible
+      T* again = current_.load();
+      if (again == ptr) {
+        return ptr;
+      }
+      ptr = again;
+    }
+  }
+  /**
+   * Done with what acquire() returned (optional, the next acquire() does
+   * the same). Reader thread only.
+   */
+  void release() {
+    hazard_.store(nullptr, std::memory_order_release);
+  }
+  /**
+   * Replace the current T with `next`. Never blocks the reader, but
+   * writers are serialized.
+   */
+  void publish(std::unique_ptr<T> next) {
+    std::lock_guard<std::mutex> lock(writer_lock_);
+    retired_.push_back(current_.exchange(next.release()));
+    // free whatever the reader can't be using
+    T* in_use = hazard_.load();
+    size_t kept = 0;
+    for (T* old : retired_) {
+      if (old == in_use) {
+        retired_[kept++] = old;
+      } else {
+        delete old;
+      }
+    }
+    retired_.resize(kept);
+  }
+  /**
+   * Get a copy of the current T (eg. to modify and publish()). Any thread.
+   */
+  T copy() const {
+    std::lock_guard<std::mutex> lock(writer_lock_);
+    return *current_.load(std::memory_order_acquire);
+  }
+
+protected:
+  std::atomic<T*> current_;
+  // what the reader may be using
+  std::atomic<T*> hazard_;
+  // replaced, but maybe still in use (only ever one)
+  std::vector<T*> retired_;
+  mutable std::mutex writer_lock_;
+};
+
+} // namespace ds
+
+#endif  // RCU_HPP_
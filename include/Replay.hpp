@@ -0,0 +1,146 @@
+/* Replay.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef REPLAY_HPP_
+#define REPLAY_HPP_
+
+#pragma once
+
+#include "BaseFilter.hpp"
+#include "ReplaySource.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * Replay rebuilds DeepStream metadata (frames, and person objects with their
+ * boxes, source ids and timestamps) from recorded or synthetic Batches and
+ * pushes it through a chain of filters and brokers, timing each of them.
+ *
+ * It doesn't need a GPU or a pipeline, so real crowd recordings become
+ * repeatable CPU benchmarks:
+ *
+ *   FileReplaySource source("metadata.coded");
+ *   Replay replay(&source);
+ *   DistanceFilter distance;
+ *   ProtoPayloadFilter payload;
+ *   replay.add_stage("distance", &distance);
+ *   replay.add_stage("payload", &payload);
+ *   replay.run().print(stdout);
+ *
+ * Recorded danger values are not carried over, since recomputing them is
+ * DistanceFilter's job.
+ */
+class Replay {
+public:
+  /**
+   * fast: push batches as fast as possible.
+   * recorded: wait until each batch is due, going by the first frame's pts
+   *  relative to the first batch's (scaled by speed).
+   */
+  enum Pacing { fast, recorded };
+
+  /**
+   * Latency of one stage (or the whole chain), in microseconds.
+   */
+  struct Stats {
+    std::string name;
+    uint64_t count;
+    double mean_us;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+  };
+
+  struct Report {
+    uint64_t batches;
+    uint64_t frames;
+    uint64_t objects;
+    // wall time of the whole run, pacing included
+    double seconds;
+    // building the metadata from each Batch
+    Stats build;
+    // one per stage, in order
+    std::vector<Stats> stages;
+    // all the stages together
+    Stats total;
+    /**
+     * Print a human readable summary.
+     */
+    void print(FILE* out) const;
+  };
+
+  explicit Replay(ReplaySource* source, Pacing pacing = fast);
+  virtual ~Replay() = default;
+
+  /**
+   * The class id objects get (default: 0, which is DistanceFilter's).
+   */
+  int class_id;
+  /**
+   * Playback speed for recorded pacing (default: 1.0, 2.0 is twice as fast).
+   */
+  double speed;
+
+  /**
+   * Add a stage to the end of the chain. The filter is not owned.
+   */
+  void add_stage(std::string name, BaseFilter* filter);
+  /**
+   * Replay batches until the source runs out, or `max_batches` have been
+   * replayed (0 for no limit).
+   */
+  Report run(uint64_t max_batches = 0);
+  /**
+   * Make a buffer with batch metadata equivalent to `batch`, with people as
+   * objects of `class_id`. An object's object_id is the person's uid, or, if
+   * that's 0, their index in the frame. Unref it when done.
+   */
+  static GstBuffer* make_buffer(const distanceproto::Batch& batch,
+                                int class_id = 0);
+
+protected:
+  struct Stage {
+    std::string name;
+    BaseFilter* filter;
+    std::vector<uint64_t> latencies_ns;
+  };
+
+  /**
+   * Summarize `latencies_ns` (which gets sorted).
+   */
+  static Stats summarize(std::string name, std::vector<uint64_t>* latencies_ns);
+
+  ReplaySource* source_;
+  Pacing pacing_;
+  std::vector<Stage> stages_;
+};
+
+} // namespace ds
+
+#endif  // REPLAY_HPP_
@@ -0,0 +1,199 @@
+/* ReplaySource.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef REPLAY_SOURCE_HPP_
+#define REPLAY_SOURCE_HPP_
+
+#pragma once
+
+#include "PackedBatch.hpp"
+#include "distance.pb.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * ReplaySource is where Replay gets its batches from.
+ */
+class ReplaySource {
+public:
+  virtual ~ReplaySource() = default;
+  /**
+   * Fill in `batch` (which is cleared first) with the next Batch.
+   *
+   * Returns true on success, false at the end (or on error).
+   */
+  virtual bool next(distanceproto::Batch* batch) = 0;
+};
+
+/**
+ * FileReplaySource reads back what FileMetaBroker wrote, in either the proto
+ * (.coded) or packed format (told apart by the magic number).
+ *
+ * Proto files are Batches written back to back with no framing, so they're
+ * read field by field and a new Batch starts at each max_frames. Recordings
+ * made without max_frames fall back on starting a new Batch when a source
+ * repeats, which is right as long as each source has at most one frame per
+ * batch (the nvstreammux default).
+ */
+class FileReplaySource : public ReplaySource {
+public:
+  explicit FileReplaySource(std::string filename);
+  virtual ~FileReplaySource();
+  /**
+   * True if the file was opened and has a known magic number.
+   */
+  bool is_open() const { return stream_ != nullptr; }
+  virtual bool next(distanceproto::Batch* batch);
+
+protected:
+  bool next_coded(distanceproto::Batch* batch);
+  bool next_packed(distanceproto::Batch* batch);
+
+  std::string filename_;
+  int fd_;
+  std::unique_ptr<google::protobuf::io::FileInputStream> stream_;
+  bool packed_;
+  // a field read by next_coded that belongs to the following Batch
+  bool has_max_frames_;
+  uint32_t max_frames_;
+  bool has_frame_;
+  distanceproto::Frame frame_;
+  // whether the file has max_frames at all
+  bool saw_max_frames_;
+  // reused for packed records
+  std::string record_;
+  PackedBatch packed_batch_;
+};
+
+/**
+ * MotReplaySource reads MOTChallenge style detection or track files, a
+ * line per box:
+ *
+ *   <frame>,<id>,<left>,<top>,<width>,<height>,<conf>,...
+ *
+ * and returns a Batch of one frame per frame number, in order, with the id
+ * as each Person's uid. Fields may be separated by commas or whitespace and
+ * anything after conf is ignored. Lines need not be sorted (ground truth
+ * files are sorted by id).
+ */
+class MotReplaySource : public ReplaySource {
+public:
+  /**
+   * @param filename the file to read (all of it, up front).
+   * @param source_id source_id of every frame.
+   * @param fps frame rate, for timestamps.
+   * @param min_confidence leave out boxes with a lower conf.
+   */
+  MotReplaySource(std::string filename,
+                  uint32_t source_id = 0,
+                  double fps = 30.0,
+                  float min_confidence = -INFINITY);
+  virtual ~MotReplaySource() = default;
+  /**
+   * True if the file was read and parsed.
+   */
+  bool is_open() const { return open_; }
+  /**
+   * The number of boxes read.
+   */
+  size_t size() const { return rows_.size(); }
+  virtual bool next(distanceproto::Batch* batch);
+
+protected:
+  struct Row {
+    int32_t frame;
+    int32_t id;
+    float left;
+    float top;
+    float width;
+    float height;
+  };
+
+  /**
+   * Parse `text` into rows_. Returns false on a malformed line.
+   */
+  bool parse(const std::string& text, float min_confidence);
+
+  std::string filename_;
+  uint32_t source_id_;
+  uint64_t frame_ns_;
+  bool open_;
+  // sorted by frame
+  std::vector<Row> rows_;
+  size_t next_;
+};
+
+/**
+ * SyntheticReplaySource generates crowds: each source has groups of people
+ * that wander around the frame, so some are close enough to be dangerous.
+ * The same seed always generates the same batches.
+ */
+class SyntheticReplaySource : public ReplaySource {
+public:
+  static const uint32_t DEFAULT_BATCH_SIZE = 8;
+  static const uint32_t DEFAULT_MAX_PEOPLE = 40;
+
+  /**
+   * @param num_batches how many batches to generate (0 for no end).
+   * @param batch_size sources (and frames) per batch.
+   * @param max_people most people in one frame.
+   * @param fps frame rate, for timestamps.
+   * @param seed random seed.
+   */
+  SyntheticReplaySource(uint64_t num_batches = 0,
+                        uint32_t batch_size = DEFAULT_BATCH_SIZE,
+                        uint32_t max_people = DEFAULT_MAX_PEOPLE,
+                        double fps = 30.0,
+                        uint32_t seed = 0);
+  virtual ~SyntheticReplaySource() = default;
+  virtual bool next(distanceproto::Batch* batch);
+
+protected:
+  struct Walker {
+    float x;
+    float y;
+    float height;
+  };
+
+  uint64_t num_batches_;
+  uint32_t batch_size_;
+  uint32_t max_people_;
+  uint64_t frame_ns_;
+  uint64_t count_;
+  std::default_random_engine rng_;
+  // the people of each source
+  std::vector<std::vector<Walker>> crowds_;
+};
+
+} // namespace ds
+
+#endif  // REPLAY_SOURCE_HPP_
@@ -0,0 +1,160 @@
+/* RoiMask.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef ROI_MASK_HPP_
+#define ROI_MASK_HPP_
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ds {
+
+class RoiMask;
+
+/**
+ * RoiMasks by source_id.
+ */
+typedef std::unordered_map<uint32_t, RoiMask> RoiMasks;
+
+/**
+ * RoiMask is a region of interest for one source, as a bitmap of cells
+ * cell_size pixels square, so testing a point is a single lookup however
+ * many polygons went into it.
+ *
+ * A mask starts out including the whole frame. exclude() carves polygons
+ * out of it and include() puts them back, in the order they're called.
+ * A cell belongs to a polygon if its center does. Points off the frame
+ * count as the nearest cell.
+ */
+class RoiMask {
+public:
+  /**
+   * Default cell size (pixels).
+   */
+  static const uint32_t DEFAULT_CELL_SIZE = 8;
+
+  struct Point {
+    float x;
+    float y;
+  };
+
+  /**
+   * An empty mask, which includes everything.
+   */
+  RoiMask();
+  /**
+   * A mask for frames of width x height pixels, which includes everything
+   * until told otherwise.
+   */
+  RoiMask(uint32_t width, uint32_t height,
+          uint32_t cell_size = DEFAULT_CELL_SIZE);
+  /**
+   * Include the area inside `polygon` (even-odd rule).
+   */
+  void include(const std::vector<Point>& polygon) { fill(polygon, true); }
+  /**
+   * Exclude the area inside `polygon` (even-odd rule).
+   */
+  void exclude(const std::vector<Point>& polygon) { fill(polygon, false); }
+  /**
+   * Include (or exclude) the whole frame.
+   */
+  void fill_all(bool included);
+  /**
+   * Returns true if (x, y) is included.
+   */
+  bool contains(float x, float y) const {
+    if (bits_.empty()) {
+      return true;
+    }
+    // clamp to the frame (as floats, so huge values don't overflow)
+    x = x < 0.0f ? 0.0f : x * scale_;
+    y = y < 0.0f ? 0.0f : y * scale_;
+    uint32_t col = x < max_col_ ? (uint32_t) x : cols_ - 1;
+    uint32_t row = y < max_row_ ? (uint32_t) y : rows_ - 1;
+    return (bits_[row * stride_ + (col >> 6)] >> (col & 63)) & 1;
+  }
+  /**
+   * Returns true if the bottom center of a box (where the feet are) is
+   * included.
+   */
+  bool contains_feet(float left, float top, float width, float height) const {
+    return contains(left + width / 2, top + height);
+  }
+  /**
+   * The number of cells included.
+   */
+  size_t count() const;
+  /**
+   * Bytes of bitmap.
+   */
+  size_t byte_size() const { return bits_.size() * sizeof(uint64_t); }
+  uint32_t cols() const { return cols_; }
+  uint32_t rows() const { return rows_; }
+  uint32_t cell_size() const { return cell_size_; }
+
+  /**
+   * Load masks from a text file into `masks` (cleared first). Each source
+   * starts with a `source` line, followed by its polygons as x,y pixel
+   * coordinates, applied in order. # starts a comment.
+   *
+   *   source 0 1920 1080 [cell_size]
+   *   exclude 0,0 1920,0 1920,200 0,200
+   *   include 800,0 1100,0 1100,200 800,200
+   *
+   * Returns true on success, false on failure (with a warning saying
+   * where).
+   */
+  static bool load(const std::string& filename, RoiMasks* masks);
+  /**
+   * load() from a string (eg. a config property).
+   */
+  static bool parse(const std::string& text, RoiMasks* masks);
+
+protected:
+  /**
+   * Set every cell whose center is inside `polygon` to `included`.
+   */
+  void fill(const std::vector<Point>& polygon, bool included);
+
+  uint32_t cell_size_;
+  uint32_t cols_;
+  uint32_t rows_;
+  // uint64_t words per row
+  uint32_t stride_;
+  // cells per pixel
+  float scale_;
+  // cols_ and rows_, as floats, for clamping
+  float max_col_;
+  float max_row_;
+  std::vector<uint64_t> bits_;
+};
+
+} // namespace ds
+
+#endif  // ROI_MASK_HPP_
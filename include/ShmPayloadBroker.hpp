@@ -0,0 +1,75 @@
+#ifndef SHM_PAYLOAD_BROKER_HPP_
+#define SHM_PAYLOAD_BROKER_HPP_
+
+#pragma once
+
+#include "PayloadBroker.hpp"
+#include "ShmPayloadRing.hpp"
+
+#include <sys/stat.h>
+#include <string>
+
+namespace ds {
+
+/**
+ * ShmPayloadBroker publishes every payload into a POSIX shared memory ring
+ * (see ShmPayloadRing.hpp) for consumers in other processes. Use
+ * ShmPayloadReader (libdistance-shm-reader) to read it.
+ *
+ * Publishing is a memcpy and a FUTEX_WAKE. It never waits on readers; a
+ * reader that falls behind by more than the ring size misses payloads.
+ */
+class ShmPayloadBroker : public PayloadBroker {
+public:
+  /**
+   * @param name shared memory object name (eg. "/distance").
+   * @param slot_count number of payloads in the ring.
+   * @param slot_size max payload size (bigger payloads are dropped).
+   * @param mode permissions of the shared memory object (not subject to the
+   * umask). Owner only by default, since payloads may identify people.
+   */
+  ShmPayloadBroker(std::string name,
+                   uint32_t slot_count = 64,
+                   uint32_t slot_size = 1 << 20,
+                   mode_t mode = S_IRUSR | S_IWUSR);
+  /**
+   * Calls stop().
+   */
+  virtual ~ShmPayloadBroker();
+  /**
+   * Called by on_buffer when a NVDS_PAYLOAD_META is found on the buffer.
+   * 
+   * Returns true on success, false on failure.
+   */
+  virtual bool on_batch_payload(Payload* payload);
+  /**
+   * Creates (replacing any stale one) and maps the shared memory object.
+   */
+  virtual void start();
+  /**
+   * Marks the ring closed, wakes readers, unmaps and unlinks it. Readers
+   * which have it mapped can still finish reading.
+   */
+  virtual void stop();
+  /**
+   * Whether the ring is mapped (start() succeeded).
+   */
+  virtual bool is_open() { return header_ != nullptr; }
+  /**
+   * get the shared memory object name
+   */
+  virtual std::string get_name() { return name_; }
+
+protected:
+  std::string name_;
+  uint32_t slot_count_;
+  uint32_t slot_size_;
+  mode_t mode_;
+  size_t size_;
+  ShmRingHeader* header_;
+  uint64_t seq_;
+};
+
+} // namespace ds
+
+#endif  // SHM_PAYLOAD_BROKER_HPP_
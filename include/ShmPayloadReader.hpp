@@ -0,0 +1,103 @@
+#ifndef SHM_PAYLOAD_READER_HPP_
+#define SHM_PAYLOAD_READER_HPP_
+
+#pragma once
+
+#include "ShmPayloadRing.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ds {
+
+/**
+ * ShmPayloadReader reads payloads published by a ShmPayloadBroker in
+ * another process. It only maps the ring read only, and it has no GStreamer
+ * or DeepStream dependencies (libdistance-shm-reader).
+ *
+ * Zero copy reads go: peek(), use the bytes, validate(). If validate()
+ * returns false, the writer overwrote the slot while it was in use and
+ * whatever was done with the bytes must be thrown away.
+ */
+class ShmPayloadReader {
+public:
+  /**
+   * Result of a read.
+   *
+   * ok: the payload is available.
+   * again: the payload hasn't been published yet.
+   * gone: the payload was overwritten (the reader fell behind).
+   * error: not open, or a bad argument.
+   */
+  enum Status { ok = 0, again = 1, gone = 2, error = -1 };
+
+  ShmPayloadReader();
+  virtual ~ShmPayloadReader();
+  /**
+   * Map the ring published under `name`.
+   *
+   * The ring is mapped writable if permissions allow, so wait_for_next()
+   * can register with the writer. Otherwise it's mapped read only and
+   * wait_for_next() polls.
+   *
+   * Returns false if it doesn't exist (yet) or isn't a valid ring.
+   */
+  bool open(const std::string& name);
+  /**
+   * Unmap the ring.
+   */
+  void close();
+  /**
+   * Whether a ring is mapped.
+   */
+  bool is_open() const { return header_ != nullptr; }
+  /**
+   * Whether the writer has shut down. Anything still in the ring may be
+   * read, but nothing new will arrive.
+   */
+  bool writer_closed() const;
+  /**
+   * Sequence number of the latest payload (0 for none).
+   */
+  uint64_t latest_seq() const;
+  /**
+   * Sequence number of the oldest payload which may still be in the ring.
+   */
+  uint64_t oldest_seq() const;
+  /**
+   * Number of payloads the writer dropped for being too big.
+   */
+  uint64_t dropped() const;
+  /**
+   * Sleep until there is a payload newer than last_seq, the writer closes
+   * or timeout_ms passes (negative to wait forever).
+   *
+   * Returns the latest sequence number.
+   */
+  uint64_t wait_for_next(uint64_t last_seq, int64_t timeout_ms = -1) const;
+  /**
+   * Get a pointer to payload `seq` in shared memory, without copying.
+   * `token` must be passed to validate() once done with the bytes.
+   */
+  Status peek(uint64_t seq, const uint8_t** data, size_t* size,
+              uint64_t* token) const;
+  /**
+   * Returns true if payload `seq` was not overwritten since peek().
+   */
+  bool validate(uint64_t seq, uint64_t token) const;
+  /**
+   * Copy payload `seq` into `out`.
+   */
+  Status read(uint64_t seq, std::string* out) const;
+
+private:
+  ShmRingHeader* header_;
+  size_t size_;
+  // whether the mapping is writable (so we can register in `waiters`)
+  bool writable_;
+};
+
+} // namespace ds
+
+#endif  // SHM_PAYLOAD_READER_HPP_
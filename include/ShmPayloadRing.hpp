@@ -0,0 +1,128 @@
+/* ShmPayloadRing.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef SHM_PAYLOAD_RING_HPP_
+#define SHM_PAYLOAD_RING_HPP_
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Shared memory layout used by ShmPayloadBroker (the one writer) and
+ * ShmPayloadReader (any number of reader processes).
+ *
+ * [ShmRingHeader][ShmSlotHeader][data...][ShmSlotHeader][data...]...
+ *
+ * Payload `seq` (starting at 1) goes in slot `seq % slot_count`. Each slot
+ * is a seqlock: `gen` is 2 * seq - 1 while the writer is copying into it
+ * and 2 * seq once it's done. A reader checks `gen` before and after using
+ * the bytes and throws away anything where it changed. The writer never
+ * waits for readers, and readers write nothing but `waiters`.
+ *
+ * After each payload the writer bumps `notify` and, if any reader has
+ * registered in `waiters`, does a FUTEX_WAKE on it, so readers can sleep
+ * instead of polling without costing the writer a syscall per payload.
+ */
+
+namespace ds {
+
+/**
+ * Magic number at the start of the segment ("DSHR").
+ */
+static const uint32_t SHM_RING_MAGIC = 0x44534852;
+/**
+ * Layout version. Bumped on any incompatible change.
+ */
+static const uint32_t SHM_RING_VERSION = 2;
+/**
+ * Alignment of the header, slot headers and slot data.
+ */
+static const size_t SHM_RING_ALIGNMENT = 64;
+
+struct alignas(SHM_RING_ALIGNMENT) ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  // max payload size, in bytes
+  uint32_t slot_size;
+  // sequence number of the latest complete payload (0 for none)
+  std::atomic<uint64_t> write_seq;
+  // futex word, incremented after every payload and on close
+  std::atomic<uint32_t> notify;
+  // non-zero once the writer has shut down
+  std::atomic<uint32_t> closed;
+  // payloads too big for a slot
+  std::atomic<uint64_t> dropped;
+  // readers sleeping (or about to sleep) on `notify`
+  std::atomic<uint32_t> waiters;
+};
+
+struct alignas(SHM_RING_ALIGNMENT) ShmSlotHeader {
+  // seqlock generation (see above)
+  std::atomic<uint64_t> gen;
+  // payload size, in bytes
+  std::atomic<uint64_t> size;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) &&
+              sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "shared memory atomics must be plain integers");
+
+/**
+ * Bytes between the start of one slot header and the next.
+ */
+inline size_t shm_ring_slot_stride(uint32_t slot_size) {
+  size_t data = ((size_t)slot_size + SHM_RING_ALIGNMENT - 1) /
+    SHM_RING_ALIGNMENT * SHM_RING_ALIGNMENT;
+  return sizeof(ShmSlotHeader) + data;
+}
+
+/**
+ * Total size of a segment.
+ */
+inline size_t shm_ring_size(uint32_t slot_count, uint32_t slot_size) {
+  return sizeof(ShmRingHeader) +
+    (size_t)slot_count * shm_ring_slot_stride(slot_size);
+}
+
+/**
+ * Get the header of slot `index`.
+ */
+inline ShmSlotHeader* shm_ring_slot(ShmRingHeader* header, uint32_t index) {
+  return (ShmSlotHeader*)((uint8_t*)header + sizeof(ShmRingHeader) +
+    (size_t)index * shm_ring_slot_stride(header->slot_size));
+}
+
+/**
+ * Get the data following a slot header.
+ */
+inline uint8_t* shm_ring_slot_data(ShmSlotHeader* slot) {
+  return (uint8_t*)slot + sizeof(ShmSlotHeader);
+}
+
+} // namespace ds
+
+#endif  // SHM_PAYLOAD_RING_HPP_
@@ -0,0 +1,161 @@
+/* SocketPayloadBroker.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef SOCKET_PAYLOAD_BROKER_HPP_
+#define SOCKET_PAYLOAD_BROKER_HPP_
+
+#pragma once
+
+#include "PayloadBroker.hpp"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ds {
+
+/**
+ * SocketPayloadBroker serves payloads to any number of subscribers over a
+ * Unix domain (stream) socket. Each payload is sent as a 32 bit little
+ * endian length followed by the payload bytes.
+ *
+ * on_batch_payload only takes a reference and wakes the server thread,
+ * which does all socket I/O with epoll and gathered writes. Each subscriber
+ * has a bounded send queue. When it fills up the subscriber either has
+ * frames skipped (oldest unsent first) or is disconnected, so a slow client
+ * never stalls the pipeline.
+ */
+class SocketPayloadBroker : public PayloadBroker {
+public:
+  /**
+   * What to do with a subscriber whose send queue is full.
+   *
+   * skip_frames: drop the oldest payload that hasn't started sending.
+   * drop_client: close the connection.
+   */
+  enum SlowPolicy { skip_frames, drop_client };
+
+  /**
+   * @param path filesystem path of the socket (replaced if it exists).
+   * @param max_queue max payloads queued per subscriber.
+   * @param policy what to do when a subscriber's queue is full.
+   */
+  SocketPayloadBroker(std::string path,
+                      size_t max_queue = 32,
+                      SlowPolicy policy = skip_frames);
+  /**
+   * Calls stop().
+   */
+  virtual ~SocketPayloadBroker();
+  /**
+   * Called by on_buffer when a NVDS_PAYLOAD_META is found on the buffer.
+   * Only queues the payload for the server thread.
+   * 
+   * Returns true on success, false on failure.
+   */
+  virtual bool on_batch_payload(Payload* payload);
+  /**
+   * Binds the socket and starts the server thread.
+   */
+  virtual void start();
+  /**
+   * Stops the server thread and closes every connection.
+   */
+  virtual void stop();
+  /**
+   * Whether the server thread is running.
+   */
+  virtual bool is_running() { return running_.load(); }
+  /**
+   * Number of currently connected subscribers.
+   */
+  virtual size_t subscriber_count() { return subscribers_count_.load(); }
+  /**
+   * Total payloads skipped for slow subscribers.
+   */
+  virtual uint64_t skipped() { return skipped_.load(); }
+  /**
+   * Total subscribers disconnected for being slow.
+   */
+  virtual uint64_t disconnected() { return disconnected_.load(); }
+  /**
+   * get the socket path
+   */
+  virtual std::string get_path() { return path_; }
+
+protected:
+  /**
+   * A connected client.
+   */
+  struct Subscriber {
+    int fd;
+    std::deque<Payload*> queue;
+    // bytes of the front payload (including its header) already sent
+    size_t offset;
+    bool want_write;
+  };
+
+  /**
+   * epoll loop, runs on worker_
+   */
+  virtual void server_func();
+  void accept_all();
+  void remove(int fd);
+  /**
+   * Queue a payload for a subscriber, applying the slow policy.
+   *
+   * Returns false if the subscriber was disconnected.
+   */
+  bool enqueue(Subscriber* sub, Payload* payload);
+  /**
+   * Write as much of the queue as the socket will take.
+   *
+   * Returns false if the subscriber was disconnected.
+   */
+  bool flush(Subscriber* sub);
+
+  std::string path_;
+  size_t max_queue_;
+  SlowPolicy policy_;
+  int listen_fd_;
+  int event_fd_;
+  int epoll_fd_;
+  std::thread worker_;
+  std::atomic<bool> running_;
+  // payloads handed over by on_batch_payload
+  std::mutex inbox_lock_;
+  std::vector<Payload*> inbox_;
+  // only touched by the server thread
+  std::unordered_map<int, Subscriber> subscribers_;
+  std::atomic<size_t> subscribers_count_;
+  std::atomic<uint64_t> skipped_;
+  std::atomic<uint64_t> disconnected_;
+};
+
+} // namespace ds
+
+#endif  // SOCKET_PAYLOAD_BROKER_HPP_
@@ -0,0 +1,195 @@
+/* StaticFilter.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef STATIC_FILTER_HPP_
+#define STATIC_FILTER_HPP_
+
+#pragma once
+
+#include "Trace.hpp"
+
+// DeepStream includes:
+
+#include "gstnvdsmeta.h"
+#include "nvbufsurface.h"
+
+#include <cstring>
+
+namespace ds {
+
+/**
+ * StaticFilter is the compile time (CRTP) counterpart of BaseFilter. The
+ * on_frame and on_object hooks are resolved statically, so they can be
+ * inlined into the loops below. Derive like this:
+ *
+ *   class MyFilter : public StaticFilter<MyFilter> {
+ *    public:
+ *     // metadata only, so don't map the buffer (frame will be nullptr)
+ *     static const bool NEEDS_SURFACE = false;
+ *     bool on_object(NvDsFrameMeta* f_meta,
+ *                    NvDsObjectMeta* o_meta,
+ *                    NvBufSurfaceParams* frame) { ... }
+ *   };
+ *
+ * and hide on_frame as well to skip the object loop.
+ */
+template <typename Derived>
+class StaticFilter {
+ public:
+  /**
+   * Whether on_buffer should map the buffer to get at the NvBufSurface.
+   * Hide this with false in Derived if only metadata is needed.
+   */
+  static const bool NEEDS_SURFACE = true;
+  /**
+   * Called on every NVMM batched buffer.
+   *
+   * Should be connected to a buffer callback or used in a filter plugin.
+   *
+   * return a GstFlowReturn (success, failure, etc.)
+   */
+  GstFlowReturn on_buffer(GstBuffer* buf);
+  /**
+   * Called on every frame by on_buffer. surf is nullptr if the buffer
+   * isn't mapped (see NEEDS_SURFACE).
+   *
+   * return true on success, false on failure
+   */
+  bool on_frame(NvBufSurface* surf, NvDsFrameMeta* frame_meta);
+  /**
+   * Called on every object meta by on_frame. frame is nullptr if the buffer
+   * isn't mapped (see NEEDS_SURFACE).
+   *
+   * return true on success, false on failure
+   */
+  bool on_object(NvDsFrameMeta* f_meta,
+                 NvDsObjectMeta* o_meta,
+                 NvBufSurfaceParams* frame) {
+    (void)f_meta;
+    (void)o_meta;
+    (void)frame;
+    return true;
+  }
+
+ protected:
+  Derived& derived() { return static_cast<Derived&>(*this); }
+};
+
+template <typename Derived>
+GstFlowReturn StaticFilter<Derived>::on_buffer(GstBuffer* buf) {
+  DS_TRACE_SCOPE("StaticFilter::on_buffer");
+  GST_LOG("on_buffer:got buffer");
+
+  GstMapInfo info;
+  NvBufSurface* surf = nullptr;
+  bool mapped = false;
+
+  if (Derived::NEEDS_SURFACE) {
+    // get the info about the buffer
+    memset(&info, 0, sizeof(info));
+    if (!gst_buffer_map(buf, &info, GST_MAP_READ)) {
+      GST_ERROR("on_buffer:failed to get info from buffer");
+      return GST_FLOW_ERROR;
+    }
+    mapped = true;
+    // get the surface data
+    surf = (NvBufSurface*)info.data;
+  }
+
+  // get the batch metadata from the buffer
+  NvDsBatchMeta* batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  if (batch_meta == nullptr) {
+    GST_WARNING("on_buffer:no metadata attached to buffer");
+    if (mapped) {
+      gst_buffer_unmap(buf, &info);
+    }
+    return GST_FLOW_OK;
+  }
+  // we need to lock the metadata
+  DS_TRACE_BEGIN("meta_lock.wait");
+  nvds_acquire_meta_lock(batch_meta);
+  DS_TRACE_END("meta_lock.wait");
+  DS_TRACE_BEGIN("meta_lock.held");
+
+  GST_LOG("on_buffer:got batch with %d frames.",
+          batch_meta->num_frames_in_batch);
+
+  GstFlowReturn ret = GST_FLOW_OK;
+  // for frame_meta in batch_meta
+  for (auto l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
+       l_frame = l_frame->next) {
+    auto frame_meta = (NvDsFrameMeta*)l_frame->data;
+    if (frame_meta == nullptr) {
+      GST_ERROR("on_buffer:frame_meta is NULL");
+      ret = GST_FLOW_ERROR;
+      break;
+    }
+
+    if (!derived().on_frame(surf, frame_meta)) {
+      ret = GST_FLOW_ERROR;
+      break;
+    }
+  }
+  // release lock (and mapping) before return
+  DS_TRACE_END("meta_lock.held");
+  nvds_release_meta_lock(batch_meta);
+  if (mapped) {
+    gst_buffer_unmap(buf, &info);
+  }
+  return ret;
+}
+
+template <typename Derived>
+bool StaticFilter<Derived>::on_frame(NvBufSurface* surf,
+                                     NvDsFrameMeta* frame_meta) {
+#ifdef VERBOSE
+  GST_LOG("on_frame:processing frame %d", frame_meta->frame_num);
+#endif
+
+  // if there are no detected objects in the frame, skip it
+  if (!frame_meta->num_obj_meta) {
+    return true;
+  }
+
+  NvBufSurfaceParams* frame = surf ?
+    &surf->surfaceList[frame_meta->batch_id] : nullptr;
+
+  // for obj_meta in frame meta
+  for (auto l_obj = frame_meta->obj_meta_list; l_obj != nullptr;
+       l_obj = l_obj->next) {
+    auto obj_meta = (NvDsObjectMeta*)l_obj->data;
+    if (obj_meta == nullptr) {
+      GST_ERROR("on_frame:obj_meta is NULL");
+      return false;
+    }
+
+    if (!derived().on_object(frame_meta, obj_meta, frame)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace ds
+
+#endif  // STATIC_FILTER_HPP_
@@ -0,0 +1,84 @@
+/* Subscription.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef SUBSCRIPTION_HPP_
+#define SUBSCRIPTION_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstdint>
+#include <set>
+
+namespace ds {
+
+/**
+ * Subscription describes the part of each Batch a consumer cares about.
+ *
+ * ProtoPayloadFilter evaluates subscriptions once per Batch, before
+ * serialization, and attaches a separate, pre-filtered, Payload for each.
+ * A PayloadBroker subscribed to one only ever sees those payloads, and
+ * nothing at all for a Batch where nothing matched.
+ */
+struct Subscription {
+  /**
+   * Only keep frames from these sources (empty for all sources).
+   */
+  std::set<uint32_t> source_ids;
+  /**
+   * Only keep frames with a sum_danger of at least this.
+   */
+  float min_sum_danger = 0.0f;
+  /**
+   * Only keep people with is_danger set, and frames with any such people.
+   */
+  bool danger_only = false;
+
+  /**
+   * True if the subscription keeps everything.
+   */
+  bool is_passthrough() const;
+  /**
+   * True if the frame passes the frame level filters (source_ids,
+   * min_sum_danger and, if danger_only, having any dangerous people).
+   */
+  bool matches(const distanceproto::Frame& frame) const;
+  /**
+   * Copy the matching parts of `batch` into `out` (which is cleared first).
+   *
+   * Returns true if anything matched, false if `out` has no frames.
+   */
+  bool apply(const distanceproto::Batch& batch,
+             distanceproto::Batch* out) const;
+
+  bool operator==(const Subscription& other) const {
+    return source_ids == other.source_ids &&
+           min_sum_danger == other.min_sum_danger &&
+           danger_only == other.danger_only;
+  }
+};
+
+} // namespace ds
+
+#endif  // SUBSCRIPTION_HPP_
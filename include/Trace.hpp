@@ -0,0 +1,203 @@
+/* Trace.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Trace points, for finding out where the time goes on the hot paths.
+ *
+ * They compile to nothing unless DS_TRACING is defined (meson configure
+ * -Dtracing=true), in which case each records into a per thread ring
+ * buffer (tens of nanoseconds, no locks) and ds::trace::dump() writes
+ * whatever the rings hold as Chrome trace event JSON, which
+ * chrome://tracing and https://ui.perfetto.dev open.
+ *
+ * Names must be string literals (only the pointer is recorded).
+ *
+ * DS_TRACE_SCOPE(name): the rest of the enclosing scope.
+ * DS_TRACE_BEGIN(name) / DS_TRACE_END(name): a span that isn't a scope.
+ *  They must nest properly on a thread.
+ * DS_TRACE_INSTANT(name): a point in time.
+ * DS_TRACE_COUNTER(name, value): a value over time (eg. a queue depth).
+ */
+#ifdef DS_TRACING
+#define DS_TRACE_CONCAT_(a, b) a ## b
+#define DS_TRACE_CONCAT(a, b) DS_TRACE_CONCAT_(a, b)
+#define DS_TRACE_SCOPE(name) \
+  ::ds::trace::Scope DS_TRACE_CONCAT(ds_trace_scope_, __LINE__)(name)
+#define DS_TRACE_BEGIN(name) ::ds::trace::record(name, 'B', 0)
+#define DS_TRACE_END(name) ::ds::trace::record(name, 'E', 0)
+#define DS_TRACE_INSTANT(name) ::ds::trace::record(name, 'i', 0)
+#define DS_TRACE_COUNTER(name, value) \
+  ::ds::trace::record(name, 'C', (uint64_t)(value))
+#else
+#define DS_TRACE_SCOPE(name) ((void)0)
+#define DS_TRACE_BEGIN(name) ((void)0)
+#define DS_TRACE_END(name) ((void)0)
+#define DS_TRACE_INSTANT(name) ((void)0)
+#define DS_TRACE_COUNTER(name, value) ((void)0)
+#endif
+
+namespace ds {
+namespace trace {
+
+/**
+ * A raw timestamp: the TSC on x86, the virtual counter on aarch64, and
+ * steady_clock nanoseconds elsewhere. dump() converts them to time.
+ */
+inline uint64_t
+now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * One recorded event. The fields are relaxed atomics so dump() may read a
+ * ring while its thread writes it.
+ */
+struct Event {
+  std::atomic<const char*> name;
+  std::atomic<uint64_t> ts;
+  // duration in ticks for 'X', the value for 'C'
+  std::atomic<uint64_t> arg;
+  std::atomic<char> phase;
+};
+
+/**
+ * The events of one thread. Only that thread writes it; once full, the
+ * oldest events are overwritten. dump() copies it without stopping the
+ * writer, so it only trusts the newest CAPACITY - 1 events.
+ */
+class Ring {
+public:
+  /**
+   * Events kept per thread (a power of two).
+   */
+  static const size_t CAPACITY = 1 << 14;
+
+  void push(const char* name, char phase, uint64_t ts, uint64_t arg) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    Event& event = events_[head & (CAPACITY - 1)];
+    event.name.store(name, std::memory_order_relaxed);
+    event.ts.store(ts, std::memory_order_relaxed);
+    event.arg.store(arg, std::memory_order_relaxed);
+    event.phase.store(phase, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+private:
+  friend class Registry;
+
+  Event events_[CAPACITY];
+  // events ever pushed
+  std::atomic<uint64_t> head_{0};
+  // events before this were cleared
+  std::atomic<uint64_t> tail_{0};
+  // the kernel thread id, for the trace
+  uint32_t tid_ = 0;
+};
+
+// the calling thread's Ring, once it has one
+extern thread_local Ring* current_ring;
+/**
+ * Get a Ring for the calling thread (the slow path of thread_ring).
+ */
+Ring* register_thread();
+/**
+ * The calling thread's Ring (registered on first use).
+ */
+inline Ring*
+thread_ring() {
+  Ring* ring = current_ring;
+  return ring ? ring : register_thread();
+}
+
+inline void
+record(const char* name, char phase, uint64_t arg) {
+  thread_ring()->push(name, phase, now(), arg);
+}
+
+/**
+ * Records the time from construction to destruction (see DS_TRACE_SCOPE).
+ */
+class Scope {
+public:
+  explicit Scope(const char* name) : name_(name), start_(now()) {}
+  ~Scope() {
+    uint64_t end = now();
+    thread_ring()->push(name_, 'X', start_, end - start_);
+  }
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+private:
+  const char* name_;
+  uint64_t start_;
+};
+
+/**
+ * True if the library was built with DS_TRACING.
+ */
+bool enabled();
+/**
+ * Write every thread's events as Chrome trace event JSON. May be called at
+ * any time, from any thread.
+ */
+void write_json(std::ostream& out);
+/**
+ * write_json() to `filename`.
+ *
+ * Returns true on success, false on failure.
+ */
+bool dump(const std::string& filename);
+/**
+ * Forget everything recorded so far.
+ */
+void clear();
+
+} // namespace trace
+} // namespace ds
+
+#endif  // TRACE_HPP_
@@ -0,0 +1,60 @@
+/* UserMetaHandler.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef USER_META_HANDLER_HPP_
+#define USER_META_HANDLER_HPP_
+
+#pragma once
+
+#include "gstnvdsmeta.h"
+
+#include <vector>
+
+namespace ds {
+
+/**
+ * UserMetaHandler is implemented by anything that consumes batch level user
+ * metadata, so a MetaDispatcher can feed several of them
+ * from a single pass over the user meta list.
+ */
+class UserMetaHandler {
+public:
+  virtual ~UserMetaHandler() = default;
+  /**
+   * The types of batch level user metadata this handles. Called once, when
+   * the handler is registered, so they may be expensive to resolve.
+   */
+  virtual std::vector<NvDsMetaType> user_meta_types() = 0;
+  /**
+   * Called with each batch level user meta of one of user_meta_types(). The
+   * meta lock is already held, so don't take it again.
+   * 
+   * Returns true on success, false on failure.
+   */
+  virtual bool on_user_meta(NvDsBatchMeta* batch_meta,
+                            NvDsUserMeta* user_meta) = 0;
+};
+
+} // namespace ds
+
+#endif  // USER_META_HANDLER_HPP_
@@ -0,0 +1,104 @@
+/* ViolationEventFilter.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef VIOLATION_EVENT_FILTER_HPP_
+#define VIOLATION_EVENT_FILTER_HPP_
+
+#pragma once
+
+#include "ProtoPayloadFilter.hpp"
+#include "ViolationTracker.hpp"
+
+#include <string>
+#include <vector>
+
+namespace ds {
+
+/**
+ * ViolationEventFilter attaches violation start/update/end events (see
+ * ViolationTracker) instead of the full state of every frame. Nothing is
+ * attached for a batch where nothing happened, which is most of them.
+ *
+ * Events are attached as NVDS_PAYLOAD_META tagged with EVENTS_SUBSCRIPTION,
+ * so a PayloadBroker gets them with
+ * set_subscription(ViolationEventFilter::EVENTS_SUBSCRIPTION). Decode them
+ * with ViolationTracker::decode.
+ *
+ * Events depend on the frames before, so they are generated in order, on
+ * the streaming thread. Call on_eos() at EOS to end violations still
+ * ongoing. There is no Batch to filter, so Subscriptions are refused.
+ */
+class ViolationEventFilter : public ProtoPayloadFilter {
+public:
+  /**
+   * The subscription id event Payloads are tagged with.
+   */
+  static const uint32_t EVENTS_SUBSCRIPTION = 0xFFFFFFFF;
+
+  ViolationEventFilter();
+  virtual ~ViolationEventFilter() = default;
+  /**
+   * Thresholds, timeouts and limits. Set before the first buffer.
+   */
+  ViolationTracker tracker;
+  /**
+   * This implementation feeds the Batch to the tracker and attaches any
+   * events it comes up with.
+   */
+  virtual bool on_batch_meta(
+    NvDsBatchMeta* batch_meta, distanceproto::Batch* batch);
+  /**
+   * Feeds the materialized Batch to on_batch_meta (whatever the encoding).
+   */
+  virtual bool on_packed_meta(NvDsBatchMeta* batch_meta, PackedBatch* batch) {
+    return this->on_batch_meta(batch_meta, batch->materialize());
+  }
+  /**
+   * Groups aren't events, so this attaches nothing.
+   */
+  virtual bool on_groups_meta(NvDsBatchMeta*, BatchGroups*) { return true; }
+  /**
+   * Refused (events aren't filtered). Returns NO_SUBSCRIPTION.
+   */
+  virtual uint32_t subscribe(const Subscription& subscription);
+  /**
+   * Ends every ongoing violation (see ViolationTracker::flush).
+   *
+   * Returns a buffer with the end events, or nullptr if there are none.
+   */
+  virtual GstBuffer* on_eos();
+
+protected:
+  /**
+   * Encode events_ into a pooled Payload tagged with EVENTS_SUBSCRIPTION.
+   */
+  Payload* make_events_payload();
+
+  // reused for each batch
+  std::vector<ViolationEvent> events_;
+  std::string scratch_;
+};
+
+} // namespace ds
+
+#endif  // VIOLATION_EVENT_FILTER_HPP_
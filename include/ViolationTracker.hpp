@@ -0,0 +1,234 @@
+/* ViolationTracker.hpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef VIOLATION_TRACKER_HPP_
+#define VIOLATION_TRACKER_HPP_
+
+#pragma once
+
+#include "distance.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ds {
+
+/**
+ * Something that happened to one tracked person's violation.
+ *
+ * Times are frame pts (nanoseconds). The box and danger_val are from the
+ * latest sighting.
+ */
+struct ViolationEvent {
+  /**
+   * start: the person has been in violation for min_duration (start_pts is
+   *  when it began).
+   * update: still in violation (every update_interval).
+   * end: the violation is over (pts is when it ended, so the duration is
+   *  pts - start_pts).
+   */
+  enum Kind : uint8_t { start, update, end };
+
+  Kind kind;
+  uint32_t source_id;
+  uint64_t object_id;
+  uint64_t start_pts;
+  uint64_t pts;
+  float danger_val;
+  // highest danger_val since start_pts
+  float peak_danger;
+  float left;
+  float top;
+  float width;
+  float height;
+};
+
+/**
+ * ViolationTracker turns the per frame danger of tracked people into
+ * violation start/update/end events, keyed on (source_id, object_id).
+ *
+ * A person enters violation when danger_val stays at or above enter_danger
+ * for min_duration and leaves it when danger_val stays below exit_danger
+ * for min_duration, so flicker around the thresholds doesn't turn into a
+ * storm of events. Only people who are (or are about to be) in violation
+ * are remembered, at most max_tracks per source.
+ *
+ * Events encode to a compact message (see encode) which starts with a byte
+ * that can't begin a serialized Batch or a DeltaEncoder message:
+ *
+ * 'V' | varint count | event...
+ * event: kind byte | varint source_id | varint object_id | varint start_pts
+ *  | varint (pts - start_pts) | fixed32 danger_val | fixed32 peak_danger
+ *  | fixed32 left | fixed32 top | fixed32 width | fixed32 height
+ */
+class ViolationTracker {
+public:
+  /**
+   * First byte of an encoded message.
+   */
+  static const uint8_t MAGIC = 'V';
+
+  /**
+   * One tracked person in a frame.
+   */
+  struct Sighting {
+    uint64_t object_id;
+    float danger_val;
+    float left;
+    float top;
+    float width;
+    float height;
+  };
+
+  ViolationTracker();
+  virtual ~ViolationTracker() = default;
+  /**
+   * danger_val at which a violation begins (default: 1.0, which is when
+   * DistanceFilter sets is_danger with the default
+   * SourceConfig::danger_threshold). The tracker doesn't see the config, so
+   * if danger_threshold changes, change this (and exit_danger) with it.
+   */
+  float enter_danger;
+  /**
+   * danger_val below which a violation ends (default: 0.8). Keep it below
+   * enter_danger.
+   */
+  float exit_danger;
+  /**
+   * How long (ns) a violation must last to be reported, and how long it
+   * must be over to end (default: 0.5s).
+   */
+  uint64_t min_duration;
+  /**
+   * Send an update this often (ns) during a violation (default: 5s, 0 for
+   * never).
+   */
+  uint64_t update_interval;
+  /**
+   * End a violation if the person isn't seen for this long (ns), eg. because
+   * they left or the tracker lost them (default: 2s). Checked on every
+   * update, so a source that stops sending frames is expired by the others.
+   */
+  uint64_t idle_timeout;
+  /**
+   * The most people to remember per source. When full, the one seen least
+   * recently is ended and forgotten (default: 256).
+   */
+  size_t max_tracks;
+
+  /**
+   * Feed one frame of sightings for a source. Frames of a source must come
+   * in pts order. Anything that happened is appended to `events`.
+   */
+  void update(uint32_t source_id, uint64_t pts,
+              const Sighting* sightings, size_t count,
+              std::vector<ViolationEvent>* events);
+  /**
+   * Feed every frame in `batch`, keyed on each Person's uid, which
+   * DistanceFilter sets to the tracker's object_id (truncated to 32 bits,
+   * so that is all an event's object_id has). People with a uid of 0 aren't
+   * tracked, so they are left out. Afterwards every source is expired at
+   * the latest pts in the batch.
+   */
+  void update(const distanceproto::Batch& batch,
+              std::vector<ViolationEvent>* events);
+  /**
+   * End and forget anybody, in any source, not seen for idle_timeout before
+   * `pts` (eg. because their source stopped sending frames).
+   */
+  void expire(uint64_t pts, std::vector<ViolationEvent>* events);
+  /**
+   * End every ongoing violation and forget everyone (eg. at end of stream).
+   */
+  void flush(std::vector<ViolationEvent>* events);
+  /**
+   * The number of people currently remembered (across all sources).
+   */
+  size_t num_tracks() const;
+
+  /**
+   * Encode `events` as a message into `out` (cleared first).
+   */
+  static void encode(const std::vector<ViolationEvent>& events,
+                     std::string* out);
+  /**
+   * Decode a message from encode into `events` (cleared first).
+   *
+   * Returns true on success, false if the message is malformed.
+   */
+  static bool decode(const uint8_t* data, size_t size,
+                     std::vector<ViolationEvent>* events);
+  /**
+   * Returns true if `data` looks like an encoded message.
+   */
+  static bool is_event_message(const uint8_t* data, size_t size);
+
+protected:
+  enum State { starting, active, ending };
+
+  struct Track {
+    State state;
+    // when the current state began
+    uint64_t since;
+    // when the violation began
+    uint64_t start_pts;
+    uint64_t last_seen;
+    uint64_t last_report;
+    float peak_danger;
+    Sighting latest;
+  };
+
+  typedef std::unordered_map<uint64_t, Track> Tracks;
+
+  /**
+   * Make an event for a track.
+   */
+  static ViolationEvent make_event(ViolationEvent::Kind kind,
+                                   uint32_t source_id,
+                                   const Track& track,
+                                   uint64_t pts);
+  /**
+   * Forget the least recently seen track of a source, ending it first if
+   * it was reported.
+   */
+  void evict(uint32_t source_id, Tracks* tracks,
+             std::vector<ViolationEvent>* events);
+  /**
+   * Forget the tracks of a source not seen for idle_timeout before `pts`,
+   * ending them first if they were reported.
+   */
+  void expire_source(uint32_t source_id, Tracks* tracks, uint64_t pts,
+                     std::vector<ViolationEvent>* events);
+
+  // tracks for each source
+  std::unordered_map<uint32_t, Tracks> sources_;
+  // reused by update(batch, ...)
+  std::vector<Sighting> sightings_;
+};
+
+} // namespace ds
+
+#endif  // VIOLATION_TRACKER_HPP_
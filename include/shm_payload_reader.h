@@ -0,0 +1,51 @@
+/* shm_payload_reader.h
+ *
+ * C interface to ds::ShmPayloadReader (libdistance-shm-reader).
+ * See ShmPayloadReader.hpp for details.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef SHM_PAYLOAD_READER_H_
+#define SHM_PAYLOAD_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ds_shm_reader ds_shm_reader;
+
+/* read status, same values as ds::ShmPayloadReader::Status */
+#define DS_SHM_OK 0
+#define DS_SHM_AGAIN 1
+#define DS_SHM_GONE 2
+/* ds_shm_reader_read only: buf is too small, *size is the size needed */
+#define DS_SHM_TOO_SMALL 3
+#define DS_SHM_ERROR -1
+
+/* returns NULL if the ring doesn't exist (yet) */
+ds_shm_reader* ds_shm_reader_open(const char* name);
+void ds_shm_reader_close(ds_shm_reader* reader);
+int ds_shm_reader_writer_closed(const ds_shm_reader* reader);
+uint64_t ds_shm_reader_latest_seq(const ds_shm_reader* reader);
+uint64_t ds_shm_reader_oldest_seq(const ds_shm_reader* reader);
+uint64_t ds_shm_reader_wait_for_next(const ds_shm_reader* reader,
+                                     uint64_t last_seq, int64_t timeout_ms);
+/* zero copy: peek, use *data, then validate (non-zero if still valid) */
+int ds_shm_reader_peek(const ds_shm_reader* reader, uint64_t seq,
+                       const uint8_t** data, size_t* size, uint64_t* token);
+int ds_shm_reader_validate(const ds_shm_reader* reader, uint64_t seq,
+                           uint64_t token);
+/* copy into buf, *size is set to the payload size (DS_SHM_TOO_SMALL and
+ * nothing copied if that's more than capacity) */
+int ds_shm_reader_read(const ds_shm_reader* reader, uint64_t seq,
+                       uint8_t* buf, size_t capacity, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SHM_PAYLOAD_READER_H_ */
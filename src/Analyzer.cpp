@@ -0,0 +1,289 @@
+/* Analyzer.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Analyzer.hpp"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+static const float DEFAULT_FILTER_HEIGHT_DIFF = 0.25f;
+static const float DEFAULT_DANGER_THRESHOLD = 1.0f;
+static const unsigned DEFAULT_NUM_THREADS = 0;
+static const size_t DEFAULT_CHUNK_SIZE = 1024;
+static const double DEFAULT_FPS = 30.0;
+// batches a scoring thread takes at a time
+static const size_t SCORE_GRAIN = 16;
+
+Analyzer::Analyzer() : frames_(0) {
+  this->filter_height_diff = DEFAULT_FILTER_HEIGHT_DIFF;
+  this->danger_threshold = DEFAULT_DANGER_THRESHOLD;
+  this->format = FileMetaBroker::proto;
+  this->num_threads = DEFAULT_NUM_THREADS;
+  this->chunk_size = DEFAULT_CHUNK_SIZE;
+  this->fps = DEFAULT_FPS;
+  this->min_confidence = -INFINITY;
+}
+
+void
+Analyzer::score(dp::Frame* frame, std::vector<Box>* boxes) const {
+  boxes->clear();
+  for (const auto& person : frame->people()) {
+    const dp::BBox& bbox = person.bbox();
+    Box box = {bbox.left(), bbox.top(), bbox.width(), bbox.height()};
+    boxes->push_back(box);
+  }
+  float frame_danger = 0.0f;
+  for (size_t i = 0; i < boxes->size(); i++) {
+    float person_danger = how_dangerous(*boxes, i, filter_height_diff);
+    auto person = frame->mutable_people(i);
+    person->set_danger_val(person_danger);
+    person->set_is_danger(person_danger >= danger_threshold);
+    frame_danger += person_danger;
+  }
+  frame->set_sum_danger(frame_danger);
+}
+
+void
+Analyzer::score_batches(dp::Batch* batches, size_t count,
+                        unsigned threads) const {
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    std::vector<Box> boxes;
+    for (;;) {
+      size_t first = next.fetch_add(SCORE_GRAIN);
+      if (first >= count) {
+        return;
+      }
+      size_t last = std::min(first + SCORE_GRAIN, count);
+      for (size_t b = first; b < last; b++) {
+        for (auto& frame : *batches[b].mutable_frames()) {
+          score(&frame, &boxes);
+        }
+      }
+    }
+  };
+  // no point waking threads that would find nothing to do
+  threads = std::min<size_t>(threads, (count + SCORE_GRAIN - 1) / SCORE_GRAIN);
+  std::vector<std::thread> helpers;
+  for (unsigned t = 1; t < threads; t++) {
+    helpers.emplace_back(work);
+  }
+  work();
+  for (auto& helper : helpers) {
+    helper.join();
+  }
+}
+
+std::unique_ptr<ReplaySource>
+Analyzer::open_source(const std::string& input, uint32_t source_id) const {
+  auto dot = input.rfind('.');
+  std::string extension = dot == std::string::npos ? "" : input.substr(dot);
+  if (extension == ".coded" || extension == ".packed") {
+    auto source = new FileReplaySource(input);
+    if (source->is_open()) {
+      return std::unique_ptr<ReplaySource>(source);
+    }
+    delete source;
+  } else {
+    auto source = new MotReplaySource(input, source_id, fps, min_confidence);
+    if (source->is_open()) {
+      return std::unique_ptr<ReplaySource>(source);
+    }
+    delete source;
+  }
+  return nullptr;
+}
+
+std::unique_ptr<BatchWriter>
+Analyzer::make_writer() const {
+  switch (format) {
+    case FileMetaBroker::proto:
+      return std::unique_ptr<BatchWriter>(new CodedBatchWriter(false));
+    case FileMetaBroker::packed:
+      return std::unique_ptr<BatchWriter>(new CodedBatchWriter(true));
+    case FileMetaBroker::csv:
+      return std::unique_ptr<BatchWriter>(new CsvBatchWriter());
+#ifdef DS_SQLITE
+    case FileMetaBroker::sqlite:
+      return std::unique_ptr<BatchWriter>(new SqliteBatchWriter(true));
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+std::string
+Analyzer::output_filename(const std::string& input,
+                          const std::string& output_dir) const {
+  auto slash = input.rfind('/');
+  std::string name = slash == std::string::npos ?
+    input : input.substr(slash + 1);
+  auto dot = name.rfind('.');
+  if (dot != std::string::npos && dot > 0) {
+    name.resize(dot);
+  }
+  // the same as FileMetaBroker::get_filename
+  switch (format) {
+    case FileMetaBroker::csv:
+      return output_dir + "/" + name + ".csv";
+    case FileMetaBroker::packed:
+      return output_dir + "/" + name + ".packed";
+#ifdef DS_SQLITE
+    case FileMetaBroker::sqlite:
+      return output_dir + "/" + name + ".sqlite";
+#endif
+    default:
+      return output_dir + "/" + name + ".coded";
+  }
+}
+
+/**
+ * True if a and b are the same file.
+ */
+static bool
+same_file(const std::string& a, const std::string& b) {
+  struct stat sa, sb;
+  return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 &&
+    sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+std::vector<std::string>
+Analyzer::find_clashes(const std::vector<std::string>& inputs,
+                       const std::string& output_dir) const {
+  // inputs by file, so differently spelled paths still match
+  std::set<std::pair<dev_t, ino_t>> files;
+  for (const auto& input : inputs) {
+    struct stat st;
+    if (stat(input.c_str(), &st) == 0) {
+      files.emplace(st.st_dev, st.st_ino);
+    }
+  }
+  std::vector<std::string> outputs;
+  std::unordered_map<std::string, size_t> count;
+  for (const auto& input : inputs) {
+    outputs.push_back(output_filename(input, output_dir));
+    count[outputs.back()]++;
+  }
+  std::vector<std::string> clashes;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    // its own input is caught by analyze_file
+    bool overwrites = stat(outputs[i].c_str(), &st) == 0 &&
+      files.count(std::make_pair(st.st_dev, st.st_ino)) &&
+      !same_file(inputs[i], outputs[i]);
+    if (count[outputs[i]] > 1 || overwrites) {
+      clashes.push_back(inputs[i]);
+    }
+  }
+  return clashes;
+}
+
+bool
+Analyzer::analyze_file(const std::string& input, const std::string& output,
+                       uint32_t source_id, unsigned threads) {
+  if (same_file(input, output)) {
+    // truncating the output would destroy the input
+    return false;
+  }
+  auto source = open_source(input, source_id);
+  auto writer = make_writer();
+  if (!source || !writer || !writer->open(output)) {
+    return false;
+  }
+  // Batches are reused from chunk to chunk, so their memory is too
+  std::vector<dp::Batch> chunk(std::max<size_t>(chunk_size, 1));
+  bool more = true;
+  bool ok = true;
+  while (more && ok) {
+    size_t count = 0;
+    while (count < chunk.size() && (more = source->next(&chunk[count]))) {
+      count++;
+    }
+    score_batches(chunk.data(), count, std::max(threads, 1u));
+    uint64_t frames = 0;
+    for (size_t b = 0; b < count && ok; b++) {
+      ok = writer->write(chunk[b]);
+      frames += chunk[b].frames_size();
+    }
+    // a transaction per chunk (sqlite)
+    ok = ok && writer->flush();
+    frames_ += frames;
+  }
+  return writer->close() && ok;
+}
+
+bool
+Analyzer::run(const std::vector<std::string>& inputs,
+              const std::string& output_dir,
+              std::vector<std::string>* failed) {
+  // threads writing the same file would make a mess of it
+  auto clashes = find_clashes(inputs, output_dir);
+  if (!clashes.empty()) {
+    if (failed) {
+      failed->insert(failed->end(), clashes.begin(), clashes.end());
+    }
+    return false;
+  }
+  unsigned threads = num_threads ?
+    num_threads : std::max(std::thread::hardware_concurrency(), 1u);
+  // a thread per file, and any threads left over help score within files
+  size_t workers = std::min<size_t>(threads, inputs.size());
+  unsigned threads_per_file = workers ? threads / workers : 1;
+  std::atomic<size_t> next(0);
+  std::mutex lock;
+  bool ok = true;
+  auto work = [&]() {
+    for (size_t i = next++; i < inputs.size(); i = next++) {
+      if (analyze_file(inputs[i], output_filename(inputs[i], output_dir),
+                       (uint32_t) i, threads_per_file)) {
+        continue;
+      }
+      std::lock_guard<std::mutex> guard(lock);
+      ok = false;
+      if (failed) {
+        failed->push_back(inputs[i]);
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < workers; t++) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  return ok;
+}
+
+} // namespace ds
@@ -26,81 +26,11 @@
 namespace ds {
 
 GstFlowReturn BaseFilter::on_buffer(GstBuffer* buf) {
-  GST_LOG("on_buffer:got buffer");
-
-  GstMapInfo info;
-  NvBufSurface* surf = nullptr;
-  NvDsBatchMeta* batch_meta = nullptr;
-  NvDsFrameMeta* frame_meta = nullptr;
-  NvDsFrameMetaList* l_frame = nullptr;
-
-  // get the info about the buffer
-  memset(&info, 0, sizeof(info));
-  if (!gst_buffer_map(buf, &info, GST_MAP_READ)) {
-    GST_ERROR("on_buffer:failed to get info from buffer");
-    return GST_FLOW_ERROR;
-  }
-
-  // get the surface data
-  surf = (NvBufSurface*)info.data;
-
-  // get the batch metadata from the buffer
-  batch_meta = gst_buffer_get_nvds_batch_meta(buf);
-  // we need to lock the metadata
-  nvds_acquire_meta_lock(batch_meta);
-
-  GST_LOG("on_buffer:got batch with %d frames.",
-          batch_meta->num_frames_in_batch);
-
-  // for frame_meta in batch_meta
-  for (l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
-       l_frame = l_frame->next) {
-    frame_meta = (NvDsFrameMeta*)l_frame->data;
-    if (frame_meta == nullptr) {
-      GST_ERROR("on_buffer:frame_meta is NULL");
-      // release lock before return
-      nvds_release_meta_lock(batch_meta);
-      return GST_FLOW_ERROR;
-    }
-
-    if (!on_frame(surf, frame_meta)) {
-      // release lock before return
-      nvds_release_meta_lock(batch_meta);
-      return GST_FLOW_ERROR;
-    };
-  }
-  // release lock before return
-  nvds_release_meta_lock(batch_meta);
-  return GST_FLOW_OK;
+  return StaticFilter<BaseFilter>::on_buffer(buf);
 }
 
 bool BaseFilter::on_frame(NvBufSurface* surf, NvDsFrameMeta* frame_meta) {
-#ifdef VERBOSE
-  GST_LOG("on_frame:processing frame %d", frame_meta->frame_num);
-#endif
-
-  // if there are no detected objects in the frame, skip it
-  if (!frame_meta->num_obj_meta) {
-    return true;
-  }
-
-  NvBufSurfaceParams* frame = &surf->surfaceList[frame_meta->batch_id];
-  NvDsObjectMeta* obj_meta = nullptr;
-  NvDsObjectMetaList* l_obj = nullptr;
-
-  // for obj_meta in frame meta
-  for (l_obj = frame_meta->obj_meta_list; l_obj != nullptr; l_obj = l_obj->next) {
-    obj_meta = (NvDsObjectMeta*)l_obj->data;
-    if (obj_meta == nullptr) {
-      GST_ERROR("on_frame:obj_meta is NULL");
-      return false;
-    }
-
-    if (!on_object(frame_meta, obj_meta, frame)) {
-      return false;
-    }
-  }
-  return true;
+  return StaticFilter<BaseFilter>::on_frame(surf, frame_meta);
 }
 
 bool BaseFilter::on_object(NvDsFrameMeta* f_meta,
@@ -114,4 +44,10 @@ bool BaseFilter::on_object(NvDsFrameMeta* f_meta,
   return true;
 }
 
+const ObjectSnapshot& BaseFilter::snapshot(NvDsBatchMeta* batch_meta,
+                                           int class_id) {
+  snapshot_.build(batch_meta, class_id);
+  return snapshot_;
+}
+
 } // namespace ds
\ No newline at end of file
@@ -0,0 +1,546 @@
+/* BatchSerializer.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "BatchSerializer.hpp"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/coded_stream.h>
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace dp = distanceproto;
+namespace gp = google::protobuf;
+
+using pbio = gp::io::CodedOutputStream;
+
+namespace ds {
+
+namespace {
+
+// wire types
+const uint32_t WIRE_VARINT = 0;
+const uint32_t WIRE_FIXED64 = 1;
+const uint32_t WIRE_LENGTH = 2;
+const uint32_t WIRE_FIXED32 = 5;
+
+/**
+ * Encoding of a (proto3, non packed) scalar field by C++ type, as the
+ * generated accessors return them.
+ */
+template <typename T, typename Enable = void>
+struct Scalar;
+
+template <>
+struct Scalar<bool> {
+  static const uint32_t WIRE = WIRE_VARINT;
+  static gp::FieldDescriptor::Type type() {
+    return gp::FieldDescriptor::TYPE_BOOL;
+  }
+  static bool is_zero(bool v) { return !v; }
+  static size_t size(bool) { return 1; }
+  static uint8_t* write(bool v, uint8_t* t) { *t++ = v ? 1 : 0; return t; }
+};
+
+template <>
+struct Scalar<float> {
+  static const uint32_t WIRE = WIRE_FIXED32;
+  static gp::FieldDescriptor::Type type() {
+    return gp::FieldDescriptor::TYPE_FLOAT;
+  }
+  // like the generated code, compare bits, so -0.0 is written
+  static bool is_zero(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits == 0;
+  }
+  static size_t size(float) { return 4; }
+  static uint8_t* write(float v, uint8_t* t) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return pbio::WriteLittleEndian32ToArray(bits, t);
+  }
+};
+
+template <>
+struct Scalar<double> {
+  static const uint32_t WIRE = WIRE_FIXED64;
+  static gp::FieldDescriptor::Type type() {
+    return gp::FieldDescriptor::TYPE_DOUBLE;
+  }
+  static bool is_zero(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits == 0;
+  }
+  static size_t size(double) { return 8; }
+  static uint8_t* write(double v, uint8_t* t) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return pbio::WriteLittleEndian64ToArray(bits, t);
+  }
+};
+
+// int32, uint32, int64 and uint64 (all plain varints)
+template <typename T>
+struct Scalar<T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+  static const uint32_t WIRE = WIRE_VARINT;
+  static const bool SIGNED = std::is_signed<T>::value;
+  static const bool WIDE = sizeof(T) == 8;
+  static gp::FieldDescriptor::Type type() {
+    if (WIDE) {
+      return SIGNED ? gp::FieldDescriptor::TYPE_INT64 :
+                      gp::FieldDescriptor::TYPE_UINT64;
+    }
+    return SIGNED ? gp::FieldDescriptor::TYPE_INT32 :
+                    gp::FieldDescriptor::TYPE_UINT32;
+  }
+  static bool is_zero(T v) { return v == 0; }
+  static size_t size(T v) {
+    if (WIDE) {
+      return pbio::VarintSize64((uint64_t) v);
+    }
+    // negative int32s are sign extended to 10 bytes
+    return SIGNED && v < 0 ? 10 : pbio::VarintSize32((uint32_t) v);
+  }
+  static uint8_t* write(T v, uint8_t* t) {
+    if (WIDE || (SIGNED && v < 0)) {
+      return pbio::WriteVarint64ToArray((uint64_t)(int64_t) v, t);
+    }
+    return pbio::WriteVarint32ToArray((uint32_t) v, t);
+  }
+};
+
+/**
+ * A field we know about, ready to write.
+ */
+struct Field {
+  int id;
+  int number;
+  uint32_t tag;
+  size_t tag_size;
+};
+
+/**
+ * The known fields of a message, in field number order (like the generated
+ * code writes them).
+ */
+struct Message {
+  Field fields[8];
+  int count = 0;
+
+  void add(int id, int number, uint32_t wire) {
+    Field f = {id, number, (uint32_t)(number << 3) | wire, 0};
+    f.tag_size = pbio::VarintSize32(f.tag);
+    fields[count++] = f;
+  }
+  void sort() {
+    std::sort(fields, fields + count, [](const Field& a, const Field& b) {
+      return a.number < b.number;
+    });
+  }
+};
+
+template <typename T>
+using Accessor = typename std::decay<T>::type;
+
+// the C++ types of the generated accessors
+using LeftType = Accessor<decltype(std::declval<dp::BBox>().left())>;
+using TopType = Accessor<decltype(std::declval<dp::BBox>().top())>;
+using WidthType = Accessor<decltype(std::declval<dp::BBox>().width())>;
+using HeightType = Accessor<decltype(std::declval<dp::BBox>().height())>;
+using UidType = Accessor<decltype(std::declval<dp::Person>().uid())>;
+using IsDangerType = Accessor<decltype(std::declval<dp::Person>().is_danger())>;
+using DangerValType = Accessor<decltype(std::declval<dp::Person>().danger_val())>;
+using FrameNumType = Accessor<decltype(std::declval<dp::Frame>().frame_num())>;
+using SumDangerType = Accessor<decltype(std::declval<dp::Frame>().sum_danger())>;
+using PtsType = Accessor<decltype(std::declval<dp::Frame>().pts())>;
+using DtsType = Accessor<decltype(std::declval<dp::Frame>().dts())>;
+using SourceIdType = Accessor<decltype(std::declval<dp::Frame>().source_id())>;
+using MaxFramesType = Accessor<decltype(std::declval<dp::Batch>().max_frames())>;
+
+// field ids
+enum { BBOX_LEFT, BBOX_TOP, BBOX_WIDTH, BBOX_HEIGHT };
+enum { PERSON_UID, PERSON_IS_DANGER, PERSON_DANGER_VAL, PERSON_BBOX };
+enum {
+  FRAME_FRAME_NUM, FRAME_PEOPLE, FRAME_SUM_DANGER, FRAME_PTS, FRAME_DTS,
+  FRAME_SOURCE_ID,
+};
+enum { BATCH_MAX_FRAMES, BATCH_FRAMES };
+
+/**
+ * Check a message has exactly `message.count` fields, and each of them is
+ * the type we expect (and not in a oneof, or proto3 optional).
+ */
+static bool
+check(const gp::Descriptor* descriptor, const Message& message,
+      const gp::FieldDescriptor::Type* types,
+      const gp::Descriptor* const* message_types) {
+  if (descriptor->field_count() != message.count) {
+    return false;
+  }
+  for (int i = 0; i < message.count; i++) {
+    const auto& f = message.fields[i];
+    auto field = descriptor->FindFieldByNumber(f.number);
+    if (field == nullptr || field->type() != types[f.id] ||
+        field->containing_oneof() != nullptr) {
+      return false;
+    }
+    // repeated messages are checked by the caller
+    if (field->is_repeated() &&
+        field->type() != gp::FieldDescriptor::TYPE_MESSAGE) {
+      return false;
+    }
+    if (field->type() == gp::FieldDescriptor::TYPE_MESSAGE &&
+        field->message_type() != message_types[f.id]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The known layout of the generated code, worked out once.
+ */
+struct Plan {
+  Message bbox;
+  Message person;
+  Message frame;
+  Message batch;
+  bool compatible;
+
+  Plan() {
+    bbox.add(BBOX_LEFT, dp::BBox::kLeftFieldNumber, Scalar<LeftType>::WIRE);
+    bbox.add(BBOX_TOP, dp::BBox::kTopFieldNumber, Scalar<TopType>::WIRE);
+    bbox.add(BBOX_WIDTH, dp::BBox::kWidthFieldNumber, Scalar<WidthType>::WIRE);
+    bbox.add(BBOX_HEIGHT, dp::BBox::kHeightFieldNumber,
+      Scalar<HeightType>::WIRE);
+    bbox.sort();
+
+    person.add(PERSON_UID, dp::Person::kUidFieldNumber,
+      Scalar<UidType>::WIRE);
+    person.add(PERSON_IS_DANGER, dp::Person::kIsDangerFieldNumber,
+      Scalar<IsDangerType>::WIRE);
+    person.add(PERSON_DANGER_VAL, dp::Person::kDangerValFieldNumber,
+      Scalar<DangerValType>::WIRE);
+    person.add(PERSON_BBOX, dp::Person::kBboxFieldNumber, WIRE_LENGTH);
+    person.sort();
+
+    frame.add(FRAME_FRAME_NUM, dp::Frame::kFrameNumFieldNumber,
+      Scalar<FrameNumType>::WIRE);
+    frame.add(FRAME_PEOPLE, dp::Frame::kPeopleFieldNumber, WIRE_LENGTH);
+    frame.add(FRAME_SUM_DANGER, dp::Frame::kSumDangerFieldNumber,
+      Scalar<SumDangerType>::WIRE);
+    frame.add(FRAME_PTS, dp::Frame::kPtsFieldNumber, Scalar<PtsType>::WIRE);
+    frame.add(FRAME_DTS, dp::Frame::kDtsFieldNumber, Scalar<DtsType>::WIRE);
+    frame.add(FRAME_SOURCE_ID, dp::Frame::kSourceIdFieldNumber,
+      Scalar<SourceIdType>::WIRE);
+    frame.sort();
+
+    batch.add(BATCH_MAX_FRAMES, dp::Batch::kMaxFramesFieldNumber,
+      Scalar<MaxFramesType>::WIRE);
+    batch.add(BATCH_FRAMES, dp::Batch::kFramesFieldNumber, WIRE_LENGTH);
+    batch.sort();
+
+    compatible = check_descriptors();
+  }
+
+  bool check_descriptors() const {
+    // proto2 has field presence, which changes when scalars are written
+    if (dp::Batch::descriptor()->file()->syntax() !=
+        gp::FileDescriptor::SYNTAX_PROTO3) {
+      return false;
+    }
+    const gp::FieldDescriptor::Type MESSAGE =
+      gp::FieldDescriptor::TYPE_MESSAGE;
+
+    gp::FieldDescriptor::Type bbox_types[] = {
+      Scalar<LeftType>::type(), Scalar<TopType>::type(),
+      Scalar<WidthType>::type(), Scalar<HeightType>::type(),
+    };
+    const gp::Descriptor* bbox_messages[] = {
+      nullptr, nullptr, nullptr, nullptr,
+    };
+    gp::FieldDescriptor::Type person_types[] = {
+      Scalar<UidType>::type(), Scalar<IsDangerType>::type(),
+      Scalar<DangerValType>::type(), MESSAGE,
+    };
+    const gp::Descriptor* person_messages[] = {
+      nullptr, nullptr, nullptr, dp::BBox::descriptor(),
+    };
+    gp::FieldDescriptor::Type frame_types[] = {
+      Scalar<FrameNumType>::type(), MESSAGE, Scalar<SumDangerType>::type(),
+      Scalar<PtsType>::type(), Scalar<DtsType>::type(),
+      Scalar<SourceIdType>::type(),
+    };
+    const gp::Descriptor* frame_messages[] = {
+      nullptr, dp::Person::descriptor(), nullptr, nullptr, nullptr, nullptr,
+    };
+    gp::FieldDescriptor::Type batch_types[] = {
+      Scalar<MaxFramesType>::type(), MESSAGE,
+    };
+    const gp::Descriptor* batch_messages[] = {
+      nullptr, dp::Frame::descriptor(),
+    };
+    return check(dp::BBox::descriptor(), bbox, bbox_types, bbox_messages) &&
+           check(dp::Person::descriptor(), person, person_types,
+                 person_messages) &&
+           check(dp::Frame::descriptor(), frame, frame_types,
+                 frame_messages) &&
+           check(dp::Batch::descriptor(), batch, batch_types,
+                 batch_messages) &&
+           // repeated where it should be, singular where it shouldn't
+           dp::Person::descriptor()->FindFieldByNumber(
+             dp::Person::kBboxFieldNumber)->is_repeated() == false &&
+           dp::Frame::descriptor()->FindFieldByNumber(
+             dp::Frame::kPeopleFieldNumber)->is_repeated() &&
+           dp::Batch::descriptor()->FindFieldByNumber(
+             dp::Batch::kFramesFieldNumber)->is_repeated();
+  }
+};
+
+const Plan&
+plan() {
+  // thread safe (C++11 magic statics)
+  static const Plan p;
+  return p;
+}
+
+template <typename T>
+inline size_t
+scalar_size(const Field& f, T v) {
+  return Scalar<T>::is_zero(v) ? 0 : f.tag_size + Scalar<T>::size(v);
+}
+
+template <typename T>
+inline uint8_t*
+write_scalar(const Field& f, T v, uint8_t* t) {
+  if (Scalar<T>::is_zero(v)) {
+    return t;
+  }
+  t = pbio::WriteVarint32ToArray(f.tag, t);
+  return Scalar<T>::write(v, t);
+}
+
+inline size_t
+length_size(const Field& f, uint32_t size) {
+  return f.tag_size + pbio::VarintSize32(size) + size;
+}
+
+inline uint8_t*
+write_length(const Field& f, uint32_t size, uint8_t* t) {
+  t = pbio::WriteVarint32ToArray(f.tag, t);
+  return pbio::WriteVarint32ToArray(size, t);
+}
+
+size_t
+bbox_size(const Message& m, const dp::BBox& b) {
+  size_t size = 0;
+  for (int i = 0; i < m.count; i++) {
+    const auto& f = m.fields[i];
+    switch (f.id) {
+      case BBOX_LEFT: size += scalar_size(f, b.left()); break;
+      case BBOX_TOP: size += scalar_size(f, b.top()); break;
+      case BBOX_WIDTH: size += scalar_size(f, b.width()); break;
+      case BBOX_HEIGHT: size += scalar_size(f, b.height()); break;
+    }
+  }
+  return size;
+}
+
+uint8_t*
+write_bbox(const Message& m, const dp::BBox& b, uint8_t* t) {
+  for (int i = 0; i < m.count; i++) {
+    const auto& f = m.fields[i];
+    switch (f.id) {
+      case BBOX_LEFT: t = write_scalar(f, b.left(), t); break;
+      case BBOX_TOP: t = write_scalar(f, b.top(), t); break;
+      case BBOX_WIDTH: t = write_scalar(f, b.width(), t); break;
+      case BBOX_HEIGHT: t = write_scalar(f, b.height(), t); break;
+    }
+  }
+  return t;
+}
+
+size_t
+person_size(const Plan& p, const dp::Person& person) {
+  size_t size = 0;
+  const auto& m = p.person;
+  for (int i = 0; i < m.count; i++) {
+    const auto& f = m.fields[i];
+    switch (f.id) {
+      case PERSON_UID: size += scalar_size(f, person.uid()); break;
+      case PERSON_IS_DANGER: size += scalar_size(f, person.is_danger()); break;
+      case PERSON_DANGER_VAL:
+        size += scalar_size(f, person.danger_val());
+        break;
+      case PERSON_BBOX:
+        if (person.has_bbox()) {
+          size += length_size(f, bbox_size(p.bbox, person.bbox()));
+        }
+        break;
+    }
+  }
+  return size;
+}
+
+uint8_t*
+write_person(const Plan& p, const dp::Person& person, uint8_t* t) {
+  const auto& m = p.person;
+  for (int i = 0; i < m.count; i++) {
+    const auto& f = m.fields[i];
+    switch (f.id) {
+      case PERSON_UID: t = write_scalar(f, person.uid(), t); break;
+      case PERSON_IS_DANGER: t = write_scalar(f, person.is_danger(), t); break;
+      case PERSON_DANGER_VAL:
+        t = write_scalar(f, person.danger_val(), t);
+        break;
+      case PERSON_BBOX:
+        if (person.has_bbox()) {
+          const auto& bbox = person.bbox();
+          t = write_length(f, bbox_size(p.bbox, bbox), t);
+          t = write_bbox(p.bbox, bbox, t);
+        }
+        break;
+    }
+  }
+  return t;
+}
+
+}  // namespace
+
+bool
+BatchSerializer::is_compatible() {
+  return plan().compatible;
+}
+
+size_t
+BatchSerializer::byte_size(const dp::Batch& batch) {
+  const auto& p = plan();
+  if (!p.compatible) {
+    return batch.ByteSizeLong();
+  }
+  sizes_.clear();
+  size_t size = 0;
+  const auto& bm = p.batch;
+  for (int i = 0; i < bm.count; i++) {
+    const auto& bf = bm.fields[i];
+    if (bf.id == BATCH_MAX_FRAMES) {
+      size += scalar_size(bf, batch.max_frames());
+      continue;
+    }
+    for (const auto& frame : batch.frames()) {
+      // the frame's size goes first, then its people's
+      size_t frame_index = sizes_.size();
+      sizes_.push_back(0);
+      size_t frame_size = 0;
+      const auto& fm = p.frame;
+      for (int j = 0; j < fm.count; j++) {
+        const auto& f = fm.fields[j];
+        switch (f.id) {
+          case FRAME_FRAME_NUM:
+            frame_size += scalar_size(f, frame.frame_num());
+            break;
+          case FRAME_PEOPLE:
+            for (const auto& person : frame.people()) {
+              auto psize = (uint32_t) person_size(p, person);
+              sizes_.push_back(psize);
+              frame_size += length_size(f, psize);
+            }
+            break;
+          case FRAME_SUM_DANGER:
+            frame_size += scalar_size(f, frame.sum_danger());
+            break;
+          case FRAME_PTS: frame_size += scalar_size(f, frame.pts()); break;
+          case FRAME_DTS: frame_size += scalar_size(f, frame.dts()); break;
+          case FRAME_SOURCE_ID:
+            frame_size += scalar_size(f, frame.source_id());
+            break;
+        }
+      }
+      sizes_[frame_index] = (uint32_t) frame_size;
+      size += length_size(bf, frame_size);
+    }
+  }
+  return size;
+}
+
+uint8_t*
+BatchSerializer::write(const dp::Batch& batch, uint8_t* t) {
+  const auto& p = plan();
+  if (!p.compatible) {
+    return batch.SerializeWithCachedSizesToArray(t);
+  }
+  const uint32_t* sizes = sizes_.data();
+  const auto& bm = p.batch;
+  for (int i = 0; i < bm.count; i++) {
+    const auto& bf = bm.fields[i];
+    if (bf.id == BATCH_MAX_FRAMES) {
+      t = write_scalar(bf, batch.max_frames(), t);
+      continue;
+    }
+    for (const auto& frame : batch.frames()) {
+      t = write_length(bf, *sizes++, t);
+      const auto& fm = p.frame;
+      for (int j = 0; j < fm.count; j++) {
+        const auto& f = fm.fields[j];
+        switch (f.id) {
+          case FRAME_FRAME_NUM:
+            t = write_scalar(f, frame.frame_num(), t);
+            break;
+          case FRAME_PEOPLE:
+            for (const auto& person : frame.people()) {
+              t = write_length(f, *sizes++, t);
+              t = write_person(p, person, t);
+            }
+            break;
+          case FRAME_SUM_DANGER:
+            t = write_scalar(f, frame.sum_danger(), t);
+            break;
+          case FRAME_PTS: t = write_scalar(f, frame.pts(), t); break;
+          case FRAME_DTS: t = write_scalar(f, frame.dts(), t); break;
+          case FRAME_SOURCE_ID:
+            t = write_scalar(f, frame.source_id(), t);
+            break;
+        }
+      }
+    }
+  }
+  return t;
+}
+
+bool
+BatchSerializer::serialize(const dp::Batch& batch, std::string* out) {
+  size_t size = byte_size(batch);
+  out->resize(size);
+  if (size == 0) {
+    return true;
+  }
+  auto start = (uint8_t*) &(*out)[0];
+  return (size_t)(write(batch, start) - start) == size;
+}
+
+} // namespace ds
@@ -0,0 +1,454 @@
+/* BatchWriter.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "BatchWriter.hpp"
+#include "FileMetaBroker.hpp"  // magic numbers
+
+#ifdef DS_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#include <iomanip>
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+CodedBatchWriter::CodedBatchWriter(bool packed) :
+  direct_io(false),
+  prealloc_size(0),
+  writeback_size(0),
+  packed_(packed),
+  direct_(false),
+  fd_(-1),
+  raw_(),
+  coded_(),
+  serializer_(),
+  packed_batch_(),
+  scratch_(),
+  in_place_(false)
+  {}
+
+CodedBatchWriter::~CodedBatchWriter() {
+  close();
+}
+
+bool
+CodedBatchWriter::open(const std::string& filename) {
+  close();
+  errno_ = 0;
+// https://developers.google.com/protocol-buffers/docs/reference/cpp/google.protobuf.io.coded_stream
+  // truncate, since whatever was here before would otherwise be left after
+  // our data and the result would be garbage
+  int flags = O_CREAT | O_WRONLY | O_TRUNC;
+  direct_ = direct_io;
+  fd_ = ::open(filename.c_str(), flags | (direct_ ? O_DIRECT : 0),
+               S_IRUSR | S_IWUSR);
+  if (fd_ == -1 && direct_ && errno == EINVAL) {
+    // tmpfs and friends don't do O_DIRECT
+    direct_ = false;
+    fd_ = ::open(filename.c_str(), flags, S_IRUSR | S_IWUSR);
+  }
+  if (fd_ == -1) {
+    errno_ = errno;
+    return false;
+  }
+  raw_.reset(new DirectOutputStream(
+    fd_, direct_, prealloc_size, writeback_size));
+  coded_.reset(new google::protobuf::io::CodedOutputStream(raw_.get()));
+  coded_->WriteLittleEndian32(packed_ ?
+    (uint32_t) FileMetaBroker::PACKED_MAGIC_NUMBER :
+    (uint32_t) FileMetaBroker::PROTO_MAGIC_NUMBER);
+  return !coded_->HadError();
+}
+
+bool
+CodedBatchWriter::write(const dp::Batch& batch) {
+  if (packed_) {
+    packed_batch_.from_proto(batch);
+    return this->write(packed_batch_);
+  }
+  if (!coded_) {
+    return false;
+  }
+  size_t size = serializer_.byte_size(batch);
+  serializer_.write(batch, this->reserve(size));
+  return this->finish(size);
+}
+
+bool
+CodedBatchWriter::write(const PackedBatch& batch) {
+  if (!coded_ || !packed_) {
+    return false;
+  }
+  // packed records are framed, so they can be told apart
+  size_t size = batch.byte_size();
+  coded_->WriteVarint32((uint32_t) size);
+  batch.write(this->reserve(size));
+  return this->finish(size);
+}
+
+uint8_t*
+CodedBatchWriter::reserve(size_t size) {
+  // write straight into the stream's buffer if it fits, otherwise go
+  // through a scratch buffer
+  auto target = coded_->GetDirectBufferForNBytesAndAdvance((int) size);
+  in_place_ = target != nullptr;
+  if (!in_place_) {
+    scratch_.resize(size);
+    target = (uint8_t*) &scratch_[0];
+  }
+  return target;
+}
+
+bool
+CodedBatchWriter::finish(size_t size) {
+  if (!in_place_) {
+    coded_->WriteRaw(scratch_.data(), (int) size);
+  }
+  if (coded_->HadError()) {
+    errno_ = raw_->GetErrno();
+    return false;
+  }
+  return true;
+}
+
+bool
+CodedBatchWriter::flush() {
+  // the stream writes whole buffers as it goes, and the rest on close()
+  return coded_ && !coded_->HadError();
+}
+
+bool
+CodedBatchWriter::close() {
+  if (fd_ == -1) {
+    return true;
+  }
+  bool ok = !coded_->HadError();
+  // the coded stream must be gone before the raw stream is closed, since it
+  // returns unused buffer space on destruction
+  coded_.reset();
+  // write the last block and truncate to the final size
+  if (!raw_->Close()) {
+    errno_ = raw_->GetErrno();
+    ok = false;
+  }
+  raw_.reset();
+  if (::close(fd_) == -1) {
+    errno_ = errno;
+    ok = false;
+  }
+  fd_ = -1;
+  return ok;
+}
+
+/**
+ * Gets a frame timestamp (ns since the epoch).
+ * Tries the decoder timestamp first, then the playback timestamp, then
+ * falls back on the system time.
+ */
+static uint64_t
+frame_to_ns(const dp::Frame& frame) {
+  if (frame.dts()) {
+    return frame.dts();
+  }
+  if (frame.pts()) {
+    return frame.pts();
+  }
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Gets a std::tm struct (gmt) for a frame timestamp (see frame_to_ns).
+ */
+static const std::tm*
+frame_to_time(const dp::Frame& frame, std::tm* out) {
+  // this is implementation dependent and may be wrong on platforms
+  // where a time_t is not the seconds since the epoch
+  time_t seconds = (time_t) (frame_to_ns(frame) / 1000000000ull);
+  // gmtime_r, since std::gmtime and friends are not thread safe
+  return gmtime_r(&seconds, out);
+}
+
+/**
+ * The number of people in violation in `frame`.
+ */
+static int
+count_violating(const dp::Frame& frame) {
+  int violating = 0;
+  for (int i = 0; i < frame.people_size(); i++)
+  {
+    const dp::Person& person = frame.people(i);
+    if (person.is_danger()) violating++;
+  }
+  return violating;
+}
+
+/**
+ * Write a dp::Frame to a csv output stream in the format expected by
+ * neuralet/smart_distancing:
+ * 
+ * Timestamp,DetectedObjects,ViolatingObjects,EnvironmentScore
+ */
+static void
+frame_to_csv(const dp::Frame& frame, std::ostream& out) {
+  // so we'll get the danger score by dividing the sum danger by the number
+  // of people. This has the potential to be greater than 1 in extreme cases.
+  float score = 0.0f;
+  if (frame.people_size() > 0) {
+    score = frame.sum_danger() / frame.people_size();
+  }
+  // number of violating people
+  int violating = count_violating(frame);
+  std::tm time;
+  out << std::put_time(frame_to_time(frame, &time), "%F %T")
+    << "," << frame.people_size() << "," << violating << "," << score
+    << "," << frame.source_id() << "\n";
+}
+
+CsvBatchWriter::CsvBatchWriter(bool append) :
+  append_(append),
+  out_()
+  {}
+
+CsvBatchWriter::~CsvBatchWriter() {
+  close();
+}
+
+bool
+CsvBatchWriter::open(const std::string& filename) {
+  close();
+  errno_ = 0;
+  auto mode = std::ios::out | (append_ ?
+    std::ios::app | std::ios::ate : std::ios::trunc);
+  out_.open(filename.c_str(), mode);
+  if (!out_.is_open()) {
+    errno_ = errno;
+    return false;
+  }
+  // if we are at the beginning of the file, write a header line
+  if (out_.tellp() == 0) {
+    out_ << "Timestamp,DetectedObjects,ViolatingObjects,EnvironmentScore,SourceID" << std::endl;
+  }
+  // set the number of digits for floats
+  out_ << std::setprecision(3) << std::fixed;
+  return out_.good();
+}
+
+bool
+CsvBatchWriter::write(const dp::Batch& batch) {
+  for (int i = 0; i < batch.frames_size(); i++)
+  {
+    frame_to_csv(batch.frames(i), out_);
+  }
+  return out_.good();
+}
+
+bool
+CsvBatchWriter::flush() {
+  out_.flush();
+  return out_.good();
+}
+
+bool
+CsvBatchWriter::close() {
+  if (!out_.is_open()) {
+    return true;
+  }
+  out_.flush();
+  bool ok = out_.good();
+  out_.close();
+  return ok;
+}
+
+#ifdef DS_SQLITE
+
+static const char* SCHEMA =
+  "PRAGMA journal_mode=WAL;"
+  // in WAL mode, only checkpoints sync, so a commit is just a write
+  "PRAGMA synchronous=NORMAL;"
+  "CREATE TABLE IF NOT EXISTS frames ("
+  "  id INTEGER PRIMARY KEY,"
+  "  source_id INTEGER NOT NULL,"
+  "  timestamp INTEGER NOT NULL,"
+  "  frame_num INTEGER,"
+  "  pts INTEGER,"
+  "  dts INTEGER,"
+  "  people INTEGER,"
+  "  violating INTEGER,"
+  "  sum_danger REAL);"
+  "CREATE INDEX IF NOT EXISTS frames_source_id_timestamp"
+  "  ON frames (source_id, timestamp);"
+  "CREATE TABLE IF NOT EXISTS people ("
+  "  frame_id INTEGER NOT NULL REFERENCES frames (id),"
+  "  uid INTEGER,"
+  "  bbox_left REAL,"
+  "  bbox_top REAL,"
+  "  bbox_width REAL,"
+  "  bbox_height REAL,"
+  "  danger_val REAL,"
+  "  is_danger INTEGER);"
+  "CREATE INDEX IF NOT EXISTS people_frame_id ON people (frame_id);";
+
+static const char* INSERT_FRAME =
+  "INSERT INTO frames (source_id, timestamp, frame_num, pts, dts, people,"
+  "  violating, sum_danger) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char* INSERT_PERSON =
+  "INSERT INTO people (frame_id, uid, bbox_left, bbox_top, bbox_width,"
+  "  bbox_height, danger_val, is_danger) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+SqliteBatchWriter::SqliteBatchWriter(bool people) :
+  people_(people),
+  in_transaction_(false),
+  db_(nullptr),
+  insert_frame_(nullptr),
+  insert_person_(nullptr),
+  message_()
+  {}
+
+SqliteBatchWriter::~SqliteBatchWriter() {
+  close();
+}
+
+bool
+SqliteBatchWriter::fail() {
+  errno_ = EIO;
+  message_ = db_ ? sqlite3_errmsg(db_) : "out of memory";
+  return false;
+}
+
+bool
+SqliteBatchWriter::exec(const char* sql) {
+  return sqlite3_exec(db_, sql, nullptr, nullptr, nullptr) == SQLITE_OK ||
+    fail();
+}
+
+bool
+SqliteBatchWriter::open(const std::string& filename) {
+  close();
+  errno_ = 0;
+  message_.clear();
+  // only ever used from one thread at a time
+  int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+    SQLITE_OPEN_NOMUTEX;
+  if (sqlite3_open_v2(filename.c_str(), &db_, flags, nullptr) != SQLITE_OK) {
+    fail();
+    close();
+    return false;
+  }
+  if (!exec(SCHEMA) ||
+      sqlite3_prepare_v2(db_, INSERT_FRAME, -1, &insert_frame_, nullptr)
+        != SQLITE_OK ||
+      sqlite3_prepare_v2(db_, INSERT_PERSON, -1, &insert_person_, nullptr)
+        != SQLITE_OK) {
+    fail();
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool
+SqliteBatchWriter::write(const dp::Batch& batch) {
+  if (!db_) {
+    return false;
+  }
+  if (!in_transaction_) {
+    if (!exec("BEGIN;")) {
+      return false;
+    }
+    in_transaction_ = true;
+  }
+  for (const auto& frame : batch.frames()) {
+    sqlite3_bind_int64(insert_frame_, 1, frame.source_id());
+    sqlite3_bind_int64(insert_frame_, 2, (sqlite3_int64) frame_to_ns(frame));
+    sqlite3_bind_int64(insert_frame_, 3, frame.frame_num());
+    sqlite3_bind_int64(insert_frame_, 4, (sqlite3_int64) frame.pts());
+    sqlite3_bind_int64(insert_frame_, 5, (sqlite3_int64) frame.dts());
+    sqlite3_bind_int64(insert_frame_, 6, frame.people_size());
+    sqlite3_bind_int64(insert_frame_, 7, count_violating(frame));
+    sqlite3_bind_double(insert_frame_, 8, frame.sum_danger());
+    int rc = sqlite3_step(insert_frame_);
+    sqlite3_reset(insert_frame_);
+    if (rc != SQLITE_DONE) {
+      return fail();
+    }
+    if (!people_) {
+      continue;
+    }
+    sqlite3_int64 frame_id = sqlite3_last_insert_rowid(db_);
+    for (const auto& person : frame.people()) {
+      sqlite3_bind_int64(insert_person_, 1, frame_id);
+      sqlite3_bind_int64(insert_person_, 2, person.uid());
+      sqlite3_bind_double(insert_person_, 3, person.bbox().left());
+      sqlite3_bind_double(insert_person_, 4, person.bbox().top());
+      sqlite3_bind_double(insert_person_, 5, person.bbox().width());
+      sqlite3_bind_double(insert_person_, 6, person.bbox().height());
+      sqlite3_bind_double(insert_person_, 7, person.danger_val());
+      sqlite3_bind_int(insert_person_, 8, person.is_danger());
+      rc = sqlite3_step(insert_person_);
+      sqlite3_reset(insert_person_);
+      if (rc != SQLITE_DONE) {
+        return fail();
+      }
+    }
+  }
+  return true;
+}
+
+bool
+SqliteBatchWriter::flush() {
+  if (!in_transaction_) {
+    return db_ != nullptr;
+  }
+  in_transaction_ = false;
+  return exec("COMMIT;");
+}
+
+bool
+SqliteBatchWriter::close() {
+  if (!db_) {
+    return true;
+  }
+  bool ok = flush();
+  sqlite3_finalize(insert_frame_);
+  sqlite3_finalize(insert_person_);
+  insert_frame_ = nullptr;
+  insert_person_ = nullptr;
+  if (sqlite3_close(db_) != SQLITE_OK) {
+    ok = fail();
+  }
+  db_ = nullptr;
+  return ok;
+}
+
+#endif  // DS_SQLITE
+
+} // namespace ds
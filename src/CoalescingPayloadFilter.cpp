@@ -0,0 +1,308 @@
+/* CoalescingPayloadFilter.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "CoalescingPayloadFilter.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/gzip_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace dp = distanceproto;
+namespace pbio = google::protobuf::io;
+
+namespace ds {
+
+const uint8_t CoalescingPayloadFilter::MAGIC;
+const uint8_t CoalescingPayloadFilter::COLUMNAR;
+
+// magic, compression, count and raw size
+static const size_t MAX_HEADER_SIZE = 2 + 5 + 10;
+// the largest sane batch count, to bail early on garbage
+static const uint32_t MAX_COUNT = 1 << 16;
+
+CoalescingPayloadFilter::CoalescingPayloadFilter(uint32_t max_batches,
+                                                 uint32_t max_delay_ms,
+                                                 Compression compression,
+                                                 size_t compress_threshold,
+                                                 int compression_level) :
+  ProtoPayloadFilter(sync),
+  max_batches_(max_batches ? max_batches : 1),
+  max_delay_(max_delay_ms),
+  compression_(compression),
+  compress_threshold_(compress_threshold),
+  compression_level_(compression_level),
+  pending_lock_(),
+  pending_(),
+  compressed_()
+  {}
+
+uint8_t*
+CoalescingPayloadFilter::add_record(size_t size, Pending* pending,
+                                    std::chrono::steady_clock::time_point now) {
+  if (pending->count == 0) {
+    pending->first = now;
+  }
+  pending->count++;
+  // (varint size | record) on the end of the raw body, reusing its capacity
+  std::string& raw = pending->raw;
+  size_t offset = raw.size();
+  raw.resize(offset + pbio::CodedOutputStream::VarintSize32(size) + size);
+  auto data = (uint8_t*) &raw[offset];
+  return pbio::CodedOutputStream::WriteVarint32ToArray(size, data);
+}
+
+void
+CoalescingPayloadFilter::append(const dp::Batch& batch, Pending* pending,
+                                std::chrono::steady_clock::time_point now) {
+  if (encoding == columnar) {
+    packed_.from_proto(batch);
+    this->append_packed(packed_, pending, now);
+    return;
+  }
+  size_t size = serializer_.byte_size(batch);
+  serializer_.write(batch, this->add_record(size, pending, now));
+}
+
+void
+CoalescingPayloadFilter::append_packed(
+    const PackedBatch& batch, Pending* pending,
+    std::chrono::steady_clock::time_point now) {
+  batch.write(this->add_record(batch.byte_size(), pending, now));
+}
+
+bool
+CoalescingPayloadFilter::on_batch_meta(NvDsBatchMeta* batch_meta,
+                                       dp::Batch* batch) {
+  return this->coalesce(batch_meta, batch, nullptr);
+}
+
+bool
+CoalescingPayloadFilter::on_packed_meta(NvDsBatchMeta* batch_meta,
+                                        PackedBatch* batch) {
+  if (encoding != columnar) {
+    return this->on_batch_meta(batch_meta, batch->materialize());
+  }
+  return this->coalesce(batch_meta, nullptr, batch);
+}
+
+bool
+CoalescingPayloadFilter::coalesce(NvDsBatchMeta* batch_meta,
+                                  dp::Batch* batch, PackedBatch* packed) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<Payload*> payloads;
+  bool ok;
+  {
+    std::lock_guard<std::mutex> pending_guard(pending_lock_);
+    {
+      std::lock_guard<std::mutex> guard(subscriptions_lock_);
+      if (unfiltered_ && packed != nullptr) {
+        this->append_packed(*packed, &pending_[0], now);
+      } else if (unfiltered_) {
+        this->append(*batch, &pending_[0], now);
+      }
+      // each subscription is evaluated once, however many brokers want it
+      for (const auto& entry : subscriptions_) {
+        // filtering needs a Batch
+        batch = batch != nullptr ? batch : packed->materialize();
+        if (entry.subscription.apply(*batch, &filtered_)) {
+          this->append(filtered_, &pending_[entry.id], now);
+        }
+      }
+    }
+    ok = this->pack_due(false, now, &payloads);
+  }
+  for (auto payload : payloads) {
+    ok = this->attach_payload(batch_meta, payload) && ok;
+  }
+  return ok;
+}
+
+bool
+CoalescingPayloadFilter::flush(NvDsBatchMeta* batch_meta) {
+  std::vector<Payload*> payloads;
+  bool ok;
+  {
+    std::lock_guard<std::mutex> pending_guard(pending_lock_);
+    ok = this->pack_due(true, std::chrono::steady_clock::now(), &payloads);
+  }
+  for (auto payload : payloads) {
+    ok = this->attach_payload(batch_meta, payload) && ok;
+  }
+  return ok;
+}
+
+GstBuffer*
+CoalescingPayloadFilter::on_eos() {
+  std::vector<Payload*> payloads;
+  {
+    std::lock_guard<std::mutex> pending_guard(pending_lock_);
+    this->pack_due(true, std::chrono::steady_clock::now(), &payloads);
+  }
+  return this->make_payload_buffer(payloads);
+}
+
+GstBuffer*
+CoalescingPayloadFilter::on_timeout() {
+  std::vector<Payload*> payloads;
+  {
+    std::lock_guard<std::mutex> pending_guard(pending_lock_);
+    this->pack_due(false, std::chrono::steady_clock::now(), &payloads);
+  }
+  return this->make_payload_buffer(payloads);
+}
+
+bool
+CoalescingPayloadFilter::pack_due(bool all,
+                                  std::chrono::steady_clock::time_point now,
+                                  std::vector<Payload*>* payloads) {
+  bool ok = true;
+  for (auto& it : pending_) {
+    Pending& pending = it.second;
+    if (pending.count == 0 || !(all || pending.count >= max_batches_ ||
+        (max_delay_.count() && now - pending.first >= max_delay_))) {
+      continue;
+    }
+    auto payload = this->pack(it.first, &pending);
+    if (payload == nullptr) {
+      GST_WARNING("could not pack payload");
+      ok = false;
+      continue;
+    }
+    payloads->push_back(payload);
+  }
+  return ok;
+}
+
+Payload*
+CoalescingPayloadFilter::pack(uint32_t subscription, Pending* pending) {
+  const std::string& raw = pending->raw;
+  const std::string* body = &raw;
+  uint8_t compression = none;
+  if (compression_ != none && raw.size() >= compress_threshold_) {
+    compressed_.clear();
+    pbio::StringOutputStream sink(&compressed_);
+    pbio::GzipOutputStream::Options options;
+    options.format = compression_ == gzip ?
+      pbio::GzipOutputStream::GZIP : pbio::GzipOutputStream::ZLIB;
+    options.compression_level = compression_level_;
+    pbio::GzipOutputStream gz(&sink, options);
+    void* chunk;
+    int chunk_size;
+    size_t done = 0;
+    bool ok = true;
+    while (done < raw.size() && (ok = gz.Next(&chunk, &chunk_size))) {
+      size_t n = std::min((size_t)chunk_size, raw.size() - done);
+      memcpy(chunk, raw.data() + done, n);
+      done += n;
+      if (n < (size_t)chunk_size) {
+        gz.BackUp(chunk_size - n);
+      }
+    }
+    ok = gz.Close() && ok;
+    // only use it if it helped
+    if (ok && compressed_.size() < raw.size()) {
+      body = &compressed_;
+      compression = compression_;
+    } else if (!ok) {
+      GST_WARNING("compression failed, sending uncompressed");
+    }
+  }
+
+  auto payload = pool_->acquire(MAX_HEADER_SIZE + body->size());
+  uint8_t* start = payload->mutable_data();
+  uint8_t* data = start;
+  *data++ = MAGIC;
+  *data++ = compression | (encoding == columnar ? COLUMNAR : 0);
+  data = pbio::CodedOutputStream::WriteVarint32ToArray(pending->count, data);
+  data = pbio::CodedOutputStream::WriteVarint64ToArray(raw.size(), data);
+  memcpy(data, body->data(), body->size());
+  payload->set_size((data - start) + body->size());
+  payload->set_subscription(subscription);
+
+  pending->count = 0;
+  pending->raw.clear();
+  return payload;
+}
+
+bool
+CoalescingPayloadFilter::is_coalesced(const uint8_t* data, size_t size) {
+  return size > 1 && data[0] == MAGIC && (data[1] & ~COLUMNAR) <= zlib;
+}
+
+bool
+CoalescingPayloadFilter::unpack(const uint8_t* data, size_t size,
+                                std::vector<dp::Batch>* batches) {
+  if (!is_coalesced(data, size)) {
+    return false;
+  }
+  uint8_t compression = data[1] & ~COLUMNAR;
+  bool columnar = (data[1] & COLUMNAR) != 0;
+  pbio::CodedInputStream header(data + 2, (int)(size - 2));
+  uint32_t count;
+  uint64_t raw_size;
+  if (!header.ReadVarint32(&count) || count > MAX_COUNT ||
+      !header.ReadVarint64(&raw_size)) {
+    return false;
+  }
+  size_t body_offset = 2 + header.CurrentPosition();
+  pbio::ArrayInputStream body(data + body_offset, (int)(size - body_offset));
+  std::unique_ptr<pbio::GzipInputStream> gz;
+  pbio::ZeroCopyInputStream* source = &body;
+  if (compression != none) {
+    gz.reset(new pbio::GzipInputStream(&body, pbio::GzipInputStream::AUTO));
+    source = gz.get();
+  }
+  pbio::CodedInputStream in(source);
+  PackedBatch packed;
+  std::string record;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t batch_size;
+    if (!in.ReadVarint32(&batch_size) || batch_size > raw_size) {
+      return false;
+    }
+    if (columnar) {
+      if (!in.ReadString(&record, (int) batch_size) ||
+          !packed.parse((const uint8_t*) record.data(), record.size())) {
+        return false;
+      }
+      batches->emplace_back();
+      packed.to_proto(&batches->back());
+      continue;
+    }
+    auto limit = in.PushLimit(batch_size);
+    batches->emplace_back();
+    if (!batches->back().ParseFromCodedStream(&in) ||
+        !in.ConsumedEntireMessage()) {
+      batches->pop_back();
+      return false;
+    }
+    in.PopLimit(limit);
+  }
+  return true;
+}
+
+} // namespace ds
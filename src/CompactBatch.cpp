@@ -0,0 +1,158 @@
+/* CompactBatch.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "CompactBatch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+static_assert(sizeof(CompactFrame) % alignof(CompactFrame) == 0 &&
+              sizeof(CompactPerson) % alignof(CompactPerson) == 0,
+              "records must pack without padding");
+
+CompactBatch::CompactBatch(uint32_t max_frames,
+                           uint32_t frame_capacity,
+                           uint32_t person_capacity) :
+  max_frames_(max_frames),
+  frame_capacity_(frame_capacity),
+  person_capacity_(person_capacity),
+  num_frames_(0),
+  num_people_(0),
+  proto_(nullptr)
+  {}
+
+size_t
+CompactBatch::byte_size(uint32_t frame_capacity, uint32_t person_capacity) {
+  // the header is padded to a multiple of 8, so the frames are aligned
+  static_assert(sizeof(CompactBatch) % alignof(CompactFrame) == 0,
+                "frames must be aligned after the header");
+  return sizeof(CompactBatch) +
+         frame_capacity * sizeof(CompactFrame) +
+         person_capacity * sizeof(CompactPerson);
+}
+
+CompactBatch*
+CompactBatch::create(uint32_t max_frames,
+                     uint32_t frame_capacity,
+                     uint32_t person_capacity) {
+  void* mem = malloc(byte_size(frame_capacity, person_capacity));
+  if (mem == nullptr) {
+    return nullptr;
+  }
+  return new (mem) CompactBatch(max_frames, frame_capacity, person_capacity);
+}
+
+void
+CompactBatch::destroy(CompactBatch* batch) {
+  if (batch == nullptr) {
+    return;
+  }
+  delete batch->proto_;
+  batch->~CompactBatch();
+  free(batch);
+}
+
+CompactBatch*
+CompactBatch::copy() const {
+  size_t size = byte_size();
+  void* mem = malloc(size);
+  if (mem == nullptr) {
+    return nullptr;
+  }
+  memcpy(mem, this, size);
+  auto batch = (CompactBatch*) mem;
+  // the copy materializes its own, if it needs to
+  batch->proto_ = nullptr;
+  return batch;
+}
+
+CompactFrame*
+CompactBatch::add_frame() {
+  if (num_frames_ == frame_capacity_) {
+    return nullptr;
+  }
+  auto frame = &frames()[num_frames_++];
+  memset(frame, 0, sizeof(*frame));
+  frame->first_person = num_people_;
+  return frame;
+}
+
+CompactPerson*
+CompactBatch::add_person() {
+  if (num_frames_ == 0 || num_people_ == person_capacity_) {
+    return nullptr;
+  }
+  frames()[num_frames_ - 1].num_people++;
+  auto person = &people()[num_people_++];
+  memset(person, 0, sizeof(*person));
+  return person;
+}
+
+void
+CompactBatch::to_proto(dp::Batch* out) const {
+  out->Clear();
+  out->set_max_frames(max_frames_);
+  auto frames_out = out->mutable_frames();
+  frames_out->Reserve(num_frames_);
+  for (uint32_t f = 0; f < num_frames_; f++) {
+    const auto& record = frame(f);
+    auto frame_proto = frames_out->Add();
+    frame_proto->set_frame_num(record.frame_num);
+    frame_proto->set_pts(record.pts);
+    frame_proto->set_dts(record.dts);
+    frame_proto->set_sum_danger(record.sum_danger);
+    frame_proto->set_source_id(record.source_id);
+    auto people_out = frame_proto->mutable_people();
+    people_out->Reserve(record.num_people);
+    const CompactPerson* person = people(record);
+    for (uint32_t p = 0; p < record.num_people; p++, person++) {
+      auto person_proto = people_out->Add();
+      person_proto->set_uid(person->uid);
+      auto bbox = person_proto->mutable_bbox();
+      bbox->set_left(person->left);
+      bbox->set_top(person->top);
+      bbox->set_width(person->width);
+      bbox->set_height(person->height);
+      person_proto->set_danger_val(person->danger_val);
+      if (person->is_danger) {
+        person_proto->set_is_danger(true);
+      }
+    }
+  }
+}
+
+dp::Batch*
+CompactBatch::materialize() {
+  if (proto_ == nullptr) {
+    proto_ = new dp::Batch();
+    to_proto(proto_);
+  }
+  return proto_;
+}
+
+} // namespace ds
@@ -0,0 +1,112 @@
+/* Danger.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Danger.hpp"
+#include "Groups.hpp"
+
+#include <math.h>
+
+namespace ds {
+
+/**
+ * Calculate distance between the center of the bottom edge of two rectangles
+ */
+static float
+distance_between(const Box& a, const Box& b) {
+  // use the middle of the feet as a center point.
+  int ax = a.left + a.width / 2;
+  int ay = a.top + a.height;
+  int bx = b.left + b.width / 2;
+  int by = b.top + b.height;
+
+  int dx = ax - bx;
+  int dy = ay - by;
+
+  return sqrtf((float)(dx * dx + dy * dy));
+}
+
+/**
+ * Return true if how_much % height difference.
+ *
+ * @param how_much is the height % difference between two bounding boxes
+ * after which a true value is returned.
+ *
+ * if (abs(current.height - other.height) > current.height * how_much) {
+ *   return true;
+ * }
+ * 
+ * A true return value may be used to skip a detection. The idea is that
+ * Higher height difference either meas kid or a narrow camera angle or far away.
+ * camera angles where people in the foreground against a background like a crowd
+ * are missed, so this can help to fix that by filtering out these pairs.
+ *
+ */
+static bool
+too_far(const Box& current, const Box& other, const float how_much) {
+  if (abs(current.height - other.height) > current.height * how_much) {
+    return true;
+  }
+  return false;
+}
+
+float
+how_dangerous(const std::vector<Box>& boxes, size_t i,
+              float filter_height_diff, GroupFinder* finder) {
+  const Box& current = boxes[i];
+
+  float how_dangerous = 0.0f;  // sum of all normalized violation distances.
+  float danger_distance = current.height;
+  float d; // distance temp (in pixels).
+
+  // iterate forwards from current element, then in reverse from it
+  for (size_t j = i + 1; j < boxes.size(); j++) {
+    const Box& other = boxes[j];
+    if (too_far(current, other, filter_height_diff)) {
+      continue;
+    }
+    d = danger_distance - distance_between(current, other);
+    if (d > 0.0) {
+      how_dangerous += d / danger_distance;
+      if (finder) {
+        finder->unite(i, j);
+      }
+    }
+  }
+  for (size_t j = i; j-- > 0;) {
+    const Box& other = boxes[j];
+    if (too_far(current, other, filter_height_diff)) {
+      continue;
+    }
+    d = danger_distance - distance_between(current, other);
+    if (d > 0.0f) {
+      how_dangerous += d / danger_distance;
+      if (finder) {
+        finder->unite(i, j);
+      }
+    }
+  }
+
+  return how_dangerous;
+}
+
+} // namespace ds
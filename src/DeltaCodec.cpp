@@ -0,0 +1,541 @@
+/* DeltaCodec.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "DeltaCodec.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <math.h>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace dp = distanceproto;
+namespace pbio = google::protobuf::io;
+
+namespace ds {
+
+const uint8_t DeltaEncoder::KEYFRAME;
+const uint8_t DeltaEncoder::DELTA;
+
+// frame mask bits
+static const uint8_t FRAME_SUM_DANGER = 1 << 0;
+// person mask bits (box bits are 1 << 0 through 1 << 3, in BOX_* order)
+static const int BOX_LEFT = 0;
+static const int BOX_TOP = 1;
+static const int BOX_WIDTH = 2;
+static const int BOX_HEIGHT = 3;
+static const int BOX_FIELDS = 4;
+static const uint8_t PERSON_DANGER_VAL = 1 << 4;
+static const uint8_t PERSON_IS_DANGER = 1 << 5;
+static const uint8_t PERSON_UID = 1 << 6;
+// set on every changed person, so the mask of one is never 0
+static const uint8_t PERSON_CHANGED = 1 << 7;
+// the largest sane count in a message, to bail early on garbage
+static const uint32_t MAX_COUNT = 1 << 16;
+
+static inline uint32_t zigzag32(int32_t n) {
+  return ((uint32_t)n << 1) ^ (uint32_t)(n >> 31);
+}
+static inline int32_t unzigzag32(uint32_t n) {
+  return (int32_t)(n >> 1) ^ -(int32_t)(n & 1);
+}
+static inline uint64_t zigzag64(int64_t n) {
+  return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
+static inline int64_t unzigzag64(uint64_t n) {
+  return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+static inline uint32_t float_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+static inline float bits_float(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline int32_t quantize(float v, float grid) {
+  return (int32_t) lroundf(v / grid);
+}
+
+/**
+ * Get a box field by BOX_* index.
+ */
+static inline float get_box(const dp::BBox& box, int field) {
+  switch (field) {
+    case BOX_LEFT: return box.left();
+    case BOX_TOP: return box.top();
+    case BOX_WIDTH: return box.width();
+    default: return box.height();
+  }
+}
+
+/**
+ * Set a box field by BOX_* index.
+ */
+static inline void set_box(dp::BBox* box, int field, float v) {
+  switch (field) {
+    case BOX_LEFT: box->set_left(v); break;
+    case BOX_TOP: box->set_top(v); break;
+    case BOX_WIDTH: box->set_width(v); break;
+    default: box->set_height(v);
+  }
+}
+
+/**
+ * Make the number of people in a reference frame match `count`.
+ */
+static void resize_people(dp::Frame* ref, int count) {
+  auto people = ref->mutable_people();
+  while (people->size() > count) {
+    people->RemoveLast();
+  }
+  while (people->size() < count) {
+    people->Add();
+  }
+}
+
+/**
+ * The reference person the next person starts from unless a delta says
+ * otherwise: the one after `last` (the last reference person used, or -1),
+ * or none (-1) past the end. So someone leaving or joining only moves the
+ * people after them as a run, and costs a single entry.
+ */
+static inline int next_source(int last, int old_count) {
+  return last + 1 < old_count ? last + 1 : -1;
+}
+
+/**
+ * Find, for each person in `frame`, the index of the same person in `ref`,
+ * or -1 if they are new. People are matched by uid. People with a uid of 0
+ * are matched by index, with a reference person that also has no uid.
+ */
+static void
+match_people(const dp::Frame& frame, const dp::Frame& ref,
+             std::vector<int>* src) {
+  int count = frame.people_size();
+  int old_count = ref.people_size();
+  src->resize(count);
+  std::unordered_map<int32_t, int> by_uid;
+  bool indexed = false;
+  for (int i = 0; i < count; i++) {
+    int32_t uid = frame.people(i).uid();
+    if (i < old_count && ref.people(i).uid() == uid) {
+      // same person in the same place (the usual case)
+      (*src)[i] = i;
+      continue;
+    }
+    if (!uid) {
+      (*src)[i] = -1;
+      continue;
+    }
+    if (!indexed) {
+      for (int j = 0; j < old_count; j++) {
+        if (ref.people(j).uid()) {
+          by_uid.emplace(ref.people(j).uid(), j);
+        }
+      }
+      indexed = true;
+    }
+    auto it = by_uid.find(uid);
+    (*src)[i] = it == by_uid.end() ? -1 : it->second;
+  }
+}
+
+/**
+ * Rebuild the people of a reference frame so person i starts from old
+ * person `src[i]`, or from an empty Person if that is -1.
+ */
+static void remap_people(dp::Frame* ref, const std::vector<int>& src) {
+  google::protobuf::RepeatedPtrField<dp::Person> people;
+  people.Reserve(src.size());
+  for (int s : src) {
+    dp::Person* person = people.Add();
+    if (s >= 0) {
+      *person = ref->people(s);
+    }
+  }
+  ref->mutable_people()->Swap(&people);
+}
+
+/**
+ * Compute the change mask of a person against its reference.
+ *
+ * Returns the mask, or 0 if nothing changed.
+ */
+static uint8_t
+person_mask(const dp::Person& person, const dp::Person& ref,
+            float grid, float danger_step) {
+  uint8_t mask = 0;
+  for (int field = 0; field < BOX_FIELDS; field++) {
+    if (quantize(get_box(person.bbox(), field), grid) !=
+        quantize(get_box(ref.bbox(), field), grid)) {
+      mask |= 1 << field;
+    }
+  }
+  if (fabsf(person.danger_val() - ref.danger_val()) > danger_step) {
+    mask |= PERSON_DANGER_VAL;
+  }
+  if (person.uid() != ref.uid()) {
+    mask |= PERSON_UID;
+  }
+  if (mask || person.is_danger() != ref.is_danger()) {
+    // is_danger is sent as a value with every changed person
+    return mask | PERSON_CHANGED | (person.is_danger() ? PERSON_IS_DANGER : 0);
+  }
+  return 0;
+}
+
+/**
+ * Write one frame of a delta and update its reference.
+ */
+static void
+encode_frame(const dp::Frame& frame, dp::Frame* ref,
+             float grid, float danger_step, pbio::CodedOutputStream* out) {
+  out->WriteVarint32(frame.source_id());
+  uint8_t fmask = 0;
+  if (fabsf(frame.sum_danger() - ref->sum_danger()) > danger_step) {
+    fmask |= FRAME_SUM_DANGER;
+  }
+  out->WriteRaw(&fmask, 1);
+  out->WriteVarint64(zigzag64(
+    (int64_t)frame.frame_num() - (int64_t)ref->frame_num()));
+  out->WriteVarint64(zigzag64((int64_t)(frame.pts() - ref->pts())));
+  out->WriteVarint64(zigzag64((int64_t)(frame.dts() - ref->dts())));
+  if (fmask & FRAME_SUM_DANGER) {
+    out->WriteLittleEndian32(float_bits(frame.sum_danger()));
+    ref->set_sum_danger(frame.sum_danger());
+  }
+  ref->set_source_id(frame.source_id());
+  ref->set_frame_num(frame.frame_num());
+  ref->set_pts(frame.pts());
+  ref->set_dts(frame.dts());
+
+  // people, and where each of them was in the reference
+  int count = frame.people_size();
+  out->WriteVarint32(count);
+  std::vector<int> src;
+  match_people(frame, *ref, &src);
+  int old_count = ref->people_size();
+  uint32_t moved = 0;
+  int last = -1;
+  for (int i = 0; i < count; i++) {
+    if (src[i] != next_source(last, old_count)) {
+      moved++;
+    }
+    last = src[i] >= 0 ? src[i] : last;
+  }
+  out->WriteVarint32(moved);
+  if (moved) {
+    int next = 0;
+    last = -1;
+    for (int i = 0; i < count; i++) {
+      int expected = next_source(last, old_count);
+      last = src[i] >= 0 ? src[i] : last;
+      if (src[i] == expected) {
+        continue;
+      }
+      out->WriteVarint32(i - next);
+      next = i + 1;
+      out->WriteVarint32(zigzag32(src[i] - expected));
+    }
+    remap_people(ref, src);
+  } else {
+    resize_people(ref, count);
+  }
+  uint32_t changed = 0;
+  for (int i = 0; i < count; i++) {
+    if (person_mask(frame.people(i), ref->people(i), grid, danger_step)) {
+      changed++;
+    }
+  }
+  out->WriteVarint32(changed);
+  int next = 0;
+  for (int i = 0; i < count && changed; i++) {
+    const dp::Person& person = frame.people(i);
+    dp::Person* rp = ref->mutable_people(i);
+    uint8_t mask = person_mask(person, *rp, grid, danger_step);
+    if (!mask) {
+      continue;
+    }
+    changed--;
+    out->WriteVarint32(i - next);
+    next = i + 1;
+    out->WriteRaw(&mask, 1);
+    for (int field = 0; field < BOX_FIELDS; field++) {
+      if (!(mask & (1 << field))) {
+        continue;
+      }
+      int32_t q_new = quantize(get_box(person.bbox(), field), grid);
+      int32_t q_ref = quantize(get_box(rp->bbox(), field), grid);
+      out->WriteVarint32(zigzag32(q_new - q_ref));
+      // what the decoder will have
+      set_box(rp->mutable_bbox(), field, q_new * grid);
+    }
+    if (mask & PERSON_DANGER_VAL) {
+      out->WriteLittleEndian32(float_bits(person.danger_val()));
+      rp->set_danger_val(person.danger_val());
+    }
+    if (mask & PERSON_UID) {
+      out->WriteVarint32(zigzag32(person.uid()));
+      rp->set_uid(person.uid());
+    }
+    rp->set_is_danger(mask & PERSON_IS_DANGER);
+  }
+}
+
+/**
+ * Read one frame of a delta into its reference.
+ *
+ * Returns true on success, false on malformed input.
+ */
+static bool
+decode_frame(pbio::CodedInputStream* in, dp::Frame* ref, float grid) {
+  uint8_t fmask;
+  uint64_t frame_num, pts, dts;
+  if (!in->ReadRaw(&fmask, 1) ||
+      !in->ReadVarint64(&frame_num) ||
+      !in->ReadVarint64(&pts) ||
+      !in->ReadVarint64(&dts)) {
+    return false;
+  }
+  ref->set_frame_num(ref->frame_num() + unzigzag64(frame_num));
+  ref->set_pts(ref->pts() + unzigzag64(pts));
+  ref->set_dts(ref->dts() + unzigzag64(dts));
+  if (fmask & FRAME_SUM_DANGER) {
+    uint32_t bits;
+    if (!in->ReadLittleEndian32(&bits)) {
+      return false;
+    }
+    ref->set_sum_danger(bits_float(bits));
+  }
+
+  // people
+  uint32_t count, moved, changed;
+  if (!in->ReadVarint32(&count) || count > MAX_COUNT ||
+      !in->ReadVarint32(&moved) || moved > count) {
+    return false;
+  }
+  if (moved) {
+    int old_count = ref->people_size();
+    std::vector<int> src(count);
+    uint32_t next = 0;
+    int last = -1;
+    for (uint32_t m = 0; m <= moved; m++) {
+      // the people up to the next entry continue the run
+      uint32_t i = count;
+      uint32_t gap, offset = 0;
+      if (m < moved) {
+        if (!in->ReadVarint32(&gap) || gap >= count - next ||
+            !in->ReadVarint32(&offset)) {
+          return false;
+        }
+        i = next + gap;
+      }
+      for (; next < i; next++) {
+        src[next] = next_source(last, old_count);
+        last = src[next] >= 0 ? src[next] : last;
+      }
+      if (m == moved) {
+        break;
+      }
+      int64_t s = (int64_t) next_source(last, old_count) + unzigzag32(offset);
+      if (s < -1 || s >= old_count) {
+        return false;
+      }
+      src[i] = (int) s;
+      last = src[i] >= 0 ? src[i] : last;
+      next = i + 1;
+    }
+    remap_people(ref, src);
+  } else {
+    resize_people(ref, count);
+  }
+  if (!in->ReadVarint32(&changed) || changed > count) {
+    return false;
+  }
+  uint32_t next = 0;
+  for (uint32_t c = 0; c < changed; c++) {
+    uint32_t gap;
+    uint8_t mask;
+    if (!in->ReadVarint32(&gap) || gap >= count - next ||
+        !in->ReadRaw(&mask, 1)) {
+      return false;
+    }
+    uint32_t i = next + gap;
+    next = i + 1;
+    dp::Person* rp = ref->mutable_people(i);
+    for (int field = 0; field < BOX_FIELDS; field++) {
+      if (!(mask & (1 << field))) {
+        continue;
+      }
+      uint32_t dq;
+      if (!in->ReadVarint32(&dq)) {
+        return false;
+      }
+      int32_t q = quantize(get_box(rp->bbox(), field), grid) + unzigzag32(dq);
+      set_box(rp->mutable_bbox(), field, q * grid);
+    }
+    if (mask & PERSON_DANGER_VAL) {
+      uint32_t bits;
+      if (!in->ReadLittleEndian32(&bits)) {
+        return false;
+      }
+      rp->set_danger_val(bits_float(bits));
+    }
+    if (mask & PERSON_UID) {
+      uint32_t uid;
+      if (!in->ReadVarint32(&uid)) {
+        return false;
+      }
+      rp->set_uid(unzigzag32(uid));
+    }
+    rp->set_is_danger(mask & PERSON_IS_DANGER);
+  }
+  return true;
+}
+
+DeltaEncoder::DeltaEncoder(uint32_t keyframe_interval,
+                           float grid,
+                           float danger_step) :
+  keyframe_interval_(keyframe_interval ? keyframe_interval : 1),
+  grid_(grid > 0.0f ? grid : 1.0f),
+  danger_step_(danger_step),
+  seq_(0),
+  since_keyframe_(keyframe_interval_),
+  refs_()
+  {}
+
+bool
+DeltaEncoder::encode(const dp::Batch& batch, std::string* out) {
+  out->clear();
+  pbio::StringOutputStream raw(out);
+  pbio::CodedOutputStream coded(&raw);
+  if (since_keyframe_ >= keyframe_interval_) {
+    coded.WriteRaw(&KEYFRAME, 1);
+    coded.WriteVarint64(seq_);
+    coded.WriteLittleEndian32(float_bits(grid_));
+    coded.WriteVarint32(batch.ByteSizeLong());
+    batch.SerializeWithCachedSizes(&coded);
+    // the decoder starts over from exactly this
+    refs_.clear();
+    for (int i = 0; i < batch.frames_size(); i++) {
+      refs_[batch.frames(i).source_id()] = batch.frames(i);
+    }
+    since_keyframe_ = 1;
+  } else {
+    coded.WriteRaw(&DELTA, 1);
+    coded.WriteVarint64(seq_);
+    coded.WriteVarint32(batch.max_frames());
+    coded.WriteVarint32(batch.frames_size());
+    for (int i = 0; i < batch.frames_size(); i++) {
+      const dp::Frame& frame = batch.frames(i);
+      encode_frame(frame, &refs_[frame.source_id()],
+                   grid_, danger_step_, &coded);
+    }
+    since_keyframe_++;
+  }
+  seq_++;
+  return !coded.HadError();
+}
+
+DeltaDecoder::DeltaDecoder() :
+  synced_(false),
+  grid_(1.0f),
+  seq_(0),
+  refs_()
+  {}
+
+bool
+DeltaDecoder::is_delta_message(const uint8_t* data, size_t size) {
+  return size > 0 &&
+    (data[0] == DeltaEncoder::KEYFRAME || data[0] == DeltaEncoder::DELTA);
+}
+
+bool
+DeltaDecoder::decode(const uint8_t* data, size_t size, dp::Batch* batch) {
+  batch->Clear();
+  pbio::CodedInputStream in(data, (int)size);
+  uint8_t kind;
+  uint64_t seq;
+  if (!in.ReadRaw(&kind, 1) || !in.ReadVarint64(&seq)) {
+    return false;
+  }
+  if (kind == DeltaEncoder::KEYFRAME) {
+    uint32_t grid_bits, length;
+    if (!in.ReadLittleEndian32(&grid_bits) || !in.ReadVarint32(&length)) {
+      return false;
+    }
+    auto limit = in.PushLimit(length);
+    if (!batch->ParseFromCodedStream(&in) || !in.ConsumedEntireMessage()) {
+      synced_ = false;
+      return false;
+    }
+    in.PopLimit(limit);
+    grid_ = bits_float(grid_bits);
+    seq_ = seq;
+    refs_.clear();
+    for (int i = 0; i < batch->frames_size(); i++) {
+      refs_[batch->frames(i).source_id()] = batch->frames(i);
+    }
+    synced_ = true;
+    return true;
+  }
+  if (kind != DeltaEncoder::DELTA) {
+    return false;
+  }
+  // a delta only applies on top of the message right before it
+  if (!synced_ || seq != seq_ + 1) {
+    synced_ = false;
+    return false;
+  }
+  uint32_t max_frames, frames;
+  if (!in.ReadVarint32(&max_frames) ||
+      !in.ReadVarint32(&frames) || frames > MAX_COUNT) {
+    synced_ = false;
+    return false;
+  }
+  batch->set_max_frames(max_frames);
+  for (uint32_t i = 0; i < frames; i++) {
+    uint32_t source_id;
+    if (!in.ReadVarint32(&source_id)) {
+      synced_ = false;
+      return false;
+    }
+    dp::Frame* ref = &refs_[source_id];
+    ref->set_source_id(source_id);
+    if (!decode_frame(&in, ref, grid_)) {
+      synced_ = false;
+      return false;
+    }
+    *batch->add_frames() = *ref;
+  }
+  seq_ = seq;
+  return true;
+}
+
+} // namespace ds
@@ -0,0 +1,76 @@
+/* DeltaPayloadFilter.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "DeltaPayloadFilter.hpp"
+
+#include <cstring>
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+DeltaPayloadFilter::DeltaPayloadFilter(uint32_t keyframe_interval,
+                                       float grid,
+                                       float danger_step) :
+  ProtoPayloadFilter(sync),
+  keyframe_interval_(keyframe_interval),
+  grid_(grid),
+  danger_step_(danger_step),
+  encoder_(keyframe_interval, grid, danger_step),
+  subscription_encoders_(),
+  scratch_()
+  {}
+
+void
+DeltaPayloadFilter::force_keyframe() {
+  // on the streaming thread, since that's where the encoders are used
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  encoder_.force_keyframe();
+  for (auto& kv : subscription_encoders_) {
+    kv.second.force_keyframe();
+  }
+}
+
+Payload*
+DeltaPayloadFilter::serialize(dp::Batch* batch, uint32_t subscription) {
+  DeltaEncoder* encoder = &encoder_;
+  if (subscription) {
+    auto it = subscription_encoders_.find(subscription);
+    if (it == subscription_encoders_.end()) {
+      it = subscription_encoders_.emplace(subscription, DeltaEncoder(
+        keyframe_interval_, grid_, danger_step_)).first;
+    }
+    encoder = &it->second;
+  }
+  if (!encoder->encode(*batch, &scratch_)) {
+    // the decoder can't follow a stream with a hole in it
+    encoder->force_keyframe();
+    return nullptr;
+  }
+  auto payload = pool_->acquire(scratch_.size());
+  memcpy(payload->mutable_data(), scratch_.data(), scratch_.size());
+  payload->set_subscription(subscription);
+  return payload;
+}
+
+} // namespace ds
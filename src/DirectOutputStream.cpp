@@ -0,0 +1,224 @@
+/* DirectOutputStream.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "DirectOutputStream.hpp"
+
+#include <gst/gst.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace ds {
+
+const size_t DirectOutputStream::ALIGNMENT;
+const size_t DirectOutputStream::DEFAULT_BUFFER_SIZE;
+
+DirectOutputStream::DirectOutputStream(int fd,
+                                       bool direct,
+                                       size_t prealloc_size,
+                                       size_t writeback_size,
+                                       size_t buffer_size) :
+  fd_(fd),
+  direct_(direct),
+  prealloc_size_(prealloc_size),
+  writeback_size_(writeback_size),
+  buffer_size_(0),
+  buffer_(nullptr),
+  buffer_used_(0),
+  offset_(0),
+  allocated_(0),
+  wb_started_(0),
+  wb_end_(0),
+  closed_(false),
+  errno_(0)
+  {
+    // round the buffer up to a whole number of blocks
+    buffer_size_ = ((buffer_size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    if (buffer_size_ == 0) {
+      buffer_size_ = ALIGNMENT;
+    }
+    void* mem = nullptr;
+    if (posix_memalign(&mem, ALIGNMENT, buffer_size_) != 0) {
+      GST_ERROR("could not allocate %zu byte aligned buffer", buffer_size_);
+      errno_ = ENOMEM;
+      return;
+    }
+    buffer_ = (uint8_t*) mem;
+  }
+
+DirectOutputStream::~DirectOutputStream() {
+  if (!closed_) {
+    Close();
+  }
+  free(buffer_);
+}
+
+bool
+DirectOutputStream::Next(void** data, int* size) {
+  if (closed_ || buffer_ == nullptr || errno_) {
+    return false;
+  }
+  // the buffer is full, so write it out in one aligned chunk
+  if (buffer_used_ == buffer_size_) {
+    if (!write_buffer(buffer_size_)) {
+      return false;
+    }
+    buffer_used_ = 0;
+  }
+  *data = buffer_ + buffer_used_;
+  *size = (int)(buffer_size_ - buffer_used_);
+  buffer_used_ = buffer_size_;
+  return true;
+}
+
+void
+DirectOutputStream::BackUp(int count) {
+  buffer_used_ -= count;
+}
+
+int64_t
+DirectOutputStream::ByteCount() const {
+  return (int64_t)offset_ + buffer_used_;
+}
+
+bool
+DirectOutputStream::Close() {
+  if (closed_) {
+    return errno_ == 0;
+  }
+  closed_ = true;
+  if (buffer_ == nullptr) {
+    return false;
+  }
+  if (buffer_used_ && !errno_) {
+    size_t size = buffer_used_;
+    if (direct_) {
+      // O_DIRECT writes must be whole blocks, so pad the last one with zeros.
+      // The padding is truncated away below.
+      size = ((size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+      memset(buffer_ + buffer_used_, 0, size - buffer_used_);
+    }
+    if (write_buffer(size)) {
+      // the padding isn't data
+      offset_ -= size - buffer_used_;
+    }
+  }
+  // after a failed write only what was written in full is kept, not the
+  // rest of the buffer (or whatever part of it made it)
+  bool failed = errno_ != 0;
+  buffer_used_ = 0;
+  // drop the zero padding and any preallocated extents past the data
+  if ((direct_ || allocated_ || failed) && ftruncate(fd_, offset_) == -1) {
+    GST_ERROR("could not truncate output to %ld bytes: %s",
+      (long)offset_, strerror(errno));
+    if (!errno_) {
+      errno_ = errno;
+    }
+  }
+  return errno_ == 0;
+}
+
+bool
+DirectOutputStream::write_buffer(size_t size) {
+  reserve(offset_ + size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t written = write(fd_, buffer_ + done, size - done);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      GST_ERROR("write failed: %s", strerror(errno));
+      errno_ = errno;
+      return false;
+    }
+    // a short O_DIRECT write leaves the file offset off a block boundary,
+    // after which every write fails, so only whole blocks may be retried.
+    // no progress at all is likely a full disk.
+    if (written == 0 || (direct_ && written % ALIGNMENT)) {
+      GST_ERROR("short write: %ld of %lu bytes", (long) written,
+        (unsigned long) (size - done));
+      errno_ = written == 0 ? ENOSPC : EIO;
+      return false;
+    }
+    done += written;
+  }
+  offset_ += size;
+  pace();
+  return true;
+}
+
+void
+DirectOutputStream::reserve(off_t end) {
+  if (!prealloc_size_ || end <= allocated_) {
+    return;
+  }
+  off_t new_end = allocated_;
+  while (new_end < end) {
+    new_end += prealloc_size_;
+  }
+  // mode 0 extends the file size as well. This keeps the extents allocated
+  // until Close() truncates back to the real size.
+  if (fallocate(fd_, 0, allocated_, new_end - allocated_) == -1) {
+    GST_WARNING("fallocate failed (%s), disabling preallocation",
+      strerror(errno));
+    prealloc_size_ = 0;
+    return;
+  }
+  allocated_ = new_end;
+}
+
+void
+DirectOutputStream::pace() {
+  // O_DIRECT bypasses the page cache, so there is nothing to pace
+  if (direct_ || !writeback_size_) {
+    return;
+  }
+  if (offset_ - wb_end_ < (off_t)writeback_size_) {
+    return;
+  }
+  // wait on the window started last time and drop it from the page cache,
+  // so at most two windows are ever dirty at once
+  if (wb_end_ > wb_started_) {
+    if (sync_file_range(fd_, wb_started_, wb_end_ - wb_started_,
+                        SYNC_FILE_RANGE_WAIT_BEFORE |
+                        SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER) == -1) {
+      GST_WARNING("sync_file_range failed: %s", strerror(errno));
+    }
+    posix_fadvise(fd_, wb_started_, wb_end_ - wb_started_,
+                  POSIX_FADV_DONTNEED);
+  }
+  // start asynchronous writeback of the new window
+  if (sync_file_range(fd_, wb_end_, offset_ - wb_end_,
+                      SYNC_FILE_RANGE_WRITE) == -1) {
+    GST_WARNING("sync_file_range failed: %s", strerror(errno));
+  }
+  wb_started_ = wb_end_;
+  wb_end_ = offset_;
+}
+
+} // namespace ds
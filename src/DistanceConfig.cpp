@@ -0,0 +1,205 @@
+/* DistanceConfig.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "DistanceConfig.hpp"
+
+#include <gst/gst.h>
+
+#include <math.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+GST_DEBUG_CATEGORY_STATIC(distanceconfig);
+
+namespace ds {
+
+static const bool DEFAULT_DO_DRAWING=false;
+static const float DEFAULT_FILTER_HEIGHT_DIFF=0.25f;
+static const float DEFAULT_DANGER_THRESHOLD=1.0f;
+static const float DEFAULT_RAMP_DANGER=1.0f;
+static const Rgba DEFAULT_RAMP_LOW={0.2f, 0.2f, 0.2f, 0.2f};
+static const Rgba DEFAULT_RAMP_HIGH={0.8f, 0.2f, 0.2f, 0.8f};
+static const int DEFAULT_CLASS_ID=0;
+
+SourceConfig::SourceConfig() {
+  this->do_drawing = DEFAULT_DO_DRAWING;
+  this->filter_height_diff = DEFAULT_FILTER_HEIGHT_DIFF;
+  this->danger_threshold = DEFAULT_DANGER_THRESHOLD;
+  this->ramp_danger = DEFAULT_RAMP_DANGER;
+  this->ramp_low = DEFAULT_RAMP_LOW;
+  this->ramp_high = DEFAULT_RAMP_HIGH;
+}
+
+Rgba
+SourceConfig::color(float danger) const {
+  float t = danger / ramp_danger;
+  t = t > 0.0f ? (t < 1.0f ? t : 1.0f) : 0.0f;
+  return {
+    ramp_low.red + (ramp_high.red - ramp_low.red) * t,
+    ramp_low.green + (ramp_high.green - ramp_low.green) * t,
+    ramp_low.blue + (ramp_high.blue - ramp_low.blue) * t,
+    ramp_low.alpha + (ramp_high.alpha - ramp_low.alpha) * t,
+  };
+}
+
+DistanceConfig::DistanceConfig() :
+  defaults(),
+  sources()
+{
+  this->class_id = DEFAULT_CLASS_ID;
+}
+
+/**
+ * Parse a finite float, the whole of `s`.
+ */
+static bool
+parse_float(const std::string& s, float* value) {
+  char* end;
+  *value = strtof(s.c_str(), &end);
+  return !s.empty() && *end == '\0' && isfinite(*value);
+}
+
+/**
+ * Parse an integer, the whole of `s`.
+ */
+static bool
+parse_long(const std::string& s, long* value) {
+  char* end;
+  *value = strtol(s.c_str(), &end, 10);
+  return !s.empty() && *end == '\0';
+}
+
+/**
+ * Parse true/false/1/0.
+ */
+static bool
+parse_bool(const std::string& s, bool* value) {
+  if (s == "true" || s == "1") {
+    *value = true;
+  } else if (s == "false" || s == "0") {
+    *value = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Parse an r,g,b,a color, each from 0 to 1, the whole of `s`.
+ */
+static bool
+parse_color(const std::string& s, Rgba* color) {
+  float* channels[] = {
+    &color->red, &color->green, &color->blue, &color->alpha};
+  const char* p = s.c_str();
+  for (size_t i = 0; i < 4; i++) {
+    char* end;
+    *channels[i] = strtof(p, &end);
+    if (end == p || !(*channels[i] >= 0.0f && *channels[i] <= 1.0f) ||
+        *end != (i == 3 ? '\0' : ',')) {
+      return false;
+    }
+    p = end + 1;
+  }
+  return true;
+}
+
+bool
+DistanceConfig::parse(const std::string& text, DistanceConfig* config) {
+  GST_DEBUG_CATEGORY_INIT(distanceconfig, "distanceconfig", 0,
+    "DistanceConfig debug category.");
+  *config = DistanceConfig();
+  std::istringstream lines(text);
+  std::string line;
+  SourceConfig* source = &config->defaults;
+  for (int number = 1; std::getline(lines, line); number++) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.resize(comment);
+    }
+    std::istringstream words(line);
+    std::string key, value, extra;
+    if (!(words >> key)) {
+      continue;
+    }
+    if (!(words >> value) || (words >> extra)) {
+      GST_WARNING("line %d: expected %s <value>", number, key.c_str());
+      return false;
+    }
+    long l;
+    bool ok = true;
+    if (key == "source") {
+      ok = parse_long(value, &l) && l >= 0 && l <= UINT32_MAX;
+      if (ok) {
+        // later sections for the same source start over
+        source = &config->sources[(uint32_t) l];
+        *source = config->defaults;
+      }
+    } else if (key == "class_id") {
+      // the same for every source
+      ok = source == &config->defaults && parse_long(value, &l) &&
+        l >= INT32_MIN && l <= INT32_MAX;
+      if (ok) {
+        config->class_id = (int) l;
+      }
+    } else if (key == "do_drawing") {
+      ok = parse_bool(value, &source->do_drawing);
+    } else if (key == "filter_height_diff") {
+      ok = parse_float(value, &source->filter_height_diff) &&
+        source->filter_height_diff >= 0.0f;
+    } else if (key == "danger_threshold") {
+      ok = parse_float(value, &source->danger_threshold);
+    } else if (key == "ramp_danger") {
+      ok = parse_float(value, &source->ramp_danger) &&
+        source->ramp_danger > 0.0f;
+    } else if (key == "ramp_low") {
+      ok = parse_color(value, &source->ramp_low);
+    } else if (key == "ramp_high") {
+      ok = parse_color(value, &source->ramp_high);
+    } else {
+      GST_WARNING("line %d: unknown key: %s", number, key.c_str());
+      return false;
+    }
+    if (!ok) {
+      GST_WARNING("line %d: bad %s: %s", number, key.c_str(), value.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+DistanceConfig::load(const std::string& filename, DistanceConfig* config) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    GST_WARNING("could not open %s", filename.c_str());
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return parse(text.str(), config);
+}
+
+} // namespace ds
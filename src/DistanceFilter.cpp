@@ -40,27 +40,24 @@
  */
 
 #include "DistanceFilter.hpp"
+#include "CompactBatch.hpp"
+#include "Danger.hpp"
+#include "PackedBatch.hpp"
+#include "Trace.hpp"
 #include "distance.pb.h"
 
-#include <math.h>
-
 namespace dp = distanceproto;
 
 namespace ds {
 
-static const bool DEFAULT_DO_DRAWING=false;
-static const float DEFAULT_FILTER_HEIGHT_DIFF=0.25f;
-static const float DEFAULT_CLASS_ID=0;
+static const bool DEFAULT_COMPACT_META=false;
+static const bool DEFAULT_PACKED_META=false;
+static const bool DEFAULT_ADAPTIVE=false;
+static const bool DEFAULT_FIND_GROUPS=false;
+static const uint32_t DEFAULT_MIN_GROUP_SIZE=2;
 static const int OBJ_LABEL_MAX_LEN=8;
 // static const int FRAME_LABEL_MAX_LEN=16;
 
-/**
- * Calculate how dangerous a list element is based on proximity to other
- * list elements.
- */
-static float
-calculate_how_dangerous(int class_id, NvDsMetaList* l_obj, float danger_distance);
-
 /**
  * NvDsUserMeta copy function for batch level distance metadata.
  */
@@ -89,21 +86,128 @@ static void release_dp_batch_meta(gpointer data, gpointer user_data) {
   delete batch_proto;
 }
 
-DistanceFilter::DistanceFilter() {
+/**
+ * NvDsUserMeta copy function for compact batch level distance metadata.
+ */
+static gpointer copy_compact_batch_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  return (gpointer) ((CompactBatch*)(user_meta->user_meta_data))->copy();
+}
+
+/**
+ * NvDsUserMeta release function for compact batch level distance metadata.
+ */
+static void release_compact_batch_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  CompactBatch::destroy((CompactBatch*)(user_meta->user_meta_data));
+}
+
+/**
+ * NvDsUserMeta copy function for packed batch level distance metadata.
+ */
+static gpointer copy_packed_batch_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  return (gpointer) new PackedBatch(*(PackedBatch*)(user_meta->user_meta_data));
+}
+
+/**
+ * NvDsUserMeta release function for packed batch level distance metadata.
+ */
+static void release_packed_batch_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  delete (PackedBatch*)(user_meta->user_meta_data);
+}
+
+/**
+ * NvDsUserMeta copy function for batch level group metadata.
+ */
+static gpointer copy_groups_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  return (gpointer) new BatchGroups(*(BatchGroups*)(user_meta->user_meta_data));
+}
+
+/**
+ * NvDsUserMeta release function for batch level group metadata.
+ */
+static void release_groups_meta(gpointer data, gpointer user_data) {
+  (void)user_data;
+
+  NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
+
+  delete (BatchGroups*)(user_meta->user_meta_data);
+}
+
+DistanceFilter::DistanceFilter() :
+  config_(std::unique_ptr<DistanceConfig>(new DistanceConfig()))
+{
   // copypasta from the protobuf docs:
   // Verify that the version of the library that we linked against is
   // compatible with the version of the headers we compiled against.
   GOOGLE_PROTOBUF_VERIFY_VERSION;
   // set some default values for this
-  this->do_drawing = DEFAULT_DO_DRAWING;
-  this->class_id = DEFAULT_CLASS_ID;
-  this->filter_height_diff = DEFAULT_FILTER_HEIGHT_DIFF;
+  this->compact_meta = DEFAULT_COMPACT_META;
+  this->packed_meta = DEFAULT_PACKED_META;
+  this->adaptive = DEFAULT_ADAPTIVE;
+  this->find_groups = DEFAULT_FIND_GROUPS;
+  this->min_group_size = DEFAULT_MIN_GROUP_SIZE;
+}
+
+void
+DistanceFilter::set_config(const DistanceConfig& config) {
+  this->config_.publish(
+    std::unique_ptr<DistanceConfig>(new DistanceConfig(config)));
+}
+
+bool
+DistanceFilter::load_config(const std::string& filename) {
+  std::unique_ptr<DistanceConfig> config(new DistanceConfig());
+  if (!DistanceConfig::load(filename, config.get())) {
+    return false;
+  }
+  this->config_.publish(std::move(config));
+  return true;
+}
+
+void
+DistanceFilter::set_roi(uint32_t source_id, const RoiMask& roi) {
+  roi_[source_id] = roi;
+}
+
+void
+DistanceFilter::clear_roi(uint32_t source_id) {
+  roi_.erase(source_id);
+}
+
+bool
+DistanceFilter::load_roi(const std::string& filename) {
+  RoiMasks masks;
+  if (!RoiMask::load(filename, &masks)) {
+    return false;
+  }
+  roi_.swap(masks);
+  return true;
 }
 
 // TODO(mdegans): split this function up and clean it up
 GstFlowReturn
 DistanceFilter::on_buffer(GstBuffer* buf)
 {
+  DS_TRACE_SCOPE("DistanceFilter::on_buffer");
   /**
    * https://gstreamer.freedesktop.org/documentation/gstreamer/gstbuffer.html
    *
@@ -114,7 +218,10 @@ DistanceFilter::on_buffer(GstBuffer* buf)
   buf = gst_buffer_make_writable(buf);
 
   float person_danger=0.0f;
-  float color_val=0.0f;
+  bool person_is_danger=false;
+
+  // the parameters for this buffer, whatever set_config() does meanwhile
+  const DistanceConfig* config = this->config_.acquire();
 
   // GList of NvDsFrameMeta
   NvDsMetaList* l_frame = nullptr;
@@ -127,11 +234,15 @@ DistanceFilter::on_buffer(GstBuffer* buf)
     return GST_FLOW_OK;
   }
   // we need to lock the metadata
+  DS_TRACE_BEGIN("meta_lock.wait");
   nvds_acquire_meta_lock(batch_meta);
+  DS_TRACE_END("meta_lock.wait");
+  DS_TRACE_BEGIN("meta_lock.held");
   // Nvidia user metadata structure
   NvDsUserMeta* user_meta = nvds_acquire_user_meta_from_pool(batch_meta);
   if (user_meta == nullptr) {
     GST_WARNING("dsdistance: could not get user meta from batch pool !!!");
+    DS_TRACE_END("meta_lock.held");
     nvds_release_meta_lock(batch_meta);
     return GST_FLOW_OK;
   }
@@ -143,16 +254,75 @@ DistanceFilter::on_buffer(GstBuffer* buf)
   NvOSD_RectParams* rect_params = nullptr;
   NvOSD_TextParams* text_params = nullptr;
 
-  // our Batch level metadata
-  auto batch_proto = new dp::Batch();
-  // attach it to nvidia user meta
-  user_meta->user_meta_data = (void*) batch_proto;
-  user_meta->base_meta.meta_type = DF_USER_BATCH_META;
-  user_meta->base_meta.copy_func = (NvDsMetaCopyFunc) copy_dp_batch_meta;
-  user_meta->base_meta.release_func = (NvDsMetaReleaseFunc) release_dp_batch_meta;
+  // our Batch level metadata (only one of them)
+  dp::Batch* batch_proto = nullptr;
+  CompactBatch* batch_compact = nullptr;
+  PackedBatch* batch_packed = nullptr;
+  // size compact and packed batches in one go, with room for every object
+  guint num_frames = 0;
+  guint num_objects = 0;
+  if (this->packed_meta || this->compact_meta) {
+    for (l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
+        l_frame = l_frame->next) {
+      frame_meta = (NvDsFrameMeta *) (l_frame->data);
+      if (frame_meta != nullptr) {
+        num_frames++;
+        num_objects += frame_meta->num_obj_meta;
+      }
+    }
+  }
+  if (this->packed_meta) {
+    batch_packed = new PackedBatch();
+    batch_packed->set_max_frames(batch_meta->max_frames_in_batch);
+    batch_packed->reserve(num_frames, num_objects);
+    // attach it to nvidia user meta
+    user_meta->user_meta_data = (void*) batch_packed;
+    user_meta->base_meta.meta_type = DF_USER_PACKED_BATCH_META;
+    user_meta->base_meta.copy_func = (NvDsMetaCopyFunc) copy_packed_batch_meta;
+    user_meta->base_meta.release_func = (NvDsMetaReleaseFunc) release_packed_batch_meta;
+  } else if (this->compact_meta) {
+    batch_compact = CompactBatch::create(
+      batch_meta->max_frames_in_batch, num_frames, num_objects);
+    if (batch_compact == nullptr) {
+      GST_WARNING("dsdistance: could not allocate compact batch !!!");
+      DS_TRACE_END("meta_lock.held");
+      nvds_release_meta_lock(batch_meta);
+      return GST_FLOW_OK;
+    }
+    // attach it to nvidia user meta
+    user_meta->user_meta_data = (void*) batch_compact;
+    user_meta->base_meta.meta_type = DF_USER_COMPACT_BATCH_META;
+    user_meta->base_meta.copy_func = (NvDsMetaCopyFunc) copy_compact_batch_meta;
+    user_meta->base_meta.release_func = (NvDsMetaReleaseFunc) release_compact_batch_meta;
+  } else {
+    batch_proto = new dp::Batch();
+    batch_proto->set_max_frames(batch_meta->max_frames_in_batch);
+    // attach it to nvidia user meta
+    user_meta->user_meta_data = (void*) batch_proto;
+    user_meta->base_meta.meta_type = DF_USER_BATCH_META;
+    user_meta->base_meta.copy_func = (NvDsMetaCopyFunc) copy_dp_batch_meta;
+    user_meta->base_meta.release_func = (NvDsMetaReleaseFunc) release_dp_batch_meta;
+  }
   // add nvidia user meta to the batch
   nvds_add_user_meta_to_batch(batch_meta, user_meta);
 
+  // group metadata goes alongside, in its own user meta
+  BatchGroups* batch_groups = nullptr;
+  if (this->find_groups) {
+    NvDsUserMeta* groups_meta = nvds_acquire_user_meta_from_pool(batch_meta);
+    if (groups_meta == nullptr) {
+      GST_WARNING("dsdistance: could not get user meta for groups !!!");
+    } else {
+      batch_groups = new BatchGroups();
+      batch_groups->frames.reserve(batch_meta->num_frames_in_batch);
+      groups_meta->user_meta_data = (void*) batch_groups;
+      groups_meta->base_meta.meta_type = DF_USER_GROUPS_META;
+      groups_meta->base_meta.copy_func = (NvDsMetaCopyFunc) copy_groups_meta;
+      groups_meta->base_meta.release_func = (NvDsMetaReleaseFunc) release_groups_meta;
+      nvds_add_user_meta_to_batch(batch_meta, groups_meta);
+    }
+  }
+
   // for frame_meta in frame_meta_list
   for (l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
       l_frame = l_frame->next) {
@@ -166,61 +336,155 @@ DistanceFilter::on_buffer(GstBuffer* buf)
     }
 
     // our Frame level metadata
-    auto frame_proto = batch_proto->add_frames();
+    dp::Frame* frame_proto = nullptr;
+    CompactFrame* frame_compact = nullptr;
+    PackedFrame* frame_packed = nullptr;
 
     // copy some frame meta
-    frame_proto->set_frame_num(frame_meta->frame_num);
-    frame_proto->set_pts(frame_meta->buf_pts);
-    frame_proto->set_dts(frame_meta->ntp_timestamp);
-
-    // danger score for this frame
-    float frame_danger = 0.0f;
+    if (batch_packed) {
+      frame_packed = batch_packed->add_frame();
+      frame_packed->frame_num = frame_meta->frame_num;
+      frame_packed->pts = frame_meta->buf_pts;
+      frame_packed->dts = frame_meta->ntp_timestamp;
+    } else if (batch_compact) {
+      frame_compact = batch_compact->add_frame();
+      frame_compact->frame_num = frame_meta->frame_num;
+      frame_compact->pts = frame_meta->buf_pts;
+      frame_compact->dts = frame_meta->ntp_timestamp;
+    } else {
+      frame_proto = batch_proto->add_frames();
+      frame_proto->set_frame_num(frame_meta->frame_num);
+      frame_proto->set_pts(frame_meta->buf_pts);
+      frame_proto->set_dts(frame_meta->ntp_timestamp);
+    }
 
-    // for obj_meta in obj_meta_list
+    // this source's parameters
+    const SourceConfig& source = config->source(frame_meta->source_id);
+    // this source's region of interest, if it has one
+    const RoiMask* roi = nullptr;
+    if (!this->roi_.empty()) {
+      auto it = this->roi_.find(frame_meta->source_id);
+      if (it != this->roi_.end()) {
+        roi = &it->second;
+      }
+    }
+    // gather the people, leaving out anybody outside the roi
+    this->people_.clear();
+    this->boxes_.clear();
     for (l_obj = frame_meta->obj_meta_list; l_obj != nullptr;
          l_obj = l_obj->next) {
       obj_meta = (NvDsObjectMeta *) (l_obj->data);
       // skip the object, if it's not a person
-      if (obj_meta->class_id != this->class_id) {
+      if (obj_meta->class_id != config->class_id) {
+        continue;
+      }
+      rect_params = &(obj_meta->rect_params);
+      if (roi && !roi->contains_feet(rect_params->left, rect_params->top,
+                                     rect_params->width, rect_params->height)) {
         continue;
       }
+      this->people_.push_back(obj_meta);
+      Box box = {rect_params->left, rect_params->top,
+                 rect_params->width, rect_params->height};
+      this->boxes_.push_back(box);
+    }
 
-      // our Person level metadata
-      dp::Person* person_proto = frame_proto->add_people();
-      // metadata for the person's bounding box
-      auto bb_proto = new dp::BBox();
+    // danger score for this frame
+    float frame_danger = 0.0f;
+    // in violation means is_danger, whatever this source's threshold is
+    this->scheduler.violation_danger = source.danger_threshold;
+    // whether to compute danger, or reuse the last results for this source
+    bool compute = !this->adaptive ||
+      this->scheduler.begin_frame(frame_meta, this->people_);
+    // our Frame level group metadata
+    FrameGroups* frame_groups = nullptr;
+    if (batch_groups) {
+      batch_groups->frames.emplace_back();
+      frame_groups = &batch_groups->frames.back();
+      frame_groups->frame_num = frame_meta->frame_num;
+      frame_groups->source_id = frame_meta->source_id;
+      frame_groups->pts = frame_meta->buf_pts;
+      if (compute) {
+        this->finder_.reset(this->people_.size());
+      }
+    }
+
+    // no room left for people in the compact batch
+    bool compact_full = false;
+    for (size_t i = 0; i < this->people_.size(); i++) {
+      obj_meta = this->people_[i];
 
       rect_params = &(obj_meta->rect_params);
       text_params = &(obj_meta->text_params); // TODO(mdegans, osd labels?)
-      // record the bounding box and set it on the person
-      bb_proto->set_height(rect_params->height);
-      bb_proto->set_left(rect_params->left);
-      bb_proto->set_top(rect_params->top);
-      bb_proto->set_width(rect_params->width);
-      person_proto->set_allocated_bbox(bb_proto);
 
       // get how dangerous the object is as a float
-      person_danger = calculate_how_dangerous(
-          this->class_id, l_obj, this->filter_height_diff);
-      // set it on the person metadata
-      person_proto->set_danger_val(person_danger);
+      if (compute) {
+        person_danger = how_dangerous(
+            this->boxes_, i, source.filter_height_diff,
+            frame_groups ? &this->finder_ : nullptr);
+        if (this->adaptive) {
+          this->scheduler.set_danger(obj_meta, person_danger);
+        }
+      } else {
+        person_danger = this->scheduler.get_danger(obj_meta);
+      }
+      person_is_danger = person_danger >= source.danger_threshold;
+      // the tracker's id, as much of it as fits
+      int32_t uid = obj_meta->object_id == UNTRACKED_OBJECT_ID ?
+        0 : (int32_t) obj_meta->object_id;
+
+      // our Person level metadata
+      if (frame_packed) {
+        batch_packed->add_person(rect_params->left, rect_params->top,
+          rect_params->width, rect_params->height, person_danger,
+          person_is_danger, uid);
+      } else if (frame_compact) {
+        auto person_compact = compact_full ?
+          nullptr : batch_compact->add_person();
+        if (person_compact) {
+          person_compact->left = rect_params->left;
+          person_compact->top = rect_params->top;
+          person_compact->width = rect_params->width;
+          person_compact->height = rect_params->height;
+          person_compact->danger_val = person_danger;
+          person_compact->is_danger = person_is_danger;
+          person_compact->uid = uid;
+        } else if (!compact_full) {
+          // sized by num_obj_meta, which whoever edited obj_meta_list
+          // didn't keep up to date, so the rest of the frame is left out
+          GST_WARNING("dsdistance: compact batch full, frame %d is missing "
+            "people !!!", frame_meta->frame_num);
+          compact_full = true;
+        }
+      } else {
+        dp::Person* person_proto = frame_proto->add_people();
+        person_proto->set_uid(uid);
+        // metadata for the person's bounding box
+        auto bb_proto = new dp::BBox();
+        // record the bounding box and set it on the person
+        bb_proto->set_height(rect_params->height);
+        bb_proto->set_left(rect_params->left);
+        bb_proto->set_top(rect_params->top);
+        bb_proto->set_width(rect_params->width);
+        person_proto->set_allocated_bbox(bb_proto);
+        // set it on the person metadata
+        person_proto->set_danger_val(person_danger);
+        if (person_is_danger) {
+          person_proto->set_is_danger(true);
+        }
+      }
       // set it on the osd metadata
       g_free(text_params->display_text);
       text_params->display_text = (gchararray) g_malloc0(OBJ_LABEL_MAX_LEN);
       snprintf(
         text_params->display_text, OBJ_LABEL_MAX_LEN, "%.2f", person_danger);
 
-      // TODO(mdegans): make this configurable
-      if (person_danger >= 1.0) {
-        person_proto->set_is_danger(true);
-      }
       // add it to the frame danger score
       frame_danger += person_danger;
 
-      if (this->do_drawing) {
+      if (source.do_drawing) {
         // make the box opaque and red depending on the danger
-        color_val = (person_danger * 0.6f);
-        color_val = color_val < 0.6f ? color_val : 0.6f;
+        Rgba color = source.color(person_danger);
 
         // gchararray display_text = nullptr;
         // sprintf(display_text, "%.2f", person_danger);
@@ -228,106 +492,42 @@ DistanceFilter::on_buffer(GstBuffer* buf)
 
         rect_params->border_width = 0;
         rect_params->has_bg_color = 1;
-        rect_params->bg_color.red = (double) color_val + 0.2;
-        rect_params->bg_color.green = 0.2;
-        rect_params->bg_color.blue = 0.2;
-        rect_params->bg_color.alpha = (double) color_val + 0.2;
+        rect_params->bg_color.red = color.red;
+        rect_params->bg_color.green = color.green;
+        rect_params->bg_color.blue = color.blue;
+        rect_params->bg_color.alpha = color.alpha;
       }
     }
-    // set the sum danger for the frame
-    frame_proto->set_sum_danger(frame_danger);
-    // set the origin id
-    frame_proto->set_source_id(frame_meta->source_id);
-  }
-  nvds_release_meta_lock(batch_meta);
-  return GST_FLOW_OK;
-}
-
-/**
- * Calculate distance between the center of the bottom edge of two rectangles
- */
-static float
-distance_between(NvOSD_RectParams* a, NvOSD_RectParams* b) {
-  // use the middle of the feet as a center point.
-  int ax = a->left + a->width / 2;
-  int ay = a->top + a->height;
-  int bx = b->left + b->width / 2;
-  int by = b->top + b->height;
-
-  int dx = ax - bx;
-  int dy = ay - by;
-
-  return sqrtf((float)(dx * dx + dy * dy));
-}
-
-/**
- * Return true if how_much % height difference.
- *
- * @param how_much is the height % difference between two bounding boxes
- * after which a true value is returned.
- *
- * if (abs(current->rect_params.height - other->rect_params.height) > current->rect_params.height * how_much) {
- *   return true;
- * }
- * 
- * A true return value may be used to skip a detection. The idea is that
- * Higher height difference either meas kid or a narrow camera angle or far away.
- * camera angles where people in the foreground against a background like a crowd
- * are missed, so this can help to fix that by filtering out these pairs.
- *
- */
-static bool
-too_far(const NvDsObjectMeta* current, const NvDsObjectMeta* other, const float how_much) {
-  if (abs(current->rect_params.height - other->rect_params.height) > current->rect_params.height * how_much) {
-    return true;
-  }
-  return false;
-}
-
-static float
-calculate_how_dangerous(int class_id, NvDsMetaList* l_obj, float background_cutoff=0.25f) {
-  NvDsObjectMeta* current = (NvDsObjectMeta *) (l_obj->data);
-  NvDsObjectMeta* other;
-
-  float how_dangerous = 0.0f;  // sum of all normalized violation distances.
-  float danger_distance = current->rect_params.height;
-  float d; // distance temp (in pixels).
-
-  // TODO(mdegans): combine these two loops into one function?
-  // there may be a function to do this (iteration in both directions from a starting
-  // element of a GList.)
-
-  // iterate forwards from current element
-  for (NvDsMetaList* f_iter = l_obj->next; f_iter != nullptr; f_iter = f_iter->next) {
-    other = (NvDsObjectMeta *) (f_iter->data);
-    if (other->class_id != class_id) {
-        continue;
-    }
-    if (too_far(current, other, background_cutoff)) {
-      continue;
-    }
-    d = danger_distance - distance_between(&(current->rect_params), &(other->rect_params));
-    if (d > 0.0) {
-      how_dangerous += d / danger_distance;
-    }
-  }
-
-  // iterate in reverse from current element
-  for (NvDsMetaList* r_iter = l_obj->prev; r_iter != nullptr; r_iter = r_iter->prev) {
-    other = (NvDsObjectMeta *) (r_iter->data);
-    if (other->class_id != class_id) {
-        continue;
+    if (this->adaptive) {
+      this->scheduler.end_frame();
     }
-    if (too_far(current, other, background_cutoff)) {
-      continue;
+    if (frame_groups) {
+      if (compute) {
+        this->finder_.collect(
+          this->boxes_, this->min_group_size, &frame_groups->groups);
+        if (this->adaptive) {
+          this->last_groups_[frame_meta->source_id] = frame_groups->groups;
+        }
+      } else {
+        frame_groups->groups = this->last_groups_[frame_meta->source_id];
+      }
     }
-    d = danger_distance - distance_between(&(current->rect_params), &(other->rect_params));
-    if (d > 0.0f) {
-      how_dangerous += d / danger_distance;
+    if (frame_packed) {
+      frame_packed->sum_danger = frame_danger;
+      frame_packed->source_id = frame_meta->source_id;
+    } else if (frame_compact) {
+      frame_compact->sum_danger = frame_danger;
+      frame_compact->source_id = frame_meta->source_id;
+    } else {
+      // set the sum danger for the frame
+      frame_proto->set_sum_danger(frame_danger);
+      // set the origin id
+      frame_proto->set_source_id(frame_meta->source_id);
     }
   }
-
-  return how_dangerous;
+  DS_TRACE_END("meta_lock.held");
+  nvds_release_meta_lock(batch_meta);
+  return GST_FLOW_OK;
 }
 
-} // namespace ds
\ No newline at end of file
+} // namespace ds
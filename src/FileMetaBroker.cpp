@@ -26,14 +26,12 @@
 //  - 
 
 #include "FileMetaBroker.hpp"
+#include "BatchWriter.hpp"
+#include "Trace.hpp"
 
 #include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/zero_copy_stream_impl.h>
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <chrono>
-#include <iomanip>
+#include <cstring>
 #include <thread>
 
 namespace dp = distanceproto;
@@ -42,10 +40,20 @@ GST_DEBUG_CATEGORY_STATIC(filemetabroker);
 
 namespace ds {
 
+static const size_t DEFAULT_DB_MAX_BATCHES = 1024;
+
 FileMetaBroker::FileMetaBroker(std::string basepath, Format format) :
+  direct_io(false),
+  prealloc_size(0),
+  writeback_size(0),
+  db_people(false),
+  db_max_batches(DEFAULT_DB_MAX_BATCHES),
   basepath_(basepath),
   format_(format),
-  queue_()
+  queue_(),
+  packed_queue_(),
+  events_queue_(),
+  events_()
   {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
     GST_DEBUG_CATEGORY_INIT(
@@ -61,148 +69,223 @@ FileMetaBroker::get_filename(){
       return basepath_ + ".csv";
     case proto:
       return basepath_ + ".coded";
+    case packed:
+      return basepath_ + ".packed";
+    case events:
+      return basepath_ + ".events";
+#ifdef DS_SQLITE
+    case sqlite:
+      return basepath_ + ".sqlite";
+#endif
     default:
       return "invalid format";
   }
 }
 
+/**
+ * Write everything from `queue` until it's flushed.
+ *
+ * Returns false on a write error.
+ */
+template <typename T>
+static bool
+write_queue(CodedBatchWriter* writer, ds::Queue<std::unique_ptr<T>>* queue) {
+  // wait for the first batch
+  auto batch = std::move(queue->get());
+  while (batch) {
+    DS_TRACE_INSTANT("FileMetaBroker::dequeue");
+    DS_TRACE_BEGIN("FileMetaBroker::write");
+    bool ok = writer->write(*batch);
+    DS_TRACE_END("FileMetaBroker::write");
+    if (!ok) {
+      return false;
+    };
+    // get the next batch (or nullptr)
+    batch = std::move(queue->get());
+  }
+  return true;
+}
+
 void
 FileMetaBroker::proto_worker_func() {
   GST_DEBUG("%s start", __func__);
   GST_DEBUG("opening %s", get_filename().c_str());
-// https://developers.google.com/protocol-buffers/docs/reference/cpp/google.protobuf.io.coded_stream
-  int fd = open(get_filename().c_str(), O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
-  if (fd == -1) {
+  CodedBatchWriter writer(format_ == packed);
+  writer.direct_io = direct_io;
+  writer.prealloc_size = prealloc_size;
+  writer.writeback_size = writeback_size;
+  if (!writer.open(get_filename())) {
     GST_ERROR("could not open for output: %s", get_filename().c_str());
     return;
   }
-  // Google's fancy, potentially zero-copy, ostream
-  auto raw = new google::protobuf::io::FileOutputStream(fd);
-  // the coded output stream
-  auto coded = new google::protobuf::io::CodedOutputStream(raw);
-  coded->WriteLittleEndian32(PROTO_MAGIC_NUMBER);
+  if (direct_io && !writer.is_direct()) {
+    // tmpfs and friends don't do O_DIRECT
+    GST_WARNING("O_DIRECT not supported for %s, using buffered writes",
+      get_filename().c_str());
+  }
+  bool ok = format_ == packed ?
+    write_queue(&writer, &packed_queue_) : write_queue(&writer, &queue_);
+  if (!ok) {
+    GST_ERROR("failed to write to %s", get_filename().c_str());
+  }
+  // write the last block and truncate to the final size
+  if (!writer.close()) {
+    GST_ERROR("failed to finish %s: %s",
+      get_filename().c_str(), strerror(writer.error()));
+  }
+}
+
+void
+FileMetaBroker::csv_worker_func() {
+  GST_DEBUG("%s start", __func__);
+  // output file opened for appending
+  CsvBatchWriter writer(true);
+  if (!writer.open(get_filename())) {
+    GST_ERROR("failed to open %s", get_filename().c_str());
+    return;
+  }
   // wait for the first batch
   auto batch = std::move(queue_.get());
   while (batch) {
-    if (!batch->SerializeToCodedStream(coded)) {
-      GST_ERROR("failed to write to %s", get_filename().c_str());
-      break;
-    };
+    DS_TRACE_INSTANT("FileMetaBroker::dequeue");
+    DS_TRACE_BEGIN("FileMetaBroker::write");
+    writer.write(*batch);
+    // flush after each batch for testing (remove this).
+    writer.flush();
+    DS_TRACE_END("FileMetaBroker::write");
     // get the next batch (or nullptr)
     batch = std::move(queue_.get());
-  }
-  delete coded;
-  delete raw;
-  if (close(fd) == EIO) {
-    GST_ERROR("I/O error closing %s", get_filename().c_str());
-  }
-}
-
-static const time_t*
-ns_to_time(const uint64_t ns) {
-  static time_t ret;
-  // std::chrono is spectacularly ugly
-  // why is it so hard to print a simple timestamp?
-  // in python this is 1-2 lines. in c++ every example is 40-50
-  auto timestamp = std::chrono::nanoseconds(ns);
-  auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timestamp);
-  // this is implementation dependent and may be wrong on platforms
-  // where a time_t is not the seconds since the epoch, but wtf
-  // this is a giant turd in c++ (at least until the formatter in c++ 20)
-  ret = seconds.count();
-  return &ret;
+  };
+  writer.close();
 }
 
-
-/**
- * Gets a std::tm struct for a frame timestamp.
- * Tries the decoder timestamp first, then the playback timestamp, then
- * falls back on the system local time as gmt.
- */
-static const std::tm*
-frame_to_time(const dp::Frame& frame) {
-  if (frame.dts()) {
-    return std::gmtime(ns_to_time(frame.dts()));
+void
+FileMetaBroker::events_worker_func() {
+  GST_DEBUG("%s start", __func__);
+  GST_DEBUG("opening %s", get_filename().c_str());
+  std::ofstream out(get_filename(), std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    GST_ERROR("could not open for output: %s", get_filename().c_str());
+    return;
   }
-  if (frame.pts()) {
-    return std::gmtime(ns_to_time(frame.pts()));
+  uint8_t header[4];
+  google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+    EVENTS_MAGIC_NUMBER, header);
+  out.write((const char*) header, sizeof(header));
+  // wait for the first message
+  auto message = std::move(events_queue_.get());
+  while (message) {
+    DS_TRACE_INSTANT("FileMetaBroker::dequeue");
+    DS_TRACE_BEGIN("FileMetaBroker::write");
+    // a varint32 is at most 5 bytes
+    uint8_t prefix[5];
+    auto end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+      (uint32_t) message->size(), prefix);
+    out.write((const char*) prefix, end - prefix);
+    out.write(message->data(), message->size());
+    // events are few and far between, so don't sit on them
+    out.flush();
+    DS_TRACE_END("FileMetaBroker::write");
+    if (!out) {
+      GST_ERROR("failed to write to %s", get_filename().c_str());
+      break;
+    }
+    // get the next message (or nullptr)
+    message = std::move(events_queue_.get());
   }
-  auto now = std::time(nullptr);
-  return std::gmtime(&now);
-}
-
-/**
- * Write a dp::Frame to a csv output stream in the format expected by
- * neuralet/smart_distancing:
- * 
- * Timestamp,DetectedObjects,ViolatingObjects,EnvironmentScore
- */
-static void
-frame_to_csv(const dp::Frame& frame, std::ostream& out) {
-  // so we'll get the danger score by dividing the sum danger by the number
-  // of people. This has the potential to be greater than 1 in extreme cases.
-  float score = 0.0f;
-  if (frame.people_size() > 0) {
-    score = frame.sum_danger() / frame.people_size();
-  }
-  // number of violating people
-  int violating = 0;
-  for (int i = 0; i < frame.people_size(); i++)
-  {
-    const dp::Person& person = frame.people(i);
-    if (person.is_danger()) violating++;
-  }
-  // this is because std::gmtime and friends are not thread safe
-  static std::mutex timelock;
-  std::lock_guard<std::mutex> lock(timelock);
-  out << std::put_time(frame_to_time(frame), "%F %T")
-    << "," << frame.people_size() << "," << violating << "," << score
-    << "," << frame.source_id() << "\n";
+  out.close();
 }
 
+#ifdef DS_SQLITE
 void
-FileMetaBroker::csv_worker_func() {
+FileMetaBroker::sqlite_worker_func() {
   GST_DEBUG("%s start", __func__);
-  // output file opened for appending
-  std::ofstream out(get_filename().c_str(), std::ios::out | std::ios::app | std::ios::ate);
-  if (!out.is_open()) {
-    GST_ERROR("failed to open %s", get_filename().c_str());
+  GST_DEBUG("opening %s", get_filename().c_str());
+  SqliteBatchWriter writer(db_people);
+  if (!writer.open(get_filename())) {
+    GST_ERROR("could not open %s: %s",
+      get_filename().c_str(), writer.message().c_str());
     return;
   }
-  // if we are at the beginning of the file, write a header line
-  if (out.tellp() == 0) {
-    out << "Timestamp,DetectedObjects,ViolatingObjects,EnvironmentScore,SourceID" << std::endl;
-  }
-  // set the number of digits for floats
-  out << std::setprecision(3) << std::fixed;
+  std::vector<std::unique_ptr<dp::Batch>> backlog;
   // wait for the first batch
   auto batch = std::move(queue_.get());
   while (batch) {
-    for (int i = 0; i < batch->frames_size(); i++)
-    {
-      frame_to_csv(batch->frames(i), out);
+    DS_TRACE_INSTANT("FileMetaBroker::dequeue");
+    DS_TRACE_BEGIN("FileMetaBroker::write");
+    // everything else already queued goes in the same transaction
+    backlog.clear();
+    if (db_max_batches > 1) {
+      queue_.drain(&backlog, db_max_batches - 1);
+    }
+    bool ok = writer.write(*batch);
+    for (size_t i = 0; ok && i < backlog.size(); i++) {
+      ok = writer.write(*backlog[i]);
+    }
+    ok = ok && writer.flush();
+    DS_TRACE_END("FileMetaBroker::write");
+    if (!ok) {
+      GST_ERROR("failed to write to %s: %s",
+        get_filename().c_str(), writer.message().c_str());
+      break;
     }
-    // flush after each batch for testing (remove this).
-    out.flush();
     // get the next batch (or nullptr)
     batch = std::move(queue_.get());
-  };
-  out.close();
+  }
+  if (!writer.close()) {
+    GST_ERROR("failed to finish %s: %s",
+      get_filename().c_str(), writer.message().c_str());
+  }
 }
+#endif  // DS_SQLITE
 
 bool
 FileMetaBroker::on_batch_meta(NvDsBatchMeta* batch_meta, dp::Batch* batch) {
   (void)batch_meta;
+  DS_TRACE_SCOPE("FileMetaBroker::on_batch_meta");
 
   GST_LOG("%s start", __func__);
+  if (format_ == events) {
+    events_.clear();
+    tracker.update(*batch, &events_);
+    if (!events_.empty()) {
+      auto message = std::unique_ptr<std::string>(new std::string());
+      ViolationTracker::encode(events_, message.get());
+      DS_TRACE_INSTANT("FileMetaBroker::enqueue");
+      events_queue_.put(std::move(message));
+    }
+    return true;
+  }
+  if (format_ == packed) {
+    // packing it here is cheaper than copying the Batch
+    auto packed_batch = std::unique_ptr<PackedBatch>(new PackedBatch());
+    packed_batch->from_proto(*batch);
+    DS_TRACE_INSTANT("FileMetaBroker::enqueue");
+    this->packed_queue_.put(std::move(packed_batch));
+    return true;
+  }
   // make a copy of the batch and stick it in a unique_ptr
   auto batch_copy = std::unique_ptr<dp::Batch>(new dp::Batch(*batch));
   // move the unique_ptr into the queue
+  DS_TRACE_INSTANT("FileMetaBroker::enqueue");
   this->queue_.put(std::move(batch_copy));
 
   return true;
 }
 
+bool
+FileMetaBroker::on_packed_meta(NvDsBatchMeta* batch_meta, PackedBatch* batch) {
+  if (format_ != packed) {
+    return this->on_batch_meta(batch_meta, batch->materialize());
+  }
+  DS_TRACE_SCOPE("FileMetaBroker::on_packed_meta");
+  // a few flat arrays, and written as is
+  auto batch_copy = std::unique_ptr<PackedBatch>(new PackedBatch(*batch));
+  DS_TRACE_INSTANT("FileMetaBroker::enqueue");
+  this->packed_queue_.put(std::move(batch_copy));
+  return true;
+}
+
 void
 FileMetaBroker::start() {
   GST_DEBUG("%s start", __func__);
@@ -212,15 +295,38 @@ FileMetaBroker::start() {
       worker_ = std::thread(&FileMetaBroker::csv_worker_func, this);
       break;
     case proto:
+    case packed:
       GST_DEBUG("spawning proto worker thread");
       worker_ = std::thread(&FileMetaBroker::proto_worker_func, this);
+      break;
+    case events:
+      GST_DEBUG("spawning events worker thread");
+      worker_ = std::thread(&FileMetaBroker::events_worker_func, this);
+      break;
+#ifdef DS_SQLITE
+    case sqlite:
+      GST_DEBUG("spawning sqlite worker thread");
+      worker_ = std::thread(&FileMetaBroker::sqlite_worker_func, this);
+#endif
   }
 }
 
 void
 FileMetaBroker::stop(bool block) {
   GST_DEBUG("%s start", __func__);
+  if (format_ == events) {
+    // end whatever is still going on, so every start has an end
+    events_.clear();
+    tracker.flush(&events_);
+    if (!events_.empty()) {
+      auto message = std::unique_ptr<std::string>(new std::string());
+      ViolationTracker::encode(events_, message.get());
+      events_queue_.put(std::move(message));
+    }
+  }
   queue_.flush();
+  packed_queue_.flush();
+  events_queue_.flush();
   if (block && worker_.joinable()){
     GST_DEBUG("%s joining", __func__);
     worker_.join();
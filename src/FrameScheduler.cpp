@@ -0,0 +1,163 @@
+/* FrameScheduler.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "FrameScheduler.hpp"
+
+#include <algorithm>
+
+namespace ds {
+
+static const uint32_t DEFAULT_MIN_INTERVAL = 1;
+static const uint32_t DEFAULT_MAX_INTERVAL = 8;
+static const uint32_t DEFAULT_VIOLATION_INTERVAL = 2;
+static const uint64_t DEFAULT_MAX_STALENESS = 250000000ull;  // 250ms
+static const float DEFAULT_MOTION_THRESHOLD = 0.05f;
+static const float DEFAULT_VIOLATION_DANGER = 1.0f;
+
+FrameScheduler::FrameScheduler() :
+  sources_(),
+  current_(nullptr),
+  pts_(0),
+  computing_(false),
+  changed_(false),
+  violation_(false),
+  cursor_(0),
+  next_(),
+  computed_(0),
+  skipped_(0)
+{
+  this->min_interval = DEFAULT_MIN_INTERVAL;
+  this->max_interval = DEFAULT_MAX_INTERVAL;
+  this->violation_interval = DEFAULT_VIOLATION_INTERVAL;
+  this->max_staleness = DEFAULT_MAX_STALENESS;
+  this->motion_threshold = DEFAULT_MOTION_THRESHOLD;
+  this->violation_danger = DEFAULT_VIOLATION_DANGER;
+}
+
+const FrameScheduler::Person*
+FrameScheduler::find(const People& people, uint64_t object_id, size_t hint) {
+  if (hint < people.size() && people[hint].object_id == object_id) {
+    return &people[hint];
+  }
+  for (const auto& person : people) {
+    if (person.object_id == object_id) {
+      return &person;
+    }
+  }
+  return nullptr;
+}
+
+bool
+FrameScheduler::changed(const Source& source,
+                        const std::vector<NvDsObjectMeta*>& people) const {
+  size_t count = 0;
+  for (const NvDsObjectMeta* obj_meta : people) {
+    if (obj_meta->object_id == UNTRACKED_OBJECT_ID) {
+      return true;
+    }
+    auto person = find(source.people, obj_meta->object_id, count++);
+    if (person == nullptr) {
+      // somebody new
+      return true;
+    }
+    const NvOSD_RectParams& rect = obj_meta->rect_params;
+    float dx = rect.left + rect.width / 2 - person->x;
+    float dy = rect.top + rect.height - person->y;
+    float limit = motion_threshold * person->height;
+    if (dx * dx + dy * dy > limit * limit) {
+      return true;
+    }
+  }
+  // somebody left
+  return count != source.people.size();
+}
+
+bool
+FrameScheduler::begin_frame(NvDsFrameMeta* frame_meta,
+                            const std::vector<NvDsObjectMeta*>& people) {
+  Source& source = sources_[frame_meta->source_id];
+  current_ = &source;
+  pts_ = frame_meta->buf_pts;
+  violation_ = false;
+  cursor_ = 0;
+  changed_ = !source.valid || changed(source, people);
+  computing_ = changed_ ||
+    source.since + 1 >= source.interval ||
+    (max_staleness && pts_ - source.pts >= max_staleness);
+  if (computing_) {
+    next_.clear();
+  }
+  return computing_;
+}
+
+void
+FrameScheduler::set_danger(const NvDsObjectMeta* obj_meta, float danger) {
+  const NvOSD_RectParams& rect = obj_meta->rect_params;
+  Person person = {obj_meta->object_id,
+    rect.left + rect.width / 2, rect.top + rect.height, rect.height, danger};
+  next_.push_back(person);
+  if (danger >= violation_danger) {
+    violation_ = true;
+  }
+}
+
+float
+FrameScheduler::get_danger(const NvDsObjectMeta* obj_meta) {
+  // people usually come in the same order as last time
+  auto person = find(current_->people, obj_meta->object_id, cursor_);
+  if (person == nullptr) {
+    return 0.0f;
+  }
+  cursor_ = person - current_->people.data() + 1;
+  return person->danger;
+}
+
+void
+FrameScheduler::end_frame() {
+  Source& source = *current_;
+  if (!computing_) {
+    source.since++;
+    skipped_++;
+    return;
+  }
+  source.people.swap(next_);
+  source.pts = pts_;
+  source.since = 0;
+  if (changed_ || !source.valid) {
+    source.interval = min_interval;
+  } else {
+    // still quiet, so look less often
+    source.interval = std::min(std::max(source.interval * 2, 1u),
+      violation_ ? violation_interval : max_interval);
+  }
+  source.valid = true;
+  computed_++;
+}
+
+void
+FrameScheduler::clear() {
+  sources_.clear();
+  current_ = nullptr;
+}
+
+} // namespace ds
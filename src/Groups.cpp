@@ -0,0 +1,163 @@
+/* Groups.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Groups.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace pbio = google::protobuf::io;
+
+namespace ds {
+
+const uint8_t BatchGroups::MAGIC;
+
+// the largest sane count in a message, to bail early on garbage
+static const uint32_t MAX_COUNT = 1 << 16;
+
+static inline uint32_t float_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+static inline float bits_float(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+void
+GroupFinder::reset(size_t n) {
+  parent_.resize(n);
+  size_.assign(n, 1);
+  for (size_t i = 0; i < n; i++) {
+    parent_[i] = i;
+  }
+}
+
+void
+GroupFinder::collect(const std::vector<Box>& boxes,
+                     uint32_t min_size, std::vector<Group>* groups) {
+  index_.assign(parent_.size(), -1);
+  size_t first = groups->size();
+  for (uint32_t i = 0; i < parent_.size(); i++) {
+    uint32_t root = find(i);
+    if (size_[root] < min_size) {
+      continue;
+    }
+    const Box& box = boxes[i];
+    if (index_[root] < 0) {
+      index_[root] = groups->size() - first;
+      Group group = {size_[root], box};
+      groups->push_back(group);
+      continue;
+    }
+    Box& bbox = (*groups)[first + index_[root]].bbox;
+    float right = std::max(bbox.left + bbox.width, box.left + box.width);
+    float bottom = std::max(bbox.top + bbox.height, box.top + box.height);
+    bbox.left = std::min(bbox.left, box.left);
+    bbox.top = std::min(bbox.top, box.top);
+    bbox.width = right - bbox.left;
+    bbox.height = bottom - bbox.top;
+  }
+}
+
+void
+BatchGroups::encode(const BatchGroups& groups, std::string* out) {
+  out->clear();
+  pbio::StringOutputStream raw(out);
+  pbio::CodedOutputStream coded(&raw);
+  coded.WriteRaw(&MAGIC, 1);
+  coded.WriteVarint32((uint32_t) groups.frames.size());
+  for (const auto& frame : groups.frames) {
+    coded.WriteVarint32((uint32_t) frame.frame_num);
+    coded.WriteVarint32(frame.source_id);
+    coded.WriteVarint64(frame.pts);
+    coded.WriteVarint32((uint32_t) frame.groups.size());
+    for (const auto& group : frame.groups) {
+      coded.WriteVarint32(group.size);
+      coded.WriteLittleEndian32(float_bits(group.bbox.left));
+      coded.WriteLittleEndian32(float_bits(group.bbox.top));
+      coded.WriteLittleEndian32(float_bits(group.bbox.width));
+      coded.WriteLittleEndian32(float_bits(group.bbox.height));
+    }
+  }
+}
+
+bool
+BatchGroups::decode(const uint8_t* data, size_t size, BatchGroups* groups) {
+  groups->frames.clear();
+  if (!is_groups_message(data, size)) {
+    return false;
+  }
+  pbio::CodedInputStream in(data + 1, (int) size - 1);
+  uint32_t num_frames;
+  if (!in.ReadVarint32(&num_frames) || num_frames > MAX_COUNT) {
+    return false;
+  }
+  groups->frames.reserve(num_frames);
+  for (uint32_t f = 0; f < num_frames; f++) {
+    FrameGroups frame;
+    uint32_t frame_num;
+    uint32_t num_groups;
+    if (!in.ReadVarint32(&frame_num) ||
+        !in.ReadVarint32(&frame.source_id) ||
+        !in.ReadVarint64(&frame.pts) ||
+        !in.ReadVarint32(&num_groups) || num_groups > MAX_COUNT) {
+      return false;
+    }
+    frame.frame_num = (int32_t) frame_num;
+    frame.groups.reserve(num_groups);
+    for (uint32_t g = 0; g < num_groups; g++) {
+      Group group;
+      uint32_t bits[4];
+      if (!in.ReadVarint32(&group.size)) {
+        return false;
+      }
+      for (auto& b : bits) {
+        if (!in.ReadLittleEndian32(&b)) {
+          return false;
+        }
+      }
+      group.bbox.left = bits_float(bits[0]);
+      group.bbox.top = bits_float(bits[1]);
+      group.bbox.width = bits_float(bits[2]);
+      group.bbox.height = bits_float(bits[3]);
+      frame.groups.push_back(group);
+    }
+    groups->frames.push_back(std::move(frame));
+  }
+  // trailing garbage means it isn't what we think it is
+  return in.ExpectAtEnd();
+}
+
+bool
+BatchGroups::is_groups_message(const uint8_t* data, size_t size) {
+  return size > 0 && data[0] == MAGIC;
+}
+
+} // namespace ds
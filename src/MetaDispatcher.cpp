@@ -0,0 +1,112 @@
+/* MetaDispatcher.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "MetaDispatcher.hpp"
+#include "Trace.hpp"
+#include "nvdsmeta.h"
+
+namespace ds {
+
+void
+MetaDispatcher::add(UserMetaHandler* handler) {
+  for (auto meta_type : handler->user_meta_types()) {
+    Route route = {meta_type, handler};
+    routes_.push_back(route);
+  }
+}
+
+bool
+MetaDispatcher::dispatch(NvDsBatchMeta* batch_meta, NvDsUserMeta* user_meta) {
+  bool ok = true;
+  auto meta_type = user_meta->base_meta.meta_type;
+  for (const auto& route : routes_) {
+    if (route.meta_type == meta_type) {
+      ok = route.handler->on_user_meta(batch_meta, user_meta) && ok;
+    }
+  }
+  return ok;
+}
+
+GList*
+MetaDispatcher::dispatch_list(NvDsBatchMeta* batch_meta,
+                              GList* begin, GList* end) {
+  GList* last = nullptr;
+  // ->next is only read after the handlers are done, so anything they
+  // append is picked up when end is nullptr
+  for (auto elem = begin; elem != end; elem = elem->next) {
+    last = elem;
+    auto user_meta = (NvDsUserMeta*) elem->data;
+    if (user_meta == nullptr){
+      GST_WARNING("empty meta found in GList");
+      continue;
+    }
+    if (!dispatch(batch_meta, user_meta)) {
+      GST_DEBUG("a handler failed on meta type %d",
+        user_meta->base_meta.meta_type);
+    }
+  }
+  return last;
+}
+
+GstFlowReturn
+MetaDispatcher::on_buffer(GstBuffer* buf)
+{
+  DS_TRACE_SCOPE("MetaDispatcher::on_buffer");
+  NvDsBatchMeta* batch_meta = gst_buffer_get_nvds_batch_meta (buf);
+  if (batch_meta == nullptr) {
+    GST_WARNING("dispatcher: no metadata attached to buffer !!!");
+    return GST_FLOW_OK;
+  }
+
+  // we need to lock the metadata (once, for everybody)
+  DS_TRACE_BEGIN("meta_lock.wait");
+  nvds_acquire_meta_lock(batch_meta);
+  DS_TRACE_END("meta_lock.wait");
+  DS_TRACE_BEGIN("meta_lock.held");
+
+  // handlers may attach meta as we go, appended (after `last`) or
+  // prepended (before `first`), and so may the handlers of that meta, so
+  // keep going until nothing new turns up. New meta always lands outside
+  // [first, last], since that's all been dispatched.
+  auto first = batch_meta->batch_user_meta_list;
+  auto last = dispatch_list(batch_meta, first, nullptr);
+  while (true) {
+    auto head = batch_meta->batch_user_meta_list;
+    if (head != first) {
+      auto tail = dispatch_list(batch_meta, head, first);
+      // the list was empty when we started
+      last = last != nullptr ? last : tail;
+      first = head;
+    } else if (last != nullptr && last->next != nullptr) {
+      last = dispatch_list(batch_meta, last->next, nullptr);
+    } else {
+      break;
+    }
+  }
+
+  DS_TRACE_END("meta_lock.held");
+  nvds_release_meta_lock(batch_meta);
+  return GST_FLOW_OK;
+}
+
+} // namespace ds
@@ -0,0 +1,112 @@
+/* ObjectSnapshot.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ObjectSnapshot.hpp"
+
+namespace ds {
+
+void
+ObjectSnapshot::clear() {
+  // clear() keeps the capacity of every column
+  frame_index.clear();
+  source_id.clear();
+  class_id.clear();
+  object_id.clear();
+  left.clear();
+  top.clear();
+  width.clear();
+  height.clear();
+  confidence.clear();
+  objects.clear();
+  frames.clear();
+  frame_begin.clear();
+}
+
+void
+ObjectSnapshot::build(NvDsBatchMeta* batch_meta, int only_class_id) {
+  clear();
+  if (batch_meta == nullptr) {
+    frame_begin.push_back(0);
+    return;
+  }
+
+  // count first, so each column grows at most once
+  size_t object_count = 0;
+  size_t frame_count = 0;
+  for (auto l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
+       l_frame = l_frame->next) {
+    auto frame_meta = (NvDsFrameMeta*) l_frame->data;
+    if (frame_meta != nullptr) {
+      frame_count++;
+      object_count += frame_meta->num_obj_meta;
+    }
+  }
+  frames.reserve(frame_count);
+  frame_begin.reserve(frame_count + 1);
+  frame_index.reserve(object_count);
+  source_id.reserve(object_count);
+  class_id.reserve(object_count);
+  object_id.reserve(object_count);
+  left.reserve(object_count);
+  top.reserve(object_count);
+  width.reserve(object_count);
+  height.reserve(object_count);
+  confidence.reserve(object_count);
+  objects.reserve(object_count);
+
+  for (auto l_frame = batch_meta->frame_meta_list; l_frame != nullptr;
+       l_frame = l_frame->next) {
+    auto frame_meta = (NvDsFrameMeta*) l_frame->data;
+    if (frame_meta == nullptr) {
+      GST_WARNING("snapshot: frame_meta is NULL");
+      continue;
+    }
+    auto index = (uint32_t) frames.size();
+    frames.push_back(frame_meta);
+    frame_begin.push_back((uint32_t) objects.size());
+    for (auto l_obj = frame_meta->obj_meta_list; l_obj != nullptr;
+         l_obj = l_obj->next) {
+      auto obj_meta = (NvDsObjectMeta*) l_obj->data;
+      if (obj_meta == nullptr) {
+        GST_WARNING("snapshot: obj_meta is NULL");
+        continue;
+      }
+      if (only_class_id >= 0 && obj_meta->class_id != only_class_id) {
+        continue;
+      }
+      frame_index.push_back(index);
+      source_id.push_back(frame_meta->source_id);
+      class_id.push_back(obj_meta->class_id);
+      object_id.push_back(obj_meta->object_id);
+      left.push_back(obj_meta->rect_params.left);
+      top.push_back(obj_meta->rect_params.top);
+      width.push_back(obj_meta->rect_params.width);
+      height.push_back(obj_meta->rect_params.height);
+      confidence.push_back(obj_meta->confidence);
+      objects.push_back(obj_meta);
+    }
+  }
+  frame_begin.push_back((uint32_t) objects.size());
+}
+
+} // namespace ds
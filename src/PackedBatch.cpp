@@ -0,0 +1,572 @@
+/* PackedBatch.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "PackedBatch.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <climits>
+#include <cstring>
+
+namespace dp = distanceproto;
+
+using pbio = google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+namespace ds {
+
+namespace {
+
+/**
+ * Tag for field `number` with `wire` type (all ours fit in one byte).
+ */
+constexpr uint32_t
+make_tag(uint32_t number, uint32_t wire) {
+  return (number << 3) | wire;
+}
+
+const uint32_t VARINT = 0;
+const uint32_t LENGTH = 2;
+const uint32_t FIXED32 = 5;
+
+// PackedBatch
+const uint32_t TAG_MAX_FRAMES = make_tag(1, VARINT);
+const uint32_t TAG_FRAMES = make_tag(2, LENGTH);
+// PackedFrame
+const uint32_t TAG_FRAME_NUM = make_tag(1, VARINT);
+const uint32_t TAG_SUM_DANGER = make_tag(3, FIXED32);
+const uint32_t TAG_PTS = make_tag(4, VARINT);
+const uint32_t TAG_DTS = make_tag(5, VARINT);
+const uint32_t TAG_SOURCE_ID = make_tag(6, VARINT);
+const uint32_t FIELD_LEFT = 7;
+const uint32_t FIELD_TOP = 8;
+const uint32_t FIELD_WIDTH = 9;
+const uint32_t FIELD_HEIGHT = 10;
+const uint32_t FIELD_DANGER_VAL = 11;
+const uint32_t TAG_IS_DANGER = make_tag(12, LENGTH);
+const uint32_t FIELD_UID = 13;
+
+inline uint32_t
+float_bits(float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+inline size_t
+int32_size(int32_t v) {
+  // negative int32s are sign extended to 10 bytes
+  return v < 0 ? 10 : pbio::VarintSize32((uint32_t) v);
+}
+
+/**
+ * Size of a packed int32 column of `n` values, without tag and length, or
+ * 0 if they're all 0 (and it's left out).
+ */
+inline size_t
+int32s_size(const int32_t* values, uint32_t n) {
+  size_t size = 0;
+  bool any = false;
+  for (uint32_t i = 0; i < n; i++) {
+    size += int32_size(values[i]);
+    any = any || values[i] != 0;
+  }
+  return any ? size : 0;
+}
+
+inline uint8_t*
+write_int32s(uint32_t number, const int32_t* values, uint32_t n,
+             size_t size, uint8_t* t) {
+  *t++ = (uint8_t) make_tag(number, LENGTH);
+  t = pbio::WriteVarint32ToArray((uint32_t) size, t);
+  for (uint32_t i = 0; i < n; i++) {
+    t = pbio::WriteVarint64ToArray((uint64_t)(int64_t) values[i], t);
+  }
+  return t;
+}
+
+/**
+ * Read an int32 column field (packed, or not) onto the end of `out`.
+ */
+bool
+read_int32s(CodedInputStream* in, uint32_t tag, std::vector<int32_t>* out) {
+  uint32_t value;
+  if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_VARINT) {
+    if (!in->ReadVarint32(&value)) {
+      return false;
+    }
+    out->push_back((int32_t) value);
+    return true;
+  }
+  if (WireFormatLite::GetTagWireType(tag) !=
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+    return false;
+  }
+  uint32_t length;
+  if (!in->ReadVarint32(&length) ||
+      length > (uint32_t) in->BytesUntilLimit()) {
+    return false;
+  }
+  auto limit = in->PushLimit((int) length);
+  while (in->BytesUntilLimit() > 0) {
+    if (!in->ReadVarint32(&value)) {
+      return false;
+    }
+    out->push_back((int32_t) value);
+  }
+  in->PopLimit(limit);
+  return true;
+}
+
+/**
+ * Size of a packed float column of `n` values, with tag and length.
+ */
+inline size_t
+floats_size(uint32_t n) {
+  return 1 + pbio::VarintSize32(n * 4) + n * 4;
+}
+
+inline uint8_t*
+write_floats(uint32_t number, const float* values, uint32_t n, uint8_t* t) {
+  *t++ = (uint8_t) make_tag(number, LENGTH);
+  t = pbio::WriteVarint32ToArray(n * 4, t);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(t, values, n * 4);
+  return t + n * 4;
+#else
+  for (uint32_t i = 0; i < n; i++) {
+    t = pbio::WriteLittleEndian32ToArray(float_bits(values[i]), t);
+  }
+  return t;
+#endif
+}
+
+/**
+ * Read a float column field (packed, or not, as the spec requires parsers
+ * to accept either) onto the end of `out`.
+ */
+bool
+read_floats(CodedInputStream* in, uint32_t tag, std::vector<float>* out) {
+  uint32_t bits;
+  if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_FIXED32) {
+    if (!in->ReadLittleEndian32(&bits)) {
+      return false;
+    }
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    out->push_back(v);
+    return true;
+  }
+  if (WireFormatLite::GetTagWireType(tag) !=
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+    return false;
+  }
+  uint32_t length;
+  if (!in->ReadVarint32(&length) || length % 4 != 0 ||
+      length > (uint32_t) in->BytesUntilLimit()) {
+    return false;
+  }
+  size_t offset = out->size();
+  out->resize(offset + length / 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return in->ReadRaw(out->data() + offset, (int) length);
+#else
+  for (uint32_t i = 0; i < length / 4; i++) {
+    if (!in->ReadLittleEndian32(&bits)) {
+      return false;
+    }
+    memcpy(out->data() + offset + i, &bits, sizeof(bits));
+  }
+  return true;
+#endif
+}
+
+}  // namespace
+
+PackedBatch::PackedBatch() :
+  max_frames_(0)
+  {}
+
+PackedBatch::PackedBatch(const PackedBatch& other) :
+  max_frames_(other.max_frames_),
+  frames_(other.frames_),
+  uid_(other.uid_),
+  left_(other.left_),
+  top_(other.top_),
+  width_(other.width_),
+  height_(other.height_),
+  danger_val_(other.danger_val_),
+  is_danger_(other.is_danger_),
+  proto_()
+  {}
+
+PackedBatch&
+PackedBatch::operator=(const PackedBatch& other) {
+  if (this != &other) {
+    max_frames_ = other.max_frames_;
+    frames_ = other.frames_;
+    uid_ = other.uid_;
+    left_ = other.left_;
+    top_ = other.top_;
+    width_ = other.width_;
+    height_ = other.height_;
+    danger_val_ = other.danger_val_;
+    is_danger_ = other.is_danger_;
+    proto_.reset();
+  }
+  return *this;
+}
+
+PackedBatch::~PackedBatch() = default;
+
+void
+PackedBatch::clear() {
+  max_frames_ = 0;
+  frames_.clear();
+  uid_.clear();
+  left_.clear();
+  top_.clear();
+  width_.clear();
+  height_.clear();
+  danger_val_.clear();
+  is_danger_.clear();
+  proto_.reset();
+}
+
+void
+PackedBatch::reserve(size_t num_frames, size_t num_people) {
+  frames_.reserve(num_frames);
+  uid_.reserve(num_people);
+  left_.reserve(num_people);
+  top_.reserve(num_people);
+  width_.reserve(num_people);
+  height_.reserve(num_people);
+  danger_val_.reserve(num_people);
+  is_danger_.reserve(num_people);
+}
+
+PackedFrame*
+PackedBatch::add_frame() {
+  frames_.emplace_back();
+  auto record = &frames_.back();
+  memset(record, 0, sizeof(*record));
+  record->first_person = (uint32_t) people_size();
+  return record;
+}
+
+void
+PackedBatch::add_person(float left, float top, float width, float height,
+                        float danger_val, bool is_danger, int32_t uid) {
+  frames_.back().num_people++;
+  uid_.push_back(uid);
+  left_.push_back(left);
+  top_.push_back(top);
+  width_.push_back(width);
+  height_.push_back(height);
+  danger_val_.push_back(danger_val);
+  is_danger_.push_back(is_danger ? 1 : 0);
+}
+
+void
+PackedBatch::from_proto(const dp::Batch& batch) {
+  clear();
+  max_frames_ = batch.max_frames();
+  size_t num_people = 0;
+  for (const auto& frame_proto : batch.frames()) {
+    num_people += frame_proto.people_size();
+  }
+  reserve(batch.frames_size(), num_people);
+  for (const auto& frame_proto : batch.frames()) {
+    auto record = add_frame();
+    record->frame_num = frame_proto.frame_num();
+    record->source_id = frame_proto.source_id();
+    record->pts = frame_proto.pts();
+    record->dts = frame_proto.dts();
+    record->sum_danger = frame_proto.sum_danger();
+    for (const auto& person : frame_proto.people()) {
+      // the default instance has all zeros if there's no bbox
+      const auto& bbox = person.bbox();
+      add_person(bbox.left(), bbox.top(), bbox.width(), bbox.height(),
+                 person.danger_val(), person.is_danger(), person.uid());
+    }
+  }
+}
+
+void
+PackedBatch::to_proto(dp::Batch* out) const {
+  out->Clear();
+  out->set_max_frames(max_frames_);
+  auto frames_out = out->mutable_frames();
+  frames_out->Reserve((int) frames_.size());
+  for (const auto& record : frames_) {
+    auto frame_proto = frames_out->Add();
+    frame_proto->set_frame_num(record.frame_num);
+    frame_proto->set_pts(record.pts);
+    frame_proto->set_dts(record.dts);
+    frame_proto->set_sum_danger(record.sum_danger);
+    frame_proto->set_source_id(record.source_id);
+    auto people_out = frame_proto->mutable_people();
+    people_out->Reserve(record.num_people);
+    for (uint32_t p = record.first_person;
+         p < record.first_person + record.num_people; p++) {
+      auto person_proto = people_out->Add();
+      person_proto->set_uid(uid_[p]);
+      auto bbox = person_proto->mutable_bbox();
+      bbox->set_left(left_[p]);
+      bbox->set_top(top_[p]);
+      bbox->set_width(width_[p]);
+      bbox->set_height(height_[p]);
+      person_proto->set_danger_val(danger_val_[p]);
+      if (is_danger_[p]) {
+        person_proto->set_is_danger(true);
+      }
+    }
+  }
+}
+
+dp::Batch*
+PackedBatch::materialize() {
+  if (!proto_) {
+    proto_.reset(new dp::Batch());
+    to_proto(proto_.get());
+  }
+  return proto_.get();
+}
+
+size_t
+PackedBatch::frame_size(const PackedFrame& f) const {
+  size_t size = 0;
+  if (f.frame_num) {
+    size += 1 + int32_size(f.frame_num);
+  }
+  if (float_bits(f.sum_danger)) {
+    size += 1 + 4;
+  }
+  if (f.pts) {
+    size += 1 + pbio::VarintSize64(f.pts);
+  }
+  if (f.dts) {
+    size += 1 + pbio::VarintSize64(f.dts);
+  }
+  if (f.source_id) {
+    size += 1 + pbio::VarintSize32(f.source_id);
+  }
+  if (f.num_people) {
+    uint32_t num_bytes = (f.num_people + 7) / 8;
+    size += 5 * floats_size(f.num_people) +
+            1 + pbio::VarintSize32(num_bytes) + num_bytes;
+    size_t uids = int32s_size(uid(f), f.num_people);
+    if (uids) {
+      size += 1 + pbio::VarintSize32((uint32_t) uids) + uids;
+    }
+  }
+  return size;
+}
+
+size_t
+PackedBatch::byte_size() const {
+  size_t size = 0;
+  if (max_frames_) {
+    size += 1 + pbio::VarintSize32(max_frames_);
+  }
+  for (const auto& record : frames_) {
+    size_t fsize = frame_size(record);
+    size += 1 + pbio::VarintSize32((uint32_t) fsize) + fsize;
+  }
+  return size;
+}
+
+uint8_t*
+PackedBatch::write(uint8_t* t) const {
+  if (max_frames_) {
+    *t++ = (uint8_t) TAG_MAX_FRAMES;
+    t = pbio::WriteVarint32ToArray(max_frames_, t);
+  }
+  for (const auto& f : frames_) {
+    *t++ = (uint8_t) TAG_FRAMES;
+    t = pbio::WriteVarint32ToArray((uint32_t) frame_size(f), t);
+    if (f.frame_num) {
+      *t++ = (uint8_t) TAG_FRAME_NUM;
+      t = pbio::WriteVarint64ToArray((uint64_t)(int64_t) f.frame_num, t);
+    }
+    if (float_bits(f.sum_danger)) {
+      *t++ = (uint8_t) TAG_SUM_DANGER;
+      t = pbio::WriteLittleEndian32ToArray(float_bits(f.sum_danger), t);
+    }
+    if (f.pts) {
+      *t++ = (uint8_t) TAG_PTS;
+      t = pbio::WriteVarint64ToArray(f.pts, t);
+    }
+    if (f.dts) {
+      *t++ = (uint8_t) TAG_DTS;
+      t = pbio::WriteVarint64ToArray(f.dts, t);
+    }
+    if (f.source_id) {
+      *t++ = (uint8_t) TAG_SOURCE_ID;
+      t = pbio::WriteVarint32ToArray(f.source_id, t);
+    }
+    if (f.num_people == 0) {
+      continue;
+    }
+    uint32_t n = f.num_people;
+    t = write_floats(FIELD_LEFT, left(f), n, t);
+    t = write_floats(FIELD_TOP, top(f), n, t);
+    t = write_floats(FIELD_WIDTH, width(f), n, t);
+    t = write_floats(FIELD_HEIGHT, height(f), n, t);
+    t = write_floats(FIELD_DANGER_VAL, danger_val(f), n, t);
+    uint32_t num_bytes = (n + 7) / 8;
+    *t++ = (uint8_t) TAG_IS_DANGER;
+    t = pbio::WriteVarint32ToArray(num_bytes, t);
+    memset(t, 0, num_bytes);
+    const uint8_t* danger = is_danger_.data() + f.first_person;
+    for (uint32_t i = 0; i < n; i++) {
+      t[i / 8] |= (uint8_t)((danger[i] != 0) << (i % 8));
+    }
+    t += num_bytes;
+    size_t uids = int32s_size(uid(f), n);
+    if (uids) {
+      t = write_int32s(FIELD_UID, uid(f), n, uids, t);
+    }
+  }
+  return t;
+}
+
+void
+PackedBatch::serialize(std::string* out) const {
+  out->resize(byte_size());
+  if (!out->empty()) {
+    write((uint8_t*) &(*out)[0]);
+  }
+}
+
+bool
+PackedBatch::parse(const uint8_t* data, size_t size) {
+  clear();
+  if (size > INT_MAX) {
+    return false;
+  }
+  CodedInputStream in(data, (int) size);
+  // so BytesUntilLimit() is the bytes left, at the top level too
+  in.PushLimit((int) size);
+  // is_danger bits of the current frame (they may come before the columns)
+  std::string bits;
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    if (tag == TAG_MAX_FRAMES) {
+      if (!in.ReadVarint32(&max_frames_)) {
+        return false;
+      }
+      continue;
+    }
+    if (tag != TAG_FRAMES) {
+      if (!WireFormatLite::SkipField(&in, tag)) {
+        return false;
+      }
+      continue;
+    }
+    uint32_t length;
+    if (!in.ReadVarint32(&length) ||
+        length > (uint32_t) in.BytesUntilLimit()) {
+      return false;
+    }
+    auto limit = in.PushLimit((int) length);
+    auto record = add_frame();
+    uint32_t first = record->first_person;
+    bits.clear();
+    uint32_t value;
+    uint64_t value64;
+    while ((tag = in.ReadTag()) != 0) {
+      bool ok = true;
+      switch (tag) {
+        case TAG_FRAME_NUM:
+          ok = in.ReadVarint32(&value);
+          record->frame_num = (int32_t) value;
+          break;
+        case TAG_SUM_DANGER:
+          ok = in.ReadLittleEndian32(&value);
+          memcpy(&record->sum_danger, &value, sizeof(value));
+          break;
+        case TAG_PTS:
+          ok = in.ReadVarint64(&value64);
+          record->pts = value64;
+          break;
+        case TAG_DTS:
+          ok = in.ReadVarint64(&value64);
+          record->dts = value64;
+          break;
+        case TAG_SOURCE_ID:
+          ok = in.ReadVarint32(&record->source_id);
+          break;
+        case TAG_IS_DANGER:
+          ok = in.ReadVarint32(&value) &&
+               value <= (uint32_t) in.BytesUntilLimit() &&
+               in.ReadString(&bits, (int) value);
+          break;
+        default:
+          switch (WireFormatLite::GetTagFieldNumber(tag)) {
+            case FIELD_LEFT: ok = read_floats(&in, tag, &left_); break;
+            case FIELD_TOP: ok = read_floats(&in, tag, &top_); break;
+            case FIELD_WIDTH: ok = read_floats(&in, tag, &width_); break;
+            case FIELD_HEIGHT: ok = read_floats(&in, tag, &height_); break;
+            case FIELD_DANGER_VAL:
+              ok = read_floats(&in, tag, &danger_val_);
+              break;
+            case FIELD_UID: ok = read_int32s(&in, tag, &uid_); break;
+            default: ok = WireFormatLite::SkipField(&in, tag);
+          }
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    if (!in.ConsumedEntireMessage()) {
+      return false;
+    }
+    in.PopLimit(limit);
+    // every column must have the same number of people
+    size_t end = left_.size();
+    if (top_.size() != end || width_.size() != end ||
+        height_.size() != end || danger_val_.size() != end) {
+      return false;
+    }
+    uint32_t n = (uint32_t)(end - first);
+    if (!bits.empty() && bits.size() != (n + 7) / 8) {
+      return false;
+    }
+    // uids are left out when they're all 0
+    if (uid_.size() != first && uid_.size() != end) {
+      return false;
+    }
+    record->num_people = n;
+    uid_.resize(end, 0);
+    is_danger_.resize(end, 0);
+    for (uint32_t i = 0; i < n && !bits.empty(); i++) {
+      is_danger_[first + i] = ((uint8_t) bits[i / 8] >> (i % 8)) & 1;
+    }
+  }
+  return in.ConsumedEntireMessage();
+}
+
+} // namespace ds
@@ -0,0 +1,180 @@
+/* Payload.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Payload.hpp"
+
+#include <cstdlib>
+#include <utility>
+
+namespace ds {
+
+const size_t PayloadPool::MIN_CLASS_SIZE;
+const size_t PayloadPool::MAX_CLASS_SIZE;
+const size_t PayloadPool::DEFAULT_MAX_FREE;
+
+Payload::Payload(PayloadPool* pool, size_t capacity) :
+  refcount_(1),
+  pool_(pool),
+  data_((uint8_t*) malloc(capacity)),
+  size_(0),
+  capacity_(capacity),
+  subscription_(0),
+  ready_(true),
+  failed_(false)
+  {}
+
+Payload::~Payload() {
+  free(data_);
+}
+
+void
+Payload::unref() {
+  // acq_rel so the last owner sees every other owner's reads finish before
+  // the buffer is reused
+  if (refcount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    pool_->recycle(this);
+  }
+}
+
+void
+Payload::reserve(size_t size) {
+  if (size > capacity_) {
+    // trade buffers with a Payload of the right size class, and recycle it
+    // (with ours) into the class we came from, so every class stays stocked
+    // and steady state growing doesn't hit the allocator either
+    Payload* other = pool_->acquire(size);
+    std::swap(data_, other->data_);
+    std::swap(capacity_, other->capacity_);
+    other->unref();
+  }
+  size_ = size;
+}
+
+bool
+Payload::resolve_slow() const {
+  // whoever gets the lock first produces, everybody else waits for them
+  std::lock_guard<std::mutex> lock(resolve_lock_);
+  if (!ready_.load(std::memory_order_relaxed)) {
+    // const_cast is ok here, since nobody can see the bytes until ready_
+    failed_ = !producer_->produce(const_cast<Payload*>(this));
+    if (failed_) {
+      const_cast<Payload*>(this)->size_ = 0;
+    }
+    producer_.reset();
+    ready_.store(true, std::memory_order_release);
+  }
+  return !failed_;
+}
+
+PayloadPool::PayloadPool(size_t max_free) :
+  max_free_(max_free),
+  free_(size_class(MAX_CLASS_SIZE) + 1)
+  {}
+
+PayloadPool::~PayloadPool() {
+  for (auto& bucket : free_) {
+    for (auto payload : bucket) {
+      delete payload;
+    }
+  }
+}
+
+int
+PayloadPool::size_class(size_t size) {
+  if (size > MAX_CLASS_SIZE) {
+    return -1;
+  }
+  int index = 0;
+  for (size_t class_size = MIN_CLASS_SIZE; class_size < size; class_size <<= 1) {
+    index++;
+  }
+  return index;
+}
+
+size_t
+PayloadPool::class_capacity(size_t size) {
+  int index = size_class(size);
+  return index == -1 ? size : MIN_CLASS_SIZE << index;
+}
+
+Payload*
+PayloadPool::acquire(size_t size) {
+  int index = size_class(size);
+  Payload* payload = nullptr;
+  if (index == -1) {
+    // too big to bother pooling
+    payload = new Payload(this, size);
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      auto& bucket = free_[index];
+      if (!bucket.empty()) {
+        payload = bucket.back();
+        bucket.pop_back();
+      }
+    }
+    if (payload == nullptr) {
+      payload = new Payload(this, MIN_CLASS_SIZE << index);
+    }
+    payload->refcount_.store(1, std::memory_order_relaxed);
+  }
+  payload->size_ = size;
+  payload->subscription_ = 0;
+  return payload;
+}
+
+Payload*
+PayloadPool::acquire_pending(std::unique_ptr<PayloadProducer> producer) {
+  auto payload = acquire(0);
+  payload->producer_ = std::move(producer);
+  payload->failed_ = false;
+  payload->ready_.store(false, std::memory_order_release);
+  return payload;
+}
+
+void
+PayloadPool::recycle(Payload* payload) {
+  // a pending Payload nobody resolved, drop whatever it would have needed
+  payload->producer_.reset();
+  payload->ready_.store(true, std::memory_order_relaxed);
+  payload->failed_ = false;
+  int index = size_class(payload->capacity_);
+  if (index != -1) {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto& bucket = free_[index];
+    if (bucket.size() < max_free_) {
+      bucket.push_back(payload);
+      return;
+    }
+  }
+  delete payload;
+}
+
+PayloadPool*
+PayloadPool::get_default() {
+  // intentionally leaked, see header
+  static PayloadPool* pool = new PayloadPool();
+  return pool;
+}
+
+} // namespace ds
@@ -25,6 +25,7 @@
 //  this.
 
 #include "PayloadBroker.hpp"
+#include "Trace.hpp"
 #include "nvdsmeta.h"
 
 namespace ds {
@@ -32,6 +33,7 @@ namespace ds {
 GstFlowReturn
 PayloadBroker::on_buffer(GstBuffer* buf)
 {
+  DS_TRACE_SCOPE("PayloadBroker::on_buffer");
   NvDsBatchMeta* batch_meta = gst_buffer_get_nvds_batch_meta (buf);
   if (batch_meta == nullptr) {
     GST_WARNING("protopayload: no metadata attached to buffer !!!");
@@ -39,7 +41,10 @@ PayloadBroker::on_buffer(GstBuffer* buf)
   }
 
   // we need to lock the metadata
+  DS_TRACE_BEGIN("meta_lock.wait");
   nvds_acquire_meta_lock(batch_meta);
+  DS_TRACE_END("meta_lock.wait");
+  DS_TRACE_BEGIN("meta_lock.held");
 
   // loop through the batch level user metadata list
   for (auto elem = batch_meta->batch_user_meta_list; elem != nullptr; elem = elem->next)
@@ -54,19 +59,31 @@ PayloadBroker::on_buffer(GstBuffer* buf)
     // message converter element without modification.
     // if the attached metadata is already serialized
     if (user_meta->base_meta.meta_type == NVDS_PAYLOAD_META) {
-      // call on_batch_payload with our string
-      auto payload = (std::string*) user_meta->user_meta_data;
-      if (payload == nullptr) {
-        GST_WARNING("payload was NULL");
-        continue;
-      }
-      if (!this->on_batch_payload(payload)) {
+      if (!this->on_user_meta(batch_meta, user_meta)) {
         continue;
       }
     }
   }
+  DS_TRACE_END("meta_lock.held");
   nvds_release_meta_lock(batch_meta);
   return GST_FLOW_OK;
 }
 
+bool
+PayloadBroker::on_user_meta(NvDsBatchMeta* batch_meta,
+                            NvDsUserMeta* user_meta) {
+  (void)batch_meta;
+  // call on_batch_payload with our Payload
+  auto payload = (Payload*) user_meta->user_meta_data;
+  if (payload == nullptr) {
+    GST_WARNING("payload was NULL");
+    return false;
+  }
+  // filtered for somebody else
+  if (payload->subscription() != subscription_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  return this->on_batch_payload(payload);
+}
+
 } // namespace ds
@@ -22,54 +22,181 @@
  */
 
 #include "ProtoPayloadFilter.hpp"
+#include "BatchSerializer.hpp"
+#include "CompactBatch.hpp"
 #include "DistanceFilter.hpp"  // NVDS_USER_BATCH_META_DP
+#include "PackedBatch.hpp"
+#include "Trace.hpp"
 
 #include "distance.pb.h"
 #include "nvdsmeta.h"
 
+#include <cstring>
+#include <memory>
 
 namespace dp = distanceproto;
 
 namespace ds {
 
+const uint32_t ProtoPayloadFilter::NO_SUBSCRIPTION;
+const uint32_t ProtoPayloadFilter::GROUPS_SUBSCRIPTION;
+
 /**
- * NvDsUserMeta copy function for string payload metadata.
+ * NvDsUserMeta copy function for Payload metadata. Payloads are immutable
+ * once attached, so a copy is just another reference.
  */
 static gpointer copy_dp_payload_meta(gpointer data, gpointer user_data) {
   (void)user_data;
 
   NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
 
-  auto src_payload = (std::string*)(user_meta->user_meta_data);
-  auto dst_payload = new std::string();
-
-  *dst_payload = *src_payload;
+  auto payload = (Payload*)(user_meta->user_meta_data);
 
-  return (gpointer) dst_payload;
+  return (gpointer) payload->ref();
 }
 
 /**
- * NvDsUserMeta release function for string payload metadata.
+ * NvDsUserMeta release function for Payload metadata.
  */
 static void release_dp_payload_meta(gpointer data, gpointer user_data) {
   (void)user_data;
 
   NvDsUserMeta* user_meta = (NvDsUserMeta *)data;
 
-  auto payload = (std::string*)(user_meta->user_meta_data);
-  delete payload;
+  auto payload = (Payload*)(user_meta->user_meta_data);
+  payload->unref();
 }
 
-ProtoPayloadFilter::ProtoPayloadFilter() {
+/**
+ * Serialize a Batch into `*payload`, growing it as needed, or, if it's
+ * nullptr, into a new one from `pool` of exactly the right size class.
+ */
+static bool
+serialize_batch(const dp::Batch* batch,
+                ProtoPayloadFilter::Encoding encoding,
+                PayloadPool* pool,
+                Payload** payload) {
+  DS_TRACE_SCOPE("ProtoPayloadFilter::serialize");
+  // reused, so steady state packing doesn't allocate
+  static thread_local PackedBatch packed;
+  // byte_size caches the sizes of all the submessages, so write doesn't
+  // have to walk the tree twice. Producers run on whatever thread resolves
+  // the Payload, so each thread gets its own serializer.
+  static thread_local BatchSerializer serializer;
+  size_t size;
+  if (encoding == ProtoPayloadFilter::columnar) {
+    packed.from_proto(*batch);
+    size = packed.byte_size();
+  } else {
+    size = serializer.byte_size(*batch);
+  }
+  if (*payload == nullptr) {
+    *payload = pool->acquire(size);
+  } else {
+    (*payload)->reserve(size);
+  }
+  uint8_t* data = (*payload)->mutable_data();
+  uint8_t* end = encoding == ProtoPayloadFilter::columnar ?
+    packed.write(data) : serializer.write(*batch, data);
+  return (size_t)(end - data) == size;
+}
+
+/**
+ * Serialize a PackedBatch into a new Payload from `pool`.
+ */
+static Payload*
+serialize_packed_batch(const PackedBatch* batch, PayloadPool* pool) {
+  DS_TRACE_SCOPE("ProtoPayloadFilter::serialize");
+  auto payload = pool->acquire(batch->byte_size());
+  batch->write(payload->mutable_data());
+  return payload;
+}
+
+/**
+ * Produces a pending Payload from a Batch it owns.
+ */
+class BatchPayloadProducer : public PayloadProducer {
+public:
+  BatchPayloadProducer(std::unique_ptr<dp::Batch> batch,
+                       ProtoPayloadFilter::Encoding encoding) :
+    batch_(std::move(batch)), encoding_(encoding) {}
+  virtual bool produce(Payload* payload) {
+    return serialize_batch(batch_.get(), encoding_, nullptr, &payload);
+  }
+private:
+  std::unique_ptr<dp::Batch> batch_;
+  ProtoPayloadFilter::Encoding encoding_;
+};
+
+/**
+ * Produces a pending Payload from a private copy of a PackedBatch (a
+ * handful of flat arrays, so much cheaper to copy than a Batch), or a
+ * PackedBatch snapshot of a Batch. With the nested encoding, the Batch is
+ * built here too, off the streaming thread.
+ */
+class PackedPayloadProducer : public PayloadProducer {
+public:
+  PackedPayloadProducer(const PackedBatch* batch,
+                        ProtoPayloadFilter::Encoding encoding) :
+    batch_(*batch), encoding_(encoding) {}
+  PackedPayloadProducer(const dp::Batch& batch,
+                        ProtoPayloadFilter::Encoding encoding) :
+    batch_(), encoding_(encoding) {
+    batch_.from_proto(batch);
+  }
+  virtual bool produce(Payload* payload) {
+    if (encoding_ == ProtoPayloadFilter::nested) {
+      return serialize_batch(batch_.materialize(), encoding_, nullptr,
+                             &payload);
+    }
+    DS_TRACE_SCOPE("ProtoPayloadFilter::serialize");
+    payload->reserve(batch_.byte_size());
+    batch_.write(payload->mutable_data());
+    return true;
+  }
+private:
+  PackedBatch batch_;
+  ProtoPayloadFilter::Encoding encoding_;
+};
+
+ProtoPayloadFilter::ProtoPayloadFilter(Serialization serialization) :
+  encoding(nested),
+  pool_(PayloadPool::get_default()),
+  batch_meta_type_(DF_USER_BATCH_META),
+  compact_meta_type_(DF_USER_COMPACT_BATCH_META),
+  packed_meta_type_(DF_USER_PACKED_BATCH_META),
+  groups_meta_type_(DF_USER_GROUPS_META),
+  serialization_(serialization),
+  serialize_worker_(),
+  serialize_queue_(),
+  subscriptions_lock_(),
+  subscriptions_(),
+  next_subscription_(1),
+  unfiltered_(true),
+  filtered_(),
+  groups_scratch_()
+{
   // copypasta from the protobuf docs:
   // Verify that the version of the library that we linked against is
   // compatible with the version of the headers we compiled against.
   GOOGLE_PROTOBUF_VERIFY_VERSION;
+  if (serialization_ == async) {
+    serialize_worker_ = std::thread(
+      &ProtoPayloadFilter::serialize_worker_func, this);
+  }
+}
+
+ProtoPayloadFilter::~ProtoPayloadFilter() {
+  if (serialize_worker_.joinable()) {
+    serialize_queue_.flush();
+    serialize_worker_.join();
+  }
 }
 
 GstFlowReturn
 ProtoPayloadFilter::on_buffer(GstBuffer* buf)
 {
+  DS_TRACE_SCOPE("ProtoPayloadFilter::on_buffer");
   NvDsBatchMeta* batch_meta = gst_buffer_get_nvds_batch_meta (buf);
   if (batch_meta == nullptr) {
     GST_WARNING("protopayload: no metadata attached to buffer !!!");
@@ -77,7 +204,10 @@ ProtoPayloadFilter::on_buffer(GstBuffer* buf)
   }
 
   // we need to lock the metadata
+  DS_TRACE_BEGIN("meta_lock.wait");
   nvds_acquire_meta_lock(batch_meta);
+  DS_TRACE_END("meta_lock.wait");
+  DS_TRACE_BEGIN("meta_lock.held");
 
   // loop through the batch level user metadata list
   for (auto elem = batch_meta->batch_user_meta_list; elem != nullptr; elem = elem->next)
@@ -89,34 +219,173 @@ ProtoPayloadFilter::on_buffer(GstBuffer* buf)
       continue;
     }
     // if the attached metadata is not ours, skip it
-    if (user_meta->base_meta.meta_type != DF_USER_BATCH_META) {
+    if (user_meta->base_meta.meta_type != batch_meta_type_ &&
+        user_meta->base_meta.meta_type != compact_meta_type_ &&
+        user_meta->base_meta.meta_type != packed_meta_type_ &&
+        user_meta->base_meta.meta_type != groups_meta_type_) {
       continue;
     }
-    auto batch = (dp::Batch*) user_meta->user_meta_data;
 
-    if (!this->on_batch_meta(batch_meta, batch)) {
+    if (!this->on_user_meta(batch_meta, user_meta)) {
       continue;
     }
   }
 
+  DS_TRACE_END("meta_lock.held");
   nvds_release_meta_lock(batch_meta);
   return GST_FLOW_OK;
 }
 
+bool
+ProtoPayloadFilter::on_user_meta(NvDsBatchMeta* batch_meta,
+                                 NvDsUserMeta* user_meta) {
+  if (user_meta->user_meta_data == nullptr) {
+    GST_WARNING("batch was NULL");
+    return false;
+  }
+  dp::Batch* batch;
+  if (user_meta->base_meta.meta_type == compact_meta_type_) {
+    // only built once, however many of us ask
+    batch = ((CompactBatch*) user_meta->user_meta_data)->materialize();
+  } else if (user_meta->base_meta.meta_type == packed_meta_type_) {
+    return this->on_packed_meta(
+      batch_meta, (PackedBatch*) user_meta->user_meta_data);
+  } else if (user_meta->base_meta.meta_type == groups_meta_type_) {
+    return this->on_groups_meta(
+      batch_meta, (BatchGroups*) user_meta->user_meta_data);
+  } else {
+    batch = (dp::Batch*) user_meta->user_meta_data;
+  }
+  return this->on_batch_meta(batch_meta, batch);
+}
+
 bool
 ProtoPayloadFilter::on_batch_meta(NvDsBatchMeta* batch_meta, dp::Batch* batch) {
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  bool ok = true;
+
+  if (unfiltered_) {
+    // try to serialize the batch into a pooled buffer
+    auto payload = this->serialize(batch, 0);
+    if (payload == nullptr) {
+      GST_WARNING("could not serialize payload");
+      ok = false;
+    } else {
+      ok = this->attach_payload(batch_meta, payload) && ok;
+    }
+  }
+
+  // each subscription is evaluated once, however many brokers want it
+  for (const auto& entry : subscriptions_) {
+    if (!entry.subscription.apply(*batch, &filtered_)) {
+      // nothing matched, so subscribers get nothing
+      continue;
+    }
+    auto payload = this->serialize_filtered(entry.id);
+    if (payload == nullptr) {
+      GST_WARNING("could not serialize payload for subscription %u", entry.id);
+      ok = false;
+      continue;
+    }
+    ok = this->attach_payload(batch_meta, payload) && ok;
+  }
+
+  return ok;
+}
+
+bool
+ProtoPayloadFilter::on_packed_meta(NvDsBatchMeta* batch_meta,
+                                   PackedBatch* batch) {
+  if (encoding != columnar && serialization_ == sync) {
+    return this->on_batch_meta(batch_meta, batch->materialize());
+  }
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  bool ok = true;
+
+  if (unfiltered_) {
+    // already in the wire layout (or copied as is, to be expanded later),
+    // so no Batch is needed
+    auto payload = this->serialize_packed(batch, 0);
+    if (payload == nullptr) {
+      GST_WARNING("could not serialize payload");
+      ok = false;
+    } else {
+      ok = this->attach_payload(batch_meta, payload) && ok;
+    }
+  }
+
+  // subscriptions filter Batches, so only then is one built
+  for (const auto& entry : subscriptions_) {
+    if (!entry.subscription.apply(*batch->materialize(), &filtered_)) {
+      continue;
+    }
+    auto payload = this->serialize_filtered(entry.id);
+    if (payload == nullptr) {
+      GST_WARNING("could not serialize payload for subscription %u", entry.id);
+      ok = false;
+      continue;
+    }
+    ok = this->attach_payload(batch_meta, payload) && ok;
+  }
+
+  return ok;
+}
+
+bool
+ProtoPayloadFilter::on_groups_meta(NvDsBatchMeta* batch_meta,
+                                   BatchGroups* groups) {
+  BatchGroups::encode(*groups, &groups_scratch_);
+  auto payload = pool_->acquire(groups_scratch_.size());
+  memcpy(payload->mutable_data(), groups_scratch_.data(),
+         groups_scratch_.size());
+  payload->set_subscription(GROUPS_SUBSCRIPTION);
+  return this->attach_payload(batch_meta, payload);
+}
+
+uint32_t
+ProtoPayloadFilter::subscribe(const Subscription& subscription) {
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  if (subscription.is_passthrough()) {
+    unfiltered_ = true;
+    return 0;
+  }
+  for (auto& entry : subscriptions_) {
+    if (entry.subscription == subscription) {
+      entry.count++;
+      return entry.id;
+    }
+  }
+  SubscriptionEntry entry = {next_subscription_++, subscription, 1};
+  subscriptions_.push_back(entry);
+  return entry.id;
+}
+
+void
+ProtoPayloadFilter::unsubscribe(uint32_t id) {
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  for (auto it = subscriptions_.begin(); it != subscriptions_.end(); ++it) {
+    if (it->id == id) {
+      if (--it->count == 0) {
+        subscriptions_.erase(it);
+      }
+      return;
+    }
+  }
+}
+
+void
+ProtoPayloadFilter::set_unfiltered(bool unfiltered) {
+  std::lock_guard<std::mutex> guard(subscriptions_lock_);
+  unfiltered_ = unfiltered;
+}
+
+bool
+ProtoPayloadFilter::attach_payload(NvDsBatchMeta* batch_meta, Payload* payload) {
   // try to get a new user metadata pointer from the pool
   auto user_meta = nvds_acquire_user_meta_from_pool(batch_meta);
   if (user_meta == nullptr) {
     GST_WARNING("could not get user metadata from batch pool");
-    return false;
-  }
-
-  // try to serialize the batch to string
-  auto payload = new std::string();
-  if (!batch->SerializeToString(payload)) {
-    GST_WARNING("could not convert payload to string");
-    delete payload;
+    payload->unref();
     return false;
   }
 
@@ -136,4 +405,90 @@ ProtoPayloadFilter::on_batch_meta(NvDsBatchMeta* batch_meta, dp::Batch* batch) {
   return true;
 }
 
+GstBuffer*
+ProtoPayloadFilter::make_payload_buffer(const std::vector<Payload*>& payloads) {
+  if (payloads.empty()) {
+    return nullptr;
+  }
+  auto batch_meta = nvds_create_batch_meta(1);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  for (auto payload : payloads) {
+    this->attach_payload(batch_meta, payload);
+  }
+  return buf;
+}
+
+Payload*
+ProtoPayloadFilter::serialize(dp::Batch* batch, uint32_t subscription) {
+  if (serialization_ == sync) {
+    Payload* payload = nullptr;
+    if (!serialize_batch(batch, encoding, pool_, &payload)) {
+      payload->unref();
+      return nullptr;
+    }
+    payload->set_subscription(subscription);
+    return payload;
+  }
+  // the Batch is metadata, shared with everything downstream, so the
+  // producer needs its own. A deep copy (and its free) costs more than
+  // serializing, so it gets a flat PackedBatch snapshot instead.
+  return this->serialize_pending(
+    new PackedPayloadProducer(*batch, encoding), subscription);
+}
+
+Payload*
+ProtoPayloadFilter::serialize_filtered(uint32_t subscription) {
+  if (serialization_ == sync) {
+    return this->serialize(&filtered_, subscription);
+  }
+  // ours, so hand it over instead of copying it
+  auto batch = std::unique_ptr<dp::Batch>(new dp::Batch());
+  batch->Swap(&filtered_);
+  return this->serialize_pending(
+    new BatchPayloadProducer(std::move(batch), encoding), subscription);
+}
+
+Payload*
+ProtoPayloadFilter::serialize_packed(PackedBatch* batch,
+                                     uint32_t subscription) {
+  if (serialization_ == sync) {
+    auto payload = serialize_packed_batch(batch, pool_);
+    payload->set_subscription(subscription);
+    return payload;
+  }
+  return this->serialize_pending(
+    new PackedPayloadProducer(batch, encoding), subscription);
+}
+
+Payload*
+ProtoPayloadFilter::serialize_pending(PayloadProducer* producer,
+                                      uint32_t subscription) {
+  auto payload = pool_->acquire_pending(
+    std::unique_ptr<PayloadProducer>(producer));
+  payload->set_subscription(subscription);
+  if (serialization_ == async) {
+    // the worker gets its own reference
+    DS_TRACE_INSTANT("ProtoPayloadFilter::enqueue");
+    serialize_queue_.put(payload->ref());
+  }
+  return payload;
+}
+
+void
+ProtoPayloadFilter::serialize_worker_func() {
+  auto payload = serialize_queue_.get();
+  while (payload) {
+    DS_TRACE_INSTANT("ProtoPayloadFilter::dequeue");
+    // if ours is the last reference, nobody is left to read the bytes
+    if (payload->use_count() > 1) {
+      payload->resolve();
+    }
+    payload->unref();
+    payload = serialize_queue_.get();
+  }
+}
+
 } // namespace ds
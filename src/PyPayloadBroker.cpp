@@ -23,24 +23,125 @@
 
 #include "PyPayloadBroker.hpp"
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
 namespace ds {
 
+const size_t PyPayloadBroker::DEFAULT_SLOTS;
+
+PyPayloadBroker::PyPayloadBroker(size_t slots) :
+  ring_(slots ? slots : 1, Entry{0, nullptr}),
+  seq_(0)
+  {}
+
+PyPayloadBroker::~PyPayloadBroker() {
+  for (auto& entry : ring_) {
+    if (entry.payload) {
+      entry.payload->unref();
+    }
+  }
+}
+
 bool
-PyPayloadBroker::on_batch_payload(std::string* payload) {
-  std::lock_guard<std::mutex> lock(this->data_lock);
-  this->data = *payload;
+PyPayloadBroker::on_batch_payload(Payload* payload) {
+  // take our reference outside the lock. The old one is dropped outside too,
+  // since it may be the last one.
+  payload->ref();
+  Payload* old = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    seq_++;
+    Entry& entry = ring_[seq_ % ring_.size()];
+    old = entry.payload;
+    entry.seq = seq_;
+    entry.payload = payload;
+  }
+  cv_.notify_all();
+  if (old) {
+    old->unref();
+  }
   return true;
 }
 
 gchararray
 PyPayloadBroker::get_payload() {
-  if (this->data.empty()) {
+  Payload* payload = borrow();
+  if (payload == nullptr) {
     return nullptr;
   }
-  gchararray ret = (gchararray) malloc(this->data.length()+ 1);
-  this->data.copy(ret, this->data.length());
-  ret[this->data.length()] = '\0';
+  size_t size = payload->size();
+  if (size == 0) {
+    release(payload);
+    return nullptr;
+  }
+  gchararray ret = (gchararray) malloc(size + 1);
+  memcpy(ret, payload->data(), size);
+  ret[size] = '\0';
+  release(payload);
   return ret;
 }
 
-} // namespace ds
\ No newline at end of file
+guint64
+PyPayloadBroker::latest_seq() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return seq_;
+}
+
+guint64
+PyPayloadBroker::wait_for_next(guint64 last_seq, gint64 timeout_ms) {
+  std::unique_lock<std::mutex> lock(lock_);
+  auto newer = [this, last_seq]() { return seq_ > last_seq; };
+  if (timeout_ms < 0) {
+    cv_.wait(lock, newer);
+  } else if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), newer)) {
+    return last_seq;
+  }
+  return seq_;
+}
+
+guint64
+PyPayloadBroker::get_since(guint64 seq, std::vector<Entry>* entries) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (seq >= seq_) {
+    return 0;
+  }
+  // the oldest payload still in the ring
+  guint64 oldest = seq_ >= ring_.size() ? seq_ - ring_.size() + 1 : 1;
+  guint64 missed = 0;
+  if (seq + 1 < oldest) {
+    missed = oldest - (seq + 1);
+    seq = oldest - 1;
+  }
+  for (guint64 s = seq + 1; s <= seq_; s++) {
+    Entry& entry = ring_[s % ring_.size()];
+    entries->push_back(Entry{entry.seq, entry.payload->ref()});
+  }
+  return missed;
+}
+
+Payload*
+PyPayloadBroker::borrow(guint64 seq) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (seq == 0) {
+    seq = seq_;
+  }
+  if (seq == 0) {
+    return nullptr;
+  }
+  Entry& entry = ring_[seq % ring_.size()];
+  if (entry.seq != seq || entry.payload == nullptr) {
+    return nullptr;
+  }
+  return entry.payload->ref();
+}
+
+void
+PyPayloadBroker::release(Payload* payload) {
+  if (payload) {
+    payload->unref();
+  }
+}
+
+} // namespace ds
@@ -0,0 +1,195 @@
+/* Replay.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Replay.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace dp = distanceproto;
+
+using clock_type = std::chrono::steady_clock;
+
+namespace ds {
+
+static const int DEFAULT_CLASS_ID = 0;
+static const double DEFAULT_SPEED = 1.0;
+
+static uint64_t
+elapsed_ns(clock_type::time_point start, clock_type::time_point end) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    end - start).count();
+}
+
+Replay::Replay(ReplaySource* source, Pacing pacing) :
+  class_id(DEFAULT_CLASS_ID),
+  speed(DEFAULT_SPEED),
+  source_(source),
+  pacing_(pacing),
+  stages_()
+  {}
+
+void
+Replay::add_stage(std::string name, BaseFilter* filter) {
+  Stage stage = {name, filter, {}};
+  stages_.push_back(stage);
+}
+
+GstBuffer*
+Replay::make_buffer(const dp::Batch& batch, int class_id) {
+  guint max_frames = std::max<guint>(batch.max_frames(), batch.frames_size());
+  auto batch_meta = nvds_create_batch_meta(max_frames);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  guint batch_id = 0;
+  for (const auto& frame : batch.frames()) {
+    auto frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+    frame_meta->batch_id = batch_id++;
+    frame_meta->pad_index = frame.source_id();
+    frame_meta->source_id = frame.source_id();
+    frame_meta->frame_num = frame.frame_num();
+    frame_meta->buf_pts = frame.pts();
+    frame_meta->ntp_timestamp = frame.dts();
+    nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+    guint64 object_id = 0;
+    for (const auto& person : frame.people()) {
+      auto obj_meta = nvds_acquire_obj_meta_from_pool(batch_meta);
+      obj_meta->class_id = class_id;
+      obj_meta->object_id = person.uid() ? (uint32_t) person.uid() : object_id;
+      object_id++;
+      obj_meta->confidence = 1.0f;
+      const auto& bbox = person.bbox();
+      obj_meta->rect_params.left = bbox.left();
+      obj_meta->rect_params.top = bbox.top();
+      obj_meta->rect_params.width = bbox.width();
+      obj_meta->rect_params.height = bbox.height();
+      nvds_add_obj_meta_to_frame(frame_meta, obj_meta, nullptr);
+    }
+  }
+  return buf;
+}
+
+Replay::Report
+Replay::run(uint64_t max_batches) {
+  Report report = {};
+  std::vector<uint64_t> build_ns;
+  std::vector<uint64_t> total_ns;
+  for (auto& stage : stages_) {
+    stage.latencies_ns.clear();
+  }
+  dp::Batch batch;
+  bool have_first_pts = false;
+  uint64_t first_pts = 0;
+  auto start = clock_type::now();
+  while ((max_batches == 0 || report.batches < max_batches) &&
+         source_->next(&batch)) {
+    if (pacing_ == recorded && speed > 0.0 && batch.frames_size() > 0) {
+      uint64_t pts = batch.frames(0).pts();
+      if (!have_first_pts) {
+        first_pts = pts;
+        have_first_pts = true;
+      }
+      // timestamps that go backwards (eg. a new file) just play right away
+      if (pts > first_pts) {
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+          (uint64_t)((pts - first_pts) / speed)));
+      }
+    }
+    auto build_start = clock_type::now();
+    auto buf = make_buffer(batch, class_id);
+    auto then = clock_type::now();
+    build_ns.push_back(elapsed_ns(build_start, then));
+    auto chain_start = then;
+    for (auto& stage : stages_) {
+      stage.filter->on_buffer(buf);
+      auto now = clock_type::now();
+      stage.latencies_ns.push_back(elapsed_ns(then, now));
+      then = now;
+    }
+    total_ns.push_back(elapsed_ns(chain_start, then));
+    gst_buffer_unref(buf);
+
+    report.batches++;
+    report.frames += batch.frames_size();
+    for (const auto& frame : batch.frames()) {
+      report.objects += frame.people_size();
+    }
+  }
+  report.seconds = std::chrono::duration<double>(
+    clock_type::now() - start).count();
+  report.build = summarize("(build)", &build_ns);
+  for (auto& stage : stages_) {
+    report.stages.push_back(summarize(stage.name, &stage.latencies_ns));
+  }
+  report.total = summarize("(total)", &total_ns);
+  return report;
+}
+
+Replay::Stats
+Replay::summarize(std::string name, std::vector<uint64_t>* latencies_ns) {
+  Stats stats = {name, latencies_ns->size(), 0.0, 0.0, 0.0, 0.0, 0.0};
+  if (latencies_ns->empty()) {
+    return stats;
+  }
+  std::sort(latencies_ns->begin(), latencies_ns->end());
+  // nearest rank
+  auto percentile = [latencies_ns](double p) {
+    size_t rank = (size_t)(p / 100.0 * (latencies_ns->size() - 1) + 0.5);
+    return (*latencies_ns)[rank] / 1e3;
+  };
+  double sum = 0.0;
+  for (auto ns : *latencies_ns) {
+    sum += ns;
+  }
+  stats.mean_us = sum / latencies_ns->size() / 1e3;
+  stats.p50_us = percentile(50.0);
+  stats.p90_us = percentile(90.0);
+  stats.p99_us = percentile(99.0);
+  stats.max_us = latencies_ns->back() / 1e3;
+  return stats;
+}
+
+void
+Replay::Report::print(FILE* out) const {
+  double secs = seconds > 0.0 ? seconds : 1.0;
+  fprintf(out, "%lu batches, %lu frames, %lu objects in %.2f s "
+    "(%.0f batches/s, %.0f frames/s, %.0f objects/s)\n",
+    (unsigned long) batches, (unsigned long) frames, (unsigned long) objects,
+    seconds, batches / secs, frames / secs, objects / secs);
+  fprintf(out, "%-24s %10s %10s %10s %10s %10s\n",
+    "stage", "mean us", "p50 us", "p90 us", "p99 us", "max us");
+  auto row = [out](const Stats& s) {
+    fprintf(out, "%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+      s.name.c_str(), s.mean_us, s.p50_us, s.p90_us, s.p99_us, s.max_us);
+  };
+  row(build);
+  for (const auto& stage : stages) {
+    row(stage);
+  }
+  row(total);
+}
+
+} // namespace ds
@@ -0,0 +1,359 @@
+/* ReplaySource.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ReplaySource.hpp"
+#include "FileMetaBroker.hpp"  // magic numbers
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace dp = distanceproto;
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
+
+namespace ds {
+
+static const uint32_t MAX_FRAMES_TAG = WireFormatLite::MakeTag(
+  dp::Batch::kMaxFramesFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+static const uint32_t FRAMES_TAG = WireFormatLite::MakeTag(
+  dp::Batch::kFramesFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+FileReplaySource::FileReplaySource(std::string filename) :
+  filename_(filename),
+  fd_(-1),
+  stream_(),
+  packed_(false),
+  has_max_frames_(false),
+  max_frames_(0),
+  has_frame_(false),
+  frame_(),
+  saw_max_frames_(false),
+  record_(),
+  packed_batch_()
+{
+  fd_ = open(filename_.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    GST_WARNING("could not open %s", filename_.c_str());
+    return;
+  }
+  stream_.reset(new google::protobuf::io::FileInputStream(fd_));
+  uint32_t magic = 0;
+  {
+    // gives back what it doesn't use when it goes
+    CodedInputStream in(stream_.get());
+    in.ReadLittleEndian32(&magic);
+  }
+  if (magic == FileMetaBroker::PACKED_MAGIC_NUMBER) {
+    packed_ = true;
+  } else if (magic != FileMetaBroker::PROTO_MAGIC_NUMBER) {
+    GST_WARNING("%s is not a FileMetaBroker proto or packed file",
+      filename_.c_str());
+    stream_.reset();
+  }
+}
+
+FileReplaySource::~FileReplaySource() {
+  stream_.reset();
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+bool
+FileReplaySource::next(dp::Batch* batch) {
+  batch->Clear();
+  if (!stream_) {
+    return false;
+  }
+  return packed_ ? next_packed(batch) : next_coded(batch);
+}
+
+bool
+FileReplaySource::next_coded(dp::Batch* batch) {
+  // sources in this batch, for files without max_frames
+  std::vector<uint32_t> sources;
+  // pick up where the last call left off
+  if (has_max_frames_) {
+    batch->set_max_frames(max_frames_);
+    has_max_frames_ = false;
+  }
+  if (has_frame_) {
+    sources.push_back(frame_.source_id());
+    batch->add_frames()->Swap(&frame_);
+    has_frame_ = false;
+  }
+  // a fresh stream per batch, so the byte limit never runs out
+  CodedInputStream in(stream_.get());
+  uint32_t tag;
+  while ((tag = in.ReadTag()) != 0) {
+    if (tag == MAX_FRAMES_TAG) {
+      uint32_t value;
+      if (!in.ReadVarint32(&value)) {
+        break;
+      }
+      saw_max_frames_ = true;
+      if (batch->frames_size() > 0) {
+        // the start of the next batch
+        has_max_frames_ = true;
+        max_frames_ = value;
+        return true;
+      }
+      batch->set_max_frames(value);
+      continue;
+    }
+    if (tag != FRAMES_TAG) {
+      if (!WireFormatLite::SkipField(&in, tag)) {
+        break;
+      }
+      continue;
+    }
+    uint32_t length;
+    if (!in.ReadVarint32(&length)) {
+      break;
+    }
+    auto limit = in.PushLimit((int) length);
+    bool ok = frame_.ParseFromCodedStream(&in);
+    in.PopLimit(limit);
+    if (!ok) {
+      GST_WARNING("bad frame in %s", filename_.c_str());
+      break;
+    }
+    if (!saw_max_frames_ &&
+        std::find(sources.begin(), sources.end(), frame_.source_id()) !=
+        sources.end()) {
+      // a source repeated, so this frame starts the next batch
+      has_frame_ = true;
+      return true;
+    }
+    sources.push_back(frame_.source_id());
+    batch->add_frames()->Swap(&frame_);
+  }
+  return batch->frames_size() > 0;
+}
+
+bool
+FileReplaySource::next_packed(dp::Batch* batch) {
+  CodedInputStream in(stream_.get());
+  uint32_t size;
+  if (!in.ReadVarint32(&size)) {
+    return false;
+  }
+  if (!in.ReadString(&record_, (int) size) ||
+      !packed_batch_.parse((const uint8_t*) record_.data(), record_.size())) {
+    GST_WARNING("bad record in %s", filename_.c_str());
+    return false;
+  }
+  packed_batch_.to_proto(batch);
+  return true;
+}
+
+MotReplaySource::MotReplaySource(std::string filename,
+                                 uint32_t source_id,
+                                 double fps,
+                                 float min_confidence) :
+  filename_(filename),
+  source_id_(source_id),
+  frame_ns_(fps > 0.0 ? (uint64_t)(1e9 / fps) : 0),
+  open_(false),
+  rows_(),
+  next_(0)
+{
+  std::ifstream in(filename_, std::ios::binary);
+  if (!in.is_open()) {
+    GST_WARNING("could not open %s", filename_.c_str());
+    return;
+  }
+  std::string text((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  if (!parse(text, min_confidence)) {
+    rows_.clear();
+    return;
+  }
+  std::stable_sort(rows_.begin(), rows_.end(),
+    [](const Row& a, const Row& b) { return a.frame < b.frame; });
+  open_ = true;
+}
+
+/**
+ * Skip separators (commas and whitespace other than newlines).
+ */
+static const char*
+skip_separators(const char* p) {
+  while (*p == ',' || *p == ' ' || *p == '\t' || *p == '\r') {
+    p++;
+  }
+  return p;
+}
+
+bool
+MotReplaySource::parse(const std::string& text, float min_confidence) {
+  // strtol and friends stop at the terminating '\0'
+  const char* p = text.c_str();
+  for (int line = 1; *p != '\0'; line++) {
+    p = skip_separators(p);
+    if (*p == '\n' || *p == '\0') {
+      // blank line
+      p += *p == '\n';
+      continue;
+    }
+    char* end;
+    Row row;
+    float values[5];
+    row.frame = (int32_t) strtol(p, &end, 10);
+    bool ok = end != p;
+    // (strtol and strtof would skip a newline, and read the next line)
+    p = skip_separators(end);
+    ok = ok && *p != '\n';
+    row.id = (int32_t) strtol(p, &end, 10);
+    ok = ok && end != p;
+    for (int i = 0; i < 5 && ok; i++) {
+      p = skip_separators(end);
+      ok = *p != '\n';
+      values[i] = strtof(p, &end);
+      ok = ok && end != p;
+    }
+    if (!ok) {
+      GST_WARNING("%s:%d: expected frame,id,left,top,width,height,conf",
+        filename_.c_str(), line);
+      return false;
+    }
+    // ignore the rest of the line
+    p = strchr(end, '\n');
+    p = p ? p + 1 : end + strlen(end);
+    if (values[4] < min_confidence) {
+      continue;
+    }
+    row.left = values[0];
+    row.top = values[1];
+    row.width = values[2];
+    row.height = values[3];
+    rows_.push_back(row);
+  }
+  return true;
+}
+
+bool
+MotReplaySource::next(dp::Batch* batch) {
+  batch->Clear();
+  if (next_ >= rows_.size()) {
+    return false;
+  }
+  int32_t frame_num = rows_[next_].frame;
+  batch->set_max_frames(1);
+  auto frame = batch->add_frames();
+  frame->set_frame_num(frame_num);
+  frame->set_pts(frame_num * frame_ns_);
+  frame->set_dts(frame_num * frame_ns_);
+  frame->set_source_id(source_id_);
+  for (; next_ < rows_.size() && rows_[next_].frame == frame_num; next_++) {
+    const Row& row = rows_[next_];
+    auto person = frame->add_people();
+    person->set_uid(row.id);
+    auto bbox = person->mutable_bbox();
+    bbox->set_left(row.left);
+    bbox->set_top(row.top);
+    bbox->set_width(row.width);
+    bbox->set_height(row.height);
+  }
+  return true;
+}
+
+// frame size the crowds wander around in
+static const float FRAME_WIDTH = 1920.0f;
+static const float FRAME_HEIGHT = 1080.0f;
+
+SyntheticReplaySource::SyntheticReplaySource(uint64_t num_batches,
+                                             uint32_t batch_size,
+                                             uint32_t max_people,
+                                             double fps,
+                                             uint32_t seed) :
+  num_batches_(num_batches),
+  batch_size_(batch_size),
+  max_people_(max_people),
+  frame_ns_(fps > 0.0 ? (uint64_t)(1e9 / fps) : 0),
+  count_(0),
+  rng_(seed),
+  crowds_(batch_size)
+{
+  std::uniform_int_distribution<uint32_t> num_people(0, max_people_);
+  std::uniform_int_distribution<int> num_groups(1, 4);
+  std::uniform_real_distribution<float> x(0.0f, FRAME_WIDTH);
+  std::uniform_real_distribution<float> y(FRAME_HEIGHT / 3, FRAME_HEIGHT);
+  std::normal_distribution<float> spread(0.0f, 60.0f);
+  for (auto& crowd : crowds_) {
+    // people bunch up in a few groups
+    std::vector<Walker> groups(num_groups(rng_));
+    for (auto& group : groups) {
+      group.x = x(rng_);
+      group.y = y(rng_);
+    }
+    crowd.resize(num_people(rng_));
+    for (size_t i = 0; i < crowd.size(); i++) {
+      const auto& group = groups[i % groups.size()];
+      crowd[i].x = group.x + spread(rng_);
+      crowd[i].y = group.y + spread(rng_) / 2;
+    }
+  }
+}
+
+bool
+SyntheticReplaySource::next(dp::Batch* batch) {
+  batch->Clear();
+  if (num_batches_ && count_ >= num_batches_) {
+    return false;
+  }
+  std::normal_distribution<float> step(0.0f, 3.0f);
+  batch->set_max_frames(batch_size_);
+  for (uint32_t s = 0; s < batch_size_; s++) {
+    auto frame = batch->add_frames();
+    frame->set_frame_num((int32_t) count_);
+    frame->set_pts(count_ * frame_ns_);
+    frame->set_dts(count_ * frame_ns_);
+    frame->set_source_id(s);
+    for (auto& walker : crowds_[s]) {
+      walker.x = std::min(std::max(walker.x + step(rng_), 0.0f), FRAME_WIDTH);
+      walker.y = std::min(std::max(walker.y + step(rng_) / 2, 1.0f),
+                          FRAME_HEIGHT);
+      // closer to the camera (lower in the frame) is bigger
+      walker.height = 60.0f + walker.y * 0.2f;
+      auto bbox = frame->add_people()->mutable_bbox();
+      bbox->set_left(walker.x - walker.height * 0.2f);
+      bbox->set_top(walker.y - walker.height);
+      bbox->set_width(walker.height * 0.4f);
+      bbox->set_height(walker.height);
+    }
+  }
+  count_++;
+  return true;
+}
+
+} // namespace ds
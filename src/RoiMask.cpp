@@ -0,0 +1,219 @@
+/* RoiMask.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "RoiMask.hpp"
+
+#include <gst/gst.h>
+
+#include <math.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+GST_DEBUG_CATEGORY_STATIC(roimask);
+
+namespace ds {
+
+const uint32_t RoiMask::DEFAULT_CELL_SIZE;
+
+RoiMask::RoiMask() :
+  cell_size_(DEFAULT_CELL_SIZE),
+  cols_(0),
+  rows_(0),
+  stride_(0),
+  scale_(0.0f),
+  max_col_(0.0f),
+  max_row_(0.0f),
+  bits_()
+  {}
+
+RoiMask::RoiMask(uint32_t width, uint32_t height, uint32_t cell_size) :
+  cell_size_(cell_size ? cell_size : DEFAULT_CELL_SIZE),
+  cols_((width + cell_size_ - 1) / cell_size_),
+  rows_((height + cell_size_ - 1) / cell_size_),
+  stride_((cols_ + 63) / 64),
+  scale_(1.0f / cell_size_),
+  max_col_((float) cols_),
+  max_row_((float) rows_),
+  bits_()
+{
+  if (cols_ && rows_) {
+    fill_all(true);
+  }
+}
+
+void
+RoiMask::fill_all(bool included) {
+  bits_.assign((size_t) stride_ * rows_, 0);
+  if (!included) {
+    return;
+  }
+  for (uint32_t row = 0; row < rows_; row++) {
+    for (uint32_t col = 0; col < cols_; col++) {
+      bits_[row * stride_ + (col >> 6)] |= 1ull << (col & 63);
+    }
+  }
+}
+
+void
+RoiMask::fill(const std::vector<Point>& polygon, bool included) {
+  if (bits_.empty() || polygon.size() < 3) {
+    return;
+  }
+  std::vector<float> crossings;
+  for (uint32_t row = 0; row < rows_; row++) {
+    // where the polygon crosses the line through the cell centers
+    float y = (row + 0.5f) * cell_size_;
+    crossings.clear();
+    for (size_t i = 0; i < polygon.size(); i++) {
+      const Point& a = polygon[i];
+      const Point& b = polygon[(i + 1) % polygon.size()];
+      if ((a.y <= y) != (b.y <= y)) {
+        crossings.push_back(a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+      // cells with centers in [crossings[i], crossings[i + 1])
+      float first = ceilf(crossings[i] * scale_ - 0.5f);
+      float last = ceilf(crossings[i + 1] * scale_ - 0.5f);
+      uint32_t begin = (uint32_t) std::min(std::max(first, 0.0f), max_col_);
+      uint32_t end = (uint32_t) std::min(std::max(last, 0.0f), max_col_);
+      for (uint32_t col = begin; col < end; col++) {
+        uint64_t bit = 1ull << (col & 63);
+        uint64_t& word = bits_[row * stride_ + (col >> 6)];
+        word = included ? word | bit : word & ~bit;
+      }
+    }
+  }
+}
+
+size_t
+RoiMask::count() const {
+  size_t included = 0;
+  for (auto word : bits_) {
+    included += __builtin_popcountll(word);
+  }
+  return included;
+}
+
+/**
+ * Parse an unsigned integer, the whole of `s`.
+ */
+static bool
+parse_uint(const std::string& s, uint32_t* value) {
+  char* end;
+  unsigned long v = strtoul(s.c_str(), &end, 10);
+  if (s.empty() || *end != '\0' || v > UINT32_MAX) {
+    return false;
+  }
+  *value = (uint32_t) v;
+  return true;
+}
+
+/**
+ * Parse an x,y point, the whole of `s`.
+ */
+static bool
+parse_point(const std::string& s, RoiMask::Point* point) {
+  char* end;
+  point->x = strtof(s.c_str(), &end);
+  if (end == s.c_str() || *end != ',') {
+    return false;
+  }
+  const char* y = end + 1;
+  point->y = strtof(y, &end);
+  return end != y && *end == '\0';
+}
+
+bool
+RoiMask::parse(const std::string& text, RoiMasks* masks) {
+  GST_DEBUG_CATEGORY_INIT(roimask, "roimask", 0, "RoiMask debug category.");
+  masks->clear();
+  std::istringstream lines(text);
+  std::string line;
+  RoiMask* mask = nullptr;
+  for (int number = 1; std::getline(lines, line); number++) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.resize(comment);
+    }
+    std::istringstream words(line);
+    std::string command;
+    if (!(words >> command)) {
+      continue;
+    }
+    std::vector<std::string> args;
+    std::string arg;
+    while (words >> arg) {
+      args.push_back(arg);
+    }
+    if (command == "source") {
+      uint32_t source_id, width, height, cell_size = DEFAULT_CELL_SIZE;
+      if ((args.size() != 3 && args.size() != 4) ||
+          !parse_uint(args[0], &source_id) ||
+          !parse_uint(args[1], &width) || !parse_uint(args[2], &height) ||
+          (args.size() == 4 && !parse_uint(args[3], &cell_size)) ||
+          !width || !height || !cell_size) {
+        GST_WARNING("line %d: expected source <id> <width> <height> "
+                    "[cell_size]", number);
+        return false;
+      }
+      mask = &(*masks)[source_id];
+      *mask = RoiMask(width, height, cell_size);
+    } else if (command == "include" || command == "exclude") {
+      std::vector<Point> polygon(args.size());
+      for (size_t i = 0; i < args.size(); i++) {
+        if (!parse_point(args[i], &polygon[i])) {
+          GST_WARNING("line %d: bad point: %s", number, args[i].c_str());
+          return false;
+        }
+      }
+      if (mask == nullptr || polygon.size() < 3) {
+        GST_WARNING("line %d: expected a source and at least 3 points",
+          number);
+        return false;
+      }
+      mask->fill(polygon, command == "include");
+    } else {
+      GST_WARNING("line %d: unknown command: %s", number, command.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+RoiMask::load(const std::string& filename, RoiMasks* masks) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    GST_WARNING("could not open %s", filename.c_str());
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return parse(text.str(), masks);
+}
+
+} // namespace ds
@@ -0,0 +1,149 @@
+/* ShmPayloadBroker.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ShmPayloadBroker.hpp"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+namespace ds {
+
+ShmPayloadBroker::ShmPayloadBroker(std::string name,
+                                   uint32_t slot_count,
+                                   uint32_t slot_size,
+                                   mode_t mode) :
+  name_(name),
+  slot_count_(slot_count ? slot_count : 1),
+  slot_size_(slot_size),
+  mode_(mode),
+  size_(shm_ring_size(slot_count_, slot_size_)),
+  header_(nullptr),
+  seq_(0)
+  {}
+
+ShmPayloadBroker::~ShmPayloadBroker() {
+  stop();
+}
+
+void
+ShmPayloadBroker::start() {
+  GST_DEBUG("%s start", __func__);
+  if (header_ != nullptr) {
+    return;
+  }
+  // a stale ring from a previous (crashed) run would confuse readers
+  shm_unlink(name_.c_str());
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, mode_);
+  if (fd == -1) {
+    GST_ERROR("could not create %s: %s", name_.c_str(), strerror(errno));
+    return;
+  }
+  // shm_open applies the umask, so set the mode we were asked for
+  if (fchmod(fd, mode_) == -1) {
+    GST_ERROR("could not chmod %s: %s", name_.c_str(), strerror(errno));
+    close(fd);
+    shm_unlink(name_.c_str());
+    return;
+  }
+  if (ftruncate(fd, size_) == -1) {
+    GST_ERROR("could not size %s: %s", name_.c_str(), strerror(errno));
+    close(fd);
+    shm_unlink(name_.c_str());
+    return;
+  }
+  void* mem = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping keeps the object alive
+  close(fd);
+  if (mem == MAP_FAILED) {
+    GST_ERROR("could not map %s: %s", name_.c_str(), strerror(errno));
+    shm_unlink(name_.c_str());
+    return;
+  }
+  // ftruncate zero fills, so every slot starts at generation 0
+  auto header = (ShmRingHeader*) mem;
+  header->version = SHM_RING_VERSION;
+  header->slot_count = slot_count_;
+  header->slot_size = slot_size_;
+  // readers check the magic last
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SHM_RING_MAGIC;
+  header_ = header;
+  seq_ = 0;
+}
+
+void
+ShmPayloadBroker::stop() {
+  GST_DEBUG("%s start", __func__);
+  if (header_ == nullptr) {
+    return;
+  }
+  header_->closed.store(1, std::memory_order_release);
+  header_->notify.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, &header_->notify, FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+  munmap(header_, size_);
+  shm_unlink(name_.c_str());
+  header_ = nullptr;
+}
+
+bool
+ShmPayloadBroker::on_batch_payload(Payload* payload) {
+  if (header_ == nullptr) {
+    return false;
+  }
+  size_t size = payload->size();
+  if (size > slot_size_) {
+    GST_WARNING("payload of %zu bytes too big for %s (max %u)",
+      size, name_.c_str(), slot_size_);
+    header_->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  uint64_t seq = ++seq_;
+  auto slot = shm_ring_slot(header_, seq % slot_count_);
+  // odd generation: readers of this slot will retry or give up
+  slot->gen.store(2 * seq - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(shm_ring_slot_data(slot), payload->data(), size);
+  slot->size.store(size, std::memory_order_relaxed);
+  slot->gen.store(2 * seq, std::memory_order_release);
+  header_->write_seq.store(seq, std::memory_order_release);
+  // wake any sleeping readers (not private, since it's shared memory). A
+  // reader registers in `waiters` before it reads `notify`, so (both being
+  // sequentially consistent) either we see it here or it sees the new
+  // `notify` and FUTEX_WAIT returns at once.
+  header_->notify.fetch_add(1);
+  if (header_->waiters.load() != 0) {
+    syscall(SYS_futex, &header_->notify, FUTEX_WAKE, INT_MAX,
+            nullptr, nullptr, 0);
+  }
+  return true;
+}
+
+} // namespace ds
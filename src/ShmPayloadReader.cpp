@@ -0,0 +1,297 @@
+/* ShmPayloadReader.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ShmPayloadReader.hpp"
+#include "shm_payload_reader.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+namespace ds {
+
+// how often a read only reader checks for new payloads
+static const std::chrono::nanoseconds POLL_INTERVAL =
+  std::chrono::milliseconds(10);
+
+ShmPayloadReader::ShmPayloadReader() :
+  header_(nullptr),
+  size_(0),
+  writable_(false)
+  {}
+
+ShmPayloadReader::~ShmPayloadReader() {
+  close();
+}
+
+bool
+ShmPayloadReader::open(const std::string& name) {
+  close();
+  // writable only so we can register as a waiter, we never touch the slots
+  bool writable = true;
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd == -1 && errno == EACCES) {
+    writable = false;
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+  }
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+    ::close(fd);
+    return false;
+  }
+  void* mem = mmap(nullptr, st.st_size,
+                   writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+  auto header = (ShmRingHeader*) mem;
+  // the writer sets the magic last
+  bool valid = header->magic == SHM_RING_MAGIC;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  valid = valid && header->version == SHM_RING_VERSION &&
+    header->slot_count > 0 &&
+    shm_ring_size(header->slot_count, header->slot_size) <= (size_t)st.st_size;
+  if (!valid) {
+    munmap(mem, st.st_size);
+    return false;
+  }
+  header_ = header;
+  size_ = st.st_size;
+  writable_ = writable;
+  return true;
+}
+
+void
+ShmPayloadReader::close() {
+  if (header_ != nullptr) {
+    munmap(header_, size_);
+    header_ = nullptr;
+    size_ = 0;
+  }
+}
+
+bool
+ShmPayloadReader::writer_closed() const {
+  return header_ == nullptr ||
+    header_->closed.load(std::memory_order_acquire) != 0;
+}
+
+uint64_t
+ShmPayloadReader::latest_seq() const {
+  if (header_ == nullptr) {
+    return 0;
+  }
+  return header_->write_seq.load(std::memory_order_acquire);
+}
+
+uint64_t
+ShmPayloadReader::oldest_seq() const {
+  uint64_t latest = latest_seq();
+  if (latest == 0) {
+    return 0;
+  }
+  // the slot after the latest one may be being overwritten right now
+  uint64_t count = header_->slot_count;
+  return latest >= count ? latest - count + 2 : 1;
+}
+
+uint64_t
+ShmPayloadReader::dropped() const {
+  if (header_ == nullptr) {
+    return 0;
+  }
+  return header_->dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t
+ShmPayloadReader::wait_for_next(uint64_t last_seq, int64_t timeout_ms) const {
+  if (header_ == nullptr) {
+    return 0;
+  }
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    // register as a waiter, then read the futex word, so the writer either
+    // sees us and wakes us, or bumps the word first and the wait returns
+    if (writable_) {
+      header_->waiters.fetch_add(1);
+    }
+    uint32_t notify = header_->notify.load();
+    uint64_t latest = latest_seq();
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (latest > last_seq || writer_closed() ||
+        (timeout_ms >= 0 && left <= std::chrono::nanoseconds(0))) {
+      if (writable_) {
+        header_->waiters.fetch_sub(1);
+      }
+      return latest;
+    }
+    // the writer won't wake a reader it doesn't know about, so poll
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+    if (!writable_ && (timeout_ms < 0 || ns > POLL_INTERVAL)) {
+      ns = POLL_INTERVAL;
+    }
+    struct timespec ts;
+    ts.tv_sec = ns.count() / 1000000000;
+    ts.tv_nsec = ns.count() % 1000000000;
+    syscall(SYS_futex, &header_->notify, FUTEX_WAIT, notify,
+            timeout_ms >= 0 || !writable_ ? &ts : nullptr, nullptr, 0);
+    if (writable_) {
+      header_->waiters.fetch_sub(1);
+    }
+  }
+}
+
+ShmPayloadReader::Status
+ShmPayloadReader::peek(uint64_t seq, const uint8_t** data, size_t* size,
+                       uint64_t* token) const {
+  if (header_ == nullptr || seq == 0) {
+    return error;
+  }
+  auto slot = shm_ring_slot(header_, seq % header_->slot_count);
+  uint64_t gen = slot->gen.load(std::memory_order_acquire);
+  if (gen != 2 * seq) {
+    // older (or being written with this seq) means not published yet
+    return gen < 2 * seq ? again : gone;
+  }
+  uint64_t slot_size = slot->size.load(std::memory_order_relaxed);
+  if (slot_size > header_->slot_size) {
+    // torn read of the size, the slot is being reused
+    return gone;
+  }
+  *data = shm_ring_slot_data(slot);
+  *size = slot_size;
+  *token = gen;
+  return ok;
+}
+
+bool
+ShmPayloadReader::validate(uint64_t seq, uint64_t token) const {
+  if (header_ == nullptr || seq == 0) {
+    return false;
+  }
+  // order the reads of the bytes before the second read of gen
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto slot = shm_ring_slot(header_, seq % header_->slot_count);
+  return slot->gen.load(std::memory_order_relaxed) == token;
+}
+
+ShmPayloadReader::Status
+ShmPayloadReader::read(uint64_t seq, std::string* out) const {
+  const uint8_t* data;
+  size_t size;
+  uint64_t token;
+  Status status = peek(seq, &data, &size, &token);
+  if (status != ok) {
+    return status;
+  }
+  out->assign((const char*)data, size);
+  return validate(seq, token) ? ok : gone;
+}
+
+} // namespace ds
+
+// C interface
+
+extern "C" {
+
+ds_shm_reader*
+ds_shm_reader_open(const char* name) {
+  auto reader = new ds::ShmPayloadReader();
+  if (!reader->open(name)) {
+    delete reader;
+    return nullptr;
+  }
+  return (ds_shm_reader*) reader;
+}
+
+void
+ds_shm_reader_close(ds_shm_reader* reader) {
+  delete (ds::ShmPayloadReader*) reader;
+}
+
+int
+ds_shm_reader_writer_closed(const ds_shm_reader* reader) {
+  return ((const ds::ShmPayloadReader*) reader)->writer_closed();
+}
+
+uint64_t
+ds_shm_reader_latest_seq(const ds_shm_reader* reader) {
+  return ((const ds::ShmPayloadReader*) reader)->latest_seq();
+}
+
+uint64_t
+ds_shm_reader_oldest_seq(const ds_shm_reader* reader) {
+  return ((const ds::ShmPayloadReader*) reader)->oldest_seq();
+}
+
+uint64_t
+ds_shm_reader_wait_for_next(const ds_shm_reader* reader,
+                            uint64_t last_seq, int64_t timeout_ms) {
+  return ((const ds::ShmPayloadReader*) reader)->wait_for_next(
+    last_seq, timeout_ms);
+}
+
+int
+ds_shm_reader_peek(const ds_shm_reader* reader, uint64_t seq,
+                   const uint8_t** data, size_t* size, uint64_t* token) {
+  return ((const ds::ShmPayloadReader*) reader)->peek(seq, data, size, token);
+}
+
+int
+ds_shm_reader_validate(const ds_shm_reader* reader, uint64_t seq,
+                       uint64_t token) {
+  return ((const ds::ShmPayloadReader*) reader)->validate(seq, token);
+}
+
+int
+ds_shm_reader_read(const ds_shm_reader* reader, uint64_t seq,
+                   uint8_t* buf, size_t capacity, size_t* size) {
+  auto r = (const ds::ShmPayloadReader*) reader;
+  const uint8_t* data;
+  uint64_t token;
+  int status = r->peek(seq, &data, size, &token);
+  if (status != ds::ShmPayloadReader::ok) {
+    return status;
+  }
+  if (*size > capacity) {
+    // *size is the capacity needed
+    return DS_SHM_TOO_SMALL;
+  }
+  memcpy(buf, data, *size);
+  return r->validate(seq, token) ? DS_SHM_OK : DS_SHM_GONE;
+}
+
+} // extern "C"
@@ -0,0 +1,389 @@
+/* SocketPayloadBroker.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "SocketPayloadBroker.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace ds {
+
+// max payloads gathered into a single sendmsg (two iovecs each)
+static const size_t MAX_GATHER = 32;
+static const int MAX_EVENTS = 64;
+// epoll data for the non subscriber fds (subscriber fds are >= 0)
+static const int LISTEN_ID = -1;
+static const int EVENT_ID = -2;
+
+SocketPayloadBroker::SocketPayloadBroker(std::string path,
+                                         size_t max_queue,
+                                         SlowPolicy policy) :
+  path_(path),
+  max_queue_(max_queue ? max_queue : 1),
+  policy_(policy),
+  listen_fd_(-1),
+  event_fd_(-1),
+  epoll_fd_(-1),
+  running_(false),
+  subscribers_count_(0),
+  skipped_(0),
+  disconnected_(0)
+  {}
+
+SocketPayloadBroker::~SocketPayloadBroker() {
+  stop();
+}
+
+void
+SocketPayloadBroker::start() {
+  GST_DEBUG("%s start", __func__);
+  if (running_.load()) {
+    return;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    GST_ERROR("socket path too long: %s", path_.c_str());
+    return;
+  }
+  strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (listen_fd_ == -1 || event_fd_ == -1 || epoll_fd_ == -1) {
+    GST_ERROR("could not create socket for %s: %s",
+      path_.c_str(), strerror(errno));
+    stop();
+    return;
+  }
+  // a stale socket from a previous (crashed) run would fail bind
+  unlink(path_.c_str());
+  if (bind(listen_fd_, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+      listen(listen_fd_, SOMAXCONN) == -1) {
+    GST_ERROR("could not listen on %s: %s", path_.c_str(), strerror(errno));
+    stop();
+    return;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = LISTEN_ID;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+  ev.data.fd = EVENT_ID;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+  running_.store(true);
+  worker_ = std::thread(&SocketPayloadBroker::server_func, this);
+}
+
+void
+SocketPayloadBroker::stop() {
+  GST_DEBUG("%s start", __func__);
+  if (running_.exchange(false)) {
+    uint64_t one = 1;
+    if (write(event_fd_, &one, sizeof(one)) == -1) {
+      GST_WARNING("could not wake server thread: %s", strerror(errno));
+    }
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+  // the server thread is gone, so nothing else touches these
+  for (auto& kv : subscribers_) {
+    for (auto p : kv.second.queue) {
+      p->unref();
+    }
+    close(kv.first);
+  }
+  subscribers_.clear();
+  subscribers_count_.store(0);
+  {
+    std::lock_guard<std::mutex> guard(inbox_lock_);
+    for (auto p : inbox_) {
+      p->unref();
+    }
+    inbox_.clear();
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+    listen_fd_ = -1;
+  }
+  if (event_fd_ != -1) {
+    close(event_fd_);
+    event_fd_ = -1;
+  }
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+}
+
+bool
+SocketPayloadBroker::on_batch_payload(Payload* payload) {
+  if (!running_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  bool wake;
+  {
+    std::lock_guard<std::mutex> guard(inbox_lock_);
+    // the server thread is already due to drain the inbox if not empty
+    wake = inbox_.empty();
+    inbox_.push_back(payload->ref());
+  }
+  if (wake) {
+    uint64_t one = 1;
+    if (write(event_fd_, &one, sizeof(one)) == -1) {
+      GST_WARNING("could not wake server thread: %s", strerror(errno));
+    }
+  }
+  return true;
+}
+
+void
+SocketPayloadBroker::server_func() {
+  struct epoll_event events[MAX_EVENTS];
+  std::vector<Payload*> incoming;
+  while (running_.load()) {
+    int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      GST_ERROR("epoll_wait failed on %s: %s", path_.c_str(), strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      int id = events[i].data.fd;
+      if (id == LISTEN_ID) {
+        accept_all();
+      } else if (id == EVENT_ID) {
+        uint64_t count;
+        if (read(event_fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+          GST_WARNING("eventfd read failed: %s", strerror(errno));
+        }
+        {
+          std::lock_guard<std::mutex> guard(inbox_lock_);
+          incoming.swap(inbox_);
+        }
+        for (auto p : incoming) {
+          // iterating while removing, so advance first
+          for (auto it = subscribers_.begin(); it != subscribers_.end();) {
+            auto sub = &(it++)->second;
+            if (!enqueue(sub, p)) {
+              remove(sub->fd);
+            }
+          }
+          p->unref();
+        }
+        incoming.clear();
+        for (auto it = subscribers_.begin(); it != subscribers_.end();) {
+          auto sub = &(it++)->second;
+          if (!sub->want_write && !flush(sub)) {
+            remove(sub->fd);
+          }
+        }
+      } else {
+        auto it = subscribers_.find(id);
+        if (it == subscribers_.end()) {
+          continue;
+        }
+        auto sub = &it->second;
+        if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+          remove(id);
+          continue;
+        }
+        if (events[i].events & EPOLLIN) {
+          // subscribers have nothing to say, but drain so we don't spin
+          char junk[256];
+          ssize_t r = recv(id, junk, sizeof(junk), 0);
+          if (r == 0 || (r == -1 && errno != EAGAIN && errno != EINTR)) {
+            remove(id);
+            continue;
+          }
+        }
+        if ((events[i].events & EPOLLOUT) && !flush(sub)) {
+          remove(id);
+        }
+      }
+    }
+  }
+}
+
+void
+SocketPayloadBroker::accept_all() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        GST_WARNING("accept failed on %s: %s", path_.c_str(), strerror(errno));
+      }
+      return;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      GST_WARNING("could not watch subscriber: %s", strerror(errno));
+      close(fd);
+      continue;
+    }
+    auto& sub = subscribers_[fd];
+    sub.fd = fd;
+    sub.offset = 0;
+    sub.want_write = false;
+    subscribers_count_.store(subscribers_.size());
+    GST_DEBUG("subscriber %d connected to %s", fd, path_.c_str());
+  }
+}
+
+void
+SocketPayloadBroker::remove(int fd) {
+  auto it = subscribers_.find(fd);
+  if (it == subscribers_.end()) {
+    return;
+  }
+  for (auto p : it->second.queue) {
+    p->unref();
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  subscribers_.erase(it);
+  subscribers_count_.store(subscribers_.size());
+  GST_DEBUG("subscriber %d disconnected from %s", fd, path_.c_str());
+}
+
+bool
+SocketPayloadBroker::enqueue(Subscriber* sub, Payload* payload) {
+  if (sub->queue.size() >= max_queue_) {
+    if (policy_ == drop_client) {
+      GST_WARNING("subscriber %d on %s too slow, disconnecting",
+        sub->fd, path_.c_str());
+      disconnected_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    // a partially sent payload has to be finished or the stream breaks
+    auto victim = sub->queue.begin();
+    if (sub->offset && sub->queue.size() > 1) {
+      ++victim;
+    }
+    if (sub->offset == 0 || victim != sub->queue.begin()) {
+      (*victim)->unref();
+      sub->queue.erase(victim);
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      // max_queue_ is 1 and it's partially sent, so skip the new one
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  sub->queue.push_back(payload->ref());
+  return true;
+}
+
+bool
+SocketPayloadBroker::flush(Subscriber* sub) {
+  struct iovec iov[MAX_GATHER * 2];
+  uint32_t headers[MAX_GATHER];
+  while (!sub->queue.empty()) {
+    // gather up to MAX_GATHER payloads, skipping what's already been sent
+    size_t count = 0;
+    size_t niov = 0;
+    size_t skip = sub->offset;
+    for (auto p : sub->queue) {
+      if (count == MAX_GATHER) {
+        break;
+      }
+      size_t size = p->size();
+      // little endian length prefix
+      uint8_t* h = (uint8_t*) &headers[count];
+      h[0] = size & 0xff;
+      h[1] = (size >> 8) & 0xff;
+      h[2] = (size >> 16) & 0xff;
+      h[3] = (size >> 24) & 0xff;
+      if (skip < sizeof(uint32_t)) {
+        iov[niov].iov_base = h + skip;
+        iov[niov].iov_len = sizeof(uint32_t) - skip;
+        niov++;
+        skip = 0;
+      } else {
+        skip -= sizeof(uint32_t);
+      }
+      if (size > skip) {
+        iov[niov].iov_base = (void*) (p->data() + skip);
+        iov[niov].iov_len = size - skip;
+        niov++;
+      }
+      skip = 0;
+      count++;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    // sendmsg rather than writev so a vanished client can't SIGPIPE us
+    ssize_t sent = sendmsg(sub->fd, &msg, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    // retire whatever was completely sent
+    size_t done = sub->offset + sent;
+    while (!sub->queue.empty()) {
+      size_t total = sizeof(uint32_t) + sub->queue.front()->size();
+      if (done < total) {
+        break;
+      }
+      done -= total;
+      sub->queue.front()->unref();
+      sub->queue.pop_front();
+    }
+    sub->offset = done;
+  }
+  // only ask for EPOLLOUT while there is a backlog
+  bool want_write = !sub->queue.empty();
+  if (want_write != sub->want_write) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (want_write ? (uint32_t) EPOLLOUT : 0);
+    ev.data.fd = sub->fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, sub->fd, &ev);
+    sub->want_write = want_write;
+  }
+  return true;
+}
+
+} // namespace ds
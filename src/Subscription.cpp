@@ -0,0 +1,80 @@
+/* Subscription.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Subscription.hpp"
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+bool
+Subscription::is_passthrough() const {
+  return source_ids.empty() && min_sum_danger <= 0.0f && !danger_only;
+}
+
+bool
+Subscription::matches(const dp::Frame& frame) const {
+  if (!source_ids.empty() &&
+      source_ids.find(frame.source_id()) == source_ids.end()) {
+    return false;
+  }
+  if (frame.sum_danger() < min_sum_danger) {
+    return false;
+  }
+  if (danger_only) {
+    for (const auto& person : frame.people()) {
+      if (person.is_danger()) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+bool
+Subscription::apply(const dp::Batch& batch, dp::Batch* out) const {
+  out->Clear();
+  out->set_max_frames(batch.max_frames());
+  for (const auto& frame : batch.frames()) {
+    if (!matches(frame)) {
+      continue;
+    }
+    auto frame_out = out->add_frames();
+    *frame_out = frame;
+    if (danger_only) {
+      // compact the dangerous people to the front and drop the rest
+      auto people = frame_out->mutable_people();
+      int kept = 0;
+      for (int i = 0; i < people->size(); i++) {
+        if (people->Get(i).is_danger()) {
+          people->SwapElements(i, kept++);
+        }
+      }
+      people->DeleteSubrange(kept, people->size() - kept);
+    }
+  }
+  return out->frames_size() != 0;
+}
+
+} // namespace ds
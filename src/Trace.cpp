@@ -0,0 +1,254 @@
+/* Trace.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "Trace.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ds {
+namespace trace {
+
+thread_local Ring* current_ring = nullptr;
+
+/**
+ * Registry owns every Ring. Rings outlive their threads (so a dump after a
+ * worker exits still has its events) and are reused by new threads once
+ * they have been cleared.
+ */
+class Registry {
+public:
+  /**
+   * The most rings of exited threads to keep around for dump().
+   */
+  static const size_t MAX_RETIRED = 64;
+
+  static Registry& get() {
+    // never destroyed, since threads may record during static destruction
+    static Registry* registry = new Registry();
+    return *registry;
+  }
+
+  Ring* acquire() {
+    std::lock_guard<std::mutex> guard(lock_);
+    Ring* ring;
+    if (!free_.empty()) {
+      ring = free_.back();
+      free_.pop_back();
+    } else if (retired_.size() < MAX_RETIRED) {
+      rings_.emplace_back(new Ring());
+      ring = rings_.back().get();
+    } else {
+      // too many threads have come and gone since the last clear(), so the
+      // oldest of them has to go
+      ring = retired_.front();
+      retired_.pop_front();
+      // (or its events would be attributed to this thread)
+      ring->tail_.store(ring->head_.load());
+    }
+    ring->tid_ = (uint32_t) syscall(SYS_gettid);
+    return ring;
+  }
+
+  /**
+   * Called when the thread using `ring` exits. Its events are kept until
+   * the next clear().
+   */
+  void retire(Ring* ring) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (ring->head_.load() == ring->tail_.load()) {
+      free_.push_back(ring);
+    } else {
+      retired_.push_back(ring);
+    }
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto& ring : rings_) {
+      ring->tail_.store(ring->head_.load(std::memory_order_acquire));
+    }
+    free_.insert(free_.end(), retired_.begin(), retired_.end());
+    retired_.clear();
+  }
+
+  void write_json(std::ostream& out) {
+    std::lock_guard<std::mutex> guard(lock_);
+    // ticks to microseconds, measured against steady_clock since we started
+    uint64_t ticks = now() - epoch_ticks_;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch_time_).count();
+    double us_per_tick = ticks ? ns / 1e3 / ticks : 1e-3;
+
+    int pid = (int) getpid();
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    std::vector<Copy> events;
+    for (auto& ring : rings_) {
+      copy_events(*ring, &events);
+      for (const auto& event : events) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"";
+        write_escaped(out, event.name);
+        out << "\",\"ph\":\"" << event.phase << "\",\"pid\":" << pid
+            << ",\"tid\":" << ring->tid_ << ",\"ts\":"
+            << (int64_t)(event.ts - epoch_ticks_) * us_per_tick;
+        switch (event.phase) {
+          case 'X':
+            out << ",\"dur\":" << event.arg * us_per_tick;
+            break;
+          case 'i':
+            out << ",\"s\":\"t\"";
+            break;
+          case 'C':
+            out << ",\"args\":{\"value\":" << event.arg << "}";
+            break;
+        }
+        out << "}";
+      }
+    }
+    out << "\n]}\n";
+  }
+
+private:
+  Registry() :
+    epoch_ticks_(now()),
+    epoch_time_(std::chrono::steady_clock::now())
+    {}
+
+  // a plain copy of an Event
+  struct Copy {
+    const char* name;
+    uint64_t ts;
+    uint64_t arg;
+    char phase;
+  };
+
+  /**
+   * Copy the live events of `ring` into `out` (replacing its contents).
+   * Events being overwritten while we copy are dropped.
+   */
+  static void copy_events(const Ring& ring, std::vector<Copy>* out) {
+    out->clear();
+    uint64_t head = ring.head_.load(std::memory_order_acquire);
+    uint64_t begin = ring.tail_.load(std::memory_order_relaxed);
+    if (head - begin > Ring::CAPACITY) {
+      begin = head - Ring::CAPACITY;
+    }
+    for (uint64_t i = begin; i < head; i++) {
+      const Event& event = ring.events_[i & (Ring::CAPACITY - 1)];
+      Copy copy = {
+        event.name.load(std::memory_order_relaxed),
+        event.ts.load(std::memory_order_relaxed),
+        event.arg.load(std::memory_order_relaxed),
+        event.phase.load(std::memory_order_relaxed),
+      };
+      out->push_back(copy);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // anything the writer may have started on since is suspect
+    uint64_t now_head = ring.head_.load(std::memory_order_relaxed);
+    if (now_head >= Ring::CAPACITY && now_head - Ring::CAPACITY + 1 > begin) {
+      size_t stale = std::min<uint64_t>(
+        now_head - Ring::CAPACITY + 1 - begin, out->size());
+      out->erase(out->begin(), out->begin() + stale);
+    }
+  }
+
+  static void write_escaped(std::ostream& out, const char* s) {
+    for (; s && *s; s++) {
+      if (*s == '"' || *s == '\\') {
+        out << '\\';
+      }
+      out << *s;
+    }
+  }
+
+  std::mutex lock_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  // rings of exited threads with nothing in them
+  std::vector<Ring*> free_;
+  // rings of exited threads with events still to dump, oldest first
+  std::deque<Ring*> retired_;
+  uint64_t epoch_ticks_;
+  std::chrono::steady_clock::time_point epoch_time_;
+};
+
+/**
+ * Gives the thread's Ring back when the thread exits.
+ */
+struct RingReleaser {
+  ~RingReleaser() {
+    if (current_ring) {
+      Registry::get().retire(current_ring);
+      current_ring = nullptr;
+    }
+  }
+};
+
+Ring*
+register_thread() {
+  static thread_local RingReleaser releaser;
+  (void) releaser;
+  current_ring = Registry::get().acquire();
+  return current_ring;
+}
+
+bool
+enabled() {
+#ifdef DS_TRACING
+  return true;
+#else
+  return false;
+#endif
+}
+
+void
+write_json(std::ostream& out) {
+  Registry::get().write_json(out);
+}
+
+bool
+dump(const std::string& filename) {
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+    return false;
+  }
+  write_json(out);
+  out.close();
+  return !out.fail();
+}
+
+void
+clear() {
+  Registry::get().clear();
+}
+
+} // namespace trace
+} // namespace ds
@@ -0,0 +1,80 @@
+/* ViolationEventFilter.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ViolationEventFilter.hpp"
+#include "Trace.hpp"
+
+#include <cstring>
+
+namespace dp = distanceproto;
+
+namespace ds {
+
+const uint32_t ViolationEventFilter::EVENTS_SUBSCRIPTION;
+
+ViolationEventFilter::ViolationEventFilter() :
+  ProtoPayloadFilter(sync),
+  tracker(),
+  events_(),
+  scratch_()
+  {}
+
+bool
+ViolationEventFilter::on_batch_meta(NvDsBatchMeta* batch_meta,
+                                    dp::Batch* batch) {
+  DS_TRACE_SCOPE("ViolationEventFilter::on_batch_meta");
+  events_.clear();
+  tracker.update(*batch, &events_);
+  if (events_.empty()) {
+    return true;
+  }
+  return this->attach_payload(batch_meta, this->make_events_payload());
+}
+
+uint32_t
+ViolationEventFilter::subscribe(const Subscription& subscription) {
+  (void) subscription;
+  GST_WARNING("events can't be filtered, so the subscription is refused");
+  return NO_SUBSCRIPTION;
+}
+
+GstBuffer*
+ViolationEventFilter::on_eos() {
+  events_.clear();
+  tracker.flush(&events_);
+  if (events_.empty()) {
+    return nullptr;
+  }
+  return this->make_payload_buffer({this->make_events_payload()});
+}
+
+Payload*
+ViolationEventFilter::make_events_payload() {
+  ViolationTracker::encode(events_, &scratch_);
+  auto payload = pool_->acquire(scratch_.size());
+  memcpy(payload->mutable_data(), scratch_.data(), scratch_.size());
+  payload->set_subscription(EVENTS_SUBSCRIPTION);
+  return payload;
+}
+
+} // namespace ds
@@ -0,0 +1,347 @@
+/* ViolationTracker.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "ViolationTracker.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <cstring>
+
+namespace dp = distanceproto;
+namespace pbio = google::protobuf::io;
+
+namespace ds {
+
+const uint8_t ViolationTracker::MAGIC;
+
+static const float DEFAULT_ENTER_DANGER = 1.0f;
+static const float DEFAULT_EXIT_DANGER = 0.8f;
+static const uint64_t DEFAULT_MIN_DURATION = 500000000ull;  // 0.5s
+static const uint64_t DEFAULT_UPDATE_INTERVAL = 5000000000ull;  // 5s
+static const uint64_t DEFAULT_IDLE_TIMEOUT = 2000000000ull;  // 2s
+static const size_t DEFAULT_MAX_TRACKS = 256;
+// the largest sane count in a message, to bail early on garbage
+static const uint32_t MAX_COUNT = 1 << 16;
+
+static inline uint32_t float_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+static inline float bits_float(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+ViolationTracker::ViolationTracker() :
+  sources_(),
+  sightings_()
+{
+  this->enter_danger = DEFAULT_ENTER_DANGER;
+  this->exit_danger = DEFAULT_EXIT_DANGER;
+  this->min_duration = DEFAULT_MIN_DURATION;
+  this->update_interval = DEFAULT_UPDATE_INTERVAL;
+  this->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+  this->max_tracks = DEFAULT_MAX_TRACKS;
+}
+
+ViolationEvent
+ViolationTracker::make_event(ViolationEvent::Kind kind,
+                             uint32_t source_id,
+                             const Track& track,
+                             uint64_t pts) {
+  ViolationEvent event;
+  event.kind = kind;
+  event.source_id = source_id;
+  event.object_id = track.latest.object_id;
+  event.start_pts = track.start_pts;
+  event.pts = pts;
+  event.danger_val = track.latest.danger_val;
+  event.peak_danger = track.peak_danger;
+  event.left = track.latest.left;
+  event.top = track.latest.top;
+  event.width = track.latest.width;
+  event.height = track.latest.height;
+  return event;
+}
+
+void
+ViolationTracker::evict(uint32_t source_id, Tracks* tracks,
+                        std::vector<ViolationEvent>* events) {
+  auto oldest = tracks->begin();
+  for (auto it = tracks->begin(); it != tracks->end(); ++it) {
+    if (it->second.last_seen < oldest->second.last_seen) {
+      oldest = it;
+    }
+  }
+  if (oldest == tracks->end()) {
+    return;
+  }
+  const Track& track = oldest->second;
+  if (track.state == active) {
+    events->push_back(make_event(
+      ViolationEvent::end, source_id, track, track.last_seen));
+  } else if (track.state == ending) {
+    events->push_back(make_event(
+      ViolationEvent::end, source_id, track, track.since));
+  }
+  tracks->erase(oldest);
+}
+
+void
+ViolationTracker::update(uint32_t source_id, uint64_t pts,
+                         const Sighting* sightings, size_t count,
+                         std::vector<ViolationEvent>* events) {
+  Tracks& tracks = sources_[source_id];
+  for (size_t i = 0; i < count; i++) {
+    const Sighting& sighting = sightings[i];
+    auto it = tracks.find(sighting.object_id);
+    if (it == tracks.end()) {
+      // nobody to remember
+      if (sighting.danger_val < enter_danger || max_tracks == 0) {
+        continue;
+      }
+      if (tracks.size() >= max_tracks) {
+        evict(source_id, &tracks, events);
+      }
+      Track track;
+      track.state = starting;
+      track.since = pts;
+      track.start_pts = pts;
+      track.last_report = pts;
+      track.peak_danger = sighting.danger_val;
+      it = tracks.emplace(sighting.object_id, track).first;
+    }
+    Track& track = it->second;
+    track.last_seen = pts;
+    track.latest = sighting;
+    if (sighting.danger_val > track.peak_danger) {
+      track.peak_danger = sighting.danger_val;
+    }
+    // it has to stay at enter_danger to start, and below exit_danger to end
+    bool above = sighting.danger_val >=
+      (track.state == starting ? enter_danger : exit_danger);
+    switch (track.state) {
+      case starting:
+        if (!above) {
+          // a blip, never reported
+          tracks.erase(it);
+        } else if (pts - track.since >= min_duration) {
+          track.state = active;
+          track.last_report = pts;
+          events->push_back(make_event(
+            ViolationEvent::start, source_id, track, pts));
+        }
+        break;
+      case active:
+        if (!above) {
+          track.state = ending;
+          track.since = pts;
+          if (min_duration == 0) {
+            events->push_back(make_event(
+              ViolationEvent::end, source_id, track, pts));
+            tracks.erase(it);
+          }
+        } else if (update_interval &&
+                   pts - track.last_report >= update_interval) {
+          track.last_report = pts;
+          events->push_back(make_event(
+            ViolationEvent::update, source_id, track, pts));
+        }
+        break;
+      case ending:
+        if (above) {
+          // it wasn't over after all
+          track.state = active;
+        } else if (pts - track.since >= min_duration) {
+          events->push_back(make_event(
+            ViolationEvent::end, source_id, track, track.since));
+          tracks.erase(it);
+        }
+        break;
+    }
+  }
+  // anybody we haven't seen in a while is gone
+  expire_source(source_id, &tracks, pts, events);
+}
+
+void
+ViolationTracker::expire_source(uint32_t source_id, Tracks* tracks,
+                                uint64_t pts,
+                                std::vector<ViolationEvent>* events) {
+  for (auto it = tracks->begin(); it != tracks->end();) {
+    const Track& track = it->second;
+    // last_seen can be ahead of pts from another source
+    if (track.last_seen >= pts || pts - track.last_seen < idle_timeout) {
+      ++it;
+      continue;
+    }
+    if (track.state == active) {
+      events->push_back(make_event(
+        ViolationEvent::end, source_id, track, track.last_seen));
+    } else if (track.state == ending) {
+      events->push_back(make_event(
+        ViolationEvent::end, source_id, track, track.since));
+    }
+    it = tracks->erase(it);
+  }
+}
+
+void
+ViolationTracker::expire(uint64_t pts, std::vector<ViolationEvent>* events) {
+  for (auto& source : sources_) {
+    expire_source(source.first, &source.second, pts, events);
+  }
+}
+
+void
+ViolationTracker::update(const dp::Batch& batch,
+                         std::vector<ViolationEvent>* events) {
+  uint64_t latest = 0;
+  for (const auto& frame : batch.frames()) {
+    sightings_.clear();
+    for (const auto& person : frame.people()) {
+      // untracked, so there's no telling who it is from frame to frame
+      if (person.uid() == 0) {
+        continue;
+      }
+      Sighting sighting;
+      sighting.object_id = (uint32_t) person.uid();
+      sighting.danger_val = person.danger_val();
+      sighting.left = person.bbox().left();
+      sighting.top = person.bbox().top();
+      sighting.width = person.bbox().width();
+      sighting.height = person.bbox().height();
+      sightings_.push_back(sighting);
+    }
+    update(frame.source_id(), frame.pts(),
+           sightings_.data(), sightings_.size(), events);
+    if (frame.pts() > latest) {
+      latest = frame.pts();
+    }
+  }
+  // sources with nothing in this batch still time out
+  expire(latest, events);
+}
+
+void
+ViolationTracker::flush(std::vector<ViolationEvent>* events) {
+  for (const auto& source : sources_) {
+    for (const auto& kv : source.second) {
+      const Track& track = kv.second;
+      if (track.state == active) {
+        events->push_back(make_event(
+          ViolationEvent::end, source.first, track, track.last_seen));
+      } else if (track.state == ending) {
+        events->push_back(make_event(
+          ViolationEvent::end, source.first, track, track.since));
+      }
+    }
+  }
+  sources_.clear();
+}
+
+size_t
+ViolationTracker::num_tracks() const {
+  size_t count = 0;
+  for (const auto& source : sources_) {
+    count += source.second.size();
+  }
+  return count;
+}
+
+void
+ViolationTracker::encode(const std::vector<ViolationEvent>& events,
+                         std::string* out) {
+  out->clear();
+  pbio::StringOutputStream raw(out);
+  pbio::CodedOutputStream coded(&raw);
+  coded.WriteRaw(&MAGIC, 1);
+  coded.WriteVarint32((uint32_t) events.size());
+  for (const auto& event : events) {
+    coded.WriteRaw(&event.kind, 1);
+    coded.WriteVarint32(event.source_id);
+    coded.WriteVarint64(event.object_id);
+    coded.WriteVarint64(event.start_pts);
+    coded.WriteVarint64(event.pts - event.start_pts);
+    coded.WriteLittleEndian32(float_bits(event.danger_val));
+    coded.WriteLittleEndian32(float_bits(event.peak_danger));
+    coded.WriteLittleEndian32(float_bits(event.left));
+    coded.WriteLittleEndian32(float_bits(event.top));
+    coded.WriteLittleEndian32(float_bits(event.width));
+    coded.WriteLittleEndian32(float_bits(event.height));
+  }
+}
+
+bool
+ViolationTracker::decode(const uint8_t* data, size_t size,
+                         std::vector<ViolationEvent>* events) {
+  events->clear();
+  if (!is_event_message(data, size)) {
+    return false;
+  }
+  pbio::CodedInputStream in(data + 1, (int) size - 1);
+  uint32_t count;
+  if (!in.ReadVarint32(&count) || count > MAX_COUNT) {
+    return false;
+  }
+  events->reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    ViolationEvent event;
+    uint8_t kind;
+    uint64_t duration;
+    uint32_t bits[6];
+    if (!in.ReadRaw(&kind, 1) || kind > ViolationEvent::end ||
+        !in.ReadVarint32(&event.source_id) ||
+        !in.ReadVarint64(&event.object_id) ||
+        !in.ReadVarint64(&event.start_pts) ||
+        !in.ReadVarint64(&duration)) {
+      return false;
+    }
+    for (auto& b : bits) {
+      if (!in.ReadLittleEndian32(&b)) {
+        return false;
+      }
+    }
+    event.kind = (ViolationEvent::Kind) kind;
+    event.pts = event.start_pts + duration;
+    event.danger_val = bits_float(bits[0]);
+    event.peak_danger = bits_float(bits[1]);
+    event.left = bits_float(bits[2]);
+    event.top = bits_float(bits[3]);
+    event.width = bits_float(bits[4]);
+    event.height = bits_float(bits[5]);
+    events->push_back(event);
+  }
+  // trailing garbage means it isn't what we think it is
+  return in.ExpectAtEnd();
+}
+
+bool
+ViolationTracker::is_event_message(const uint8_t* data, size_t size) {
+  return size > 0 && data[0] == MAGIC;
+}
+
+} // namespace ds
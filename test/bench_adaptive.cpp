@@ -0,0 +1,138 @@
+/**
+ * Adaptive frame skipping benchmark.
+ *
+ * Replays scenes through a DistanceFilter computing every frame and one
+ * with adaptive set, and reports the time spent in on_buffer by each, the
+ * share of frames the adaptive one computed, and how far its danger_val
+ * and is_danger were from the real thing.
+ *
+ * usage: bench_adaptive [num_batches] [recording]
+ *
+ * Without a recording, synthetic scenes are used: wandering crowds, a few
+ * people wandering about, big crowds (a quarter of the batches) and a crowd
+ * standing still.
+ */
+
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+#include "ReplaySource.hpp"
+
+#include <math.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace dp = distanceproto;
+
+namespace {
+
+// default number of batches per scene
+const int NUM_BATCHES = 2000;
+// frames per batch for synthetic scenes
+const uint32_t BATCH_SIZE = 8;
+
+/**
+ * Replays the first batch of another source forever, with the time moving.
+ */
+class StillReplaySource : public ds::ReplaySource {
+public:
+  StillReplaySource(ds::ReplaySource* source, uint64_t num_batches) :
+    num_batches_(num_batches), count_(0) {
+    source->next(&batch_);
+  }
+  virtual bool next(dp::Batch* batch) {
+    if (count_ >= num_batches_) {
+      return false;
+    }
+    batch->CopyFrom(batch_);
+    for (auto& frame : *batch->mutable_frames()) {
+      frame.set_frame_num((int32_t) count_);
+      frame.set_pts(count_ * 33333333ull);
+    }
+    count_++;
+    return true;
+  }
+private:
+  dp::Batch batch_;
+  uint64_t num_batches_;
+  uint64_t count_;
+};
+
+/**
+ * Run `batch` through `filter`, returning the ns spent in on_buffer and
+ * the resulting Batch in `result`.
+ */
+uint64_t
+run(ds::DistanceFilter* filter, const dp::Batch& batch, dp::Batch* result) {
+  auto buf = ds::Replay::make_buffer(batch);
+  auto start = std::chrono::steady_clock::now();
+  filter->on_buffer(buf);
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+  result->CopyFrom(*(dp::Batch*) user_meta->user_meta_data);
+  gst_buffer_unref(buf);
+  return ns;
+}
+
+void
+scene(const char* name, ds::ReplaySource* source) {
+  ds::DistanceFilter full;
+  ds::DistanceFilter adaptive;
+  adaptive.adaptive = true;
+  dp::Batch batch, expected, actual;
+  uint64_t full_ns = 0, adaptive_ns = 0, batches = 0;
+  uint64_t people = 0, flipped = 0;
+  double error = 0.0;
+  while (source->next(&batch)) {
+    full_ns += run(&full, batch, &expected);
+    adaptive_ns += run(&adaptive, batch, &actual);
+    batches++;
+    for (int f = 0; f < expected.frames_size(); f++) {
+      for (int p = 0; p < expected.frames(f).people_size(); p++) {
+        const auto& e = expected.frames(f).people(p);
+        const auto& a = actual.frames(f).people(p);
+        error += fabs(e.danger_val() - a.danger_val());
+        flipped += e.is_danger() != a.is_danger();
+        people++;
+      }
+    }
+  }
+  uint64_t frames = adaptive.scheduler.computed() + adaptive.scheduler.skipped();
+  printf("%-10s %9.1f %9.1f %7.2fx %9.1f%% %11.4f %9.3f%%\n", name,
+    full_ns / 1e3 / batches, adaptive_ns / 1e3 / batches,
+    (double) full_ns / adaptive_ns,
+    100.0 * adaptive.scheduler.computed() / frames,
+    people ? error / people : 0.0,
+    people ? 100.0 * flipped / people : 0.0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gst_init(&argc, &argv);
+  uint64_t num_batches = argc > 1 ? atoi(argv[1]) : NUM_BATCHES;
+  printf("%-10s %9s %9s %8s %10s %11s %10s\n", "scene", "full us",
+    "adapt us", "speedup", "computed", "mean error", "flipped");
+  if (argc > 2) {
+    ds::FileReplaySource recording(argv[2]);
+    if (!recording.is_open()) {
+      fprintf(stderr, "could not open %s\n", argv[2]);
+      return 1;
+    }
+    scene("recording", &recording);
+    return 0;
+  }
+  ds::SyntheticReplaySource crowds(num_batches, BATCH_SIZE, 40, 30.0, 1);
+  scene("crowds", &crowds);
+  ds::SyntheticReplaySource sparse(num_batches, BATCH_SIZE, 6, 30.0, 2);
+  scene("sparse", &sparse);
+  ds::SyntheticReplaySource dense(num_batches / 4, BATCH_SIZE, 150, 30.0, 4);
+  scene("dense", &dense);
+  ds::SyntheticReplaySource first(1, BATCH_SIZE, 40, 30.0, 3);
+  StillReplaySource still(&first, num_batches);
+  scene("still", &still);
+  return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * Offline analyzer benchmark.
+ *
+ * Records synthetic crowds to a few FileMetaBroker proto files, then
+ * analyzes them with an Analyzer using 1, 2, 4 ... up to one thread per
+ * core, and reports frames analyzed per minute for each.
+ *
+ * usage: bench_analyzer [num_batches] [num_files]
+ */
+
+#include "Analyzer.hpp"
+#include "BatchWriter.hpp"
+#include "ReplaySource.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace {
+
+// default number of batches per file
+const int NUM_BATCHES = 20000;
+// default number of files
+const int NUM_FILES = 4;
+// frames per batch
+const uint32_t BATCH_SIZE = 8;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t num_batches = argc > 1 ? atoi(argv[1]) : NUM_BATCHES;
+  int num_files = argc > 2 ? atoi(argv[2]) : NUM_FILES;
+  // inputs in /tmp, outputs in a directory of their own
+  std::string out = "/tmp/bench_analyzer";
+  mkdir(out.c_str(), S_IRWXU);
+
+  std::vector<std::string> inputs;
+  for (int i = 0; i < num_files; i++) {
+    inputs.push_back("/tmp/bench_analyzer" + std::to_string(i) + ".coded");
+    ds::CodedBatchWriter writer;
+    if (!writer.open(inputs.back())) {
+      fprintf(stderr, "could not write %s\n", inputs.back().c_str());
+      return 1;
+    }
+    ds::SyntheticReplaySource source(num_batches, BATCH_SIZE,
+      ds::SyntheticReplaySource::DEFAULT_MAX_PEOPLE, 30.0, i);
+    dp::Batch batch;
+    while (source.next(&batch)) {
+      writer.write(batch);
+    }
+    writer.close();
+  }
+
+  printf("%d files of %llu frames\n", num_files,
+    (unsigned long long) num_batches * BATCH_SIZE);
+  printf("%-8s %-8s %10s %14s\n", "threads", "files", "seconds", "frames/min");
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned threads = 1; ; threads = std::min(threads * 2, cores)) {
+    // all the files at once, then just the one (scored in chunks)
+    for (int files : {num_files, 1}) {
+      ds::Analyzer analyzer;
+      analyzer.num_threads = threads;
+      std::vector<std::string> some(inputs.begin(), inputs.begin() + files);
+      auto start = std::chrono::steady_clock::now();
+      if (!analyzer.run(some, out)) {
+        fprintf(stderr, "analysis failed\n");
+        return 1;
+      }
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+      printf("%-8u %-8d %10.2f %14.0f\n", threads, files, elapsed.count(),
+        analyzer.frames() * 60.0 / elapsed.count());
+    }
+    if (threads == cores) {
+      break;
+    }
+  }
+  for (const auto& input : inputs) {
+    unlink(input.c_str());
+    unlink((out + input.substr(4)).c_str());
+  }
+  rmdir(out.c_str());
+  return 0;
+}
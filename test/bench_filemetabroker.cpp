@@ -0,0 +1,245 @@
+/**
+ * FileMetaBroker throughput and tail latency benchmark.
+ *
+ * Drives on_batch_meta from one or more producer threads, at a fixed rate
+ * or flat out, into each output format and reports, as JSON:
+ *
+ *  - producer side on_batch_meta latency (p50/p99/p999/max, microseconds)
+ *  - sustained batches/sec and bytes/sec, including the final drain
+ *  - how long stop() takes to drain the queue
+ *
+ * usage: bench_filemetabroker [--producers=N] [--rate=BATCHES_PER_SEC]
+ *   [--batches=N] [--batch-size=FRAMES] [--people=MAX_PER_FRAME]
+ *   [--format=proto|csv|packed|sqlite|all] [--direct] [--dir=PATH]
+ *   [--db-people] [--db-max-batches=N]
+ *
+ * --rate is per producer, and 0 (the default) is as fast as possible.
+ * --batches is per producer.
+ *
+ * For example, 32 cameras at 30 fps into SQLite, with a row per person:
+ *   bench_filemetabroker --format=sqlite --batch-size=32 --rate=30
+ *     --batches=1800 --db-people
+ */
+
+#include "FileMetaBroker.hpp"
+#include "ReplaySource.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dp = distanceproto;
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  int producers = 1;
+  double rate = 0.0;
+  uint64_t batches = 20000;
+  uint32_t batch_size = 8;
+  uint32_t people = 20;
+  std::string format = "all";
+  bool direct = false;
+  std::string dir = "/tmp";
+  bool db_people = false;
+  size_t db_max_batches = 1024;
+};
+
+/**
+ * Parse --key=value options. Returns false on anything unknown.
+ */
+bool
+parse_args(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    if (key == "--producers") {
+      options->producers = std::max(1, atoi(value));
+    } else if (key == "--rate") {
+      options->rate = atof(value);
+    } else if (key == "--batches") {
+      options->batches = strtoull(value, nullptr, 10);
+    } else if (key == "--batch-size") {
+      options->batch_size = (uint32_t) atoi(value);
+    } else if (key == "--people") {
+      options->people = (uint32_t) atoi(value);
+    } else if (key == "--format") {
+      options->format = value;
+    } else if (key == "--direct") {
+      options->direct = true;
+    } else if (key == "--dir") {
+      options->dir = value;
+    } else if (key == "--db-people") {
+      options->db_people = true;
+    } else if (key == "--db-max-batches") {
+      options->db_max_batches = strtoull(value, nullptr, 10);
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Nearest rank percentile of sorted `ns`, in microseconds.
+ */
+double
+percentile_us(const std::vector<uint64_t>& ns, double p) {
+  if (ns.empty()) {
+    return 0.0;
+  }
+  size_t rank = (size_t)(p / 100.0 * (ns.size() - 1) + 0.5);
+  return ns[rank] / 1e3;
+}
+
+/**
+ * Run one format and print its JSON object.
+ */
+void
+run(const Options& options,
+    const std::vector<dp::Batch>& batches,
+    const char* name,
+    ds::FileMetaBroker::Format format,
+    bool last) {
+  ds::FileMetaBroker broker(options.dir + "/bench_filemetabroker", format);
+  broker.direct_io = options.direct;
+  broker.db_people = options.db_people;
+  broker.db_max_batches = options.db_max_batches;
+  std::vector<std::vector<uint64_t>> latencies(options.producers);
+  broker.start();
+
+  auto start = clock_type::now();
+  std::vector<std::thread> producers;
+  for (int p = 0; p < options.producers; p++) {
+    producers.emplace_back([&, p]() {
+      auto& ns = latencies[p];
+      ns.reserve(options.batches);
+      // copies, since on_batch_meta takes a non const Batch
+      std::vector<dp::Batch> mine(batches);
+      for (uint64_t i = 0; i < options.batches; i++) {
+        if (options.rate > 0.0) {
+          std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+            (uint64_t)(i * 1e9 / options.rate)));
+        }
+        auto& batch = mine[(i + p) % mine.size()];
+        auto before = clock_type::now();
+        broker.on_batch_meta(nullptr, &batch);
+        ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          clock_type::now() - before).count());
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  auto produced = clock_type::now();
+  broker.stop();
+  auto drained = clock_type::now();
+
+  std::vector<uint64_t> all;
+  for (auto& ns : latencies) {
+    all.insert(all.end(), ns.begin(), ns.end());
+  }
+  std::sort(all.begin(), all.end());
+  double sum_ns = 0.0;
+  for (auto ns : all) {
+    sum_ns += ns;
+  }
+
+  struct stat st = {};
+  stat(broker.get_filename().c_str(), &st);
+  unlink(broker.get_filename().c_str());
+
+  double produce_secs = std::chrono::duration<double>(produced - start).count();
+  double drain_secs = std::chrono::duration<double>(drained - produced).count();
+  double total_secs = produce_secs + drain_secs;
+  uint64_t total = all.size();
+  printf("    {\n");
+  printf("      \"format\": \"%s\",\n", name);
+  printf("      \"batches\": %lu,\n", (unsigned long) total);
+  printf("      \"bytes\": %lld,\n", (long long) st.st_size);
+  printf("      \"produce_seconds\": %.6f,\n", produce_secs);
+  printf("      \"drain_seconds\": %.6f,\n", drain_secs);
+  printf("      \"batches_per_second\": %.1f,\n", total / total_secs);
+  printf("      \"bytes_per_second\": %.1f,\n", st.st_size / total_secs);
+  printf("      \"on_batch_meta_us\": {\n");
+  printf("        \"mean\": %.3f,\n", total ? sum_ns / total / 1e3 : 0.0);
+  printf("        \"p50\": %.3f,\n", percentile_us(all, 50.0));
+  printf("        \"p99\": %.3f,\n", percentile_us(all, 99.0));
+  printf("        \"p999\": %.3f,\n", percentile_us(all, 99.9));
+  printf("        \"max\": %.3f\n", all.empty() ? 0.0 : all.back() / 1e3);
+  printf("      }\n");
+  printf("    }%s\n", last ? "" : ",");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gst_init(&argc, &argv);
+  Options options;
+  if (!parse_args(argc, argv, &options)) {
+    return 1;
+  }
+  struct Format {
+    const char* name;
+    ds::FileMetaBroker::Format format;
+  };
+  std::vector<Format> formats;
+  for (const Format& f : {Format{"proto", ds::FileMetaBroker::proto},
+                          Format{"csv", ds::FileMetaBroker::csv},
+                          Format{"packed", ds::FileMetaBroker::packed},
+#ifdef DS_SQLITE
+                          Format{"sqlite", ds::FileMetaBroker::sqlite},
+#endif
+                          }) {
+    if (options.format == "all" || options.format == f.name) {
+      formats.push_back(f);
+    }
+  }
+  if (formats.empty()) {
+    fprintf(stderr, "unknown format: %s\n", options.format.c_str());
+    return 1;
+  }
+
+  // pre-generate so only the broker is timed
+  std::vector<dp::Batch> batches(64);
+  ds::SyntheticReplaySource source(0, options.batch_size, options.people);
+  for (auto& batch : batches) {
+    source.next(&batch);
+  }
+
+  printf("{\n");
+  printf("  \"config\": {\n");
+  printf("    \"producers\": %d,\n", options.producers);
+  printf("    \"rate\": %.1f,\n", options.rate);
+  printf("    \"batches_per_producer\": %lu,\n", (unsigned long) options.batches);
+  printf("    \"batch_size\": %u,\n", options.batch_size);
+  printf("    \"max_people\": %u,\n", options.people);
+  printf("    \"direct_io\": %s,\n", options.direct ? "true" : "false");
+  printf("    \"db_people\": %s,\n", options.db_people ? "true" : "false");
+  printf("    \"db_max_batches\": %lu\n",
+    (unsigned long) options.db_max_batches);
+  printf("  },\n");
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < formats.size(); i++) {
+    run(options, batches, formats[i].name, formats[i].format,
+        i + 1 == formats.size());
+    fflush(stdout);
+  }
+  printf("  ]\n");
+  printf("}\n");
+  return 0;
+}
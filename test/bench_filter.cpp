@@ -0,0 +1,133 @@
+/**
+ * Filter dispatch benchmark.
+ *
+ * Walks synthetic batch metadata with a virtual BaseFilter, a StaticFilter
+ * and a metadata only StaticFilter, all doing the same trivial per object
+ * work, and reports the overhead per object.
+ *
+ * usage: bench_filter [num_buffers]
+ */
+
+#include "BaseFilter.hpp"
+#include "StaticFilter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 8;
+// objects per frame
+const int NUM_OBJECTS = 50;
+// default number of buffers to push through each filter
+const int NUM_BUFFERS = 20000;
+
+/**
+ * The per object work, the same for every filter.
+ */
+inline void
+count(double* sum, NvDsObjectMeta* o_meta) {
+  *sum += o_meta->rect_params.left + o_meta->confidence;
+}
+
+class VirtualCounter : public ds::BaseFilter {
+public:
+  virtual bool on_object(NvDsFrameMeta* f_meta,
+                         NvDsObjectMeta* o_meta,
+                         NvBufSurfaceParams* frame) {
+    (void)f_meta;
+    (void)frame;
+    count(&sum, o_meta);
+    return true;
+  }
+  double sum = 0.0;
+};
+
+class StaticCounter : public ds::StaticFilter<StaticCounter> {
+public:
+  bool on_object(NvDsFrameMeta* f_meta,
+                 NvDsObjectMeta* o_meta,
+                 NvBufSurfaceParams* frame) {
+    (void)f_meta;
+    (void)frame;
+    count(&sum, o_meta);
+    return true;
+  }
+  double sum = 0.0;
+};
+
+class MetaOnlyCounter : public ds::StaticFilter<MetaOnlyCounter> {
+public:
+  static const bool NEEDS_SURFACE = false;
+  bool on_object(NvDsFrameMeta* f_meta,
+                 NvDsObjectMeta* o_meta,
+                 NvBufSurfaceParams* frame) {
+    (void)f_meta;
+    (void)frame;
+    count(&sum, o_meta);
+    return true;
+  }
+  double sum = 0.0;
+};
+
+GstBuffer*
+make_buffer() {
+  auto buf = gst_buffer_new();
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+    frame_meta->batch_id = f;
+    frame_meta->source_id = f;
+    nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+    for (int o = 0; o < NUM_OBJECTS; o++) {
+      auto obj_meta = nvds_acquire_obj_meta_from_pool(batch_meta);
+      obj_meta->object_id = o;
+      obj_meta->confidence = 0.5f;
+      obj_meta->rect_params.left = o * 10.0f;
+      nvds_add_obj_meta_to_frame(frame_meta, obj_meta, nullptr);
+    }
+  }
+  return buf;
+}
+
+template <typename Filter>
+void
+run(const char* name, Filter* filter, GstBuffer* buf, int num_buffers) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_buffers; i++) {
+    filter->on_buffer(buf);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double objects = (double) num_buffers * BATCH_SIZE * NUM_OBJECTS;
+  printf("%-24s %8.2f ns/object %10.0f buffers/s (sum %.0f)\n",
+    name, elapsed.count() * 1e9 / objects, num_buffers / elapsed.count(),
+    filter->sum);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gst_init(&argc, &argv);
+  int num_buffers = argc > 1 ? atoi(argv[1]) : NUM_BUFFERS;
+  auto buf = make_buffer();
+  {
+    VirtualCounter filter;
+    run("virtual (BaseFilter)", &filter, buf, num_buffers);
+  }
+  {
+    StaticCounter filter;
+    run("static", &filter, buf, num_buffers);
+  }
+  {
+    MetaOnlyCounter filter;
+    run("static, metadata only", &filter, buf, num_buffers);
+  }
+  gst_buffer_unref(buf);
+  return 0;
+}
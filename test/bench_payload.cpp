@@ -0,0 +1,155 @@
+/**
+ * Payload throughput benchmark.
+ *
+ * Pushes synthetic batches through ProtoPayloadFilter variants and reports
+ * batches/sec, payloads/sec and bytes/sec of attached NVDS_PAYLOAD_META,
+ * then the time each serialization mode spends on the streaming thread.
+ *
+ * usage: bench_payload [num_batches]
+ */
+
+#include "CoalescingPayloadFilter.hpp"
+#include "ProtoPayloadFilter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+
+namespace dp = distanceproto;
+
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 8;
+// default number of batches to push through each variant
+const int NUM_BATCHES = 20000;
+
+std::default_random_engine rng;
+
+void
+generate_batch(dp::Batch* batch, int min_people = 0, int max_people = 20) {
+  std::uniform_int_distribution<int> num_people(min_people, max_people);
+  std::uniform_real_distribution<float> pos(0.0f, 1800.0f);
+  std::uniform_real_distribution<float> danger(0.0f, 2.0f);
+  batch->Clear();
+  batch->set_max_frames(BATCH_SIZE);
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame = batch->add_frames();
+    frame->set_source_id(f);
+    frame->set_frame_num(f);
+    frame->set_pts(f * 33333333ull);
+    float sum_danger = 0.0f;
+    int count = num_people(rng);
+    for (int p = 0; p < count; p++) {
+      auto person = frame->add_people();
+      auto box = person->mutable_bbox();
+      box->set_left(pos(rng));
+      box->set_top(pos(rng) / 2);
+      box->set_width(60.0f);
+      box->set_height(180.0f);
+      person->set_danger_val(danger(rng));
+      person->set_is_danger(person->danger_val() >= 1.0f);
+      sum_danger += person->danger_val();
+    }
+    frame->set_sum_danger(sum_danger);
+  }
+}
+
+/**
+ * Remove the payloads on batch_meta, counting them and their bytes.
+ */
+void
+collect_payloads(NvDsBatchMeta* batch_meta, size_t* payloads, size_t* bytes) {
+  auto elem = batch_meta->batch_user_meta_list;
+  while (elem != nullptr) {
+    auto user_meta = (NvDsUserMeta*) elem->data;
+    elem = elem->next;
+    if (user_meta->base_meta.meta_type == NVDS_PAYLOAD_META) {
+      *payloads += 1;
+      *bytes += ((ds::Payload*) user_meta->user_meta_data)->size();
+      nvds_remove_user_meta_from_batch(batch_meta, user_meta);
+    }
+  }
+}
+
+void
+run(const char* name, ds::ProtoPayloadFilter* filter, int num_batches) {
+  // pre-generate so only the filter is timed
+  std::vector<dp::Batch> batches(64);
+  for (auto& batch : batches) {
+    generate_batch(&batch);
+  }
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  size_t payloads = 0;
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_batches; i++) {
+    filter->on_batch_meta(batch_meta, &batches[i % batches.size()]);
+    collect_payloads(batch_meta, &payloads, &bytes);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  nvds_destroy_batch_meta(batch_meta);
+  double secs = elapsed.count();
+  printf("%-24s %10.0f batches/s %10.0f payloads/s %8.2f MB/s %8.0f B/payload\n",
+    name, num_batches / secs, payloads / secs, bytes / secs / 1e6,
+    payloads ? (double) bytes / payloads : 0.0);
+}
+
+/**
+ * Time only on_batch_meta (the streaming thread's share) for 8 frame x 40
+ * person batches. Payloads are resolved and released outside the clock.
+ */
+void
+run_streaming(const char* name, ds::ProtoPayloadFilter* filter,
+              int num_batches) {
+  std::vector<dp::Batch> batches(64);
+  for (auto& batch : batches) {
+    generate_batch(&batch, 40, 40);
+  }
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  size_t payloads = 0;
+  size_t bytes = 0;
+  std::chrono::duration<double> elapsed(0.0);
+  for (int i = 0; i < num_batches; i++) {
+    auto start = std::chrono::steady_clock::now();
+    filter->on_batch_meta(batch_meta, &batches[i % batches.size()]);
+    elapsed += std::chrono::steady_clock::now() - start;
+    collect_payloads(batch_meta, &payloads, &bytes);
+  }
+  nvds_destroy_batch_meta(batch_meta);
+  printf("%-24s %8.2f us/batch on the streaming thread\n",
+    name, elapsed.count() * 1e6 / num_batches);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int num_batches = argc > 1 ? atoi(argv[1]) : NUM_BATCHES;
+  using CPF = ds::CoalescingPayloadFilter;
+  {
+    ds::ProtoPayloadFilter filter;
+    run("proto (current)", &filter, num_batches);
+  }
+  {
+    CPF filter(10, 0, CPF::none);
+    run("coalesce 10", &filter, num_batches);
+  }
+  {
+    CPF filter(10, 0, CPF::zlib);
+    run("coalesce 10 + zlib", &filter, num_batches);
+  }
+  {
+    CPF filter(30, 0, CPF::gzip);
+    run("coalesce 30 + gzip", &filter, num_batches);
+  }
+  using PPF = ds::ProtoPayloadFilter;
+  for (auto serialization : {PPF::sync, PPF::async, PPF::lazy}) {
+    static const char* names[] = {"sync", "async", "lazy"};
+    PPF filter(serialization);
+    run_streaming(names[serialization], &filter, num_batches);
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * Replay benchmark.
+ *
+ * Replays a FileMetaBroker recording (or synthetic crowds) through
+ * DistanceFilter, ProtoPayloadFilter and a FileMetaBroker and reports
+ * throughput and per stage latency percentiles.
+ *
+ * usage: bench_replay [num_batches] [recording] [--recorded]
+ *
+ * num_batches of 0 replays the whole recording. Without a recording,
+ * synthetic crowds are generated.
+ */
+
+#include "DistanceFilter.hpp"
+#include "FileMetaBroker.hpp"
+#include "ProtoPayloadFilter.hpp"
+#include "Replay.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+// default number of batches to replay
+const int NUM_BATCHES = 20000;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gst_init(&argc, &argv);
+  uint64_t num_batches = argc > 1 ? atoi(argv[1]) : NUM_BATCHES;
+  auto pacing = ds::Replay::fast;
+  const char* recording = nullptr;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--recorded") == 0) {
+      pacing = ds::Replay::recorded;
+    } else {
+      recording = argv[i];
+    }
+  }
+  std::unique_ptr<ds::ReplaySource> source;
+  if (recording) {
+    auto file = new ds::FileReplaySource(recording);
+    source.reset(file);
+    if (!file->is_open()) {
+      fprintf(stderr, "could not read %s\n", recording);
+      return 1;
+    }
+  } else {
+    source.reset(new ds::SyntheticReplaySource());
+  }
+
+  ds::Replay replay(source.get(), pacing);
+  ds::DistanceFilter distance;
+  ds::ProtoPayloadFilter payload;
+  ds::FileMetaBroker file("/tmp/bench_replay");
+  replay.add_stage("DistanceFilter", &distance);
+  replay.add_stage("ProtoPayloadFilter", &payload);
+  replay.add_stage("FileMetaBroker", &file);
+  file.start();
+  auto report = replay.run(num_batches);
+  file.stop();
+  report.print(stdout);
+  return 0;
+}
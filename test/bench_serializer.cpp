@@ -0,0 +1,102 @@
+/**
+ * Batch serializer benchmark.
+ *
+ * Serializes the same synthetic batches with the generated code and with
+ * BatchSerializer and reports batches/sec and MB/sec for each.
+ *
+ * usage: bench_serializer [num_batches]
+ */
+
+#include "BatchSerializer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 8;
+// default number of batches to serialize with each serializer
+const int NUM_BATCHES = 200000;
+
+std::default_random_engine rng;
+
+void
+generate_batch(dp::Batch* batch) {
+  std::uniform_int_distribution<int> num_people(0, 20);
+  std::uniform_real_distribution<float> pos(0.0f, 1800.0f);
+  std::uniform_real_distribution<float> danger(0.0f, 2.0f);
+  batch->Clear();
+  batch->set_max_frames(BATCH_SIZE);
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame = batch->add_frames();
+    frame->set_source_id(f);
+    frame->set_frame_num(f);
+    frame->set_pts(f * 33333333ull);
+    float sum_danger = 0.0f;
+    int count = num_people(rng);
+    for (int p = 0; p < count; p++) {
+      auto person = frame->add_people();
+      auto box = person->mutable_bbox();
+      box->set_left(pos(rng));
+      box->set_top(pos(rng) / 2);
+      box->set_width(60.0f);
+      box->set_height(180.0f);
+      person->set_danger_val(danger(rng));
+      person->set_is_danger(person->danger_val() >= 1.0f);
+      sum_danger += person->danger_val();
+    }
+    frame->set_sum_danger(sum_danger);
+  }
+}
+
+template <typename Serialize>
+void
+run(const char* name, const std::vector<dp::Batch>& batches, int num_batches,
+    Serialize serialize) {
+  // reused, like the payload buffers are
+  std::string buf(1 << 16, '\0');
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_batches; i++) {
+    bytes += serialize(batches[i % batches.size()], (uint8_t*) &buf[0]);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double secs = elapsed.count();
+  printf("%-24s %10.0f batches/s %8.2f MB/s\n",
+    name, num_batches / secs, bytes / secs / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int num_batches = argc > 1 ? atoi(argv[1]) : NUM_BATCHES;
+  std::vector<dp::Batch> batches(64);
+  for (auto& batch : batches) {
+    generate_batch(&batch);
+  }
+  if (!ds::BatchSerializer::is_compatible()) {
+    printf("schema mismatch, BatchSerializer falls back to generated code\n");
+  }
+  run("generated", batches, num_batches,
+    [](const dp::Batch& batch, uint8_t* target) {
+      size_t size = batch.ByteSizeLong();
+      batch.SerializeWithCachedSizesToArray(target);
+      return size;
+    });
+  ds::BatchSerializer serializer;
+  run("BatchSerializer", batches, num_batches,
+    [&serializer](const dp::Batch& batch, uint8_t* target) {
+      size_t size = serializer.byte_size(batch);
+      serializer.write(batch, target);
+      return size;
+    });
+  return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ * ShmPayloadBroker throughput benchmark.
+ *
+ * Publishes payloads into the shared memory ring as fast as possible while
+ * several reader processes read them zero copy, and reports payloads/sec and
+ * MB/sec for the writer, and payloads/sec and missed payloads per reader.
+ *
+ * usage: bench_shm [num_payloads] [num_readers]
+ */
+
+#include "ShmPayloadBroker.hpp"
+#include "ShmPayloadReader.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// shared memory object name
+const char* SHM_NAME = "/bench_shm";
+// ring size
+const uint32_t SLOT_COUNT = 64;
+// size of each payload
+const size_t PAYLOAD_SIZE = 4096;
+// default number of payloads
+const uint64_t NUM_PAYLOADS = 200000;
+// default number of reader processes
+const int NUM_READERS = 3;
+
+/**
+ * Reader results, sent back to the writer through a pipe.
+ */
+struct ReaderStats {
+  uint64_t received;
+  uint64_t missed;
+  double seconds;
+};
+
+/**
+ * Read (zero copy, touching every payload) until the writer closes the ring.
+ */
+ReaderStats
+read_all() {
+  ReaderStats stats = {0, 0, 0.0};
+  ds::ShmPayloadReader reader;
+  while (!reader.open(SHM_NAME)) {
+    usleep(1000);
+  }
+  auto start = std::chrono::steady_clock::now();
+  uint64_t next = 1;
+  uint64_t sum = 0;
+  while (true) {
+    uint64_t latest = reader.wait_for_next(next - 1, 100);
+    if (latest < next) {
+      if (reader.writer_closed()) {
+        break;
+      }
+      continue;
+    }
+    for (; next <= latest; next++) {
+      const uint8_t* data;
+      size_t size;
+      uint64_t token;
+      auto status = reader.peek(next, &data, &size, &token);
+      if (status == ds::ShmPayloadReader::ok) {
+        sum += data[0] + data[size - 1];
+      }
+      if (status == ds::ShmPayloadReader::ok && reader.validate(next, token)) {
+        stats.received++;
+      } else {
+        // fell behind, skip to what's still there
+        uint64_t oldest = reader.oldest_seq();
+        stats.missed += oldest > next ? oldest - next : 1;
+        next = oldest > next ? oldest - 1 : next;
+      }
+    }
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  stats.seconds = elapsed.count();
+  // so the reads aren't optimized out
+  stats.missed += sum == 1 ? 1 : 0;
+  return stats;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t num_payloads =
+    argc > 1 ? strtoull(argv[1], nullptr, 10) : NUM_PAYLOADS;
+  int num_readers = argc > 2 ? atoi(argv[2]) : NUM_READERS;
+
+  ds::PayloadPool pool;
+  ds::ShmPayloadBroker broker(SHM_NAME, SLOT_COUNT, PAYLOAD_SIZE);
+  broker.start();
+  if (!broker.is_open()) {
+    fprintf(stderr, "could not open %s\n", SHM_NAME);
+    return 1;
+  }
+
+  std::vector<pid_t> pids;
+  std::vector<int> pipes;
+  for (int i = 0; i < num_readers; i++) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("pipe");
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      ReaderStats stats = read_all();
+      ssize_t written = write(fds[1], &stats, sizeof(stats));
+      _exit(written == sizeof(stats) ? 0 : 1);
+    }
+    close(fds[1]);
+    pids.push_back(pid);
+    pipes.push_back(fds[0]);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t seq = 1; seq <= num_payloads; seq++) {
+    auto payload = pool.acquire(PAYLOAD_SIZE);
+    memset(payload->mutable_data(), (int) seq, PAYLOAD_SIZE);
+    broker.on_batch_payload(payload);
+    payload->unref();
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  broker.stop();
+  printf("%-10s %10.0f payloads/s %8.2f MB/s\n", "writer",
+         num_payloads / elapsed.count(),
+         num_payloads * PAYLOAD_SIZE / elapsed.count() / 1e6);
+
+  int result = 0;
+  for (int i = 0; i < num_readers; i++) {
+    ReaderStats stats;
+    ssize_t got = read(pipes[i], &stats, sizeof(stats));
+    close(pipes[i]);
+    int status;
+    waitpid(pids[i], &status, 0);
+    if (got != sizeof(stats) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      fprintf(stderr, "reader %d failed\n", i);
+      result = 1;
+      continue;
+    }
+    printf("reader %-3d %10.0f payloads/s %10lu received %10lu missed\n", i,
+           stats.received / stats.seconds,
+           (unsigned long) stats.received, (unsigned long) stats.missed);
+  }
+  return result;
+}
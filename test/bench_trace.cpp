@@ -0,0 +1,67 @@
+/**
+ * Trace point benchmark.
+ *
+ * Reports the cost of each kind of trace point when compiled in, and of
+ * dumping a full ring.
+ *
+ * usage: bench_trace [iterations]
+ */
+
+// trace points are compiled out unless this is defined
+#define DS_TRACING
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+// default number of trace points to record for each kind
+const int NUM_ITERATIONS = 10000000;
+
+template <typename Record>
+void
+run(const char* name, int iterations, Record record) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    record(i);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  printf("%-24s %8.1f ns\n", name, elapsed.count() / iterations);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : NUM_ITERATIONS;
+  // register this thread first, so it isn't counted
+  DS_TRACE_INSTANT("warmup");
+  run("now()", iterations, [](int) {
+    volatile uint64_t ticks = ds::trace::now();
+    (void) ticks;
+  });
+  run("DS_TRACE_INSTANT", iterations, [](int) {
+    DS_TRACE_INSTANT("instant");
+  });
+  run("DS_TRACE_COUNTER", iterations, [](int i) {
+    DS_TRACE_COUNTER("counter", i);
+  });
+  run("DS_TRACE_SCOPE", iterations, [](int) {
+    DS_TRACE_SCOPE("scope");
+  });
+  run("DS_TRACE_BEGIN/END", iterations, [](int) {
+    DS_TRACE_BEGIN("span");
+    DS_TRACE_END("span");
+  });
+  auto start = std::chrono::steady_clock::now();
+  std::stringstream out;
+  ds::trace::write_json(out);
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  printf("%-24s %8.1f ms (%zu events, %zu bytes)\n", "write_json",
+    elapsed.count(), (size_t) ds::trace::Ring::CAPACITY, out.str().size());
+  return 0;
+}
@@ -0,0 +1,249 @@
+#include "Analyzer.hpp"
+#include "BatchWriter.hpp"
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+#include "ReplaySource.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <experimental/filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::experimental::filesystem;
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of batches to record
+const int NUM_BATCHES = 50;
+// sources per batch
+const int BATCH_SIZE = 4;
+
+// A MOT ground truth style file: sorted by id, with a box to ignore
+const char* MOT_TEXT =
+  "1,1,100,200,40,100,1,1,1\n"
+  "2,1,102,200,40,100,1,1,1\n"
+  "\n"
+  "1,2,150,200,40,100,1,1,1\n"
+  "2 2 152 200 40 100 1 1 1\r\n"
+  "2,3,900,200,40,100,0,1,1\n"
+  "3,2,154,200,40,100,1,1,1";
+
+// The fixture for testing class Analyzer.
+class AnalyzerTest : public ::testing::Test {
+ protected:
+  AnalyzerTest() : tmp_(fs::temp_directory_path() / "analyzertest") {
+    fs::create_directories(tmp_);
+  }
+  ~AnalyzerTest() override {
+    fs::remove_all(tmp_);
+  }
+
+  // write `text` to `name` in tmp_, returning the path
+  std::string write_text(const std::string& name, const std::string& text) {
+    auto path = (tmp_ / name).string();
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+    return path;
+  }
+
+  // record NUM_BATCHES synthetic batches, returning the path
+  std::string record(const std::string& name) {
+    auto path = (tmp_ / name).string();
+    CodedBatchWriter writer;
+    EXPECT_TRUE(writer.open(path));
+    SyntheticReplaySource source(NUM_BATCHES, BATCH_SIZE);
+    dp::Batch batch;
+    while (source.next(&batch)) {
+      EXPECT_TRUE(writer.write(batch));
+    }
+    EXPECT_TRUE(writer.close());
+    return path;
+  }
+
+  // read a whole file
+  static std::string read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+  }
+
+  fs::path tmp_;
+};
+
+// Tests the Analyzer scores frames exactly as DistanceFilter does
+TEST_F(AnalyzerTest, TestScore) {
+  Analyzer analyzer;
+  DistanceFilter filter;
+  SyntheticReplaySource source(NUM_BATCHES, BATCH_SIZE);
+  dp::Batch batch;
+  std::vector<Box> boxes;
+  while (source.next(&batch)) {
+    auto buf = Replay::make_buffer(batch);
+    ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+    auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+    auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+    const auto& expected = *(dp::Batch*) user_meta->user_meta_data;
+    for (int f = 0; f < batch.frames_size(); f++) {
+      auto frame = batch.mutable_frames(f);
+      analyzer.score(frame, &boxes);
+      ASSERT_EQ(expected.frames(f).sum_danger(), frame->sum_danger());
+      for (int p = 0; p < frame->people_size(); p++) {
+        ASSERT_EQ(expected.frames(f).people(p).danger_val(),
+                  frame->people(p).danger_val());
+        ASSERT_EQ(expected.frames(f).people(p).is_danger(),
+                  frame->people(p).is_danger());
+      }
+    }
+    gst_buffer_unref(buf);
+  }
+  // thresholds are the Analyzer's own
+  analyzer.danger_threshold = 0.0f;
+  SyntheticReplaySource(1, 1).next(&batch);
+  analyzer.score(batch.mutable_frames(0), &boxes);
+  for (const auto& person : batch.frames(0).people()) {
+    ASSERT_TRUE(person.is_danger());
+  }
+}
+
+// Tests MOT files are read in frame order
+TEST_F(AnalyzerTest, TestMot) {
+  auto path = write_text("gt.txt", MOT_TEXT);
+  MotReplaySource source(path, 7, 10.0, 0.5f);
+  ASSERT_TRUE(source.is_open());
+  ASSERT_EQ((size_t) 5, source.size());
+  dp::Batch batch;
+  std::vector<std::vector<int>> uids;
+  while (source.next(&batch)) {
+    ASSERT_EQ(1, batch.frames_size());
+    const auto& frame = batch.frames(0);
+    ASSERT_EQ((uint32_t) 7, frame.source_id());
+    ASSERT_EQ(frame.frame_num() * 100000000ull, frame.pts());
+    uids.emplace_back();
+    for (const auto& person : frame.people()) {
+      uids.back().push_back(person.uid());
+      ASSERT_EQ(100.0f, person.bbox().height());
+    }
+  }
+  std::vector<std::vector<int>> expected = {{1, 2}, {1, 2}, {2}};
+  ASSERT_EQ(expected, uids);
+  // without min_confidence, nobody is left out
+  ASSERT_EQ((size_t) 6, MotReplaySource(path).size());
+  // bad files aren't open
+  ASSERT_FALSE(MotReplaySource((tmp_ / "nope.txt").string()).is_open());
+  ASSERT_FALSE(MotReplaySource(write_text("bad.txt", "1,2,3\n4,5,6,7,8,9,10"))
+    .is_open());
+}
+
+// Tests analyzing a recording gives DistanceFilter's results, the same
+// with any number of threads
+TEST_F(AnalyzerTest, TestAnalyzeFile) {
+  auto input = record("input.coded");
+  Analyzer analyzer;
+  analyzer.chunk_size = 7;
+  std::string outputs[2];
+  for (unsigned threads : {1u, 4u}) {
+    auto& output = outputs[threads > 1];
+    output = (tmp_ / ("output" + std::to_string(threads) + ".coded")).string();
+    ASSERT_TRUE(analyzer.analyze_file(input, output, 0, threads));
+  }
+  ASSERT_EQ((uint64_t) 2 * NUM_BATCHES * BATCH_SIZE, analyzer.frames());
+  ASSERT_EQ(read(outputs[0]), read(outputs[1]));
+
+  FileReplaySource recorded(input);
+  FileReplaySource analyzed(outputs[0]);
+  DistanceFilter filter;
+  dp::Batch batch;
+  dp::Batch result;
+  for (int b = 0; b < NUM_BATCHES; b++) {
+    ASSERT_TRUE(recorded.next(&batch));
+    ASSERT_TRUE(analyzed.next(&result));
+    auto buf = Replay::make_buffer(batch);
+    ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+    auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+    auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+    const auto& expected = *(dp::Batch*) user_meta->user_meta_data;
+    ASSERT_EQ(expected.frames_size(), result.frames_size());
+    for (int f = 0; f < result.frames_size(); f++) {
+      ASSERT_EQ(expected.frames(f).sum_danger(), result.frames(f).sum_danger());
+      ASSERT_EQ(expected.frames(f).people_size(),
+                result.frames(f).people_size());
+    }
+    gst_buffer_unref(buf);
+  }
+  ASSERT_FALSE(analyzed.next(&result));
+
+  // the input is never overwritten
+  ASSERT_FALSE(analyzer.analyze_file(input, input));
+  ASSERT_EQ(read(input), read(record("check.coded")));
+}
+
+// Tests run() analyzes every file into the output directory
+TEST_F(AnalyzerTest, TestRun) {
+  std::vector<std::string> inputs = {
+    write_text("a.txt", MOT_TEXT),
+    write_text("b.txt", MOT_TEXT),
+    record("c.coded"),
+  };
+  auto out = tmp_ / "out";
+  fs::create_directories(out);
+  Analyzer analyzer;
+  analyzer.format = FileMetaBroker::csv;
+  analyzer.num_threads = 2;
+  ASSERT_TRUE(analyzer.run(inputs, out.string()));
+  ASSERT_EQ((out / "a.csv").string(),
+            analyzer.output_filename(inputs[0], out.string()));
+  // a header and a line per frame
+  std::string a = read((out / "a.csv").string());
+  ASSERT_EQ(4, std::count(a.begin(), a.end(), '\n'));
+  ASSERT_NE(std::string::npos, a.find(",2,0,0.500,0\n"));
+  // the second file is the second source
+  std::string b = read((out / "b.csv").string());
+  ASSERT_NE(std::string::npos, b.find(",2,0,0.500,1\n"));
+  std::string c = read((out / "c.csv").string());
+  ASSERT_EQ(1 + NUM_BATCHES * BATCH_SIZE, std::count(c.begin(), c.end(), '\n'));
+
+  std::vector<std::string> failed;
+  inputs.push_back((tmp_ / "missing.coded").string());
+  ASSERT_FALSE(analyzer.run(inputs, out.string(), &failed));
+  ASSERT_EQ(std::vector<std::string>({inputs.back()}), failed);
+}
+
+// Tests run() won't start if inputs would be written to the same file
+TEST_F(AnalyzerTest, TestClashes) {
+  fs::create_directories(tmp_ / "x" / "det");
+  fs::create_directories(tmp_ / "y" / "det");
+  std::vector<std::string> inputs = {
+    write_text("a.txt", MOT_TEXT),
+    write_text("x/det/det.txt", MOT_TEXT),
+    write_text("y/det/det.txt", MOT_TEXT),
+  };
+  auto out = tmp_ / "out";
+  fs::create_directories(out);
+  Analyzer analyzer;
+  analyzer.format = FileMetaBroker::csv;
+  std::vector<std::string> clashes = {inputs[1], inputs[2]};
+  ASSERT_EQ(clashes, analyzer.find_clashes(inputs, out.string()));
+  std::vector<std::string> failed;
+  ASSERT_FALSE(analyzer.run(inputs, out.string(), &failed));
+  ASSERT_EQ(clashes, failed);
+  // nothing was analyzed
+  ASSERT_FALSE(fs::exists(out / "a.csv"));
+  ASSERT_FALSE(fs::exists(out / "det.csv"));
+  ASSERT_TRUE(analyzer.find_clashes({inputs[0], inputs[1]},
+                                    out.string()).empty());
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,165 @@
+#include "BatchSerializer.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+/**
+ * A random batch with a mix of empty, zero and non zero fields, so both
+ * the written and skipped branches get exercised.
+ */
+static void
+random_batch(std::default_random_engine* rng, dp::Batch* batch) {
+  std::uniform_int_distribution<int> small(0, 6);
+  std::uniform_int_distribution<int> coin(0, 3);
+  std::uniform_real_distribution<float> pos(-100.0f, 1900.0f);
+  batch->Clear();
+  int num_frames = small(*rng);
+  if (coin(*rng)) {
+    batch->set_max_frames(num_frames + small(*rng));
+  }
+  for (int f = 0; f < num_frames; f++) {
+    auto frame = batch->add_frames();
+    if (coin(*rng)) frame->set_frame_num((*rng)() - (1u << 31));
+    if (coin(*rng)) frame->set_pts((uint64_t)(*rng)() << small(*rng) * 8);
+    if (coin(*rng)) frame->set_dts((*rng)());
+    if (coin(*rng)) frame->set_source_id(small(*rng));
+    if (coin(*rng)) frame->set_sum_danger(pos(*rng));
+    int num_people = small(*rng) * small(*rng);
+    for (int p = 0; p < num_people; p++) {
+      auto person = frame->add_people();
+      if (coin(*rng)) person->set_uid((*rng)());
+      if (coin(*rng)) person->set_is_danger(true);
+      if (coin(*rng)) person->set_danger_val(pos(*rng));
+      if (coin(*rng) == 0) {
+        continue;  // no bbox at all
+      }
+      auto bbox = person->mutable_bbox();
+      if (coin(*rng)) bbox->set_left(pos(*rng));
+      if (coin(*rng)) bbox->set_top(pos(*rng));
+      if (coin(*rng)) bbox->set_width(pos(*rng));
+      if (coin(*rng)) bbox->set_height(pos(*rng));
+    }
+  }
+}
+
+/**
+ * Serialize `batch` with a BatchSerializer, check it parses back to the same
+ * thing, and if the fast path is used, that the bytes match the generated
+ * code's.
+ */
+static void
+check_batch(BatchSerializer* serializer, const dp::Batch& batch) {
+  std::string ours;
+  ASSERT_TRUE(serializer->serialize(batch, &ours));
+  EXPECT_EQ(batch.ByteSizeLong(), ours.size());
+  if (BatchSerializer::is_compatible()) {
+    EXPECT_EQ(batch.SerializeAsString(), ours);
+  }
+  dp::Batch parsed;
+  ASSERT_TRUE(parsed.ParseFromString(ours));
+  EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    batch, parsed)) << batch.DebugString() << parsed.DebugString();
+}
+
+TEST(BatchSerializerTest, TestCompatible) {
+  // the schema in the tree is the one the serializer was written for, so
+  // this should never fall back (it would still be correct, just slow)
+  EXPECT_TRUE(BatchSerializer::is_compatible());
+}
+
+TEST(BatchSerializerTest, TestEmpty) {
+  BatchSerializer serializer;
+  dp::Batch batch;
+  EXPECT_EQ(0u, serializer.byte_size(batch));
+  check_batch(&serializer, batch);
+  // empty frames and people are still written
+  batch.add_frames()->add_people();
+  check_batch(&serializer, batch);
+}
+
+TEST(BatchSerializerTest, TestEdges) {
+  BatchSerializer serializer;
+  dp::Batch batch;
+  batch.set_max_frames(std::numeric_limits<decltype(batch.max_frames())>::max());
+  auto frame = batch.add_frames();
+  // negative int32s are sign extended to 10 bytes
+  frame->set_frame_num(-1);
+  frame->set_pts(std::numeric_limits<uint64_t>::max());
+  frame->set_dts(1);
+  // -0.0 has bits set, so it is written
+  frame->set_sum_danger(-0.0f);
+  auto person = frame->add_people();
+  person->set_danger_val(std::numeric_limits<float>::infinity());
+  // present, but empty
+  person->mutable_bbox();
+  person = frame->add_people();
+  person->set_is_danger(true);
+  person->mutable_bbox()->set_height(std::numeric_limits<float>::denorm_min());
+  check_batch(&serializer, batch);
+  EXPECT_EQ(batch.SerializeAsString().size(), serializer.byte_size(batch));
+}
+
+TEST(BatchSerializerTest, TestRandom) {
+  std::default_random_engine rng(42);
+  BatchSerializer serializer;
+  dp::Batch batch;
+  for (int i = 0; i < 500; i++) {
+    random_batch(&rng, &batch);
+    check_batch(&serializer, batch);
+  }
+}
+
+TEST(BatchSerializerTest, TestWrite) {
+  std::default_random_engine rng(7);
+  BatchSerializer serializer;
+  dp::Batch batch;
+  random_batch(&rng, &batch);
+  while (batch.frames_size() == 0) {
+    random_batch(&rng, &batch);
+  }
+  // write() only touches the measured bytes
+  size_t size = serializer.byte_size(batch);
+  std::string buf(size + 2, '\xAA');
+  auto start = (uint8_t*) &buf[1];
+  EXPECT_EQ(start + size, serializer.write(batch, start));
+  EXPECT_EQ('\xAA', buf.front());
+  EXPECT_EQ('\xAA', buf.back());
+  EXPECT_EQ(batch.SerializeAsString(), buf.substr(1, size));
+}
+
+TEST(BatchSerializerTest, TestUnknownFields) {
+  BatchSerializer serializer;
+  dp::Batch batch;
+  batch.add_frames()->add_people()->set_uid(7);
+  // a field from some newer schema
+  std::string bytes = batch.SerializeAsString();
+  bytes += '\xF8';  // field 31, varint
+  bytes += '\x01';
+  bytes += '\x01';
+  dp::Batch parsed;
+  ASSERT_TRUE(parsed.ParseFromString(bytes));
+  ASSERT_EQ(bytes, parsed.SerializeAsString());
+  // dropped, as documented
+  std::string ours;
+  ASSERT_TRUE(serializer.serialize(parsed, &ours));
+  EXPECT_EQ(batch.SerializeAsString(), ours);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,205 @@
+#include "CoalescingPayloadFilter.hpp"
+#include "PayloadBroker.hpp"
+#include "Subscription.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of sources in each test batch
+const int NUM_SOURCES = 2;
+
+/**
+ * Batch number `n`, with a frame per source, with one person each.
+ */
+static dp::Batch
+make_batch(int n) {
+  dp::Batch batch;
+  batch.set_max_frames(NUM_SOURCES);
+  for (int source = 0; source < NUM_SOURCES; source++) {
+    auto frame = batch.add_frames();
+    frame->set_source_id(source);
+    frame->set_frame_num(n);
+    auto person = frame->add_people();
+    person->mutable_bbox()->set_left(n);
+    person->set_danger_val(0.5f);
+  }
+  return batch;
+}
+
+/**
+ * A buffer with empty batch metadata attached.
+ */
+static GstBuffer*
+make_buffer(NvDsBatchMeta** batch_meta) {
+  *batch_meta = nvds_create_batch_meta(NUM_SOURCES);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, *batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  return buf;
+}
+
+/**
+ * Broker which unpacks everything it receives for its subscription.
+ */
+class TestBroker : public PayloadBroker {
+public:
+  virtual bool on_batch_payload(Payload* payload) {
+    payloads++;
+    return CoalescingPayloadFilter::unpack(
+      payload->data(), payload->size(), &batches);
+  }
+  size_t payloads = 0;
+  std::vector<dp::Batch> batches;
+};
+
+/**
+ * Run `num_batches` batches through `filter` into `broker`.
+ */
+static void
+run(CoalescingPayloadFilter* filter, PayloadBroker* broker, int first,
+    int num_batches) {
+  for (int n = first; n < first + num_batches; n++) {
+    NvDsBatchMeta* batch_meta;
+    auto buf = make_buffer(&batch_meta);
+    dp::Batch batch = make_batch(n);
+    ASSERT_TRUE(filter->on_batch_meta(batch_meta, &batch));
+    ASSERT_EQ(GST_FLOW_OK, broker->on_buffer(buf));
+    gst_buffer_unref(buf);
+  }
+}
+
+// Tests batches are coalesced max_batches at a time, and on_eos gets the
+// rest without a batch to attach them to
+TEST(CoalescingPayloadFilterTest, TestEos) {
+  CoalescingPayloadFilter filter(3, 0);
+  TestBroker broker;
+  ASSERT_EQ(nullptr, filter.on_eos());
+  run(&filter, &broker, 0, 7);
+  ASSERT_EQ((size_t) 2, broker.payloads);
+  ASSERT_EQ((size_t) 6, broker.batches.size());
+
+  auto buf = filter.on_eos();
+  ASSERT_NE(nullptr, buf);
+  ASSERT_EQ(GST_FLOW_OK, broker.on_buffer(buf));
+  gst_buffer_unref(buf);
+  ASSERT_EQ((size_t) 3, broker.payloads);
+  ASSERT_EQ((size_t) 7, broker.batches.size());
+  for (int n = 0; n < 7; n++) {
+    ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+      make_batch(n), broker.batches[n]));
+  }
+  // nothing left
+  ASSERT_EQ(nullptr, filter.on_eos());
+}
+
+// Tests on_timeout only packs what is overdue
+TEST(CoalescingPayloadFilterTest, TestTimeout) {
+  CoalescingPayloadFilter filter(100, 20);
+  TestBroker broker;
+  run(&filter, &broker, 0, 2);
+  ASSERT_EQ(nullptr, filter.on_timeout());
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  auto buf = filter.on_timeout();
+  ASSERT_NE(nullptr, buf);
+  ASSERT_EQ(GST_FLOW_OK, broker.on_buffer(buf));
+  gst_buffer_unref(buf);
+  ASSERT_EQ((size_t) 1, broker.payloads);
+  ASSERT_EQ((size_t) 2, broker.batches.size());
+  ASSERT_EQ(nullptr, filter.on_timeout());
+}
+
+// Tests a subscription gets its own coalesced payloads of filtered batches
+TEST(CoalescingPayloadFilterTest, TestSubscribe) {
+  CoalescingPayloadFilter filter(2, 0);
+  Subscription one;
+  one.source_ids = {1};
+  uint32_t id = filter.subscribe(one);
+  ASSERT_NE((uint32_t) 0, id);
+  TestBroker all, some;
+  some.set_subscription(id);
+  for (int n = 0; n < 4; n++) {
+    NvDsBatchMeta* batch_meta;
+    auto buf = make_buffer(&batch_meta);
+    dp::Batch batch = make_batch(n);
+    ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+    ASSERT_EQ(GST_FLOW_OK, all.on_buffer(buf));
+    ASSERT_EQ(GST_FLOW_OK, some.on_buffer(buf));
+    gst_buffer_unref(buf);
+  }
+  ASSERT_EQ((size_t) 2, all.payloads);
+  ASSERT_EQ((size_t) 2, some.payloads);
+  ASSERT_EQ((size_t) 4, some.batches.size());
+  for (const auto& batch : some.batches) {
+    ASSERT_EQ(1, batch.frames_size());
+    ASSERT_EQ((uint32_t) 1, batch.frames(0).source_id());
+  }
+  for (const auto& batch : all.batches) {
+    ASSERT_EQ(NUM_SOURCES, batch.frames_size());
+  }
+}
+
+// Tests the columnar encoding is flagged and unpacks, whether the batches
+// come as Batches or PackedBatches
+TEST(CoalescingPayloadFilterTest, TestColumnar) {
+  CoalescingPayloadFilter filter(4, 0, CoalescingPayloadFilter::zlib, 0);
+  filter.encoding = ProtoPayloadFilter::columnar;
+  Subscription one;
+  one.source_ids = {1};
+  TestBroker all, some;
+  some.set_subscription(filter.subscribe(one));
+  for (int n = 0; n < 4; n++) {
+    NvDsBatchMeta* batch_meta;
+    auto buf = make_buffer(&batch_meta);
+    dp::Batch batch = make_batch(n);
+    batch.mutable_frames(0)->mutable_people(0)->set_uid(n + 1);
+    if (n % 2) {
+      PackedBatch packed;
+      packed.from_proto(batch);
+      ASSERT_TRUE(filter.on_packed_meta(batch_meta, &packed));
+    } else {
+      ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+    }
+    if (n == 3) {
+      auto payload = (Payload*)
+        ((NvDsUserMeta*) batch_meta->batch_user_meta_list->data)
+          ->user_meta_data;
+      ASSERT_EQ(CoalescingPayloadFilter::MAGIC, payload->data()[0]);
+      uint8_t flags =
+        CoalescingPayloadFilter::COLUMNAR | CoalescingPayloadFilter::zlib;
+      ASSERT_EQ(flags, payload->data()[1]);
+    }
+    ASSERT_EQ(GST_FLOW_OK, all.on_buffer(buf));
+    ASSERT_EQ(GST_FLOW_OK, some.on_buffer(buf));
+    gst_buffer_unref(buf);
+  }
+  ASSERT_EQ((size_t) 1, all.payloads);
+  ASSERT_EQ((size_t) 4, all.batches.size());
+  ASSERT_EQ((size_t) 4, some.batches.size());
+  for (int n = 0; n < 4; n++) {
+    dp::Batch batch = make_batch(n);
+    batch.mutable_frames(0)->mutable_people(0)->set_uid(n + 1);
+    ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+      batch, all.batches[n])) << all.batches[n].DebugString();
+    ASSERT_EQ((uint32_t) 1, some.batches[n].frames(0).source_id());
+  }
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
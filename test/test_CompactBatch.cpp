@@ -0,0 +1,175 @@
+#include "CompactBatch.hpp"
+#include "DistanceFilter.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 4;
+// people per frame
+const int NUM_PEOPLE = 6;
+
+/**
+ * A buffer with BATCH_SIZE frames of NUM_PEOPLE people (some close enough
+ * to be dangerous) and one object of another class per frame.
+ */
+static GstBuffer*
+make_buffer() {
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+    frame_meta->batch_id = f;
+    frame_meta->source_id = f;
+    frame_meta->frame_num = 7 + f;
+    frame_meta->buf_pts = 1000 * f;
+    frame_meta->ntp_timestamp = 2000 * f;
+    nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+    for (int o = 0; o <= NUM_PEOPLE; o++) {
+      auto obj_meta = nvds_acquire_obj_meta_from_pool(batch_meta);
+      obj_meta->class_id = o == NUM_PEOPLE ? 2 : 0;
+      obj_meta->rect_params.left = o * (f + 1) * 40.0f;
+      obj_meta->rect_params.top = 100.0f;
+      obj_meta->rect_params.width = 50.0f;
+      obj_meta->rect_params.height = 150.0f;
+      nvds_add_obj_meta_to_frame(frame_meta, obj_meta, nullptr);
+    }
+  }
+  return buf;
+}
+
+/**
+ * Find the first batch level user meta of `type`.
+ */
+static NvDsUserMeta*
+find_user_meta(GstBuffer* buf, NvDsMetaType type) {
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    auto user_meta = (NvDsUserMeta*) l->data;
+    if (user_meta->base_meta.meta_type == type) {
+      return user_meta;
+    }
+  }
+  return nullptr;
+}
+
+// Tests building, copying and converting a CompactBatch
+TEST(CompactBatchTest, TestBuild) {
+  auto batch = CompactBatch::create(8, 2, 3);
+  ASSERT_NE(nullptr, batch);
+  ASSERT_EQ(nullptr, batch->add_person());
+  auto frame = batch->add_frame();
+  frame->frame_num = 1;
+  frame->source_id = 5;
+  auto person = batch->add_person();
+  person->left = 1.0f;
+  person->danger_val = 2.0f;
+  person->is_danger = 1;
+  frame = batch->add_frame();
+  frame->frame_num = 2;
+  ASSERT_NE(nullptr, batch->add_person());
+  ASSERT_NE(nullptr, batch->add_person());
+  // full
+  ASSERT_EQ(nullptr, batch->add_person());
+  ASSERT_EQ(nullptr, batch->add_frame());
+  ASSERT_EQ(2, batch->frames_size());
+  ASSERT_EQ(3, batch->people_size());
+  ASSERT_EQ(1, batch->frame(0).num_people);
+  ASSERT_EQ(2, batch->frame(1).num_people);
+  ASSERT_EQ(1, batch->frame(1).first_person);
+
+  auto proto = batch->materialize();
+  ASSERT_EQ(proto, batch->materialize());
+  ASSERT_EQ(8, proto->max_frames());
+  ASSERT_EQ(2, proto->frames_size());
+  ASSERT_EQ(5, proto->frames(0).source_id());
+  ASSERT_EQ(1, proto->frames(0).people_size());
+  ASSERT_EQ(1.0f, proto->frames(0).people(0).bbox().left());
+  ASSERT_TRUE(proto->frames(0).people(0).is_danger());
+  ASSERT_EQ(2, proto->frames(1).people_size());
+  ASSERT_FALSE(proto->frames(1).people(0).is_danger());
+
+  // the copy has its own materialized Batch and outlives the original
+  auto copy = batch->copy();
+  auto copy_proto = copy->materialize();
+  ASSERT_NE(proto, copy_proto);
+  CompactBatch::destroy(batch);
+  ASSERT_EQ(3, copy->people_size());
+  ASSERT_EQ(1.0f, copy_proto->frames(0).people(0).bbox().left());
+  CompactBatch::destroy(copy);
+}
+
+// Tests DistanceFilter's compact meta converts to the same Batch
+TEST(CompactBatchTest, TestDistanceFilter) {
+  DistanceFilter filter;
+  auto proto_buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(proto_buf));
+  filter.compact_meta = true;
+  auto compact_buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(compact_buf));
+
+  ASSERT_EQ(nullptr, find_user_meta(compact_buf, DF_USER_BATCH_META));
+  auto proto_meta = find_user_meta(proto_buf, DF_USER_BATCH_META);
+  auto compact_meta = find_user_meta(compact_buf, DF_USER_COMPACT_BATCH_META);
+  ASSERT_NE(nullptr, proto_meta);
+  ASSERT_NE(nullptr, compact_meta);
+  auto expected = (dp::Batch*) proto_meta->user_meta_data;
+  auto compact = (CompactBatch*) compact_meta->user_meta_data;
+  ASSERT_EQ(BATCH_SIZE, compact->frames_size());
+  ASSERT_EQ(BATCH_SIZE * NUM_PEOPLE, compact->people_size());
+  ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    *expected, *compact->materialize()));
+  // and there is some danger in there
+  ASSERT_LT(0.0f, expected->frames(0).sum_danger());
+
+  gst_buffer_unref(proto_buf);
+  gst_buffer_unref(compact_buf);
+}
+
+// Tests DistanceFilter leaves people out, rather than crashing, if
+// num_obj_meta undercounts obj_meta_list
+TEST(CompactBatchTest, TestUndercount) {
+  DistanceFilter filter;
+  filter.compact_meta = true;
+  auto buf = make_buffer();
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  for (auto l = batch_meta->frame_meta_list; l != nullptr; l = l->next) {
+    ((NvDsFrameMeta*) l->data)->num_obj_meta = 2;
+  }
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+  auto compact_meta = find_user_meta(buf, DF_USER_COMPACT_BATCH_META);
+  ASSERT_NE(nullptr, compact_meta);
+  auto compact = (CompactBatch*) compact_meta->user_meta_data;
+  ASSERT_EQ(BATCH_SIZE, compact->frames_size());
+  ASSERT_EQ(BATCH_SIZE * 2, compact->people_size());
+  // every frame is still scored in full
+  DistanceFilter proto_filter;
+  auto proto_buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, proto_filter.on_buffer(proto_buf));
+  auto expected = (dp::Batch*) find_user_meta(
+    proto_buf, DF_USER_BATCH_META)->user_meta_data;
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    ASSERT_EQ(expected->frames(f).sum_danger(),
+              compact->frame(f).sum_danger) << f;
+  }
+  gst_buffer_unref(proto_buf);
+  gst_buffer_unref(buf);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
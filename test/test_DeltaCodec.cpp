@@ -0,0 +1,294 @@
+#include "DeltaCodec.hpp"
+
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of sources (frames per batch)
+const int NUM_SOURCES = 4;
+// number of batches in a test stream
+const int NUM_BATCHES = 300;
+// box quantization step
+const float GRID = 4.0f;
+// smallest danger change sent
+const float DANGER_STEP = 0.01f;
+
+/**
+ * A person walking in a straight line, bouncing off the edges.
+ */
+struct Track {
+  float x, y, dx, dy, height;
+  float danger;
+  int32_t uid;
+};
+
+/**
+ * Generates batches of slowly moving people, a few of whom come and go.
+ */
+class TrackGenerator {
+ public:
+  explicit TrackGenerator(int seed = 42)
+      : rng_(seed), frame_num_(0), next_uid_(1) {
+    std::uniform_int_distribution<int> people(5, 20);
+    for (int s = 0; s < NUM_SOURCES; s++) {
+      tracks_.emplace_back();
+      int count = people(rng_);
+      for (int i = 0; i < count; i++) {
+        tracks_[s].push_back(new_track());
+      }
+    }
+  }
+
+  Track new_track() {
+    std::uniform_real_distribution<float> pos(0.0f, 1800.0f);
+    std::uniform_real_distribution<float> vel(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> height(150.0f, 250.0f);
+    return Track{pos(rng_), pos(rng_) / 2, vel(rng_), vel(rng_),
+                 height(rng_), 0.0f, next_uid_++};
+  }
+
+  dp::Batch next() {
+    std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+    dp::Batch batch;
+    batch.set_max_frames(NUM_SOURCES);
+    for (int s = 0; s < NUM_SOURCES; s++) {
+      auto& tracks = tracks_[s];
+      // people come and go now and then, from anywhere in the frame
+      if (chance(rng_) < 0.02f && tracks.size() > 1) {
+        std::uniform_int_distribution<size_t> which(0, tracks.size() - 1);
+        tracks.erase(tracks.begin() + which(rng_));
+      }
+      if (chance(rng_) < 0.02f) {
+        tracks.push_back(new_track());
+      }
+      auto frame = batch.add_frames();
+      frame->set_frame_num(frame_num_);
+      frame->set_pts(frame_num_ * 33333333ull);
+      frame->set_dts(1600000000000000000ull + frame_num_ * 33333333ull);
+      frame->set_source_id(s);
+      float sum_danger = 0.0f;
+      for (auto& t : tracks) {
+        t.x += t.dx;
+        t.y += t.dy;
+        if (t.x < 0 || t.x > 1800) t.dx = -t.dx;
+        if (t.y < 0 || t.y > 900) t.dy = -t.dy;
+        // danger changes rarely
+        if (chance(rng_) < 0.05f) {
+          t.danger = chance(rng_) < 0.5f ? 0.0f : chance(rng_) * 2.0f;
+        }
+        auto person = frame->add_people();
+        auto box = person->mutable_bbox();
+        box->set_left(t.x);
+        box->set_top(t.y);
+        box->set_width(t.height / 3);
+        box->set_height(t.height);
+        person->set_uid(t.uid);
+        person->set_danger_val(t.danger);
+        person->set_is_danger(t.danger >= 1.0f);
+        sum_danger += t.danger;
+      }
+      frame->set_sum_danger(sum_danger);
+    }
+    frame_num_++;
+    return batch;
+  }
+
+ private:
+  std::default_random_engine rng_;
+  std::vector<std::vector<Track>> tracks_;
+  int frame_num_;
+  int32_t next_uid_;
+};
+
+/**
+ * Checks a decoded batch against the original.
+ */
+static void
+expect_close(const dp::Batch& expected, const dp::Batch& actual) {
+  ASSERT_EQ(expected.max_frames(), actual.max_frames());
+  ASSERT_EQ(expected.frames_size(), actual.frames_size());
+  for (int f = 0; f < expected.frames_size(); f++) {
+    const dp::Frame& ef = expected.frames(f);
+    const dp::Frame& af = actual.frames(f);
+    EXPECT_EQ(ef.frame_num(), af.frame_num());
+    EXPECT_EQ(ef.pts(), af.pts());
+    EXPECT_EQ(ef.dts(), af.dts());
+    EXPECT_EQ(ef.source_id(), af.source_id());
+    EXPECT_NEAR(ef.sum_danger(), af.sum_danger(), DANGER_STEP);
+    ASSERT_EQ(ef.people_size(), af.people_size());
+    for (int p = 0; p < ef.people_size(); p++) {
+      const dp::Person& ep = ef.people(p);
+      const dp::Person& ap = af.people(p);
+      EXPECT_NEAR(ep.bbox().left(), ap.bbox().left(), GRID);
+      EXPECT_NEAR(ep.bbox().top(), ap.bbox().top(), GRID);
+      EXPECT_NEAR(ep.bbox().width(), ap.bbox().width(), GRID);
+      EXPECT_NEAR(ep.bbox().height(), ap.bbox().height(), GRID);
+      EXPECT_NEAR(ep.danger_val(), ap.danger_val(), DANGER_STEP);
+      EXPECT_EQ(ep.is_danger(), ap.is_danger());
+      EXPECT_EQ(ep.uid(), ap.uid());
+    }
+  }
+}
+
+// Tests that a stream of deltas decodes back to (nearly) the same batches
+TEST(DeltaCodecTest, TestRoundTrip) {
+  TrackGenerator gen;
+  DeltaEncoder encoder(30, GRID, DANGER_STEP);
+  DeltaDecoder decoder;
+  std::string message;
+  dp::Batch decoded;
+  for (int i = 0; i < NUM_BATCHES; i++) {
+    dp::Batch batch = gen.next();
+    ASSERT_TRUE(encoder.encode(batch, &message));
+    auto data = (const uint8_t*) message.data();
+    ASSERT_TRUE(DeltaDecoder::is_delta_message(data, message.size()));
+    ASSERT_TRUE(decoder.decode(data, message.size(), &decoded));
+    expect_close(batch, decoded);
+  }
+}
+
+// Tests that deltas are much smaller than full batches on tracks
+TEST(DeltaCodecTest, TestCompressionRatio) {
+  TrackGenerator gen;
+  DeltaEncoder encoder(30, GRID, DANGER_STEP);
+  std::string message;
+  size_t full_bytes = 0;
+  size_t delta_bytes = 0;
+  for (int i = 0; i < NUM_BATCHES; i++) {
+    dp::Batch batch = gen.next();
+    full_bytes += batch.ByteSizeLong();
+    ASSERT_TRUE(encoder.encode(batch, &message));
+    delta_bytes += message.size();
+  }
+  double ratio = (double) delta_bytes / full_bytes;
+  ASSERT_LT(ratio, 0.5);
+}
+
+/**
+ * Encodes `first` then `second`, checks both decode, and returns the size
+ * of the second message (a delta).
+ */
+static size_t
+delta_size(const dp::Batch& first, const dp::Batch& second) {
+  DeltaEncoder encoder(30, GRID, DANGER_STEP);
+  DeltaDecoder decoder;
+  std::string message;
+  dp::Batch decoded;
+  for (const dp::Batch* batch : {&first, &second}) {
+    EXPECT_TRUE(encoder.encode(*batch, &message));
+    EXPECT_TRUE(decoder.decode(
+      (const uint8_t*) message.data(), message.size(), &decoded));
+    expect_close(*batch, decoded);
+  }
+  EXPECT_EQ(message[0], DeltaEncoder::DELTA);
+  return message.size();
+}
+
+// Tests that removing someone from the middle doesn't re-send the people
+// after them
+TEST(DeltaCodecTest, TestRemoveMiddle) {
+  TrackGenerator gen;
+  dp::Batch batch = gen.next();
+  dp::Batch removed = batch;
+  for (auto& frame : *removed.mutable_frames()) {
+    ASSERT_GT(frame.people_size(), 2);
+    frame.mutable_people()->DeleteSubrange(frame.people_size() / 2, 1);
+  }
+  // a few bytes per frame, as for an unchanged batch
+  size_t unchanged = delta_size(batch, batch);
+  ASSERT_LE(delta_size(batch, removed), unchanged + 3 * NUM_SOURCES);
+}
+
+// Tests that people changing order are matched by uid
+TEST(DeltaCodecTest, TestReorder) {
+  TrackGenerator gen;
+  dp::Batch batch = gen.next();
+  dp::Batch reordered = batch;
+  size_t people = 0;
+  for (auto& frame : *reordered.mutable_frames()) {
+    auto list = frame.mutable_people();
+    std::reverse(list->begin(), list->end());
+    people += frame.people_size();
+  }
+  // at most one small remap entry per person, no boxes
+  size_t unchanged = delta_size(batch, batch);
+  ASSERT_LE(delta_size(batch, reordered), unchanged + 3 * people);
+}
+
+// Tests that people without a uid are still matched by index
+TEST(DeltaCodecTest, TestNoUid) {
+  TrackGenerator gen;
+  DeltaEncoder encoder(30, GRID, DANGER_STEP);
+  DeltaDecoder decoder;
+  std::string message;
+  dp::Batch decoded;
+  size_t full_bytes = 0;
+  size_t delta_bytes = 0;
+  for (int i = 0; i < NUM_BATCHES; i++) {
+    dp::Batch batch = gen.next();
+    for (auto& frame : *batch.mutable_frames()) {
+      for (auto& person : *frame.mutable_people()) {
+        person.set_uid(0);
+      }
+    }
+    full_bytes += batch.ByteSizeLong();
+    ASSERT_TRUE(encoder.encode(batch, &message));
+    delta_bytes += message.size();
+    ASSERT_TRUE(decoder.decode(
+      (const uint8_t*) message.data(), message.size(), &decoded));
+    expect_close(batch, decoded);
+  }
+  ASSERT_LT((double) delta_bytes / full_bytes, 0.5);
+}
+
+// Tests that a lost message stops decoding until the next keyframe
+TEST(DeltaCodecTest, TestResync) {
+  TrackGenerator gen;
+  DeltaEncoder encoder(10, GRID, DANGER_STEP);
+  DeltaDecoder decoder;
+  std::string message;
+  dp::Batch decoded;
+  for (int i = 0; i < 25; i++) {
+    dp::Batch batch = gen.next();
+    ASSERT_TRUE(encoder.encode(batch, &message));
+    // drop message 5
+    if (i == 5) {
+      continue;
+    }
+    bool ok = decoder.decode(
+      (const uint8_t*) message.data(), message.size(), &decoded);
+    if (i > 5 && i < 10) {
+      ASSERT_FALSE(ok);
+    } else {
+      ASSERT_TRUE(ok);
+      expect_close(batch, decoded);
+    }
+  }
+}
+
+// Tests that garbage is rejected
+TEST(DeltaCodecTest, TestGarbage) {
+  DeltaDecoder decoder;
+  dp::Batch decoded;
+  const uint8_t garbage[] = {'D', 1, 0xFF, 0xFF, 0xFF};
+  ASSERT_FALSE(decoder.decode(garbage, sizeof(garbage), &decoded));
+  const uint8_t keyframe[] = {'K', 0, 0, 0, 0x80, 0x40, 100, 1, 2};
+  ASSERT_FALSE(decoder.decode(keyframe, sizeof(keyframe), &decoded));
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,232 @@
+#include "DistanceConfig.hpp"
+#include "DistanceFilter.hpp"
+#include "Rcu.hpp"
+#include "test_helpers.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+const char* TEXT =
+  "# defaults\n"
+  "class_id 2\n"
+  "do_drawing true\n"
+  "danger_threshold 0.75  # a little more careful\n"
+  "ramp_danger 2.0\n"
+  "ramp_high 1,0,0,1\n"
+  "\n"
+  "source 3\n"
+  "filter_height_diff 0.5\n"
+  "do_drawing false\n";
+
+// Run `batch` through `filter`, returning a copy of its Batch and the osd
+// colors it set on the first frame
+dp::Batch
+filter_batch(DistanceFilter* filter, const dp::Batch& batch,
+             std::vector<NvOSD_ColorParams>* colors) {
+  return filter_batch(filter, batch, [colors](NvDsBatchMeta* batch_meta) {
+    auto frame_meta = (NvDsFrameMeta*) batch_meta->frame_meta_list->data;
+    for (auto l = frame_meta->obj_meta_list; l != nullptr; l = l->next) {
+      auto obj_meta = (NvDsObjectMeta*) l->data;
+      colors->push_back(obj_meta->rect_params.has_bg_color ?
+        obj_meta->rect_params.bg_color : NvOSD_ColorParams{});
+    }
+  });
+}
+
+// Tests the defaults, and the default ramp draws what the filter always has
+TEST(DistanceConfigTest, TestDefaults) {
+  DistanceConfig config;
+  ASSERT_EQ(0, config.class_id);
+  ASSERT_TRUE(config.sources.empty());
+  const SourceConfig& source = config.source(3);
+  ASSERT_EQ(&config.defaults, &source);
+  ASSERT_FALSE(source.do_drawing);
+  ASSERT_FLOAT_EQ(0.25f, source.filter_height_diff);
+  ASSERT_FLOAT_EQ(1.0f, source.danger_threshold);
+  for (float danger : {0.0f, 0.3f, 0.5f, 1.0f, 7.0f}) {
+    float color_val = danger * 0.6f < 0.6f ? danger * 0.6f : 0.6f;
+    Rgba color = source.color(danger);
+    ASSERT_NEAR(color_val + 0.2f, color.red, 1e-6f);
+    ASSERT_NEAR(0.2f, color.green, 1e-6f);
+    ASSERT_NEAR(0.2f, color.blue, 1e-6f);
+    ASSERT_NEAR(color_val + 0.2f, color.alpha, 1e-6f);
+  }
+}
+
+// Tests defaults come first and sources start out with them
+TEST(DistanceConfigTest, TestParse) {
+  DistanceConfig config;
+  ASSERT_TRUE(DistanceConfig::parse(TEXT, &config));
+  ASSERT_EQ(2, config.class_id);
+  ASSERT_TRUE(config.defaults.do_drawing);
+  ASSERT_FLOAT_EQ(0.25f, config.defaults.filter_height_diff);
+  ASSERT_FLOAT_EQ(0.75f, config.defaults.danger_threshold);
+  ASSERT_FLOAT_EQ(1.0f, config.defaults.ramp_high.red);
+  ASSERT_FLOAT_EQ(0.0f, config.defaults.ramp_high.green);
+  // halfway up the ramp
+  ASSERT_NEAR(0.6f, config.defaults.color(1.0f).red, 1e-6f);
+  ASSERT_EQ((size_t) 1, config.sources.size());
+  const SourceConfig& source = config.source(3);
+  ASSERT_FALSE(source.do_drawing);
+  ASSERT_FLOAT_EQ(0.5f, source.filter_height_diff);
+  ASSERT_FLOAT_EQ(0.75f, source.danger_threshold);
+  ASSERT_FLOAT_EQ(2.0f, source.ramp_danger);
+  ASSERT_EQ(&config.defaults, &config.source(4));
+
+  // an empty config is the defaults
+  ASSERT_TRUE(DistanceConfig::parse("# nothing\n", &config));
+  ASSERT_EQ(0, config.class_id);
+  ASSERT_TRUE(config.sources.empty());
+
+  for (const char* bad : {
+      "filter_height_diff\n",
+      "filter_height_diff 0.25 0.5\n",
+      "filter_height_diff -1\n",
+      "danger_threshold nan\n",
+      "do_drawing maybe\n",
+      "ramp_danger 0\n",
+      "ramp_low 0.2,0.2,0.2\n",
+      "ramp_high 0.2,0.2,0.2,2\n",
+      "source -1\n",
+      "source 1\nclass_id 2\n",
+      "color red\n"}) {
+    ASSERT_FALSE(DistanceConfig::parse(bad, &config)) << bad;
+  }
+}
+
+// Tests the reader never sees a replaced value freed or half published,
+// and everything is freed in the end (run under a sanitizer)
+TEST(RcuTest, TestPublish) {
+  struct Pair {
+    int a;
+    int b;
+  };
+  Rcu<Pair> rcu(std::unique_ptr<Pair>(new Pair{0, 0}));
+  std::atomic<bool> done(false);
+  std::vector<std::thread> writers;
+  for (int w = 1; w <= 2; w++) {
+    writers.emplace_back([&rcu, &done, w]() {
+      for (int i = 0; !done.load(); i++) {
+        rcu.publish(std::unique_ptr<Pair>(new Pair{i * w, -i * w}));
+      }
+    });
+  }
+  for (int i = 0; i < 200000; i++) {
+    const Pair* pair = rcu.acquire();
+    ASSERT_EQ(pair->a, -pair->b);
+    if (i % 1000 == 0) {
+      rcu.release();
+    }
+  }
+  done.store(true);
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  Pair last = rcu.copy();
+  ASSERT_EQ(last.a, -last.b);
+}
+
+// Tests set_config and load_config take effect on the next buffer, per
+// source
+TEST(DistanceFilterConfigTest, TestSetConfig) {
+  DistanceFilter filter;
+  dp::Batch batch;
+  add_frame(&batch, 0, 3);
+  add_frame(&batch, 3, 3);
+
+  std::vector<NvOSD_ColorParams> colors;
+  auto result = filter_batch(&filter, batch, &colors);
+  for (const auto& frame : result.frames()) {
+    ASSERT_FLOAT_EQ(1.0f, frame.people(1).danger_val());
+    ASSERT_FALSE(frame.people(0).is_danger());
+    ASSERT_TRUE(frame.people(1).is_danger());
+  }
+  // not drawing by default
+  ASSERT_EQ(0.0, colors[1].alpha);
+
+  auto config = filter.config();
+  config.defaults.danger_threshold = 0.5f;
+  config.defaults.do_drawing = true;
+  config.sources[3].danger_threshold = 2.0f;
+  filter.set_config(config);
+  colors.clear();
+  result = filter_batch(&filter, batch, &colors);
+  for (const auto& person : result.frames(0).people()) {
+    ASSERT_TRUE(person.is_danger());
+  }
+  for (const auto& person : result.frames(1).people()) {
+    ASSERT_FALSE(person.is_danger());
+  }
+  ASSERT_NEAR(0.8, colors[1].red, 1e-6);
+  ASSERT_NEAR(0.5, colors[0].red, 1e-6);
+
+  std::string filename = testing::TempDir() + "test_distance_config.txt";
+  {
+    std::ofstream out(filename);
+    out << TEXT;
+  }
+  ASSERT_TRUE(filter.load_config(filename));
+  ASSERT_FALSE(filter.load_config(filename + ".missing"));
+  remove(filename.c_str());
+  ASSERT_EQ(2, filter.config().class_id);
+  // nobody is class_id 2 anymore
+  result = filter_batch(&filter, batch);
+  ASSERT_EQ(0, result.frames(0).people_size());
+}
+
+// Tests a buffer is scored with one config from start to finish however
+// often it's replaced meanwhile
+TEST(DistanceFilterConfigTest, TestHotReload) {
+  DistanceFilter filter;
+  dp::Batch batch;
+  for (uint32_t s = 0; s < 8; s++) {
+    add_frame(&batch, s, 3);
+  }
+  DistanceConfig everybody;
+  everybody.defaults.danger_threshold = 0.0f;
+  DistanceConfig nobody;
+  nobody.defaults.danger_threshold = 100.0f;
+  filter.set_config(nobody);
+  std::atomic<bool> done(false);
+  std::thread control([&]() {
+    for (int i = 0; !done.load(); i++) {
+      filter.set_config(i % 2 ? everybody : nobody);
+    }
+  });
+  size_t seen[2] = {0, 0};
+  for (int i = 0; i < 2000; i++) {
+    auto result = filter_batch(&filter, batch);
+    bool is_danger = result.frames(0).people(0).is_danger();
+    seen[is_danger]++;
+    for (const auto& frame : result.frames()) {
+      for (const auto& person : frame.people()) {
+        ASSERT_EQ(is_danger, person.is_danger());
+      }
+    }
+  }
+  done.store(true);
+  control.join();
+  ASSERT_GT(seen[0] + seen[1], (size_t) 0);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
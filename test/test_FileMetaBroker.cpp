@@ -1,7 +1,21 @@
+#include "DirectOutputStream.hpp"
 #include "FileMetaBroker.hpp"
+#include "PackedBatch.hpp"
+#include "Replay.hpp"
 
 #include "gtest/gtest.h"
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/util/message_differencer.h>
+#ifdef DS_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cerrno>
 #include <chrono>
 #include <experimental/filesystem>
 #include <random>
@@ -86,6 +100,36 @@ class FileMetaBrokerTest : public ::testing::Test {
   }
 };
 
+// Tests a short write (here, past a file size limit that isn't a multiple
+// of the block size) is an error, rather than a misaligned retry
+TEST_F(FileMetaBrokerTest, TestDirectShortWrite) {
+  auto filename = (tmp_ / "short").string();
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_NE(-1, fd);
+  struct rlimit old_limit, limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+  limit = old_limit;
+  limit.rlim_cur = DirectOutputStream::ALIGNMENT + 100;
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+  auto old_handler = signal(SIGXFSZ, SIG_IGN);
+  {
+    // direct, as far as the stream knows
+    DirectOutputStream out(fd, true, 0, 0, 4 * DirectOutputStream::ALIGNMENT);
+    void* data;
+    int size;
+    ASSERT_TRUE(out.Next(&data, &size));
+    memset(data, 'x', size);
+    ASSERT_FALSE(out.Next(&data, &size));
+    ASSERT_EQ(EIO, out.GetErrno());
+    ASSERT_FALSE(out.Close());
+  }
+  signal(SIGXFSZ, old_handler);
+  ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &old_limit));
+  close(fd);
+  // no block was written in full, so nothing is left to misread
+  ASSERT_EQ(0, fs::file_size(filename));
+}
+
 // Tests construction and destruction
 TEST_F(FileMetaBrokerTest, TestCreateDestroy) {
   fmb_ = new FileMetaBroker(basepath_);
@@ -107,6 +151,122 @@ TEST_F(FileMetaBrokerTest, TestProto) {
   fmb_->stop();
 }
 
+// Tests that preallocated, O_DIRECT, output is truncated to the right size
+TEST_F(FileMetaBrokerTest, TestProtoDirect) {
+  fmb_ = new FileMetaBroker(basepath_);
+  fmb_->direct_io = true;
+  fmb_->prealloc_size = 1 << 20;
+  fmb_->writeback_size = 1 << 16;
+  dp::Batch* batch = nullptr;
+  // magic number
+  size_t expected_size = sizeof(uint32_t);
+  fmb_->start();
+  for (size_t i = 0; i < NUM_BATCHES; i++)
+  {
+    batch = generate_batch();
+    expected_size += batch->ByteSizeLong();
+    fmb_->on_batch_meta(nullptr, batch);
+    delete batch;
+  }
+  fmb_->stop();
+  ASSERT_EQ(expected_size, fs::file_size(fmb_->get_filename()));
+}
+
+// Tests packed output reads back as the same batches
+TEST_F(FileMetaBrokerTest, TestPacked) {
+  fmb_ = new FileMetaBroker(basepath_, FileMetaBroker::Format::packed);
+  std::vector<dp::Batch> expected(NUM_BATCHES);
+  fmb_->start();
+  for (size_t i = 0; i < expected.size(); i++) {
+    std::unique_ptr<dp::Batch> generated(generate_batch());
+    // people get a (zero) bbox in the round trip
+    PackedBatch packed;
+    packed.from_proto(*generated);
+    packed.to_proto(&expected[i]);
+    // attached PackedBatches are written as they are
+    if (i % 2) {
+      fmb_->on_packed_meta(nullptr, &packed);
+    } else {
+      fmb_->on_batch_meta(nullptr, generated.get());
+    }
+  }
+  fmb_->stop();
+
+  std::ifstream in(fmb_->get_filename(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  google::protobuf::io::CodedInputStream coded(
+    (const uint8_t*) data.data(), (int) data.size());
+  uint32_t magic;
+  ASSERT_TRUE(coded.ReadLittleEndian32(&magic));
+  ASSERT_EQ((uint32_t) FileMetaBroker::PACKED_MAGIC_NUMBER, magic);
+  for (const auto& batch : expected) {
+    uint32_t size;
+    std::string record;
+    ASSERT_TRUE(coded.ReadVarint32(&size));
+    ASSERT_TRUE(coded.ReadString(&record, (int) size));
+    PackedBatch parsed;
+    ASSERT_TRUE(parsed.parse((const uint8_t*) record.data(), record.size()));
+    ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+      batch, *parsed.materialize()));
+  }
+  uint32_t tail;
+  ASSERT_FALSE(coded.ReadVarint32(&tail));
+}
+
+// Tests the events format only writes when something happens, and that
+// stop() ends what is still going on
+TEST_F(FileMetaBrokerTest, TestEvents) {
+  fmb_ = new FileMetaBroker(basepath_, FileMetaBroker::Format::events);
+  fmb_->tracker.min_duration = 0;
+  fmb_->start();
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  auto person = frame->add_people();
+  person->set_uid(1);
+  for (uint64_t i = 0; i < 100; i++) {
+    // somebody in violation for a while in the middle
+    person->set_danger_val(i >= 40 && i < 60 ? 1.5f : 0.1f);
+    frame->set_pts(i * 100000000ull);
+    auto buf = Replay::make_buffer(batch);
+    ASSERT_TRUE(fmb_->on_batch_meta(gst_buffer_get_nvds_batch_meta(buf), &batch));
+    gst_buffer_unref(buf);
+  }
+  // and again at the end
+  person->set_danger_val(1.5f);
+  frame->set_pts(100 * 100000000ull);
+  auto buf = Replay::make_buffer(batch);
+  ASSERT_TRUE(fmb_->on_batch_meta(gst_buffer_get_nvds_batch_meta(buf), &batch));
+  gst_buffer_unref(buf);
+  fmb_->stop();
+
+  std::ifstream in(fmb_->get_filename(), std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  google::protobuf::io::CodedInputStream coded(
+    (const uint8_t*) data.data(), (int) data.size());
+  uint32_t magic;
+  ASSERT_TRUE(coded.ReadLittleEndian32(&magic));
+  ASSERT_EQ((uint32_t) FileMetaBroker::EVENTS_MAGIC_NUMBER, magic);
+  std::vector<ViolationEvent::Kind> kinds;
+  uint32_t size;
+  while (coded.ReadVarint32(&size)) {
+    std::string message;
+    ASSERT_TRUE(coded.ReadString(&message, (int) size));
+    std::vector<ViolationEvent> events;
+    ASSERT_TRUE(ViolationTracker::decode(
+      (const uint8_t*) message.data(), message.size(), &events));
+    for (const auto& event : events) {
+      kinds.push_back(event.kind);
+    }
+  }
+  std::vector<ViolationEvent::Kind> expected = {
+    ViolationEvent::start, ViolationEvent::end,
+    ViolationEvent::start, ViolationEvent::end,
+  };
+  ASSERT_EQ(expected, kinds);
+}
+
 TEST_F(FileMetaBrokerTest, TestCsv) {
   fmb_ = new FileMetaBroker(basepath_, FileMetaBroker::Format::csv);
   dp::Batch* batch = nullptr;
@@ -120,10 +280,70 @@ TEST_F(FileMetaBrokerTest, TestCsv) {
   fmb_->stop();
 }
 
+#ifdef DS_SQLITE
+static int64_t
+query_int(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt = nullptr;
+  int64_t ret = -1;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    ret = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return ret;
+}
+
+// Tests the sqlite format writes a row per frame (and per person when
+// db_people is set), indexed by source and time, in WAL mode
+TEST_F(FileMetaBrokerTest, TestSqlite) {
+  for (bool people : {false, true}) {
+    delete fmb_;
+    fmb_ = new FileMetaBroker(basepath_, FileMetaBroker::Format::sqlite);
+    // an existing database is appended to
+    fs::remove(fmb_->get_filename());
+    fmb_->db_people = people;
+    fmb_->db_max_batches = 3;
+    fmb_->start();
+    int64_t num_people = 0;
+    for (size_t i = 0; i < NUM_BATCHES; i++) {
+      std::unique_ptr<dp::Batch> batch(generate_batch());
+      for (auto& frame : *batch->mutable_frames()) {
+        frame.set_source_id(i % 2);
+        frame.set_pts(i * 1000);
+        num_people += frame.people_size();
+      }
+      ASSERT_TRUE(fmb_->on_batch_meta(nullptr, batch.get()));
+    }
+    fmb_->stop();
+
+    sqlite3* db = nullptr;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open_v2(
+      fmb_->get_filename().c_str(), &db, SQLITE_OPEN_READONLY, nullptr));
+    EXPECT_EQ(NUM_BATCHES * BATCH_SIZE,
+              query_int(db, "SELECT count(*) FROM frames"));
+    EXPECT_EQ(num_people, query_int(db, "SELECT sum(people) FROM frames"));
+    EXPECT_EQ(people ? num_people : 0,
+              query_int(db, "SELECT count(*) FROM people"));
+    EXPECT_EQ(BATCH_SIZE * 4, query_int(db,
+      "SELECT count(*) FROM frames WHERE source_id = 1"));
+    EXPECT_EQ(1, query_int(db, "SELECT count(*) FROM sqlite_master "
+      "WHERE name = 'frames_source_id_timestamp'"));
+    sqlite3_stmt* stmt = nullptr;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(
+      db, "PRAGMA journal_mode", -1, &stmt, nullptr));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_STREQ("wal", (const char*) sqlite3_column_text(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+  }
+}
+#endif  // DS_SQLITE
+
 }  // namespace
 }  // namespace ds
 
 int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "FrameScheduler.hpp"
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+#include "ReplaySource.hpp"
+#include "test_helpers.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// 30 fps, in ns
+const uint64_t FRAME_NS = 33333333ull;
+
+// A frame of a few people standing around
+dp::Batch
+make_batch(uint64_t frame_num, int num_people = 4) {
+  dp::Batch batch;
+  add_frame(&batch, 0, num_people, 0.0f, 100.0f)->set_pts(
+    frame_num * FRAME_NS);
+  return batch;
+}
+
+// The fixture for testing class FrameScheduler.
+class FrameSchedulerTest : public ::testing::Test {
+ protected:
+  FrameSchedulerTest() {
+    scheduler_.max_staleness = 0;
+  }
+
+  // run a frame through the scheduler, the way DistanceFilter does
+  bool run(const dp::Batch& batch, bool untracked = false) {
+    auto buf = Replay::make_buffer(batch);
+    auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+    auto frame_meta = (NvDsFrameMeta*) batch_meta->frame_meta_list->data;
+    if (untracked) {
+      for (auto l = frame_meta->obj_meta_list; l != nullptr; l = l->next) {
+        ((NvDsObjectMeta*) l->data)->object_id = UNTRACKED_OBJECT_ID;
+      }
+    }
+    std::vector<NvDsObjectMeta*> people;
+    for (auto l = frame_meta->obj_meta_list; l != nullptr; l = l->next) {
+      people.push_back((NvDsObjectMeta*) l->data);
+    }
+    bool compute = scheduler_.begin_frame(frame_meta, people);
+    for (auto obj_meta : people) {
+      float danger = obj_meta->object_id * 0.1f;
+      if (compute) {
+        scheduler_.set_danger(obj_meta, danger);
+      } else {
+        EXPECT_EQ(danger, scheduler_.get_danger(obj_meta));
+      }
+    }
+    scheduler_.end_frame();
+    gst_buffer_unref(buf);
+    return compute;
+  }
+
+  FrameScheduler scheduler_;
+};
+
+// Tests a quiet scene is computed less and less often, up to max_interval
+TEST_F(FrameSchedulerTest, TestQuiet) {
+  std::vector<uint64_t> computed;
+  for (uint64_t f = 0; f < 32; f++) {
+    if (run(make_batch(f))) {
+      computed.push_back(f);
+    }
+  }
+  std::vector<uint64_t> expected = {0, 1, 3, 7, 15, 23, 31};
+  ASSERT_EQ(expected, computed);
+  ASSERT_EQ(7, scheduler_.computed());
+  ASSERT_EQ(25, scheduler_.skipped());
+}
+
+// Tests somebody moving, arriving or leaving means a computation
+TEST_F(FrameSchedulerTest, TestChange) {
+  for (uint64_t f = 0; f < 8; f++) {
+    run(make_batch(f));
+  }
+  ASSERT_FALSE(run(make_batch(8)));
+  // a little jitter is fine
+  auto batch = make_batch(9);
+  batch.mutable_frames(0)->mutable_people(1)->mutable_bbox()->set_left(102.0f);
+  ASSERT_FALSE(run(batch));
+  // a step is not
+  batch = make_batch(10);
+  batch.mutable_frames(0)->mutable_people(1)->mutable_bbox()->set_left(110.0f);
+  ASSERT_TRUE(run(batch));
+  // and the interval starts over
+  ASSERT_TRUE(run(batch));
+  ASSERT_FALSE(run(batch));
+  ASSERT_TRUE(run(make_batch(13, 5)));
+  ASSERT_TRUE(run(make_batch(14, 3)));
+}
+
+// Tests max_staleness bounds the time between computations
+TEST_F(FrameSchedulerTest, TestStaleness) {
+  scheduler_.max_staleness = 3 * FRAME_NS;
+  uint64_t last = 0;
+  for (uint64_t f = 0; f < 32; f++) {
+    if (run(make_batch(f))) {
+      ASSERT_GE(3, f - last);
+      last = f;
+    }
+  }
+  ASSERT_LE(29, last);
+  ASSERT_GT(32, scheduler_.computed());
+}
+
+// Tests untracked objects are always computed
+TEST_F(FrameSchedulerTest, TestUntracked) {
+  for (uint64_t f = 0; f < 16; f++) {
+    ASSERT_TRUE(run(make_batch(f), true));
+  }
+}
+
+// Tests violations keep the interval down to violation_interval
+TEST_F(FrameSchedulerTest, TestViolation) {
+  // object 10 has a danger of 1.0
+  std::vector<uint64_t> computed;
+  for (uint64_t f = 0; f < 10; f++) {
+    if (run(make_batch(f, 11))) {
+      computed.push_back(f);
+    }
+  }
+  std::vector<uint64_t> expected = {0, 1, 3, 5, 7, 9};
+  ASSERT_EQ(expected, computed);
+}
+
+// Tests an adaptive DistanceFilter produces the same metadata for a still
+// scene, while computing less
+TEST(AdaptiveDistanceFilterTest, TestStill) {
+  DistanceFilter full;
+  DistanceFilter adaptive;
+  adaptive.adaptive = true;
+  // a quiet source and one with a crowd in it
+  dp::Batch still = make_batch(0);
+  SyntheticReplaySource source(1, 1, 20);
+  dp::Batch crowd;
+  ASSERT_TRUE(source.next(&crowd));
+  auto frame = still.add_frames();
+  frame->CopyFrom(crowd.frames(0));
+  frame->set_source_id(1);
+  for (uint64_t f = 0; f < 30; f++) {
+    for (auto& frame : *still.mutable_frames()) {
+      frame.set_pts(f * FRAME_NS);
+    }
+    dp::Batch results[] = {filter_batch(&full, still),
+                           filter_batch(&adaptive, still)};
+    ASSERT_EQ(still.frames_size(), results[1].frames_size());
+    for (int i = 0; i < still.frames_size(); i++) {
+      const auto& expected = results[0].frames(i);
+      const auto& actual = results[1].frames(i);
+      ASSERT_EQ(expected.people_size(), actual.people_size());
+      ASSERT_FLOAT_EQ(expected.sum_danger(), actual.sum_danger());
+      for (int p = 0; p < expected.people_size(); p++) {
+        ASSERT_EQ(expected.people(p).danger_val(),
+                  actual.people(p).danger_val());
+        ASSERT_EQ(expected.people(p).is_danger(),
+                  actual.people(p).is_danger());
+      }
+    }
+  }
+  // the quiet source is computed 6 times (see TestQuiet), the crowd every
+  // other frame (see TestViolation)
+  ASSERT_EQ(6 + 16, adaptive.scheduler.computed());
+  ASSERT_EQ(24 + 14, adaptive.scheduler.skipped());
+}
+
+// Tests an adaptive DistanceFilter counts violations by the source's
+// danger_threshold
+TEST(AdaptiveDistanceFilterTest, TestThreshold) {
+  for (float threshold : {1.0f, 1.5f}) {
+    DistanceFilter filter;
+    filter.adaptive = true;
+    DistanceConfig config = filter.config();
+    config.defaults.danger_threshold = threshold;
+    filter.set_config(config);
+    // the ones in the middle have a danger_val of 1.0
+    dp::Batch batch;
+    auto frame = add_frame(&batch, 0, 3);
+    for (uint64_t f = 0; f < 16; f++) {
+      frame->set_pts(f * FRAME_NS);
+      filter_batch(&filter, batch);
+    }
+    // every other frame in violation (see TestViolation), or quiet (see
+    // TestQuiet)
+    ASSERT_EQ(threshold > 1.0f ? 5 : 9, filter.scheduler.computed());
+  }
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,224 @@
+#include "Groups.hpp"
+#include "DistanceFilter.hpp"
+#include "ProtoPayloadFilter.hpp"
+#include "Replay.hpp"
+#include "test_helpers.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <string>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// 30 fps, in ns
+const uint64_t FRAME_NS = 33333333ull;
+
+// A frame with a row of five, a pair and somebody on their own
+dp::Batch
+make_batch(uint64_t frame_num) {
+  dp::Batch batch;
+  auto frame = add_frame(&batch, 0, 5);
+  frame->set_frame_num(frame_num);
+  frame->set_pts(frame_num * FRAME_NS);
+  add_row(frame, 2, 1000.0f);
+  add_row(frame, 1, 1500.0f);
+  return batch;
+}
+
+// Run `batch` through `filter`, returning a copy of its groups
+BatchGroups
+filter_groups(DistanceFilter* filter, const dp::Batch& batch) {
+  BatchGroups groups;
+  filter_batch(filter, batch, [&groups](NvDsBatchMeta* batch_meta) {
+    for (auto l = batch_meta->batch_user_meta_list; l; l = l->next) {
+      auto user_meta = (NvDsUserMeta*) l->data;
+      if (user_meta->base_meta.meta_type == DF_USER_GROUPS_META) {
+        groups = *(BatchGroups*) user_meta->user_meta_data;
+      }
+    }
+  });
+  return groups;
+}
+
+// Tests people are grouped transitively, and groups are collected in order
+// of their first member, with the bounding box of their members
+TEST(GroupFinderTest, TestCollect) {
+  // 10x20 people in a row, up and down a bit
+  std::vector<Box> people;
+  for (int i = 0; i < 6; i++) {
+    Box box = {10.0f * i, 5.0f * (i % 2), 10.0f, 20.0f};
+    people.push_back(box);
+  }
+  GroupFinder finder;
+  finder.reset(people.size());
+  finder.unite(4, 5);
+  finder.unite(2, 1);
+  finder.unite(0, 2);
+  finder.unite(1, 0);
+  ASSERT_EQ(finder.find(0), finder.find(2));
+  ASSERT_NE(finder.find(0), finder.find(3));
+  ASSERT_EQ((uint32_t) 3, finder.size(1));
+  ASSERT_EQ((uint32_t) 1, finder.size(3));
+
+  std::vector<Group> groups;
+  finder.collect(people, 2, &groups);
+  ASSERT_EQ((size_t) 2, groups.size());
+  ASSERT_EQ((uint32_t) 3, groups[0].size);
+  ASSERT_EQ(0.0f, groups[0].bbox.left);
+  ASSERT_EQ(0.0f, groups[0].bbox.top);
+  ASSERT_EQ(30.0f, groups[0].bbox.width);
+  ASSERT_EQ(25.0f, groups[0].bbox.height);
+  ASSERT_EQ((uint32_t) 2, groups[1].size);
+  ASSERT_EQ(40.0f, groups[1].bbox.left);
+  ASSERT_EQ(20.0f, groups[1].bbox.width);
+  // appends, and leaves out the small ones
+  finder.collect(people, 3, &groups);
+  ASSERT_EQ((size_t) 3, groups.size());
+  ASSERT_EQ((uint32_t) 3, groups[2].size);
+  // everybody on their own after a reset
+  finder.reset(people.size());
+  groups.clear();
+  finder.collect(people, 2, &groups);
+  ASSERT_TRUE(groups.empty());
+  finder.collect(people, 1, &groups);
+  ASSERT_EQ(people.size(), groups.size());
+}
+
+// Tests DistanceFilter reports the groups in each frame
+TEST(GroupDistanceFilterTest, TestGroups) {
+  DistanceFilter filter;
+  ASSERT_TRUE(filter_groups(&filter, make_batch(0)).frames.empty());
+  filter.find_groups = true;
+  auto batch = make_batch(3);
+  batch.add_frames()->set_source_id(1);
+  auto groups = filter_groups(&filter, batch);
+  ASSERT_EQ((size_t) 2, groups.frames.size());
+  ASSERT_EQ(3, groups.frames[0].frame_num);
+  ASSERT_EQ(3 * FRAME_NS, groups.frames[0].pts);
+  ASSERT_EQ((size_t) 2, groups.frames[0].groups.size());
+  const Group& row = groups.frames[0].groups[0];
+  ASSERT_EQ((uint32_t) 5, row.size);
+  ASSERT_EQ(0.0f, row.bbox.left);
+  ASSERT_EQ(200.0f, row.bbox.top);
+  ASSERT_EQ(240.0f, row.bbox.width);
+  ASSERT_EQ(100.0f, row.bbox.height);
+  const Group& pair = groups.frames[0].groups[1];
+  ASSERT_EQ((uint32_t) 2, pair.size);
+  ASSERT_EQ(1000.0f, pair.bbox.left);
+  ASSERT_EQ(90.0f, pair.bbox.width);
+  // an empty frame has no groups
+  ASSERT_EQ((uint32_t) 1, groups.frames[1].source_id);
+  ASSERT_TRUE(groups.frames[1].groups.empty());
+  // only the big ones
+  filter.min_group_size = 5;
+  groups = filter_groups(&filter, make_batch(4));
+  ASSERT_EQ((size_t) 1, groups.frames[0].groups.size());
+  ASSERT_EQ((uint32_t) 5, groups.frames[0].groups[0].size);
+}
+
+// Tests an adaptive DistanceFilter reports the same groups on skipped frames
+TEST(GroupDistanceFilterTest, TestAdaptive) {
+  DistanceFilter filter;
+  filter.find_groups = true;
+  filter.adaptive = true;
+  filter.scheduler.max_staleness = 0;
+  for (uint64_t f = 0; f < 16; f++) {
+    auto groups = filter_groups(&filter, make_batch(f));
+    ASSERT_EQ((size_t) 2, groups.frames[0].groups.size()) << f;
+    ASSERT_EQ((uint32_t) 5, groups.frames[0].groups[0].size) << f;
+    ASSERT_EQ((uint32_t) 2, groups.frames[0].groups[1].size) << f;
+  }
+  ASSERT_LT(0, filter.scheduler.skipped());
+}
+
+// Tests groups survive encode and decode, and garbage doesn't decode
+TEST(BatchGroupsTest, TestEncode) {
+  BatchGroups groups;
+  groups.frames.resize(2);
+  groups.frames[0].frame_num = 7;
+  groups.frames[0].source_id = 3;
+  groups.frames[0].pts = 7 * FRAME_NS;
+  Group group = {5, {1.5f, 2.5f, 300.0f, 40.0f}};
+  groups.frames[0].groups.push_back(group);
+  group.size = 2;
+  group.bbox.left = -1.0f;
+  groups.frames[0].groups.push_back(group);
+  groups.frames[1].frame_num = 8;
+  std::string message;
+  BatchGroups::encode(groups, &message);
+  auto data = (const uint8_t*) message.data();
+  ASSERT_TRUE(BatchGroups::is_groups_message(data, message.size()));
+
+  BatchGroups decoded;
+  ASSERT_TRUE(BatchGroups::decode(data, message.size(), &decoded));
+  ASSERT_EQ((size_t) 2, decoded.frames.size());
+  ASSERT_EQ(7, decoded.frames[0].frame_num);
+  ASSERT_EQ((uint32_t) 3, decoded.frames[0].source_id);
+  ASSERT_EQ(7 * FRAME_NS, decoded.frames[0].pts);
+  ASSERT_EQ((size_t) 2, decoded.frames[0].groups.size());
+  ASSERT_EQ((uint32_t) 5, decoded.frames[0].groups[0].size);
+  ASSERT_EQ(1.5f, decoded.frames[0].groups[0].bbox.left);
+  ASSERT_EQ(2.5f, decoded.frames[0].groups[0].bbox.top);
+  ASSERT_EQ(300.0f, decoded.frames[0].groups[0].bbox.width);
+  ASSERT_EQ(40.0f, decoded.frames[0].groups[0].bbox.height);
+  ASSERT_EQ((uint32_t) 2, decoded.frames[0].groups[1].size);
+  ASSERT_EQ(-1.0f, decoded.frames[0].groups[1].bbox.left);
+  ASSERT_EQ(8, decoded.frames[1].frame_num);
+  ASSERT_TRUE(decoded.frames[1].groups.empty());
+  // truncated, or with anything extra
+  for (size_t size = 0; size < message.size(); size++) {
+    ASSERT_FALSE(BatchGroups::decode(data, size, &decoded)) << size;
+  }
+  message.push_back(0);
+  data = (const uint8_t*) message.data();
+  ASSERT_FALSE(BatchGroups::decode(data, message.size(), &decoded));
+}
+
+// Tests ProtoPayloadFilter attaches the groups in their own Payload
+TEST(GroupDistanceFilterTest, TestPayload) {
+  DistanceFilter filter;
+  filter.find_groups = true;
+  ProtoPayloadFilter payload_filter;
+  auto buf = Replay::make_buffer(make_batch(5));
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+  ASSERT_EQ(GST_FLOW_OK, payload_filter.on_buffer(buf));
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  const uint32_t subscription = ProtoPayloadFilter::GROUPS_SUBSCRIPTION;
+  size_t found = 0;
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    auto user_meta = (NvDsUserMeta*) l->data;
+    if (user_meta->base_meta.meta_type != NVDS_PAYLOAD_META) {
+      continue;
+    }
+    auto payload = (Payload*) user_meta->user_meta_data;
+    if (payload->subscription() != subscription) {
+      continue;
+    }
+    found++;
+    BatchGroups groups;
+    ASSERT_TRUE(BatchGroups::decode(payload->data(), payload->size(),
+                                    &groups));
+    ASSERT_EQ((size_t) 1, groups.frames.size());
+    ASSERT_EQ(5, groups.frames[0].frame_num);
+    ASSERT_EQ((size_t) 2, groups.frames[0].groups.size());
+    ASSERT_EQ((uint32_t) 5, groups.frames[0].groups[0].size);
+    ASSERT_EQ(240.0f, groups.frames[0].groups[0].bbox.width);
+  }
+  ASSERT_EQ((size_t) 1, found);
+  gst_buffer_unref(buf);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,161 @@
+#include "DistanceFilter.hpp"  // DF_USER_BATCH_META
+#include "MetaDispatcher.hpp"
+#include "PayloadBroker.hpp"
+#include "ProtoPayloadFilter.hpp"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of buffers pushed through the dispatcher
+const int NUM_BUFFERS = 10;
+
+/**
+ * Broker which counts what it receives.
+ */
+class CountingBroker : public PayloadBroker {
+public:
+  virtual bool on_batch_payload(Payload* payload) {
+    dp::Batch batch;
+    if (!batch.ParseFromArray(payload->data(), payload->size())) {
+      return false;
+    }
+    frames += batch.frames_size();
+    payloads++;
+    return true;
+  }
+  int payloads = 0;
+  int frames = 0;
+};
+
+/**
+ * Handler for a made up meta type, which counts what it sees and, if asked
+ * to, prepends more meta of that type (to the front of the list), up to
+ * `depth` generations. If `alternate`, every other generation is appended
+ * instead.
+ */
+class PrependingHandler : public UserMetaHandler {
+public:
+  explicit PrependingHandler(intptr_t depth, bool alternate = false) :
+    depth_(depth), alternate_(alternate) {}
+  virtual std::vector<NvDsMetaType> user_meta_types() {
+    resolved++;
+    return {nvds_get_user_meta_type((gchar*)"LIBDISTANCE.TEST.META")};
+  }
+  virtual bool on_user_meta(NvDsBatchMeta* batch_meta,
+                            NvDsUserMeta* user_meta) {
+    seen++;
+    // the generation is stored in place of the data
+    auto generation = (intptr_t) user_meta->user_meta_data;
+    if (generation < depth_) {
+      auto added = nvds_acquire_user_meta_from_pool(batch_meta);
+      added->base_meta.meta_type = user_meta->base_meta.meta_type;
+      added->user_meta_data = (void*) (generation + 1);
+      if (alternate_ && generation % 2) {
+        nvds_add_user_meta_to_batch(batch_meta, added);
+      } else {
+        batch_meta->batch_user_meta_list = g_list_prepend(
+          batch_meta->batch_user_meta_list, added);
+      }
+    }
+    return true;
+  }
+  int resolved = 0;
+  int seen = 0;
+private:
+  intptr_t depth_;
+  bool alternate_;
+};
+
+/**
+ * A buffer with batch metadata holding `batch` as DF_USER_BATCH_META and a
+ * user meta of `extra_type`.
+ */
+static GstBuffer*
+make_buffer(dp::Batch* batch, NvDsMetaType extra_type) {
+  auto batch_meta = nvds_create_batch_meta(1);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  auto user_meta = nvds_acquire_user_meta_from_pool(batch_meta);
+  user_meta->base_meta.meta_type = DF_USER_BATCH_META;
+  user_meta->user_meta_data = (void*) batch;
+  nvds_add_user_meta_to_batch(batch_meta, user_meta);
+  user_meta = nvds_acquire_user_meta_from_pool(batch_meta);
+  user_meta->base_meta.meta_type = extra_type;
+  user_meta->user_meta_data = nullptr;
+  nvds_add_user_meta_to_batch(batch_meta, user_meta);
+  return buf;
+}
+
+// Tests one pass feeds a filter, the brokers downstream of it and anything
+// else registered.
+TEST(MetaDispatcherTest, TestDispatch) {
+  ProtoPayloadFilter filter;
+  Subscription none;
+  none.source_ids = {42};
+  CountingBroker full, filtered;
+  filtered.set_subscription(filter.subscribe(none));
+  PrependingHandler handler(1);
+  PrependingHandler other(0);
+
+  MetaDispatcher dispatcher;
+  // producers first, so their payloads reach the brokers in the same pass
+  dispatcher.add(&filter);
+  dispatcher.add(&full);
+  dispatcher.add(&filtered);
+  dispatcher.add(&handler);
+  dispatcher.add(&other);
+  ASSERT_EQ(1, handler.resolved);
+
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  frame->set_source_id(1);
+  frame->add_people()->set_is_danger(true);
+  for (int i = 0; i < NUM_BUFFERS; i++) {
+    auto buf = make_buffer(&batch, handler.user_meta_types()[0]);
+    ASSERT_EQ(GST_FLOW_OK, dispatcher.on_buffer(buf));
+    gst_buffer_unref(buf);
+  }
+  ASSERT_EQ(NUM_BUFFERS, full.payloads);
+  ASSERT_EQ(NUM_BUFFERS, full.frames);
+  ASSERT_EQ(0, filtered.payloads);
+  // the original meta and the one prepended in the pass
+  ASSERT_EQ(2 * NUM_BUFFERS, handler.seen);
+  ASSERT_EQ(2 * NUM_BUFFERS, other.seen);
+  // never resolved again by the dispatcher
+  ASSERT_EQ(1 + NUM_BUFFERS, handler.resolved);
+}
+
+// Tests meta attached by the handlers of attached meta is dispatched too,
+// wherever in the list it goes.
+TEST(MetaDispatcherTest, TestAttachChain) {
+  const intptr_t DEPTH = 5;
+  PrependingHandler prepending(DEPTH);
+  PrependingHandler alternating(DEPTH, true);
+  for (auto handler : {&prepending, &alternating}) {
+    MetaDispatcher dispatcher;
+    dispatcher.add(handler);
+    dp::Batch batch;
+    auto buf = make_buffer(&batch, handler->user_meta_types()[0]);
+    ASSERT_EQ(GST_FLOW_OK, dispatcher.on_buffer(buf));
+    gst_buffer_unref(buf);
+    // the original meta and one per generation
+    ASSERT_EQ(1 + DEPTH, handler->seen);
+  }
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+#include "BaseFilter.hpp"
+#include "ObjectSnapshot.hpp"
+
+#include "gtest/gtest.h"
+
+namespace ds {
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 4;
+
+/**
+ * Batch metadata where frame f has f + 1 objects, alternating class 0 and 1.
+ */
+static NvDsBatchMeta*
+make_batch_meta() {
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+    frame_meta->batch_id = f;
+    frame_meta->source_id = 10 + f;
+    nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+    for (int o = 0; o <= f; o++) {
+      auto obj_meta = nvds_acquire_obj_meta_from_pool(batch_meta);
+      obj_meta->class_id = o % 2;
+      obj_meta->object_id = 100 * f + o;
+      obj_meta->confidence = 0.5f;
+      obj_meta->rect_params.left = o;
+      obj_meta->rect_params.top = f;
+      obj_meta->rect_params.width = 10.0f;
+      obj_meta->rect_params.height = 20.0f;
+      nvds_add_obj_meta_to_frame(frame_meta, obj_meta, nullptr);
+    }
+  }
+  return batch_meta;
+}
+
+/**
+ * Filter which moves every object right, through the snapshot.
+ */
+class ShiftFilter : public BaseFilter {
+public:
+  void shift(NvDsBatchMeta* batch_meta) {
+    const auto& snap = snapshot(batch_meta);
+    for (size_t i = 0; i < snap.size(); i++) {
+      snap.objects[i]->rect_params.left = snap.left[i] + 1.0f;
+    }
+  }
+  const ObjectSnapshot& get_snapshot() { return snapshot_; }
+};
+
+// Tests the columns match the metadata
+TEST(ObjectSnapshotTest, TestBuild) {
+  auto batch_meta = make_batch_meta();
+  ObjectSnapshot snap;
+  snap.build(batch_meta);
+  ASSERT_EQ(BATCH_SIZE, snap.num_frames());
+  ASSERT_EQ(BATCH_SIZE * (BATCH_SIZE + 1) / 2, snap.size());
+  ASSERT_EQ(BATCH_SIZE + 1, snap.frame_begin.size());
+  for (size_t f = 0; f < snap.num_frames(); f++) {
+    ASSERT_EQ(f + 1, snap.frame_begin[f + 1] - snap.frame_begin[f]);
+    for (auto i = snap.frame_begin[f]; i < snap.frame_begin[f + 1]; i++) {
+      auto o = i - snap.frame_begin[f];
+      ASSERT_EQ(f, snap.frame_index[i]);
+      ASSERT_EQ(10 + f, snap.source_id[i]);
+      ASSERT_EQ(o % 2, snap.class_id[i]);
+      ASSERT_EQ(100 * f + o, snap.object_id[i]);
+      ASSERT_EQ(o, snap.left[i]);
+      ASSERT_EQ(f, snap.top[i]);
+      ASSERT_EQ(10.0f, snap.width[i]);
+      ASSERT_EQ(20.0f, snap.height[i]);
+      ASSERT_EQ(0.5f, snap.confidence[i]);
+      ASSERT_EQ(snap.object_id[i], snap.objects[i]->object_id);
+    }
+    ASSERT_EQ(10 + f, snap.frames[f]->source_id);
+  }
+
+  // only one class, but every frame is kept
+  snap.build(batch_meta, 1);
+  ASSERT_EQ(BATCH_SIZE, snap.num_frames());
+  ASSERT_EQ(0 + 1 + 1 + 2, snap.size());
+  for (size_t i = 0; i < snap.size(); i++) {
+    ASSERT_EQ(1, snap.class_id[i]);
+  }
+  ASSERT_EQ(0, snap.frame_begin[1] - snap.frame_begin[0]);
+
+  snap.build(nullptr);
+  ASSERT_EQ(0, snap.size());
+  ASSERT_EQ(1, snap.frame_begin.size());
+  nvds_destroy_batch_meta(batch_meta);
+}
+
+// Tests storage is reused and write back through BaseFilter
+TEST(ObjectSnapshotTest, TestReuseAndWriteBack) {
+  ShiftFilter filter;
+  auto batch_meta = make_batch_meta();
+  filter.shift(batch_meta);
+  auto left = filter.get_snapshot().left.data();
+  auto objects = filter.get_snapshot().objects.data();
+  nvds_destroy_batch_meta(batch_meta);
+
+  // same size batch, so no reallocation
+  batch_meta = make_batch_meta();
+  filter.shift(batch_meta);
+  ASSERT_EQ(left, filter.get_snapshot().left.data());
+  ASSERT_EQ(objects, filter.get_snapshot().objects.data());
+  for (auto obj : filter.get_snapshot().objects) {
+    ASSERT_EQ(obj->object_id % 100 + 1.0f, obj->rect_params.left);
+  }
+  nvds_destroy_batch_meta(batch_meta);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,276 @@
+#include "DistanceFilter.hpp"
+#include "PackedBatch.hpp"
+#include "ProtoPayloadFilter.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <string>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// frames per batch
+const int BATCH_SIZE = 4;
+// people per frame
+const int NUM_PEOPLE = 6;
+
+/**
+ * A buffer with BATCH_SIZE frames of NUM_PEOPLE people (some close enough
+ * to be dangerous) and one object of another class per frame.
+ */
+static GstBuffer*
+make_buffer() {
+  auto batch_meta = nvds_create_batch_meta(BATCH_SIZE);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  for (int f = 0; f < BATCH_SIZE; f++) {
+    auto frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+    frame_meta->batch_id = f;
+    frame_meta->source_id = f;
+    frame_meta->frame_num = 7 + f;
+    frame_meta->buf_pts = 1000 * f;
+    frame_meta->ntp_timestamp = 2000 * f;
+    nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+    for (int o = 0; o <= NUM_PEOPLE; o++) {
+      auto obj_meta = nvds_acquire_obj_meta_from_pool(batch_meta);
+      obj_meta->class_id = o == NUM_PEOPLE ? 2 : 0;
+      obj_meta->rect_params.left = o * (f + 1) * 40.0f;
+      obj_meta->rect_params.top = 100.0f;
+      obj_meta->rect_params.width = 50.0f;
+      obj_meta->rect_params.height = 150.0f;
+      nvds_add_obj_meta_to_frame(frame_meta, obj_meta, nullptr);
+    }
+  }
+  return buf;
+}
+
+/**
+ * Find the first batch level user meta of `type`.
+ */
+static NvDsUserMeta*
+find_user_meta(GstBuffer* buf, NvDsMetaType type) {
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    auto user_meta = (NvDsUserMeta*) l->data;
+    if (user_meta->base_meta.meta_type == type) {
+      return user_meta;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * A PackedBatch with two frames, one of them empty, and 9 people (so the
+ * bitset spills into a second byte).
+ */
+static void
+make_packed(PackedBatch* batch) {
+  batch->clear();
+  batch->set_max_frames(4);
+  auto frame = batch->add_frame();
+  frame->frame_num = -3;
+  frame->source_id = 2;
+  frame->pts = 1ull << 40;
+  frame = batch->add_frame();
+  frame->frame_num = 9;
+  frame->dts = 12345;
+  frame->sum_danger = 4.5f;
+  for (int p = 0; p < 9; p++) {
+    batch->add_person(p * 10.0f, 1.0f, 2.0f, 3.0f, p * 0.5f, p % 4 == 0);
+  }
+}
+
+// Tests building and converting a PackedBatch
+TEST(PackedBatchTest, TestBuild) {
+  PackedBatch batch;
+  make_packed(&batch);
+  ASSERT_EQ(2, batch.frames_size());
+  ASSERT_EQ(9, batch.people_size());
+  ASSERT_EQ(0, batch.frame(0).num_people);
+  ASSERT_EQ(9, batch.frame(1).num_people);
+  ASSERT_EQ(0, batch.frame(1).first_person);
+  ASSERT_EQ(80.0f, batch.left(batch.frame(1))[8]);
+  ASSERT_TRUE(batch.is_danger(batch.frame(1), 8));
+  ASSERT_FALSE(batch.is_danger(batch.frame(1), 7));
+
+  auto proto = batch.materialize();
+  ASSERT_EQ(proto, batch.materialize());
+  ASSERT_EQ(4, proto->max_frames());
+  ASSERT_EQ(-3, proto->frames(0).frame_num());
+  ASSERT_EQ(0, proto->frames(0).people_size());
+  ASSERT_EQ(9, proto->frames(1).people_size());
+  ASSERT_EQ(30.0f, proto->frames(1).people(3).bbox().left());
+  ASSERT_TRUE(proto->frames(1).people(4).is_danger());
+
+  // and back again
+  PackedBatch again;
+  again.from_proto(*proto);
+  dp::Batch proto_again;
+  again.to_proto(&proto_again);
+  ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    *proto, proto_again));
+
+  // copies don't share the materialized Batch
+  PackedBatch copy(batch);
+  ASSERT_NE(proto, copy.materialize());
+}
+
+// Tests serializing and parsing a PackedBatch
+TEST(PackedBatchTest, TestWire) {
+  PackedBatch batch;
+  make_packed(&batch);
+  std::string bytes;
+  batch.serialize(&bytes);
+  ASSERT_EQ(batch.byte_size(), bytes.size());
+
+  PackedBatch parsed;
+  ASSERT_TRUE(parsed.parse((const uint8_t*) bytes.data(), bytes.size()));
+  dp::Batch expected;
+  batch.to_proto(&expected);
+  dp::Batch actual;
+  parsed.to_proto(&actual);
+  ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    expected, actual)) << actual.DebugString();
+
+  // the bitset is the last field of the last frame: people 0, 4 and 8
+  ASSERT_EQ('\x11', bytes[bytes.size() - 2]);
+  ASSERT_EQ('\x01', bytes[bytes.size() - 1]);
+
+  // an empty batch is no bytes at all
+  PackedBatch empty;
+  ASSERT_EQ(0, empty.byte_size());
+  ASSERT_TRUE(parsed.parse(nullptr, 0));
+  ASSERT_EQ(0, parsed.frames_size());
+
+  // data truncated anywhere but between fields doesn't parse
+  // (max_frames is 2 bytes, and the first frame is short enough that its
+  // size is 1 byte)
+  size_t first_frame_end = 2 + 2 + bytes[3];
+  for (size_t size = 1; size < bytes.size(); size++) {
+    bool boundary = size == 2 || size == first_frame_end;
+    ASSERT_EQ(boundary,
+      parsed.parse((const uint8_t*) bytes.data(), size)) << size;
+  }
+}
+
+// Tests uids survive the wire, and cost nothing when there are none
+TEST(PackedBatchTest, TestUid) {
+  PackedBatch batch;
+  make_packed(&batch);
+  size_t without = batch.byte_size();
+  auto frame = batch.add_frame();
+  frame->frame_num = 10;
+  batch.add_person(1.0f, 2.0f, 3.0f, 4.0f, 0.0f, false, 42);
+  batch.add_person(1.0f, 2.0f, 3.0f, 4.0f, 0.0f, false, 0);
+  batch.add_person(1.0f, 2.0f, 3.0f, 4.0f, 0.0f, false, -1);
+  std::string bytes;
+  batch.serialize(&bytes);
+  ASSERT_EQ(batch.byte_size(), bytes.size());
+  // frame tag and size, frame_num, 5 float columns, the bitset, then the
+  // uid column: tag, size, 42, 0 and -1 (10 bytes)
+  ASSERT_EQ(without + 2 + 2 + 5 * (2 + 3 * 4) + 3 + 2 + 1 + 1 + 10,
+            bytes.size());
+
+  PackedBatch parsed;
+  ASSERT_TRUE(parsed.parse((const uint8_t*) bytes.data(), bytes.size()));
+  ASSERT_EQ(3, parsed.frames_size());
+  ASSERT_EQ(0, parsed.uid(parsed.frame(1))[8]);
+  const int32_t* uids = parsed.uid(parsed.frame(2));
+  ASSERT_EQ(42, uids[0]);
+  ASSERT_EQ(0, uids[1]);
+  ASSERT_EQ(-1, uids[2]);
+  dp::Batch proto;
+  parsed.to_proto(&proto);
+  ASSERT_EQ(42, proto.frames(2).people(0).uid());
+  ASSERT_EQ(-1, proto.frames(2).people(2).uid());
+  PackedBatch again;
+  again.from_proto(proto);
+  ASSERT_EQ(-1, again.uid(again.frame(2))[2]);
+}
+
+// Tests the packed encoding is smaller than the nested one
+TEST(PackedBatchTest, TestSize) {
+  DistanceFilter filter;
+  auto buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+  auto batch = (dp::Batch*)
+    find_user_meta(buf, DF_USER_BATCH_META)->user_meta_data;
+  PackedBatch packed;
+  packed.from_proto(*batch);
+  ASSERT_LT(packed.byte_size(), batch->ByteSizeLong());
+  gst_buffer_unref(buf);
+}
+
+// Tests DistanceFilter's packed meta converts to the same Batch, and
+// ProtoPayloadFilter emits it columnar
+TEST(PackedBatchTest, TestFilters) {
+  DistanceFilter filter;
+  auto proto_buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(proto_buf));
+  filter.packed_meta = true;
+  filter.compact_meta = true;
+  auto packed_buf = make_buffer();
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(packed_buf));
+
+  // packed wins over compact
+  ASSERT_EQ(nullptr, find_user_meta(packed_buf, DF_USER_BATCH_META));
+  ASSERT_EQ(nullptr, find_user_meta(packed_buf, DF_USER_COMPACT_BATCH_META));
+  auto proto_meta = find_user_meta(proto_buf, DF_USER_BATCH_META);
+  auto packed_meta = find_user_meta(packed_buf, DF_USER_PACKED_BATCH_META);
+  ASSERT_NE(nullptr, proto_meta);
+  ASSERT_NE(nullptr, packed_meta);
+  auto expected = (dp::Batch*) proto_meta->user_meta_data;
+  auto packed = (PackedBatch*) packed_meta->user_meta_data;
+  ASSERT_EQ(BATCH_SIZE, packed->frames_size());
+  ASSERT_EQ(BATCH_SIZE * NUM_PEOPLE, packed->people_size());
+  ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    *expected, *packed->materialize()));
+
+  ProtoPayloadFilter payloads;
+  payloads.encoding = ProtoPayloadFilter::columnar;
+  ASSERT_EQ(GST_FLOW_OK, payloads.on_buffer(packed_buf));
+  auto payload_meta = find_user_meta(packed_buf, NVDS_PAYLOAD_META);
+  ASSERT_NE(nullptr, payload_meta);
+  auto payload = (Payload*) payload_meta->user_meta_data;
+  PackedBatch parsed;
+  ASSERT_TRUE(parsed.parse(payload->data(), payload->size()));
+  ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+    *expected, *parsed.materialize()));
+  // written straight from the PackedBatch
+  std::string bytes;
+  packed->serialize(&bytes);
+  ASSERT_EQ(bytes, std::string((const char*) payload->data(), payload->size()));
+
+  // and the same when serialized later, from a copy
+  ProtoPayloadFilter lazy_payloads(ProtoPayloadFilter::lazy);
+  lazy_payloads.encoding = ProtoPayloadFilter::columnar;
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(packed_buf);
+  ASSERT_TRUE(lazy_payloads.on_user_meta(batch_meta, packed_meta));
+  auto last = batch_meta->batch_user_meta_list;
+  while (last->next != nullptr) {
+    last = last->next;
+  }
+  auto lazy_meta = (NvDsUserMeta*) last->data;
+  ASSERT_NE(payload_meta, lazy_meta);
+  auto lazy_payload = (Payload*) lazy_meta->user_meta_data;
+  ASSERT_EQ(bytes, std::string(
+    (const char*) lazy_payload->data(), lazy_payload->size()));
+
+  gst_buffer_unref(proto_buf);
+  gst_buffer_unref(packed_buf);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,179 @@
+#include "Payload.hpp"
+#include "distance.pb.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// A PayloadProducer which counts how many times it has been called
+class CountingProducer : public PayloadProducer {
+ public:
+  explicit CountingProducer(std::atomic<int>* count) : count_(count) {}
+  bool produce(Payload* payload) override {
+    count_->fetch_add(1);
+    payload->reserve(3000);
+    memset(payload->mutable_data(), 'x', 3000);
+    return true;
+  }
+ private:
+  std::atomic<int>* count_;
+};
+
+// The fixture for testing class PayloadPool.
+class PayloadPoolTest : public ::testing::Test {
+ protected:
+  PayloadPool pool_;
+};
+
+// Tests that a Payload has the requested size and a size class capacity
+TEST_F(PayloadPoolTest, TestAcquire) {
+  auto payload = pool_.acquire(1500);
+  ASSERT_EQ(1500, payload->size());
+  ASSERT_EQ(2048, payload->capacity());
+  payload->unref();
+}
+
+// Tests that released Payloads are reused for the same size class
+TEST_F(PayloadPoolTest, TestRecycle) {
+  auto first = pool_.acquire(100);
+  const uint8_t* data = first->data();
+  first->unref();
+  auto second = pool_.acquire(1000);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(data, second->data());
+  ASSERT_EQ(1000, second->size());
+  second->unref();
+}
+
+// Tests that growing a Payload trades buffers with the pool, so both size
+// classes are stocked again after, and neither allocates the next time
+TEST_F(PayloadPoolTest, TestReserve) {
+  auto payload = pool_.acquire(0);
+  const uint8_t* small = payload->data();
+  payload->unref();
+  payload = pool_.acquire(0);
+  payload->reserve(5000);
+  ASSERT_EQ(5000, payload->size());
+  ASSERT_EQ(8192, payload->capacity());
+  const uint8_t* big = payload->data();
+  payload->unref();
+  auto first = pool_.acquire(100);
+  ASSERT_EQ(small, first->data());
+  auto second = pool_.acquire(6000);
+  ASSERT_EQ(big, second->data());
+  first->unref();
+  second->unref();
+}
+
+// Tests that a Payload isn't recycled until the last reference is gone
+TEST_F(PayloadPoolTest, TestRefcount) {
+  auto payload = pool_.acquire(100);
+  auto copy = payload->ref();
+  ASSERT_EQ(payload, copy);
+  payload->unref();
+  auto other = pool_.acquire(100);
+  ASSERT_NE(copy, other);
+  copy->unref();
+  other->unref();
+}
+
+// Tests that oversized Payloads work (they aren't pooled)
+TEST_F(PayloadPoolTest, TestOversize) {
+  auto payload = pool_.acquire(PayloadPool::MAX_CLASS_SIZE + 1);
+  ASSERT_EQ(PayloadPool::MAX_CLASS_SIZE + 1, payload->capacity());
+  payload->unref();
+}
+
+// Tests concurrent ref/unref from several threads
+TEST_F(PayloadPoolTest, TestThreads) {
+  auto payload = pool_.acquire(100);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([payload]() {
+      for (int j = 0; j < 10000; j++) {
+        payload->ref()->unref();
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  payload->unref();
+}
+
+// Tests a Batch round trips through a Payload
+TEST_F(PayloadPoolTest, TestBatch) {
+  dp::Batch batch;
+  batch.set_max_frames(4);
+  batch.add_frames()->set_sum_danger(1.5f);
+  auto payload = pool_.acquire(batch.ByteSizeLong());
+  batch.SerializeWithCachedSizesToArray(payload->mutable_data());
+  dp::Batch parsed;
+  ASSERT_TRUE(parsed.ParseFromArray(payload->data(), payload->size()));
+  ASSERT_EQ(4, parsed.max_frames());
+  ASSERT_EQ(1.5f, parsed.frames(0).sum_danger());
+  payload->unref();
+}
+
+// Tests a pending Payload is produced once, on first read
+TEST_F(PayloadPoolTest, TestPending) {
+  std::atomic<int> count(0);
+  auto payload = pool_.acquire_pending(
+    std::unique_ptr<PayloadProducer>(new CountingProducer(&count)));
+  ASSERT_FALSE(payload->is_ready());
+  ASSERT_EQ(0, count.load());
+  ASSERT_EQ(3000, payload->size());
+  ASSERT_EQ('x', payload->data()[2999]);
+  ASSERT_TRUE(payload->is_ready());
+  ASSERT_TRUE(payload->resolve());
+  ASSERT_EQ(1, count.load());
+  payload->unref();
+}
+
+// Tests a pending Payload nobody reads is never produced
+TEST_F(PayloadPoolTest, TestPendingUnread) {
+  std::atomic<int> count(0);
+  auto payload = pool_.acquire_pending(
+    std::unique_ptr<PayloadProducer>(new CountingProducer(&count)));
+  payload->ref()->unref();
+  payload->unref();
+  ASSERT_EQ(0, count.load());
+  // and the recycled Payload comes back ready
+  payload = pool_.acquire(10);
+  ASSERT_TRUE(payload->is_ready());
+  payload->unref();
+}
+
+// Tests concurrent readers of a pending Payload all see the same bytes
+TEST_F(PayloadPoolTest, TestPendingThreads) {
+  std::atomic<int> count(0);
+  auto payload = pool_.acquire_pending(
+    std::unique_ptr<PayloadProducer>(new CountingProducer(&count)));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([payload]() {
+      ASSERT_EQ(3000, payload->size());
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(1, count.load());
+  payload->unref();
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
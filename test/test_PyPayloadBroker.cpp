@@ -0,0 +1,123 @@
+#include "PyPayloadBroker.hpp"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace ds {
+namespace {
+
+const size_t SLOTS = 4;
+// number of payloads pushed in the threaded test
+const guint64 NUM_PAYLOADS = 1000;
+
+// The fixture for testing class PyPayloadBroker.
+class PyPayloadBrokerTest : public ::testing::Test {
+ protected:
+  PyPayloadBrokerTest() : broker_(SLOTS) {}
+
+  /**
+   * Push a payload holding a single byte.
+   */
+  void push(uint8_t value) {
+    auto payload = pool_.acquire(1);
+    payload->mutable_data()[0] = value;
+    broker_.on_batch_payload(payload);
+    payload->unref();
+  }
+
+  PayloadPool pool_;
+  PyPayloadBroker broker_;
+};
+
+// Tests an empty broker
+TEST_F(PyPayloadBrokerTest, TestEmpty) {
+  ASSERT_EQ(0, broker_.latest_seq());
+  ASSERT_EQ(nullptr, broker_.get_payload());
+  ASSERT_EQ(nullptr, broker_.borrow());
+  ASSERT_EQ(0, broker_.wait_for_next(0, 10));
+}
+
+// Tests borrowing the latest payload and by sequence number
+TEST_F(PyPayloadBrokerTest, TestBorrow) {
+  push(1);
+  push(2);
+  ASSERT_EQ(2, broker_.latest_seq());
+  auto latest = broker_.borrow();
+  ASSERT_EQ(2, latest->data()[0]);
+  auto first = broker_.borrow(1);
+  ASSERT_EQ(1, first->data()[0]);
+  // a borrowed payload stays valid after it's overwritten
+  for (int i = 0; i < 10; i++) {
+    push(3);
+  }
+  ASSERT_EQ(nullptr, broker_.borrow(1));
+  ASSERT_EQ(1, first->data()[0]);
+  PyPayloadBroker::release(first);
+  PyPayloadBroker::release(latest);
+}
+
+// Tests get_since returns missed payloads in order and counts lost ones
+TEST_F(PyPayloadBrokerTest, TestGetSince) {
+  for (uint8_t i = 1; i <= 6; i++) {
+    push(i);
+  }
+  std::vector<PyPayloadBroker::Entry> entries;
+  // 1 and 2 were overwritten
+  ASSERT_EQ(2, broker_.get_since(0, &entries));
+  ASSERT_EQ(SLOTS, entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    ASSERT_EQ(i + 3, entries[i].seq);
+    ASSERT_EQ(i + 3, entries[i].payload->data()[0]);
+    PyPayloadBroker::release(entries[i].payload);
+  }
+  entries.clear();
+  ASSERT_EQ(0, broker_.get_since(5, &entries));
+  ASSERT_EQ(1, entries.size());
+  ASSERT_EQ(6, entries[0].seq);
+  PyPayloadBroker::release(entries[0].payload);
+  entries.clear();
+  ASSERT_EQ(0, broker_.get_since(6, &entries));
+  ASSERT_TRUE(entries.empty());
+}
+
+// Tests a reader blocking on wait_for_next sees every payload
+TEST_F(PyPayloadBrokerTest, TestWaitForNext) {
+  std::thread reader([this]() {
+    guint64 seq = 0;
+    guint64 seen = 0;
+    while (seq < NUM_PAYLOADS) {
+      seq = broker_.wait_for_next(seq);
+      std::vector<PyPayloadBroker::Entry> entries;
+      seen += broker_.get_since(seen, &entries);
+      for (auto& entry : entries) {
+        ASSERT_EQ(seen + 1, entry.seq);
+        seen = entry.seq;
+        PyPayloadBroker::release(entry.payload);
+      }
+    }
+    ASSERT_EQ(NUM_PAYLOADS, seen);
+  });
+  for (guint64 i = 0; i < NUM_PAYLOADS; i++) {
+    push(i & 0xFF);
+  }
+  reader.join();
+}
+
+// Tests the legacy copying accessor
+TEST_F(PyPayloadBrokerTest, TestGetPayload) {
+  push('x');
+  gchararray copy = broker_.get_payload();
+  ASSERT_STREQ("x", copy);
+  free(copy);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,177 @@
+#include "DistanceFilter.hpp"
+#include "FileMetaBroker.hpp"
+#include "ProtoPayloadFilter.hpp"
+#include "Replay.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/util/message_differencer.h>
+
+#include <experimental/filesystem>
+#include <fstream>
+
+namespace fs = std::experimental::filesystem;
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of batches to replay
+const int NUM_BATCHES = 20;
+// sources per batch
+const int BATCH_SIZE = 4;
+
+static bool
+equals(const dp::Batch& a, const dp::Batch& b) {
+  return google::protobuf::util::MessageDifferencer::Equals(a, b);
+}
+
+/**
+ * Record NUM_BATCHES synthetic batches with a FileMetaBroker and read them
+ * back with a FileReplaySource.
+ */
+static void
+check_file(FileMetaBroker::Format format) {
+  auto tmp = fs::temp_directory_path() / "replaytest";
+  fs::create_directories(tmp);
+  std::vector<dp::Batch> expected(NUM_BATCHES);
+  FileMetaBroker broker((tmp / "metadata").string(), format);
+  SyntheticReplaySource source(NUM_BATCHES, BATCH_SIZE);
+  broker.start();
+  for (auto& batch : expected) {
+    ASSERT_TRUE(source.next(&batch));
+    broker.on_batch_meta(nullptr, &batch);
+  }
+  broker.stop();
+
+  FileReplaySource replayed(broker.get_filename());
+  ASSERT_TRUE(replayed.is_open());
+  dp::Batch batch;
+  for (const auto& e : expected) {
+    ASSERT_TRUE(replayed.next(&batch));
+    ASSERT_TRUE(equals(e, batch)) << batch.DebugString();
+  }
+  ASSERT_FALSE(replayed.next(&batch));
+  fs::remove_all(tmp);
+}
+
+// Tests the same seed makes the same crowds
+TEST(ReplayTest, TestSynthetic) {
+  SyntheticReplaySource a(3, BATCH_SIZE, 10, 30.0, 42);
+  SyntheticReplaySource b(3, BATCH_SIZE, 10, 30.0, 42);
+  dp::Batch batch_a;
+  dp::Batch batch_b;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(a.next(&batch_a));
+    ASSERT_TRUE(b.next(&batch_b));
+    ASSERT_TRUE(equals(batch_a, batch_b));
+    ASSERT_EQ(BATCH_SIZE, batch_a.frames_size());
+    ASSERT_EQ(i * 33333333ull, batch_a.frames(0).pts());
+  }
+  ASSERT_FALSE(a.next(&batch_a));
+}
+
+// Tests reading back FileMetaBroker's proto output
+TEST(ReplayTest, TestCoded) {
+  check_file(FileMetaBroker::proto);
+}
+
+// Tests reading back FileMetaBroker's packed output
+TEST(ReplayTest, TestPacked) {
+  check_file(FileMetaBroker::packed);
+}
+
+// Tests proto files recorded without max_frames are split by source
+TEST(ReplayTest, TestCodedWithoutMaxFrames) {
+  auto path = fs::temp_directory_path() / "replaytest_legacy.coded";
+  SyntheticReplaySource source(NUM_BATCHES, BATCH_SIZE);
+  std::vector<dp::Batch> expected(NUM_BATCHES);
+  {
+    std::ofstream out(path.string(), std::ios::binary);
+    uint32_t magic = FileMetaBroker::PROTO_MAGIC_NUMBER;
+    out.write((const char*) &magic, sizeof(magic));
+    for (auto& batch : expected) {
+      ASSERT_TRUE(source.next(&batch));
+      batch.clear_max_frames();
+      out << batch.SerializeAsString();
+    }
+  }
+  FileReplaySource replayed(path.string());
+  dp::Batch batch;
+  for (const auto& e : expected) {
+    ASSERT_TRUE(replayed.next(&batch));
+    ASSERT_TRUE(equals(e, batch));
+  }
+  ASSERT_FALSE(replayed.next(&batch));
+  fs::remove(path);
+}
+
+// Tests replaying through DistanceFilter and ProtoPayloadFilter
+TEST(ReplayTest, TestRun) {
+  SyntheticReplaySource source(NUM_BATCHES, BATCH_SIZE, 10);
+  Replay replay(&source);
+  DistanceFilter distance;
+  ProtoPayloadFilter payload;
+  replay.add_stage("distance", &distance);
+  replay.add_stage("payload", &payload);
+  auto report = replay.run();
+  ASSERT_EQ(NUM_BATCHES, report.batches);
+  ASSERT_EQ(NUM_BATCHES * BATCH_SIZE, report.frames);
+  ASSERT_EQ(2, report.stages.size());
+  ASSERT_EQ("distance", report.stages[0].name);
+  for (const auto& stats : report.stages) {
+    ASSERT_EQ(NUM_BATCHES, stats.count);
+    ASSERT_LE(stats.p50_us, stats.p99_us);
+    ASSERT_LE(stats.p99_us, stats.max_us);
+  }
+  ASSERT_EQ(NUM_BATCHES, report.total.count);
+  report.print(stdout);
+
+  // the metadata DistanceFilter sees is what was replayed
+  SyntheticReplaySource again(1, BATCH_SIZE, 10);
+  dp::Batch batch;
+  ASSERT_TRUE(again.next(&batch));
+  auto buf = Replay::make_buffer(batch);
+  ASSERT_EQ(GST_FLOW_OK, distance.on_buffer(buf));
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  NvDsUserMeta* user_meta = nullptr;
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    user_meta = (NvDsUserMeta*) l->data;
+  }
+  ASSERT_NE(nullptr, user_meta);
+  auto result = (dp::Batch*) user_meta->user_meta_data;
+  ASSERT_EQ(batch.frames_size(), result->frames_size());
+  for (int f = 0; f < batch.frames_size(); f++) {
+    ASSERT_EQ(batch.frames(f).source_id(), result->frames(f).source_id());
+    ASSERT_EQ(batch.frames(f).pts(), result->frames(f).pts());
+    ASSERT_EQ(batch.frames(f).people_size(), result->frames(f).people_size());
+  }
+  gst_buffer_unref(buf);
+}
+
+// Tests recorded pacing waits for each batch
+TEST(ReplayTest, TestRecorded) {
+  // 5 batches at 100 fps is 40ms from the first to the last
+  SyntheticReplaySource source(5, 1, 1, 100.0);
+  Replay replay(&source, Replay::recorded);
+  auto report = replay.run();
+  ASSERT_EQ(5, report.batches);
+  ASSERT_LE(0.04, report.seconds);
+  // twice as fast
+  SyntheticReplaySource faster(5, 1, 1, 100.0);
+  Replay fast_replay(&faster, Replay::recorded);
+  fast_replay.speed = 2.0;
+  report = fast_replay.run();
+  ASSERT_LE(0.02, report.seconds);
+  ASSERT_GT(0.04, report.seconds);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,195 @@
+#include "RoiMask.hpp"
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+#include "ViolationTracker.hpp"
+#include "test_helpers.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// 1080p, 8 pixel cells
+const uint32_t COLS = 240;
+const uint32_t ROWS = 135;
+
+// A 1080p mask without the top 200 pixels, but for a gap in the middle
+const char* TEXT =
+  "# a comment\n"
+  "source 3 1920 1080\n"
+  "\n"
+  "exclude 0,0 1920,0 1920,200 0,200  # the sky\n"
+  "include 800,0 1100,0 1100,200 800,200\n";
+
+// A frame of people `spacing` pixels apart, close enough to be dangerous
+dp::Batch
+make_batch(int num_people, float spacing = 50.0f, float first = 0.0f) {
+  dp::Batch batch;
+  add_frame(&batch, 0, num_people, first, spacing);
+  return batch;
+}
+
+// Run `batch` through `filter`, returning a copy of its Batch and the events
+// a ViolationTracker makes of it
+dp::Batch
+filter_batch(DistanceFilter* filter, const dp::Batch& batch,
+             std::vector<ViolationEvent>* events) {
+  dp::Batch result = filter_batch(filter, batch);
+  ViolationTracker tracker;
+  tracker.min_duration = 0;
+  tracker.update(result, events);
+  return result;
+}
+
+// Tests an empty mask includes everything
+TEST(RoiMaskTest, TestEmpty) {
+  RoiMask mask;
+  ASSERT_TRUE(mask.contains(0.0f, 0.0f));
+  ASSERT_TRUE(mask.contains(-1e30f, 1e30f));
+  ASSERT_EQ((size_t) 0, mask.count());
+  ASSERT_EQ((size_t) 0, mask.byte_size());
+}
+
+// Tests polygons are rasterized by cell center, in order
+TEST(RoiMaskTest, TestFill) {
+  RoiMask mask(1920, 1080);
+  ASSERT_EQ(COLS, mask.cols());
+  ASSERT_EQ(ROWS, mask.rows());
+  ASSERT_EQ((size_t) (COLS * ROWS), mask.count());
+  // four 64 bit words per row
+  ASSERT_EQ((size_t) (4 * ROWS * 8), mask.byte_size());
+  // rows with centers above 200 (4 ... 196) go
+  mask.exclude({{0, 0}, {1920, 0}, {1920, 200}, {0, 200}});
+  ASSERT_EQ((size_t) (COLS * (ROWS - 25)), mask.count());
+  ASSERT_FALSE(mask.contains(100.0f, 100.0f));
+  ASSERT_FALSE(mask.contains(100.0f, 199.0f));
+  ASSERT_TRUE(mask.contains(100.0f, 200.0f));
+  // columns with centers from 804 to 1092 come back
+  mask.include({{800, 0}, {1100, 0}, {1100, 200}, {800, 200}});
+  ASSERT_EQ((size_t) (COLS * (ROWS - 25) + 37 * 25), mask.count());
+  ASSERT_FALSE(mask.contains(799.0f, 100.0f));
+  ASSERT_TRUE(mask.contains(800.0f, 100.0f));
+  ASSERT_TRUE(mask.contains(1095.0f, 100.0f));
+  ASSERT_FALSE(mask.contains(1096.0f, 100.0f));
+  // a triangle covers about half of its bounding box
+  mask.fill_all(false);
+  ASSERT_EQ((size_t) 0, mask.count());
+  mask.include({{0, 0}, {800, 0}, {0, 800}});
+  ASSERT_NEAR(100 * 100 / 2, (double) mask.count(), 100);
+  ASSERT_TRUE(mask.contains(10.0f, 10.0f));
+  ASSERT_FALSE(mask.contains(500.0f, 500.0f));
+  // degenerate polygons do nothing
+  mask.exclude({{0, 0}, {800, 800}});
+  ASSERT_TRUE(mask.contains(10.0f, 10.0f));
+}
+
+// Tests points off the frame count as the nearest cell
+TEST(RoiMaskTest, TestClamp) {
+  RoiMask mask(1920, 1080);
+  mask.exclude({{0, 0}, {1920, 0}, {1920, 200}, {0, 200}});
+  ASSERT_TRUE(mask.contains(-5.0f, 5000.0f));
+  ASSERT_FALSE(mask.contains(1e30f, -1.0f));
+  ASSERT_FALSE(mask.contains(1920.0f, 0.0f));
+  ASSERT_TRUE(mask.contains(1919.0f, 1079.0f));
+  ASSERT_TRUE(mask.contains_feet(0.0f, 100.0f, 40.0f, 100.0f));
+  ASSERT_FALSE(mask.contains_feet(0.0f, 0.0f, 40.0f, 100.0f));
+}
+
+// Tests masks parse, and bad ones don't
+TEST(RoiMaskTest, TestParse) {
+  RoiMasks masks;
+  ASSERT_TRUE(RoiMask::parse(TEXT, &masks));
+  ASSERT_EQ((size_t) 1, masks.size());
+  const RoiMask& mask = masks[3];
+  ASSERT_EQ((uint32_t) RoiMask::DEFAULT_CELL_SIZE, mask.cell_size());
+  ASSERT_EQ((size_t) (COLS * (ROWS - 25) + 37 * 25), mask.count());
+  ASSERT_TRUE(RoiMask::parse("source 0 640 480 16\nsource 1 640 480", &masks));
+  ASSERT_EQ((size_t) 2, masks.size());
+  ASSERT_EQ((uint32_t) 40, masks[0].cols());
+  ASSERT_EQ((uint32_t) 80, masks[1].cols());
+  for (auto bad : {
+      "exclude 0,0 1,0 1,1",
+      "source 0 640",
+      "source 0 640 0",
+      "source 0 640 480\nexclude 0,0 1,0",
+      "source 0 640 480\nexclude 0,0 1,0 1;1",
+      "source 0 640 480\nexclude 0,0 1,0 1,",
+      "source 0 640 480\nsquiggle 0,0 1,0 1,1"}) {
+    ASSERT_FALSE(RoiMask::parse(bad, &masks)) << bad;
+  }
+}
+
+// Tests masks load from a file
+TEST(RoiMaskTest, TestLoad) {
+  std::string filename = "test_RoiMask.roi";
+  {
+    std::ofstream out(filename);
+    out << TEXT;
+  }
+  RoiMasks masks;
+  ASSERT_TRUE(RoiMask::load(filename, &masks));
+  ASSERT_EQ((size_t) 1, masks.count(3));
+  std::remove(filename.c_str());
+  ASSERT_FALSE(RoiMask::load(filename, &masks));
+}
+
+// Tests DistanceFilter leaves out people outside a source's roi entirely
+TEST(RoiDistanceFilterTest, TestExclude) {
+  DistanceFilter filter;
+  // four people in a row, the first with their feet off to the left
+  dp::Batch batch = make_batch(4);
+  batch.add_frames()->CopyFrom(batch.frames(0));
+  batch.mutable_frames(1)->set_source_id(1);
+  RoiMask mask(1920, 1080);
+  mask.exclude({{0, 0}, {50, 0}, {50, 1080}, {0, 1080}});
+  filter.set_roi(0, mask);
+  std::vector<ViolationEvent> events;
+  auto actual = filter_batch(&filter, batch, &events);
+  // as if the first person wasn't there
+  DistanceFilter unmasked;
+  auto shifted = make_batch(3, 50.0f, 50.0f);
+  for (int p = 0; p < 3; p++) {
+    // with the same object ids
+    shifted.mutable_frames(0)->mutable_people(p)->set_uid(p + 1);
+  }
+  auto expected = filter_batch(&unmasked, shifted);
+  ASSERT_EQ(3, actual.frames(0).people_size());
+  ASSERT_FLOAT_EQ(expected.frames(0).sum_danger(),
+                  actual.frames(0).sum_danger());
+  for (int p = 0; p < 3; p++) {
+    ASSERT_EQ(expected.frames(0).people(p).SerializeAsString(),
+              actual.frames(0).people(p).SerializeAsString());
+  }
+  // the other source has no mask
+  ASSERT_EQ(4, actual.frames(1).people_size());
+  // only the middle of the three is in violation, and keeps its object id
+  std::vector<uint64_t> object_ids;
+  for (const auto& event : events) {
+    if (event.source_id == 0) {
+      object_ids.push_back(event.object_id);
+    }
+  }
+  ASSERT_EQ(std::vector<uint64_t>({2}), object_ids);
+  // and without it, everybody is back
+  filter.clear_roi(0);
+  actual = filter_batch(&filter, batch);
+  ASSERT_EQ(4, actual.frames(0).people_size());
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
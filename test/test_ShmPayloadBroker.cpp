@@ -0,0 +1,273 @@
+#include "ShmPayloadBroker.hpp"
+#include "ShmPayloadReader.hpp"
+#include "shm_payload_reader.h"
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ds {
+namespace {
+
+// shared memory object name for the tests
+const char* SHM_NAME = "/shmpayloadbrokertest";
+// ring size
+const uint32_t SLOT_COUNT = 64;
+// size of each test payload
+const size_t PAYLOAD_SIZE = 4096;
+// number of payloads in the multi process test (throughput is measured by
+// bench_shm)
+const uint64_t NUM_PAYLOADS = 20000;
+// number of reader processes in the multi process test
+const int NUM_READERS = 3;
+
+/**
+ * Fill a payload with a pattern derived from its sequence number.
+ */
+static void
+fill(Payload* payload, uint64_t seq) {
+  uint8_t* data = payload->mutable_data();
+  memcpy(data, &seq, sizeof(seq));
+  for (size_t i = sizeof(seq); i < payload->size(); i++) {
+    data[i] = (uint8_t)(seq + i);
+  }
+}
+
+/**
+ * Check a payload has the pattern for its sequence number.
+ */
+static bool
+check(const uint8_t* data, size_t size, uint64_t seq) {
+  if (size != PAYLOAD_SIZE || memcmp(data, &seq, sizeof(seq)) != 0) {
+    return false;
+  }
+  for (size_t i = sizeof(seq); i < size; i++) {
+    if (data[i] != (uint8_t)(seq + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Reader results, sent back to the test process through a pipe.
+ */
+struct ReaderStats {
+  uint64_t received;
+  uint64_t missed;
+  uint64_t corrupt;
+};
+
+/**
+ * Read (zero copy) until the writer closes the ring.
+ */
+static ReaderStats
+read_all() {
+  ReaderStats stats = {0, 0, 0};
+  ShmPayloadReader reader;
+  while (!reader.open(SHM_NAME)) {
+    usleep(1000);
+  }
+  uint64_t next = 1;
+  while (true) {
+    uint64_t latest = reader.wait_for_next(next - 1, 100);
+    if (latest < next) {
+      if (reader.writer_closed()) {
+        break;
+      }
+      continue;
+    }
+    for (; next <= latest; next++) {
+      const uint8_t* data;
+      size_t size;
+      uint64_t token;
+      auto status = reader.peek(next, &data, &size, &token);
+      bool good = status == ShmPayloadReader::ok && check(data, size, next);
+      if (status == ShmPayloadReader::ok && reader.validate(next, token)) {
+        stats.received++;
+        stats.corrupt += good ? 0 : 1;
+      } else {
+        // fell behind, skip to what's still there
+        uint64_t oldest = reader.oldest_seq();
+        stats.missed += oldest > next ? oldest - next : 1;
+        next = oldest > next ? oldest - 1 : next;
+      }
+    }
+  }
+  return stats;
+}
+
+// Tests publishing and reading back in one process
+TEST(ShmPayloadBrokerTest, TestRoundTrip) {
+  PayloadPool pool;
+  ShmPayloadBroker broker(SHM_NAME, 4, PAYLOAD_SIZE);
+  broker.start();
+  ASSERT_TRUE(broker.is_open());
+  ShmPayloadReader reader;
+  ASSERT_TRUE(reader.open(SHM_NAME));
+  ASSERT_EQ(0, reader.latest_seq());
+  std::string out;
+  ASSERT_EQ(ShmPayloadReader::again, reader.read(1, &out));
+  for (uint64_t seq = 1; seq <= 6; seq++) {
+    auto payload = pool.acquire(PAYLOAD_SIZE);
+    fill(payload, seq);
+    ASSERT_TRUE(broker.on_batch_payload(payload));
+    payload->unref();
+  }
+  ASSERT_EQ(6, reader.latest_seq());
+  ASSERT_EQ(ShmPayloadReader::gone, reader.read(2, &out));
+  ASSERT_EQ(ShmPayloadReader::ok, reader.read(6, &out));
+  ASSERT_TRUE(check((const uint8_t*)out.data(), out.size(), 6));
+  // too big
+  auto big = pool.acquire(PAYLOAD_SIZE + 1);
+  ASSERT_FALSE(broker.on_batch_payload(big));
+  big->unref();
+  ASSERT_EQ(1, reader.dropped());
+  ASSERT_FALSE(reader.writer_closed());
+  broker.stop();
+  ASSERT_TRUE(reader.writer_closed());
+  // still readable after the writer is gone
+  ASSERT_EQ(ShmPayloadReader::ok, reader.read(5, &out));
+}
+
+// Tests the segment is owner only unless asked otherwise
+TEST(ShmPayloadBrokerTest, TestMode) {
+  struct stat st;
+  {
+    ShmPayloadBroker broker(SHM_NAME, 4, PAYLOAD_SIZE);
+    broker.start();
+    int fd = shm_open(SHM_NAME, O_RDONLY, 0);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(0, fstat(fd, &st));
+    close(fd);
+    ASSERT_EQ((mode_t)(S_IRUSR | S_IWUSR), st.st_mode & 0777);
+  }
+  ShmPayloadBroker broker(SHM_NAME, 4, PAYLOAD_SIZE, 0640);
+  broker.start();
+  int fd = shm_open(SHM_NAME, O_RDONLY, 0);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(0, fstat(fd, &st));
+  close(fd);
+  ASSERT_EQ((mode_t)0640, st.st_mode & 0777);
+}
+
+// Tests the C read refuses to truncate
+TEST(ShmPayloadBrokerTest, TestReadTooSmall) {
+  PayloadPool pool;
+  ShmPayloadBroker broker(SHM_NAME, 4, PAYLOAD_SIZE);
+  broker.start();
+  auto payload = pool.acquire(PAYLOAD_SIZE);
+  fill(payload, 1);
+  ASSERT_TRUE(broker.on_batch_payload(payload));
+  payload->unref();
+  auto reader = ds_shm_reader_open(SHM_NAME);
+  ASSERT_NE(nullptr, reader);
+  std::vector<uint8_t> buf(PAYLOAD_SIZE);
+  size_t size = 0;
+  ASSERT_EQ(DS_SHM_TOO_SMALL,
+    ds_shm_reader_read(reader, 1, buf.data(), PAYLOAD_SIZE - 1, &size));
+  ASSERT_EQ(PAYLOAD_SIZE, size);
+  ASSERT_EQ(DS_SHM_OK,
+    ds_shm_reader_read(reader, 1, buf.data(), buf.size(), &size));
+  ASSERT_TRUE(check(buf.data(), size, 1));
+  ds_shm_reader_close(reader);
+}
+
+// Tests a sleeping reader is woken, and the waiter count is balanced
+TEST(ShmPayloadBrokerTest, TestWake) {
+  PayloadPool pool;
+  ShmPayloadBroker broker(SHM_NAME, 4, PAYLOAD_SIZE);
+  broker.start();
+  ShmPayloadReader reader;
+  ASSERT_TRUE(reader.open(SHM_NAME));
+  int fd = shm_open(SHM_NAME, O_RDONLY, 0);
+  ASSERT_NE(-1, fd);
+  auto header = (ShmRingHeader*) mmap(nullptr, sizeof(ShmRingHeader),
+                                      PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(MAP_FAILED, (void*)header);
+  ASSERT_EQ(0, header->waiters.load());
+  // nobody waiting, nothing to wake
+  auto payload = pool.acquire(PAYLOAD_SIZE);
+  fill(payload, 1);
+  ASSERT_TRUE(broker.on_batch_payload(payload));
+  payload->unref();
+  uint64_t latest = 0;
+  std::thread waiter([&]() {
+    latest = reader.wait_for_next(1);
+  });
+  while (header->waiters.load() == 0) {
+    std::this_thread::yield();
+  }
+  payload = pool.acquire(PAYLOAD_SIZE);
+  fill(payload, 2);
+  ASSERT_TRUE(broker.on_batch_payload(payload));
+  payload->unref();
+  waiter.join();
+  ASSERT_EQ(2, latest);
+  ASSERT_EQ(0, header->waiters.load());
+  munmap(header, sizeof(ShmRingHeader));
+}
+
+// Tests that several reader processes see every payload intact, or know
+// which ones they missed
+TEST(ShmPayloadBrokerTest, TestMultiProcess) {
+  PayloadPool pool;
+  ShmPayloadBroker broker(SHM_NAME, SLOT_COUNT, PAYLOAD_SIZE);
+  broker.start();
+  ASSERT_TRUE(broker.is_open());
+
+  std::vector<pid_t> pids;
+  std::vector<int> pipes;
+  for (int i = 0; i < NUM_READERS; i++) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+      close(fds[0]);
+      ReaderStats stats = read_all();
+      ssize_t written = write(fds[1], &stats, sizeof(stats));
+      _exit(written == sizeof(stats) ? 0 : 1);
+    }
+    close(fds[1]);
+    pids.push_back(pid);
+    pipes.push_back(fds[0]);
+  }
+
+  for (uint64_t seq = 1; seq <= NUM_PAYLOADS; seq++) {
+    auto payload = pool.acquire(PAYLOAD_SIZE);
+    fill(payload, seq);
+    broker.on_batch_payload(payload);
+    payload->unref();
+  }
+  broker.stop();
+
+  for (int i = 0; i < NUM_READERS; i++) {
+    ReaderStats stats;
+    ASSERT_EQ(sizeof(stats), read(pipes[i], &stats, sizeof(stats)));
+    close(pipes[i]);
+    int status;
+    ASSERT_EQ(pids[i], waitpid(pids[i], &status, 0));
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSERT_GT(stats.received, 0);
+    ASSERT_EQ(0, stats.corrupt);
+    ASSERT_EQ(NUM_PAYLOADS, stats.received + stats.missed);
+  }
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,263 @@
+#include "SocketPayloadBroker.hpp"
+
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ds {
+namespace {
+
+// socket path for the tests
+const char* SOCKET_PATH = "/tmp/socketpayloadbrokertest.sock";
+// number of payloads in the round trip test
+const uint64_t NUM_PAYLOADS = 2000;
+// number of subscribers in the round trip test
+const int NUM_SUBSCRIBERS = 3;
+// size of each payload in the slow subscriber tests (fills socket buffers)
+const size_t BIG_PAYLOAD_SIZE = 1 << 16;
+// number of payloads in the slow subscriber tests
+const uint64_t NUM_BIG_PAYLOADS = 200;
+
+/**
+ * Fill a payload with a pattern derived from its sequence number.
+ */
+static void
+fill(Payload* payload, uint64_t seq) {
+  uint8_t* data = payload->mutable_data();
+  memcpy(data, &seq, sizeof(seq));
+  for (size_t i = sizeof(seq); i < payload->size(); i++) {
+    data[i] = (uint8_t)(seq + i);
+  }
+}
+
+/**
+ * Check a payload has the pattern for its sequence number and return it.
+ * Returns 0 if the payload is corrupt.
+ */
+static uint64_t
+check(const std::string& data) {
+  uint64_t seq;
+  if (data.size() < sizeof(seq)) {
+    return 0;
+  }
+  memcpy(&seq, data.data(), sizeof(seq));
+  for (size_t i = sizeof(seq); i < data.size(); i++) {
+    if ((uint8_t) data[i] != (uint8_t)(seq + i)) {
+      return 0;
+    }
+  }
+  return seq;
+}
+
+/**
+ * Publish a payload of `size` bytes with sequence number `seq`.
+ */
+static void
+publish(SocketPayloadBroker* broker, uint64_t seq, size_t size) {
+  auto payload = PayloadPool::get_default()->acquire(size);
+  fill(payload, seq);
+  broker->on_batch_payload(payload);
+  payload->unref();
+}
+
+/**
+ * Connect a (blocking) subscriber. Returns the fd or -1.
+ */
+static int
+subscribe() {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Wait up to a few seconds for the broker to have `count` subscribers.
+ */
+static bool
+wait_for_subscribers(SocketPayloadBroker* broker, size_t count) {
+  for (int i = 0; i < 5000; i++) {
+    if (broker->subscriber_count() == count) {
+      return true;
+    }
+    usleep(1000);
+  }
+  return false;
+}
+
+/**
+ * Read exactly `size` bytes. Returns false on EOF or error.
+ */
+static bool
+read_exact(int fd, void* buf, size_t size) {
+  auto p = (uint8_t*) buf;
+  while (size) {
+    ssize_t r = read(fd, p, size);
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    size -= r;
+  }
+  return true;
+}
+
+/**
+ * Read one length prefixed frame. Returns false on EOF or error.
+ */
+static bool
+read_frame(int fd, std::string* out) {
+  uint8_t h[4];
+  if (!read_exact(fd, h, sizeof(h))) {
+    return false;
+  }
+  size_t size = h[0] | h[1] << 8 | h[2] << 16 | (size_t) h[3] << 24;
+  out->resize(size);
+  return read_exact(fd, &(*out)[0], size);
+}
+
+/**
+ * Read frames until `last` (or EOF), checking they are intact and in order.
+ * Returns the number of frames read, or 0 on any corruption.
+ */
+static uint64_t
+read_until(int fd, uint64_t last) {
+  uint64_t received = 0;
+  uint64_t prev = 0;
+  std::string frame;
+  while (prev != last && read_frame(fd, &frame)) {
+    uint64_t seq = check(frame);
+    if (seq <= prev) {
+      return 0;
+    }
+    prev = seq;
+    received++;
+  }
+  return prev == last ? received : 0;
+}
+
+// Tests every subscriber gets every payload, intact and in order
+TEST(SocketPayloadBrokerTest, TestRoundTrip) {
+  SocketPayloadBroker broker(SOCKET_PATH, NUM_PAYLOADS);
+  broker.start();
+  ASSERT_TRUE(broker.is_running());
+  std::vector<int> fds;
+  for (int i = 0; i < NUM_SUBSCRIBERS; i++) {
+    int fd = subscribe();
+    ASSERT_NE(-1, fd);
+    fds.push_back(fd);
+  }
+  ASSERT_TRUE(wait_for_subscribers(&broker, NUM_SUBSCRIBERS));
+
+  std::vector<uint64_t> received(NUM_SUBSCRIBERS);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < NUM_SUBSCRIBERS; i++) {
+    readers.emplace_back([&fds, &received, i]() {
+      received[i] = read_until(fds[i], NUM_PAYLOADS);
+    });
+  }
+  for (uint64_t seq = 1; seq <= NUM_PAYLOADS; seq++) {
+    // vary the size so frames straddle partial writes
+    publish(&broker, seq, 8 + (seq * 97) % 20000);
+  }
+  for (auto& t : readers) {
+    t.join();
+  }
+  for (int i = 0; i < NUM_SUBSCRIBERS; i++) {
+    ASSERT_EQ(NUM_PAYLOADS, received[i]);
+  }
+  ASSERT_EQ(0, broker.skipped());
+
+  // a subscriber hanging up is noticed
+  close(fds.back());
+  fds.pop_back();
+  ASSERT_TRUE(wait_for_subscribers(&broker, NUM_SUBSCRIBERS - 1));
+  broker.stop();
+  ASSERT_FALSE(broker.is_running());
+  ASSERT_FALSE(broker.on_batch_payload(nullptr));
+  // subscribers see EOF
+  std::string frame;
+  for (int fd : fds) {
+    ASSERT_FALSE(read_frame(fd, &frame));
+    close(fd);
+  }
+}
+
+// Tests a subscriber that doesn't read has frames skipped, not the others
+TEST(SocketPayloadBrokerTest, TestSlowSkip) {
+  SocketPayloadBroker broker(SOCKET_PATH, 4, SocketPayloadBroker::skip_frames);
+  broker.start();
+  int fast = subscribe();
+  int slow = subscribe();
+  ASSERT_NE(-1, fast);
+  ASSERT_NE(-1, slow);
+  ASSERT_TRUE(wait_for_subscribers(&broker, 2));
+
+  uint64_t fast_received = 0;
+  std::thread reader([fast, &fast_received]() {
+    fast_received = read_until(fast, NUM_BIG_PAYLOADS);
+  });
+  for (uint64_t seq = 1; seq <= NUM_BIG_PAYLOADS; seq++) {
+    publish(&broker, seq, BIG_PAYLOAD_SIZE);
+    // give the fast subscriber a chance to keep up
+    usleep(500);
+  }
+  reader.join();
+  ASSERT_LT(0, fast_received);
+  ASSERT_LT(0, broker.skipped());
+  // the slow subscriber is still connected and gets the latest payloads
+  ASSERT_EQ(2, broker.subscriber_count());
+  uint64_t slow_received = read_until(slow, NUM_BIG_PAYLOADS);
+  ASSERT_LT(0, slow_received);
+  ASSERT_GT(NUM_BIG_PAYLOADS, slow_received);
+  ASSERT_EQ(0, broker.disconnected());
+  broker.stop();
+  close(fast);
+  close(slow);
+}
+
+// Tests a subscriber that doesn't read is disconnected
+TEST(SocketPayloadBrokerTest, TestSlowDisconnect) {
+  SocketPayloadBroker broker(SOCKET_PATH, 4, SocketPayloadBroker::drop_client);
+  broker.start();
+  int slow = subscribe();
+  ASSERT_NE(-1, slow);
+  ASSERT_TRUE(wait_for_subscribers(&broker, 1));
+  for (uint64_t seq = 1; seq <= NUM_BIG_PAYLOADS; seq++) {
+    publish(&broker, seq, BIG_PAYLOAD_SIZE);
+  }
+  ASSERT_TRUE(wait_for_subscribers(&broker, 0));
+  ASSERT_EQ(1, broker.disconnected());
+  // what was sent is intact, then EOF
+  std::string frame;
+  uint64_t prev = 0;
+  while (read_frame(slow, &frame)) {
+    uint64_t seq = check(frame);
+    ASSERT_LT(prev, seq);
+    prev = seq;
+  }
+  ASSERT_GT(NUM_BIG_PAYLOADS, prev);
+  broker.stop();
+  close(slow);
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,215 @@
+#include "PackedBatch.hpp"
+#include "PayloadBroker.hpp"
+#include "ProtoPayloadFilter.hpp"
+#include "Subscription.hpp"
+
+#include "gtest/gtest.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// number of sources in the test batch
+const int NUM_SOURCES = 4;
+
+/**
+ * A Batch with one frame per source. Source n has n people, of which the
+ * first n / 2 are dangerous, and a sum_danger of n.
+ */
+static void
+make_batch(dp::Batch* batch) {
+  batch->set_max_frames(NUM_SOURCES);
+  for (int source = 0; source < NUM_SOURCES; source++) {
+    auto frame = batch->add_frames();
+    frame->set_source_id(source);
+    frame->set_frame_num(100 + source);
+    frame->set_sum_danger(source);
+    for (int i = 0; i < source; i++) {
+      auto person = frame->add_people();
+      person->mutable_bbox()->set_left(i);
+      person->set_is_danger(i < source / 2);
+    }
+  }
+}
+
+/**
+ * A buffer with empty batch metadata attached.
+ */
+static GstBuffer*
+make_buffer(NvDsBatchMeta** batch_meta) {
+  *batch_meta = nvds_create_batch_meta(NUM_SOURCES);
+  auto buf = gst_buffer_new();
+  auto meta = gst_buffer_add_nvds_meta(buf, *batch_meta, nullptr,
+    nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  return buf;
+}
+
+/**
+ * Broker which keeps a copy of everything it receives.
+ */
+class TestBroker : public PayloadBroker {
+public:
+  virtual bool on_batch_payload(Payload* payload) {
+    batches.emplace_back();
+    return batches.back().ParseFromArray(payload->data(), payload->size());
+  }
+  std::vector<dp::Batch> batches;
+};
+
+// Tests frame and person level filtering
+TEST(SubscriptionTest, TestApply) {
+  dp::Batch batch, out;
+  make_batch(&batch);
+
+  Subscription all;
+  ASSERT_TRUE(all.is_passthrough());
+  ASSERT_TRUE(all.apply(batch, &out));
+  ASSERT_EQ(batch.SerializeAsString(), out.SerializeAsString());
+
+  Subscription sources;
+  sources.source_ids = {1, 3, 7};
+  ASSERT_FALSE(sources.is_passthrough());
+  ASSERT_TRUE(sources.apply(batch, &out));
+  ASSERT_EQ(NUM_SOURCES, out.max_frames());
+  ASSERT_EQ(2, out.frames_size());
+  ASSERT_EQ(1, out.frames(0).source_id());
+  ASSERT_EQ(3, out.frames(1).source_id());
+  ASSERT_EQ(3, out.frames(1).people_size());
+
+  Subscription danger;
+  danger.min_sum_danger = 2.0f;
+  danger.danger_only = true;
+  ASSERT_TRUE(danger.apply(batch, &out));
+  ASSERT_EQ(2, out.frames_size());
+  for (const auto& frame : out.frames()) {
+    ASSERT_LE(2.0f, frame.sum_danger());
+    ASSERT_EQ(frame.source_id() / 2, frame.people_size());
+    for (int i = 0; i < frame.people_size(); i++) {
+      ASSERT_TRUE(frame.people(i).is_danger());
+      // order is kept
+      ASSERT_EQ(i, frame.people(i).bbox().left());
+    }
+  }
+
+  Subscription none;
+  none.source_ids = {42};
+  ASSERT_FALSE(none.apply(batch, &out));
+  ASSERT_EQ(0, out.frames_size());
+}
+
+// Tests brokers only get payloads for their subscription, and nothing when
+// nothing matches.
+TEST(SubscriptionTest, TestFilterAndBroker) {
+  ProtoPayloadFilter filter;
+  Subscription sources;
+  sources.source_ids = {2};
+  Subscription nothing;
+  nothing.source_ids = {42};
+  auto sources_id = filter.subscribe(sources);
+  auto nothing_id = filter.subscribe(nothing);
+  ASSERT_NE(0, sources_id);
+  ASSERT_NE(0, nothing_id);
+  ASSERT_NE(sources_id, nothing_id);
+  // same subscription, same id
+  ASSERT_EQ(sources_id, filter.subscribe(sources));
+  ASSERT_EQ(0, filter.subscribe(Subscription()));
+
+  TestBroker full, filtered, empty;
+  filtered.set_subscription(sources_id);
+  empty.set_subscription(nothing_id);
+
+  dp::Batch batch;
+  make_batch(&batch);
+  NvDsBatchMeta* batch_meta;
+  auto buf = make_buffer(&batch_meta);
+  ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+  full.on_buffer(buf);
+  filtered.on_buffer(buf);
+  empty.on_buffer(buf);
+
+  ASSERT_EQ(1, full.batches.size());
+  ASSERT_EQ(NUM_SOURCES, full.batches[0].frames_size());
+  ASSERT_EQ(1, filtered.batches.size());
+  ASSERT_EQ(1, filtered.batches[0].frames_size());
+  ASSERT_EQ(2, filtered.batches[0].frames(0).source_id());
+  ASSERT_EQ(0, empty.batches.size());
+
+  // once fully unsubscribed, it's no longer evaluated
+  filter.unsubscribe(sources_id);
+  filter.unsubscribe(sources_id);
+  filter.set_unfiltered(false);
+  gst_buffer_unref(buf);
+  buf = make_buffer(&batch_meta);
+  ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+  full.on_buffer(buf);
+  filtered.on_buffer(buf);
+  empty.on_buffer(buf);
+  ASSERT_EQ(1, full.batches.size());
+  ASSERT_EQ(1, filtered.batches.size());
+  ASSERT_EQ(0, empty.batches.size());
+
+  gst_buffer_unref(buf);
+}
+
+// Tests deferred serialization gets the same Batches as sync, from a Batch
+// or a PackedBatch, with filtered Batches handed over to the producers
+TEST(SubscriptionTest, TestDeferred) {
+  dp::Batch batch;
+  make_batch(&batch);
+  PackedBatch packed;
+  packed.from_proto(batch);
+  Subscription sources;
+  sources.source_ids = {1, 2};
+  auto serializations = {
+    ProtoPayloadFilter::sync, ProtoPayloadFilter::async,
+    ProtoPayloadFilter::lazy,
+  };
+  std::vector<dp::Batch> expected;
+  for (auto serialization : serializations) {
+    ProtoPayloadFilter filter(serialization);
+    TestBroker full, filtered;
+    filtered.set_subscription(filter.subscribe(sources));
+    for (int i = 0; i < 4; i++) {
+      NvDsBatchMeta* batch_meta;
+      auto buf = make_buffer(&batch_meta);
+      if (i % 2) {
+        ASSERT_TRUE(filter.on_packed_meta(batch_meta, &packed));
+      } else {
+        ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+      }
+      full.on_buffer(buf);
+      filtered.on_buffer(buf);
+      gst_buffer_unref(buf);
+    }
+    ASSERT_EQ(4, full.batches.size());
+    ASSERT_EQ(4, filtered.batches.size());
+    if (serialization == ProtoPayloadFilter::sync) {
+      expected = full.batches;
+      expected.insert(expected.end(),
+        filtered.batches.begin(), filtered.batches.end());
+      ASSERT_EQ(2, filtered.batches[3].frames_size());
+      continue;
+    }
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+        expected[i], full.batches[i]));
+      ASSERT_TRUE(google::protobuf::util::MessageDifferencer::Equals(
+        expected[4 + i], filtered.batches[i]));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
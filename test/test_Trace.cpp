@@ -0,0 +1,120 @@
+// trace points are compiled out unless this is defined
+#define DS_TRACING
+#include "Trace.hpp"
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace ds {
+namespace {
+
+// Count the occurrences of `needle` in `haystack`
+size_t
+count(const std::string& haystack, const std::string& needle) {
+  size_t found = 0;
+  for (size_t pos = haystack.find(needle); pos != std::string::npos;
+       pos = haystack.find(needle, pos + needle.size())) {
+    found++;
+  }
+  return found;
+}
+
+std::string
+json() {
+  std::stringstream out;
+  trace::write_json(out);
+  return out.str();
+}
+
+// Tests that every kind of trace point ends up in the json
+TEST(TraceTest, TestRecord) {
+  trace::clear();
+  {
+    DS_TRACE_SCOPE("scope");
+    DS_TRACE_BEGIN("span");
+    DS_TRACE_INSTANT("instant");
+    DS_TRACE_COUNTER("counter", 42);
+    DS_TRACE_END("span");
+  }
+  auto out = json();
+  ASSERT_EQ(0, out.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+  ASSERT_EQ(1, count(out, "{\"name\":\"scope\",\"ph\":\"X\""));
+  ASSERT_EQ(1, count(out, "{\"name\":\"span\",\"ph\":\"B\""));
+  ASSERT_EQ(1, count(out, "{\"name\":\"span\",\"ph\":\"E\""));
+  ASSERT_EQ(1, count(out, "{\"name\":\"instant\",\"ph\":\"i\""));
+  ASSERT_EQ(1, count(out, "{\"name\":\"counter\",\"ph\":\"C\""));
+  ASSERT_EQ(1, count(out, "\"args\":{\"value\":42}"));
+  ASSERT_EQ(1, count(out, "\"dur\":"));
+}
+
+// Tests that clear() forgets what has been recorded
+TEST(TraceTest, TestClear) {
+  DS_TRACE_INSTANT("forgotten");
+  trace::clear();
+  DS_TRACE_INSTANT("remembered");
+  auto out = json();
+  ASSERT_EQ(0, count(out, "forgotten"));
+  ASSERT_EQ(1, count(out, "remembered"));
+}
+
+// Tests that events from other threads are kept, even after they exit, and
+// are told apart by thread id
+TEST(TraceTest, TestThreads) {
+  trace::clear();
+  auto work = []() {
+    for (int i = 0; i < 100; i++) {
+      DS_TRACE_SCOPE("worker");
+    }
+  };
+  std::thread first(work);
+  std::thread second(work);
+  first.join();
+  second.join();
+  DS_TRACE_INSTANT("main");
+  auto out = json();
+  ASSERT_EQ(200, count(out, "\"worker\""));
+  ASSERT_EQ(1, count(out, "\"main\""));
+  // each ring is written out in one go, so there are three runs of tids
+  std::string last_tid;
+  size_t tids = 0;
+  for (size_t pos = out.find("\"tid\":"); pos != std::string::npos;
+       pos = out.find("\"tid\":", pos + 1)) {
+    auto tid = out.substr(pos, out.find(',', pos) - pos);
+    if (tid != last_tid) {
+      tids++;
+      last_tid = tid;
+    }
+  }
+  ASSERT_EQ(3, tids);
+}
+
+// Tests that a full ring keeps the newest events (less the one slot a
+// writer could be overwriting)
+TEST(TraceTest, TestOverflow) {
+  trace::clear();
+  DS_TRACE_INSTANT("oldest");
+  for (size_t i = 0; i < trace::Ring::CAPACITY; i++) {
+    DS_TRACE_INSTANT("newer");
+  }
+  auto out = json();
+  ASSERT_EQ(0, count(out, "oldest"));
+  ASSERT_EQ(trace::Ring::CAPACITY - 1, count(out, "newer"));
+}
+
+// Tests that names are escaped
+TEST(TraceTest, TestEscape) {
+  trace::clear();
+  DS_TRACE_INSTANT("a \"quoted\\\" name");
+  ASSERT_EQ(1, count(json(), "\"a \\\"quoted\\\\\\\" name\""));
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,360 @@
+#include "ViolationTracker.hpp"
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+#include "ViolationEventFilter.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <vector>
+
+namespace dp = distanceproto;
+
+namespace ds {
+namespace {
+
+// 10 fps, in ns
+const uint64_t FRAME_NS = 100000000ull;
+
+ViolationTracker::Sighting
+sighting(uint64_t object_id, float danger_val) {
+  ViolationTracker::Sighting s = {object_id, danger_val, 1.0f, 2.0f, 3.0f, 4.0f};
+  return s;
+}
+
+size_t
+num_user_meta(NvDsBatchMeta* batch_meta) {
+  size_t count = 0;
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    count++;
+  }
+  return count;
+}
+
+// The fixture for testing class ViolationTracker.
+class ViolationTrackerTest : public ::testing::Test {
+ protected:
+  ViolationTrackerTest() {
+    tracker_.min_duration = 3 * FRAME_NS;
+    tracker_.update_interval = 0;
+    tracker_.idle_timeout = 10 * FRAME_NS;
+  }
+
+  // feed one sighting per frame for `dangers`, starting at frame `first`
+  void feed(uint64_t object_id, const std::vector<float>& dangers,
+            uint64_t first = 0) {
+    for (size_t i = 0; i < dangers.size(); i++) {
+      auto s = sighting(object_id, dangers[i]);
+      tracker_.update(0, (first + i) * FRAME_NS, &s, 1, &events_);
+    }
+  }
+
+  ViolationTracker tracker_;
+  std::vector<ViolationEvent> events_;
+};
+
+// Tests a violation starts once it has lasted min_duration and ends once it
+// has been over for min_duration
+TEST_F(ViolationTrackerTest, TestStartEnd) {
+  feed(7, {0.0f, 1.5f, 1.2f, 1.9f});
+  ASSERT_TRUE(events_.empty());
+  feed(7, {1.1f}, 4);
+  ASSERT_EQ(1, events_.size());
+  ASSERT_EQ(ViolationEvent::start, events_[0].kind);
+  ASSERT_EQ(7, events_[0].object_id);
+  ASSERT_EQ(1 * FRAME_NS, events_[0].start_pts);
+  ASSERT_EQ(4 * FRAME_NS, events_[0].pts);
+  ASSERT_FLOAT_EQ(1.9f, events_[0].peak_danger);
+  ASSERT_FLOAT_EQ(1.1f, events_[0].danger_val);
+  // below exit_danger from frame 5
+  feed(7, {0.1f, 0.1f, 0.1f}, 5);
+  ASSERT_EQ(1, events_.size());
+  feed(7, {0.1f}, 8);
+  ASSERT_EQ(2, events_.size());
+  ASSERT_EQ(ViolationEvent::end, events_[1].kind);
+  ASSERT_EQ(1 * FRAME_NS, events_[1].start_pts);
+  ASSERT_EQ(5 * FRAME_NS, events_[1].pts);
+  ASSERT_EQ(0, tracker_.num_tracks());
+}
+
+// Tests blips shorter than min_duration, and dips between the thresholds,
+// make no events
+TEST_F(ViolationTrackerTest, TestDebounce) {
+  feed(1, {1.5f, 1.5f, 0.1f, 0.1f, 1.5f, 0.1f});
+  ASSERT_TRUE(events_.empty());
+  ASSERT_EQ(0, tracker_.num_tracks());
+  // 0.9 is between exit and enter danger, so it stays in violation
+  feed(1, {1.5f, 1.5f, 1.5f, 1.5f, 0.9f, 0.9f, 0.9f, 0.9f, 0.9f}, 10);
+  ASSERT_EQ(1, events_.size());
+  ASSERT_EQ(ViolationEvent::start, events_[0].kind);
+  // short dips below exit don't end it
+  feed(1, {0.1f, 0.1f, 1.5f, 0.1f, 1.5f}, 19);
+  ASSERT_EQ(1, events_.size());
+}
+
+// Tests a violation only starts if danger_val stays at enter_danger, not just
+// above exit_danger, for min_duration
+TEST_F(ViolationTrackerTest, TestEnter) {
+  // 0.9 is between exit and enter danger
+  feed(1, {1.5f, 0.9f, 0.9f, 0.9f, 0.9f, 0.9f});
+  ASSERT_TRUE(events_.empty());
+  ASSERT_EQ(0, tracker_.num_tracks());
+  // starting over after the dip
+  feed(1, {1.5f, 1.5f, 1.5f, 0.9f, 1.5f, 1.5f, 1.5f}, 6);
+  ASSERT_TRUE(events_.empty());
+  feed(1, {1.5f}, 13);
+  ASSERT_EQ(1, events_.size());
+  ASSERT_EQ(10 * FRAME_NS, events_[0].start_pts);
+}
+
+// Tests updates are sent every update_interval
+TEST_F(ViolationTrackerTest, TestUpdate) {
+  tracker_.update_interval = 5 * FRAME_NS;
+  feed(1, std::vector<float>(20, 1.5f));
+  ASSERT_EQ(4, events_.size());
+  ASSERT_EQ(ViolationEvent::start, events_[0].kind);
+  for (size_t i = 1; i < events_.size(); i++) {
+    ASSERT_EQ(ViolationEvent::update, events_[i].kind);
+    ASSERT_EQ(events_[i - 1].pts + 5 * FRAME_NS, events_[i].pts);
+    ASSERT_EQ(0, events_[i].start_pts);
+  }
+}
+
+// Tests people who aren't seen for idle_timeout are ended
+TEST_F(ViolationTrackerTest, TestIdle) {
+  feed(1, {1.5f, 1.5f, 1.5f, 1.5f});
+  ASSERT_EQ(1, events_.size());
+  // somebody else keeps the source going
+  for (uint64_t f = 4; f < 20; f++) {
+    tracker_.update(0, f * FRAME_NS, nullptr, 0, &events_);
+  }
+  ASSERT_EQ(2, events_.size());
+  ASSERT_EQ(ViolationEvent::end, events_[1].kind);
+  ASSERT_EQ(3 * FRAME_NS, events_[1].pts);
+  ASSERT_EQ(0, tracker_.num_tracks());
+}
+
+// Tests people are ended when their source stops sending frames, by the
+// frames of other sources
+TEST_F(ViolationTrackerTest, TestExpire) {
+  feed(1, {1.5f, 1.5f, 1.5f, 1.5f});
+  ASSERT_EQ(1, events_.size());
+  // frames from behind don't underflow
+  tracker_.expire(0, &events_);
+  tracker_.expire(12 * FRAME_NS, &events_);
+  ASSERT_EQ(1, events_.size());
+  // only another source has frames from here on
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  frame->set_source_id(1);
+  frame->set_pts(13 * FRAME_NS);
+  tracker_.update(batch, &events_);
+  ASSERT_EQ(2, events_.size());
+  ASSERT_EQ(ViolationEvent::end, events_[1].kind);
+  ASSERT_EQ(0, events_[1].source_id);
+  ASSERT_EQ(3 * FRAME_NS, events_[1].pts);
+  ASSERT_EQ(0, tracker_.num_tracks());
+}
+
+// Tests memory per source is bounded and sources are independent
+TEST_F(ViolationTrackerTest, TestMaxTracks) {
+  tracker_.max_tracks = 4;
+  tracker_.min_duration = 0;
+  std::vector<ViolationTracker::Sighting> crowd;
+  for (uint64_t id = 0; id < 10; id++) {
+    crowd.push_back(sighting(id, 1.5f));
+    tracker_.update(0, id * FRAME_NS, &crowd.back(), 1, &events_);
+  }
+  ASSERT_EQ(4, tracker_.num_tracks());
+  // each evicted person was ended
+  size_t starts = 0, ends = 0;
+  for (const auto& event : events_) {
+    (event.kind == ViolationEvent::start ? starts : ends)++;
+  }
+  ASSERT_EQ(10, starts);
+  ASSERT_EQ(6, ends);
+  tracker_.update(1, 0, crowd.data(), 4, &events_);
+  ASSERT_EQ(8, tracker_.num_tracks());
+  events_.clear();
+  tracker_.flush(&events_);
+  ASSERT_EQ(8, events_.size());
+  ASSERT_EQ(0, tracker_.num_tracks());
+}
+
+// Tests events survive an encode/decode round trip
+TEST_F(ViolationTrackerTest, TestEncode) {
+  tracker_.update_interval = 2 * FRAME_NS;
+  feed(1, {1.5f, 1.5f, 1.5f, 2.5f, 1.5f, 1.5f, 0.1f, 0.1f, 0.1f, 0.1f});
+  ASSERT_LE(3, events_.size());
+  std::string message;
+  ViolationTracker::encode(events_, &message);
+  auto data = (const uint8_t*) message.data();
+  ASSERT_TRUE(ViolationTracker::is_event_message(data, message.size()));
+  std::vector<ViolationEvent> decoded;
+  ASSERT_TRUE(ViolationTracker::decode(data, message.size(), &decoded));
+  ASSERT_EQ(events_.size(), decoded.size());
+  for (size_t i = 0; i < events_.size(); i++) {
+    ASSERT_EQ(events_[i].kind, decoded[i].kind);
+    ASSERT_EQ(events_[i].source_id, decoded[i].source_id);
+    ASSERT_EQ(events_[i].object_id, decoded[i].object_id);
+    ASSERT_EQ(events_[i].start_pts, decoded[i].start_pts);
+    ASSERT_EQ(events_[i].pts, decoded[i].pts);
+    ASSERT_EQ(events_[i].danger_val, decoded[i].danger_val);
+    ASSERT_EQ(events_[i].peak_danger, decoded[i].peak_danger);
+    ASSERT_EQ(events_[i].height, decoded[i].height);
+  }
+  // every truncation is caught
+  for (size_t size = 0; size < message.size(); size++) {
+    ASSERT_FALSE(ViolationTracker::decode(data, size, &decoded));
+  }
+}
+
+// Tests people are keyed on uid, and untracked people are left out
+TEST_F(ViolationTrackerTest, TestBatch) {
+  tracker_.min_duration = 0;
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  frame->set_source_id(3);
+  frame->set_pts(FRAME_NS);
+  frame->add_people()->set_danger_val(1.5f);
+  auto person = frame->add_people();
+  person->set_uid(101);
+  person->set_danger_val(1.5f);
+  person->mutable_bbox()->set_left(42.0f);
+  person = frame->add_people();
+  person->set_uid(-2);
+  person->set_danger_val(0.1f);
+  tracker_.update(batch, &events_);
+  ASSERT_EQ(1, events_.size());
+  ASSERT_EQ(3, events_[0].source_id);
+  ASSERT_EQ(101, events_[0].object_id);
+  ASSERT_FLOAT_EQ(42.0f, events_[0].left);
+  // the low 32 bits of the tracker's id
+  frame->mutable_people(2)->set_danger_val(1.5f);
+  frame->set_pts(2 * FRAME_NS);
+  tracker_.update(batch, &events_);
+  ASSERT_EQ(2, events_.size());
+  ASSERT_EQ(0xFFFFFFFEull, events_[1].object_id);
+}
+
+// Tests DistanceFilter's uids are the tracker's object ids, so events follow
+// people through the filter
+TEST_F(ViolationTrackerTest, TestDistanceFilter) {
+  tracker_.min_duration = 0;
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  for (int p = 0; p < 3; p++) {
+    auto bbox = frame->add_people()->mutable_bbox();
+    // the first two on top of each other
+    bbox->set_left(p == 2 ? 1000.0f : 0.0f);
+    bbox->set_top(200.0f);
+    bbox->set_width(40.0f);
+    bbox->set_height(100.0f);
+  }
+  auto buf = Replay::make_buffer(batch);
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  auto frame_meta = (NvDsFrameMeta*) batch_meta->frame_meta_list->data;
+  uint64_t object_id = 100;
+  for (auto l = frame_meta->obj_meta_list; l != nullptr; l = l->next) {
+    ((NvDsObjectMeta*) l->data)->object_id = object_id++;
+  }
+  ((NvDsObjectMeta*) frame_meta->obj_meta_list->data)->object_id =
+    UNTRACKED_OBJECT_ID;
+  DistanceFilter filter;
+  ASSERT_EQ(GST_FLOW_OK, filter.on_buffer(buf));
+  auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+  const auto& filtered = *(dp::Batch*) user_meta->user_meta_data;
+  ASSERT_EQ(0, filtered.frames(0).people(0).uid());
+  ASSERT_EQ(101, filtered.frames(0).people(1).uid());
+  ASSERT_EQ(102, filtered.frames(0).people(2).uid());
+  tracker_.update(filtered, &events_);
+  // the untracked one is in violation too, but can't be followed
+  ASSERT_EQ(1, events_.size());
+  ASSERT_EQ(101, events_[0].object_id);
+  gst_buffer_unref(buf);
+}
+
+// Tests ViolationEventFilter only attaches a Payload when something happens
+TEST(ViolationEventFilterTest, TestAttach) {
+  ViolationEventFilter filter;
+  filter.tracker.min_duration = 0;
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  frame->set_pts(FRAME_NS);
+  auto person = frame->add_people();
+  person->set_uid(1);
+  person->set_danger_val(1.5f);
+  auto buf = Replay::make_buffer(batch);
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+  ASSERT_EQ(1, num_user_meta(batch_meta));
+  auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+  ASSERT_EQ(NVDS_PAYLOAD_META, user_meta->base_meta.meta_type);
+  auto payload = (Payload*) user_meta->user_meta_data;
+  ASSERT_EQ((uint32_t) ViolationEventFilter::EVENTS_SUBSCRIPTION,
+            payload->subscription());
+  std::vector<ViolationEvent> events;
+  ASSERT_TRUE(ViolationTracker::decode(payload->data(), payload->size(),
+                                       &events));
+  ASSERT_EQ(1, events.size());
+  ASSERT_EQ(ViolationEvent::start, events[0].kind);
+  // still in violation, so nothing new
+  frame->set_pts(2 * FRAME_NS);
+  ASSERT_TRUE(filter.on_batch_meta(batch_meta, &batch));
+  ASSERT_EQ(1, num_user_meta(batch_meta));
+  gst_buffer_unref(buf);
+}
+
+// Tests on_eos ends ongoing violations on a new buffer
+TEST(ViolationEventFilterTest, TestEos) {
+  ViolationEventFilter filter;
+  filter.tracker.min_duration = 0;
+  ASSERT_EQ(nullptr, filter.on_eos());
+  dp::Batch batch;
+  auto frame = batch.add_frames();
+  frame->set_pts(FRAME_NS);
+  auto person = frame->add_people();
+  person->set_uid(1);
+  person->set_danger_val(1.5f);
+  auto buf = Replay::make_buffer(batch);
+  ASSERT_TRUE(filter.on_batch_meta(gst_buffer_get_nvds_batch_meta(buf),
+                                   &batch));
+  gst_buffer_unref(buf);
+
+  buf = filter.on_eos();
+  ASSERT_NE(nullptr, buf);
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  ASSERT_EQ(1, num_user_meta(batch_meta));
+  auto user_meta = (NvDsUserMeta*) batch_meta->batch_user_meta_list->data;
+  auto payload = (Payload*) user_meta->user_meta_data;
+  ASSERT_EQ((uint32_t) ViolationEventFilter::EVENTS_SUBSCRIPTION,
+            payload->subscription());
+  std::vector<ViolationEvent> events;
+  ASSERT_TRUE(ViolationTracker::decode(payload->data(), payload->size(),
+                                       &events));
+  ASSERT_EQ(1, events.size());
+  ASSERT_EQ(ViolationEvent::end, events[0].kind);
+  ASSERT_EQ(FRAME_NS, events[0].pts);
+  gst_buffer_unref(buf);
+  // nothing left
+  ASSERT_EQ(nullptr, filter.on_eos());
+}
+
+// Tests Subscriptions are refused
+TEST(ViolationEventFilterTest, TestSubscribe) {
+  ViolationEventFilter filter;
+  Subscription subscription;
+  subscription.danger_only = true;
+  ASSERT_EQ((uint32_t) ProtoPayloadFilter::NO_SUBSCRIPTION,
+            filter.subscribe(subscription));
+}
+
+}  // namespace
+}  // namespace ds
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
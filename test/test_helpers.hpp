@@ -0,0 +1,77 @@
+#ifndef TEST_HELPERS_HPP_
+#define TEST_HELPERS_HPP_
+
+#pragma once
+
+// Batch builders and a DistanceFilter driver shared by the tests that run
+// synthetic people through a DistanceFilter.
+
+#include "DistanceFilter.hpp"
+#include "Replay.hpp"
+
+#include "gtest/gtest.h"
+
+#include <gst/gst.h>
+
+#include <functional>
+
+namespace ds {
+
+/**
+ * Add a row of `num_people` 40x100 boxes, with their tops at 200, `spacing`
+ * pixels apart starting at `first`. At the default spacing, with the
+ * default filter_height_diff, the ones on the ends have a danger_val of 0.5
+ * and the ones in between 1.0.
+ */
+inline void
+add_row(distanceproto::Frame* frame, int num_people,
+        float first = 0.0f, float spacing = 50.0f) {
+  for (int p = 0; p < num_people; p++) {
+    auto bbox = frame->add_people()->mutable_bbox();
+    bbox->set_left(first + spacing * p);
+    bbox->set_top(200.0f);
+    bbox->set_width(40.0f);
+    bbox->set_height(100.0f);
+  }
+}
+
+/**
+ * Add a frame from `source_id` with a row of people (see add_row).
+ */
+inline distanceproto::Frame*
+add_frame(distanceproto::Batch* batch, uint32_t source_id, int num_people,
+          float first = 0.0f, float spacing = 50.0f) {
+  auto frame = batch->add_frames();
+  frame->set_source_id(source_id);
+  add_row(frame, num_people, first, spacing);
+  return frame;
+}
+
+/**
+ * Run `batch` through `filter`, returning a copy of the Batch it attached
+ * (empty if none). `inspect`, if set, gets the batch meta before the buffer
+ * is freed.
+ */
+inline distanceproto::Batch
+filter_batch(DistanceFilter* filter, const distanceproto::Batch& batch,
+             const std::function<void(NvDsBatchMeta*)>& inspect = nullptr) {
+  auto buf = Replay::make_buffer(batch);
+  EXPECT_EQ(GST_FLOW_OK, filter->on_buffer(buf));
+  auto batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  distanceproto::Batch result;
+  for (auto l = batch_meta->batch_user_meta_list; l != nullptr; l = l->next) {
+    auto user_meta = (NvDsUserMeta*) l->data;
+    if (user_meta->base_meta.meta_type == DF_USER_BATCH_META) {
+      result = *(distanceproto::Batch*) user_meta->user_meta_data;
+    }
+  }
+  if (inspect) {
+    inspect(batch_meta);
+  }
+  gst_buffer_unref(buf);
+  return result;
+}
+
+}  // namespace ds
+
+#endif  // TEST_HELPERS_HPP_
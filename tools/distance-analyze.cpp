@@ -0,0 +1,186 @@
+/* distance-analyze.cpp
+ *
+ * Copyright 2020 Michael de Gans <47511965+mdegans@users.noreply.github.com>
+ *
+ * 66E67F6ADF56899B2AA37EF8BF1F2B9DFBB1D82E66BD48C05D8A73074A7D2B75
+ * EB8AA44E3ACF111885E4F84D27DC01BB3BD8B322A9E8D7287AD20A6F6CD5CB1F
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * distance-analyze re-scores recorded detections with different thresholds,
+ * without GStreamer or DeepStream (see ds::Analyzer).
+ */
+
+#include "Analyzer.hpp"
+
+#include <getopt.h>
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void
+usage(const char* name) {
+  fprintf(stderr,
+    "usage: %s [options] FILE...\n"
+    "\n"
+    "Score each FILE (FileMetaBroker .coded or .packed output, or MOT style\n"
+    "frame,id,left,top,width,height,conf text) as dsdistance would, and\n"
+    "write the results to OUTPUT_DIR/<name>.<format>, so names must differ.\n"
+    "\n"
+    "options:\n"
+    "  -o, --output-dir DIR    where to write results (default: .)\n"
+#ifdef DS_SQLITE
+    "  -f, --format FORMAT     proto, packed, csv or sqlite (default: proto)\n"
+#else
+    "  -f, --format FORMAT     proto, packed or csv (default: proto)\n"
+#endif
+    "  -j, --threads N         threads to use (default: one per core)\n"
+    "  -d, --height-diff F     filter_height_diff (default: 0.25)\n"
+    "  -t, --danger F          danger_val at which is_danger (default: 1.0)\n"
+    "  -r, --fps F             frame rate of MOT files (default: 30)\n"
+    "  -c, --min-conf F        ignore MOT boxes with lower conf\n"
+    "  -h, --help              show this help\n",
+    name);
+}
+
+/**
+ * Parse a float option, or exit.
+ */
+static float
+parse_float(const char* name, const char* arg) {
+  char* end;
+  float value = strtof(arg, &end);
+  if (end == arg || *end != '\0') {
+    fprintf(stderr, "bad value for --%s: %s\n", name, arg);
+    exit(2);
+  }
+  return value;
+}
+
+/**
+ * Parse a positive integer option, or exit.
+ */
+static unsigned
+parse_positive(const char* name, const char* arg) {
+  char* end;
+  errno = 0;
+  long value = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || errno == ERANGE || value < 1 ||
+      value > INT_MAX) {
+    fprintf(stderr, "bad value for --%s: %s\n", name, arg);
+    exit(2);
+  }
+  return (unsigned) value;
+}
+
+int
+main(int argc, char** argv) {
+  static const struct option options[] = {
+    {"output-dir", required_argument, nullptr, 'o'},
+    {"format", required_argument, nullptr, 'f'},
+    {"threads", required_argument, nullptr, 'j'},
+    {"height-diff", required_argument, nullptr, 'd'},
+    {"danger", required_argument, nullptr, 't'},
+    {"fps", required_argument, nullptr, 'r'},
+    {"min-conf", required_argument, nullptr, 'c'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+  ds::Analyzer analyzer;
+  std::string output_dir = ".";
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:f:j:d:t:r:c:h", options,
+                            nullptr)) != -1) {
+    switch (opt) {
+      case 'o':
+        output_dir = optarg;
+        break;
+      case 'f':
+        if (strcmp(optarg, "proto") == 0) {
+          analyzer.format = ds::FileMetaBroker::proto;
+        } else if (strcmp(optarg, "packed") == 0) {
+          analyzer.format = ds::FileMetaBroker::packed;
+        } else if (strcmp(optarg, "csv") == 0) {
+          analyzer.format = ds::FileMetaBroker::csv;
+#ifdef DS_SQLITE
+        } else if (strcmp(optarg, "sqlite") == 0) {
+          analyzer.format = ds::FileMetaBroker::sqlite;
+#endif
+        } else {
+          fprintf(stderr, "unknown format: %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'j':
+        analyzer.num_threads = parse_positive("threads", optarg);
+        break;
+      case 'd':
+        analyzer.filter_height_diff = parse_float("height-diff", optarg);
+        break;
+      case 't':
+        analyzer.danger_threshold = parse_float("danger", optarg);
+        break;
+      case 'r':
+        analyzer.fps = parse_float("fps", optarg);
+        break;
+      case 'c':
+        analyzer.min_confidence = parse_float("min-conf", optarg);
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  std::vector<std::string> inputs(argv + optind, argv + argc);
+  if (inputs.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  auto clashes = analyzer.find_clashes(inputs, output_dir);
+  for (const auto& input : clashes) {
+    fprintf(stderr, "%s: output %s clashes with another file\n",
+      input.c_str(), analyzer.output_filename(input, output_dir).c_str());
+  }
+  if (!clashes.empty()) {
+    return 2;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> failed;
+  bool ok = analyzer.run(inputs, output_dir, &failed);
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  for (const auto& input : failed) {
+    fprintf(stderr, "failed: %s\n", input.c_str());
+  }
+  double seconds = elapsed.count();
+  fprintf(stderr, "%zu files, %llu frames in %.2f s (%.0f frames/min)\n",
+    inputs.size() - failed.size(), (unsigned long long) analyzer.frames(),
+    seconds, seconds > 0.0 ? analyzer.frames() * 60.0 / seconds : 0.0);
+  return ok ? 0 : 1;
+}